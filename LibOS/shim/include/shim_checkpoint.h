@@ -96,6 +96,10 @@ struct shim_palhdl_entry {
     PAL_HANDLE* phandle;
 };
 
+struct lazy_mem_snapshot;
+
+#define CP_MAX_STATS 16
+
 struct shim_cp_store {
     /* checkpoint data mapping */
     void* cp_map;
@@ -115,6 +119,17 @@ struct shim_cp_store {
     /* entries of pal handles to send */
     struct shim_palhdl_entry* last_palhdl_entry;
     int palhdl_nentries;
+
+    /* memory fetched by the new process on demand instead of sent with the checkpoint */
+    struct lazy_mem_snapshot* lazy_mem;
+
+    /* time spent on and checkpoint data created for each migrated object type */
+    struct shim_cp_stats {
+        const char* type;
+        uint64_t time_us;
+        size_t bytes;
+    } stats[CP_MAX_STATS];
+    int nstats;
 };
 
 #define CP_FUNC_ARGS struct shim_cp_store* store, void* obj, size_t size, void** objp
@@ -312,7 +327,9 @@ struct shim_cp_map_entry* get_cp_map_entry(void* map, void* addr, bool create);
 #define ADD_TO_CP_MAP(obj, off)                                                   \
     do {                                                                          \
         struct shim_cp_map_entry* e = get_cp_map_entry(store->cp_map, obj, true); \
-        e->off                      = (off);                                      \
+        if (!e)                                                                   \
+            return -ENOMEM;                                                       \
+        e->off = (off);                                                           \
     } while (0)
 
 #define BEGIN_MIGRATION_DEF(name, ...)                                  \
@@ -325,11 +342,19 @@ struct shim_cp_map_entry* get_cp_map_entry(void* map, void* addr, bool create);
         return 0;                   \
     }
 
-#define DEFINE_MIGRATE(name, obj, size)                    \
-    do {                                                   \
-        extern DEFINE_CP_FUNC(name);                       \
-        if ((ret = cp_##name(store, obj, size, NULL)) < 0) \
-            return ret;                                    \
+#define DEFINE_MIGRATE(name, obj, size)                                \
+    do {                                                               \
+        extern DEFINE_CP_FUNC(name);                                   \
+        uint64_t _start = DkSystemTimeQuery();                         \
+        ptr_t _offset   = store->offset;                               \
+        if ((ret = cp_##name(store, obj, size, NULL)) < 0)             \
+            return ret;                                                \
+        if (store->nstats < CP_MAX_STATS) {                            \
+            struct shim_cp_stats* _s = &store->stats[store->nstats++]; \
+            _s->type    = #name;                                       \
+            _s->time_us = DkSystemTimeQuery() - _start;                \
+            _s->bytes   = store->offset - _offset;                     \
+        }                                                              \
     } while (0)
 
 #define DEBUG_RESUME     0
@@ -375,6 +400,15 @@ struct newproc_cp_header {
         unsigned long entoffset;
         int nentries;
     } palhdl;
+    /* checkpoint data is in memory shared with the parent (mapped from the process stream)
+     * instead of sent on the stream */
+    bool shm;
+    /* memory of the parent fetched on demand, placed after the checkpoint in the shared memory */
+    struct lazy_mem_header {
+        unsigned long offset;
+        unsigned long nchunks;
+        unsigned long nranges;
+    } lazy_mem;
 };
 
 struct newproc_header {
@@ -397,4 +431,29 @@ void restore_context(struct shim_context* context);
 int create_checkpoint(const char* cpdir, IDTYPE* session);
 int join_checkpoint(struct shim_thread* cur, IDTYPE sid);
 
+/* lazy migration of memory on fork, see shim_lazy_mem.c */
+struct shim_vma_val;
+
+int init_lazy_mem(void);
+struct lazy_mem_snapshot* lazy_mem_create(PAL_HANDLE proc);
+bool lazy_mem_eligible(struct shim_vma_val* vma);
+long lazy_mem_add_range(struct lazy_mem_snapshot* snapshot, void* addr, size_t size, int prot);
+size_t lazy_mem_area_size(struct lazy_mem_snapshot* snapshot);
+int lazy_mem_start(struct lazy_mem_snapshot* snapshot, PAL_HANDLE proc, size_t offset,
+                   struct lazy_mem_header* hdr);
+void lazy_mem_attach(struct lazy_mem_snapshot* snapshot, IDTYPE vmid);
+void lazy_mem_destroy(struct lazy_mem_snapshot* snapshot);
+void lazy_mem_serve(void* addr, size_t size);
+void lazy_mem_release(IDTYPE vmid);
+void lazy_mem_push_all(void);
+
+int lazy_mem_init_child(struct lazy_mem_header* hdr);
+int lazy_mem_restore_range(void* addr, size_t size, int prot, size_t first);
+int lazy_mem_start_prefetch(void);
+int lazy_mem_fetch_all(void);
+
+bool lazy_mem_fault(void* addr);
+int lazy_mem_prepare(void* addr, size_t size, bool discard);
+void lazy_mem_exec(void);
+
 #endif /* _SHIM_CHECKPOINT_H_ */
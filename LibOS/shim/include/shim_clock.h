@@ -0,0 +1,112 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * shim_clock.h
+ *
+ * Definitions of the TSC-based clock of LibOS (see shim_clock.c). This header is also included by
+ * the vDSO, so it must not depend on the rest of LibOS.
+ */
+
+#ifndef _SHIM_CLOCK_H_
+#define _SHIM_CLOCK_H_
+
+#include <shim_types.h>
+
+/*
+ * Parameters of the clock, published with a sequence lock: `seq` is odd while they are being
+ * updated. The time at TSC value `tsc` is `*_base_ns + (tsc - tsc_base) * tsc_mult / 2^32`; the
+ * parameters are valid for `tsc_period` ticks after `tsc_base`, then the clock needs to be
+ * recalibrated against the host.
+ */
+struct shim_clock_data {
+    uint32_t seq;
+    uint32_t tsc_usable;
+    uint64_t tsc_base;
+    uint64_t tsc_mult;
+    uint64_t tsc_period;
+    uint64_t realtime_base_ns;
+    uint64_t monotonic_base_ns;
+};
+
+static inline uint64_t clock_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Computes the current time from `data`. Returns false if the TSC cannot be used, or if
+ * `check_period` is set and the clock is due for recalibration. */
+static inline bool clock_data_read(const struct shim_clock_data* data, bool monotonic,
+                                   bool check_period, uint64_t* time_ns) {
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        while ((seq = __atomic_load_n(&data->seq, __ATOMIC_ACQUIRE)) & 1)
+            __asm__ volatile("pause");
+
+        if (!data->tsc_usable)
+            return false;
+
+        uint64_t delta = clock_rdtsc() - data->tsc_base;
+        if (check_period && delta >= data->tsc_period)
+            return false;
+
+        ns = monotonic ? data->monotonic_base_ns : data->realtime_base_ns;
+        ns += (uint64_t)(((unsigned __int128)delta * data->tsc_mult) >> 32);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&data->seq, __ATOMIC_RELAXED) != seq);
+
+    *time_ns = ns;
+    return true;
+}
+
+/* Whether `clock` is served by the CLOCK_MONOTONIC (true) or CLOCK_REALTIME (false) timeline;
+ * returns -1 for other clocks. */
+static inline int clock_is_monotonic(clockid_t clock) {
+    switch (clock) {
+        case CLOCK_REALTIME:
+        case CLOCK_REALTIME_COARSE:
+        case CLOCK_TAI:
+            return 0;
+        case CLOCK_MONOTONIC:
+        case CLOCK_MONOTONIC_RAW:
+        case CLOCK_MONOTONIC_COARSE:
+        case CLOCK_BOOTTIME:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+extern struct shim_clock_data g_clock_data;
+/* whether the TSC can be read, even if the clock is not calibrated yet */
+extern bool g_tsc_readable;
+
+/* Converts TSC ticks to nanoseconds; returns 0 until the clock is calibrated. */
+static inline uint64_t clock_tsc_to_ns(uint64_t ticks) {
+    uint64_t mult = __atomic_load_n(&g_clock_data.tsc_mult, __ATOMIC_RELAXED);
+    return (uint64_t)(((unsigned __int128)ticks * mult) >> 32);
+}
+
+int init_clock(void);
+int get_clock_time(clockid_t clock, uint64_t* time_ns);
+int get_clock_res(clockid_t clock, uint64_t* res_ns);
+uint64_t get_time_us(void);
+
+#endif /* _SHIM_CLOCK_H_ */
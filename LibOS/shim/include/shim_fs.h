@@ -27,6 +27,7 @@
 #include <stdbool.h>
 #include <linux/stat.h>
 
+#include "hash.h"
 #include "list.h"
 #include "pal.h"
 #include "shim_defs.h"
@@ -55,6 +56,10 @@ struct shim_fs_ops {
     /* write: the content from the file opened as handle */
     ssize_t (*write)(struct shim_handle* hdl, const void* buf, size_t count);
 
+    /* writev: write a vector of buffers in one go; optional, otherwise writev() calls write for
+     * each buffer */
+    ssize_t (*writev)(struct shim_handle* hdl, const struct iovec* vec, int vlen);
+
     /* mmap: mmap handle to address */
     int (*mmap)(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
                 off_t offset);
@@ -127,8 +132,9 @@ struct shim_fs_ops {
 // Catch memory corruption issues by checking for invalid state values
 #define DENTRY_INVALID_FLAGS (~0x7FFF)
 
-#define DCACHE_HASH_SIZE  1024
-#define DCACHE_HASH(hash) ((hash) & (DCACHE_HASH_SIZE - 1))
+#define DCACHE_HASH_BITS  12
+#define DCACHE_HASH_SIZE  (1 << DCACHE_HASH_BITS)
+#define DCACHE_HASH(hash) (hash_u64(hash) >> (64 - DCACHE_HASH_BITS))
 
 DEFINE_LIST(shim_dentry);
 DEFINE_LISTP(shim_dentry);
@@ -139,11 +145,7 @@ struct shim_dentry {
     struct shim_qstr rel_path; /* the path is relative to its mount point */
     struct shim_qstr name;     /* caching the file's name. */
 
-    /* DEP 6/16/17: For now, let's try not hashing; I suspect it is overkill for most purposes.
-     * I'll leave the field here for now, but propose we move to a per-directory table to accelerate
-     * lookups, rather than a global table, since this just supports one process.
-     */
-    LIST_TYPE(shim_dentry) hlist; /* to resolve collisions in the hash table */
+    LIST_TYPE(shim_dentry) hlist; /* bucket in the dcache hash table, keyed by (parent, name) */
     LIST_TYPE(shim_dentry) list; /* put dentry to different list according to its availability, \
                                   * persistent or freeable */
 
@@ -297,6 +299,37 @@ int init_mount(void);
 /* path utilities */
 const char* get_file_name(const char* path, size_t len);
 
+/* maximum number of stream operations that are submitted to the PAL at once */
+#define STREAM_OPS_BATCH 64
+
+/*!
+ * \brief Write a vector of buffers back to back to a PAL stream, with as few PAL calls as possible.
+ *
+ * \param pal_hdl   PAL stream to write to.
+ * \param seekable  If true, buffers are written one after another starting at `offset`; otherwise
+ *                  all writes are issued at `offset`.
+ * \param offset    Offset of the first write.
+ * \param vec       Buffers to write; NULL and empty buffers are skipped.
+ * \param vlen      Number of buffers.
+ *
+ * \return Number of bytes written, which is short if some write was short, or negative error code
+ *  if nothing was written.
+ */
+ssize_t pal_stream_writev(PAL_HANDLE pal_hdl, bool seekable, off_t offset, const struct iovec* vec,
+                          int vlen);
+
+/* page cache for regular files of the chroot filesystem (fs/chroot/cache.c); the read and write
+ * functions are called with the handle lock held, on handles with `info.file.cached` set */
+int init_file_cache(void);
+void file_cache_open(struct shim_handle* hdl, bool readable);
+int file_cache_close(struct shim_handle* hdl);
+ssize_t file_cache_read(struct shim_handle* hdl, void* buf, size_t count, off_t offset);
+ssize_t file_cache_write(struct shim_handle* hdl, const void* buf, size_t count, off_t offset);
+int file_cache_flush(struct shim_file_data* data);
+void file_cache_truncate(struct shim_file_data* data, off_t len);
+int file_cache_mmap(struct shim_handle* hdl, int flags);
+void file_cache_sync_all(void);
+
 /* file system operations */
 int mount_fs(const char* mount_type, const char* mount_uri, const char* mount_point,
              struct shim_dentry* parent, struct shim_dentry** dentp, bool make_ancestor);
@@ -584,6 +617,12 @@ int pseudo_hstat(struct shim_handle* hdl, struct stat* buf, const struct pseudo_
 int pseudo_follow_link(struct shim_dentry* dent, struct shim_qstr* link,
                        const struct pseudo_ent* root_ent);
 
+/* helpers for regular files of /proc (see fs/proc/info.c) */
+int proc_info_mode(const char* name, mode_t* mode);
+int proc_info_stat(const char* name, struct stat* buf);
+int proc_print_to_str(char** str, size_t off, size_t* size, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
 /* string-type file system */
 int str_add_dir(const char* path, mode_t mode, struct shim_dentry** dent);
 int str_add_file(const char* path, mode_t mode, struct shim_dentry** dent);
@@ -26,6 +26,7 @@
 #include <asm/fcntl.h>
 #include <asm/resource.h>
 #include <atomic.h>  // TODO: migrate to stdatomic.h
+#include <avl_tree.h>
 #include <linux/in.h>
 #include <linux/in6.h>
 #include <linux/shm.h>
@@ -77,6 +78,7 @@ struct shim_file_data {
     unsigned long mtime;
     unsigned long ctime;
     unsigned long nlink;
+    struct shim_file_cache* cache;  /* cached pages, while the file is open (if enabled) */
 };
 
 struct shim_file_handle {
@@ -86,6 +88,7 @@ struct shim_file_handle {
     enum shim_file_type type;
     off_t size;
     off_t marker;
+    bool cached;    /* I/O goes through data->cache */
 };
 
 #define FILE_HANDLE_DATA(hdl)  ((hdl)->info.file.data)
@@ -300,15 +303,22 @@ struct shim_str_handle {
 
 DEFINE_LIST(shim_epoll_item);
 DEFINE_LISTP(shim_epoll_item);
+struct shim_epoll_set;
 struct shim_epoll_handle {
-    int maxfds;
     int waiter_cnt;
 
-    int pal_cnt;
-    PAL_HANDLE* pal_handles;
+    /* PAL handles and events to wait on, kept in sync with the epoll items (see shim_epoll.c) */
+    struct shim_epoll_set* set;
+    bool set_stale;
+    uint64_t set_gen;
 
     AEVENTTYPE event;
+    size_t fds_cnt;
     LISTP_TYPE(shim_epoll_item) fds;
+    struct avl_tree fds_tree;                /* epoll items by FD */
+    LISTP_TYPE(shim_epoll_item) ready;       /* items with events not yet reported to the user */
+    LISTP_TYPE(shim_epoll_item) pending;     /* items whose handles do not have PAL handles yet */
+    struct shim_epoll_item* rearm_list;      /* edge-triggered items to re-arm after I/O */
 };
 
 struct shim_mount;
@@ -409,7 +419,6 @@ struct shim_handle* detach_fd_handle(FDTYPE fd, int* flags, struct shim_handle_m
 
 /* manage handle mapping */
 int dup_handle_map(struct shim_handle_map** new_map, struct shim_handle_map* old_map);
-int flush_handle_map(struct shim_handle_map* map);
 void get_handle_map(struct shim_handle_map* map);
 void put_handle_map(struct shim_handle_map* map);
 int walk_handle_map(int (*callback)(struct shim_fd_handle*, struct shim_handle_map*),
@@ -40,6 +40,9 @@
 #include <shim_defs.h>
 #include <shim_tcb.h>
 #include <shim_types.h>
+#ifdef LOCK_PROFILE
+#include <shim_clock.h>
+#endif
 
 noreturn void shim_clean_and_exit(int exit_code);
 
@@ -179,15 +182,56 @@ static inline int64_t get_cur_preempt (void) {
     return atomic_read(&tcb->context.preempt);
 }
 
+/*
+ * Syscall statistics (`sys.syscall_stats = 1` in the manifest): each thread counts the calls and
+ * the failures of each syscall, and measures their latency, split into the time spent in LibOS and
+ * in PAL calls (see pal_call_timing in PAL_TCB). The counters of all threads are summed up when
+ * read from /proc/graphene/syscall_stats. The latencies are only measured if the TSC can be read
+ * (see shim_clock.c).
+ */
+#define SYSCALL_STATS_HIST_SIZE 24
+
+struct shim_syscall_stat {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t libos_cycles;
+    uint64_t pal_cycles;
+    /* calls by latency: < 1 us, then [2^(i-1), 2^i) us, the last one counting all the longer
+     * calls; only once the clock is calibrated */
+    uint32_t hist[SYSCALL_STATS_HIST_SIZE];
+};
+
+struct shim_syscall_start {
+    uint64_t tsc;
+    uint64_t pal_cycles;
+};
+
+extern bool g_syscall_stats_enabled;
+
+int init_syscall_stats(void);
+void syscall_stats_begin(struct shim_syscall_start* start);
+void syscall_stats_end(int sysno, long ret, const struct shim_syscall_start* start);
+void syscall_stats_thread_exit(void);
+void syscall_stats_sum(struct shim_syscall_stat* total);
+int syscall_stats_walk_threads(int (*callback)(IDTYPE tid, const struct shim_syscall_stat* stats,
+                                               void* arg),
+                               void* arg);
+
 #define BEGIN_SHIM(name, args ...)                          \
     SHIM_ARG_TYPE __shim_##name(args) {                     \
         SHIM_ARG_TYPE ret = 0;                              \
         int64_t preempt = get_cur_preempt();                \
         __UNUSED(preempt);                                  \
+        struct shim_syscall_start stats_start = {0};        \
+        if (g_syscall_stats_enabled)                        \
+            syscall_stats_begin(&stats_start);              \
         /* handle_signal(); */                              \
         /* check_stack_hook(); */
 
 #define END_SHIM(name)                                      \
+        if (g_syscall_stats_enabled)                        \
+            syscall_stats_end(__NR_##name, ret,             \
+                              &stats_start);                \
         handle_signal();                                    \
         assert(preempt == get_cur_preempt());               \
         return ret;                                         \
@@ -479,6 +523,15 @@ static inline void enable_preempt (shim_tcb_t * tcb)
     __enable_preempt(tcb);
 }
 
+/*
+ * The state of struct shim_lock: UNLOCKED and LOCKED are switched with atomic operations only.
+ * Threads that find the lock taken spin for a while, then switch it to CONTENDED and park on the
+ * PAL mutex of the lock; unlock() only calls the PAL to wake one of them up if it was CONTENDED.
+ */
+#define SHIM_LOCK_UNLOCKED  0
+#define SHIM_LOCK_LOCKED    1
+#define SHIM_LOCK_CONTENDED 2
+
 static inline bool lock_created(struct shim_lock* l)
 {
     return l->lock != NULL;
@@ -488,11 +541,60 @@ static inline void clear_lock(struct shim_lock* l)
 {
     l->lock = NULL;
     l->owner = 0;
+    l->state = SHIM_LOCK_UNLOCKED;
+#ifdef LOCK_PROFILE
+    l->class = NULL;
+#endif
+}
+
+/*
+ * Lock profiling (build LibOS with LOCK_PROFILE=1): each lock records how often it is taken, how
+ * often it is contended, and how long it is waited for and held, in the statistics of its class,
+ * i.e. of all the locks created by the same create_lock() expression in the same file (so all the
+ * handle locks share one class). The classes are listed in /proc/graphene/lock_stats, and printed
+ * with debug() at exit. The times are measured with the TSC, if it can be read (see shim_clock.c).
+ */
+#ifdef LOCK_PROFILE
+struct shim_lock_class {
+    const char* name;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_cycles;
+    uint64_t max_wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+    /* where the longest wait happened */
+    const char* max_wait_file;
+    int max_wait_line;
+};
+
+#define LOCK_NAME(l) __FILE__ ": " #l
+
+struct shim_lock_class* lock_profile_class(const char* name);
+const struct shim_lock_class* lock_profile_classes(size_t* count);
+void lock_profile_acquired(struct shim_lock* l, bool contended, uint64_t wait_start_tsc,
+                           const char* file, int line);
+void lock_profile_released(struct shim_lock* l);
+void lock_profile_dump(void);
+
+static inline uint64_t lock_profile_tsc(void) {
+    return g_tsc_readable ? clock_rdtsc() : 0;
 }
+#else
+#define LOCK_NAME(l) NULL
+#endif
 
-static inline bool create_lock(struct shim_lock* l) {
+#define create_lock(l) __create_lock(l, LOCK_NAME(l))
+static inline bool __create_lock(struct shim_lock* l, const char* name) {
+    __UNUSED(name);
     l->owner = 0;
-    l->lock = DkMutexCreate(0);
+    l->state = SHIM_LOCK_UNLOCKED;
+#ifdef LOCK_PROFILE
+    l->class        = lock_profile_class(name);
+    l->acquired_tsc = 0;
+#endif
+    /* the PAL mutex is a binary semaphore for waking up parked threads, initially taken */
+    l->lock = DkMutexCreate(1);
     return l->lock != NULL;
 }
 
@@ -502,7 +604,9 @@ static inline void destroy_lock(struct shim_lock* l) {
     l->owner = 0;
 }
 
-#ifdef DEBUG
+void __lock_slow(struct shim_lock* l);
+
+#if defined(DEBUG) || defined(LOCK_PROFILE)
 #define lock(l) __lock(l, __FILE__, __LINE__)
 static void __lock(struct shim_lock* l, const char* file, int line) {
 #else
@@ -523,10 +627,26 @@ static void lock(struct shim_lock* l) {
     shim_tcb_t * tcb = shim_get_tcb();
     disable_preempt(tcb);
 
-    while (!DkSynchronizationObjectWait(l->lock, NO_TIMEOUT))
-        /* nop */;
+#ifdef LOCK_PROFILE
+    bool contended = false;
+    uint64_t wait_start_tsc = 0;
+#endif
+    int32_t state = SHIM_LOCK_UNLOCKED;
+    if (!__atomic_compare_exchange_n(&l->state, &state, SHIM_LOCK_LOCKED, /*weak=*/false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+#ifdef LOCK_PROFILE
+        /* only contended acquisitions are timed, the fast path takes no time to speak of */
+        contended      = true;
+        wait_start_tsc = lock_profile_tsc();
+#endif
+        __lock_slow(l);
+    }
 
     l->owner = tcb->tid;
+#ifdef LOCK_PROFILE
+    if (l->class)
+        lock_profile_acquired(l, contended, wait_start_tsc, file, line);
+#endif
 }
 
 #ifdef DEBUG
@@ -547,8 +667,14 @@ static inline void unlock(struct shim_lock* l) {
 
     shim_tcb_t* tcb = shim_get_tcb();
 
+#ifdef LOCK_PROFILE
+    if (l->class)
+        lock_profile_released(l);
+#endif
     l->owner = 0;
-    DkMutexRelease(l->lock);
+    if (__atomic_exchange_n(&l->state, SHIM_LOCK_UNLOCKED, __ATOMIC_RELEASE) ==
+            SHIM_LOCK_CONTENDED)
+        DkMutexRelease(l->lock);
     enable_preempt(tcb);
 }
 
@@ -582,19 +708,85 @@ extern struct shim_lock __master_lock;
 # define MASTER_UNLOCK() do { unlock(&__master_lock); } while (0)
 #endif
 
-static inline bool create_lock_runtime(struct shim_lock* l) {
+#define create_lock_runtime(l) __create_lock_runtime(l, LOCK_NAME(l))
+static inline bool __create_lock_runtime(struct shim_lock* l, const char* name) {
     bool ret = true;
 
     if (!lock_created(l)) {
         MASTER_LOCK();
         if (!lock_created(l))
-            ret = create_lock(l);
+            ret = __create_lock(l, name);
         MASTER_UNLOCK();
     }
 
     return ret;
 }
 
+/*
+ * Reader/writer lock: readers only increment `state` while there is no writer. A writer takes
+ * `wlock`, sets RWLOCK_WRITER and waits for the readers to leave; readers that find RWLOCK_WRITER
+ * park on `wlock` until the writer is done. Writers are preferred, so the read lock must not be
+ * taken recursively.
+ */
+#define RWLOCK_WRITER 0x40000000
+
+void __rwlock_read_lock_slow(struct shim_rwlock* l);
+void __rwlock_wait_readers(struct shim_rwlock* l);
+
+#define create_rwlock(l) __create_rwlock(l, LOCK_NAME(l))
+static inline bool __create_rwlock(struct shim_rwlock* l, const char* name) {
+    l->state = 0;
+    return __create_lock(&l->wlock, name);
+}
+
+static inline void destroy_rwlock(struct shim_rwlock* l) {
+    destroy_lock(&l->wlock);
+}
+
+static inline void rwlock_read_lock(struct shim_rwlock* l) {
+    if (!lock_enabled)
+        return;
+
+    disable_preempt(NULL);
+
+    int32_t state = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+    while (!(state & RWLOCK_WRITER)) {
+        if (__atomic_compare_exchange_n(&l->state, &state, state + 1, /*weak=*/true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+    }
+    __rwlock_read_lock_slow(l);
+}
+
+static inline void rwlock_read_unlock(struct shim_rwlock* l) {
+    if (!lock_enabled)
+        return;
+
+    __atomic_sub_fetch(&l->state, 1, __ATOMIC_RELEASE);
+    enable_preempt(NULL);
+}
+
+static inline void rwlock_write_lock(struct shim_rwlock* l) {
+    if (!lock_enabled)
+        return;
+
+    lock(&l->wlock);
+    if (__atomic_fetch_or(&l->state, RWLOCK_WRITER, __ATOMIC_ACQUIRE))
+        __rwlock_wait_readers(l);
+}
+
+static inline void rwlock_write_unlock(struct shim_rwlock* l) {
+    if (!lock_enabled)
+        return;
+
+    __atomic_and_fetch(&l->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+    unlock(&l->wlock);
+}
+
+static inline bool rwlock_write_locked(struct shim_rwlock* l) {
+    return locked(&l->wlock);
+}
+
 static inline void create_event (AEVENTTYPE * e)
 {
     if (!e->event)
@@ -700,9 +892,11 @@ extern size_t g_pal_alloc_align;
 
 void * __system_malloc (size_t size);
 void __system_free (void * addr, size_t size);
+bool __system_resize (void * addr, size_t old_size, size_t new_size);
 
 #define system_malloc __system_malloc
 #define system_free __system_free
+#define system_resize __system_resize
 
 extern void * migrated_memory_start;
 extern void * migrated_memory_end;
@@ -744,6 +938,7 @@ int object_wait_with_retry(PAL_HANDLE handle);
 void release_clear_child_tid(int* clear_child_tid);
 
 void delete_from_epoll_handles(struct shim_handle* handle);
+void rearm_epoll_handles(struct shim_handle* handle);
 
 #ifdef __x86_64__
 #define __SWITCH_STACK(stack_top, func, arg)                    \
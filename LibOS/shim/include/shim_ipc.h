@@ -129,6 +129,8 @@ int ipc_checkpoint_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port
 #define IPC_CLD_BASE IPC_BASE_BOUND
 enum {
     IPC_CLD_EXIT = IPC_CLD_BASE,
+    IPC_CLD_GETMEM,
+    IPC_CLD_MEMDONE,
     IPC_CLD_BOUND,
 };
 
@@ -142,6 +144,19 @@ struct shim_ipc_cld_exit {
 int ipc_cld_exit_send(IDTYPE ppid, IDTYPE tid, unsigned int exitcode, unsigned int term_signal);
 int ipc_cld_exit_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port);
 
+/* CLD_GETMEM: request memory of the parent that was not migrated with the checkpoint */
+struct shim_ipc_cld_getmem {
+    void* addr;
+    size_t size;
+} __attribute__((packed));
+
+int ipc_cld_getmem_send(void* addr, size_t size);
+int ipc_cld_getmem_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port);
+
+/* CLD_MEMDONE: all memory of the parent was migrated */
+int ipc_cld_memdone_send(void);
+int ipc_cld_memdone_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port);
+
 /* Message code to namespace manager */
 #define IPC_PID_BASE IPC_CLD_BOUND
 
@@ -36,6 +36,8 @@ struct shim_context {
 };
 
 struct debug_buf;
+struct slab_cache;
+struct shim_syscall_stats;
 
 typedef struct shim_tcb shim_tcb_t;
 struct shim_tcb {
@@ -46,6 +48,8 @@ struct shim_tcb {
     unsigned int            tid;
     int                     pal_errno;
     struct debug_buf *      debug_buf;
+    struct slab_cache *     slab_cache;  /* per-thread cache of malloc(), see shim_malloc.c */
+    struct shim_syscall_stats* syscall_stats;  /* see shim_syscall_stats.c */
 
     /* This record is for testing the memory of user inputs.
      * If a segfault occurs with the range [start, end],
@@ -57,6 +57,8 @@ struct shim_thread {
     LIST_TYPE(shim_thread) siblings;
     /* nodes in global handles; protected by thread_list_lock */
     LIST_TYPE(shim_thread) list;
+    /* nodes in the hash table of global handles by tid; protected by thread_list_lock */
+    LIST_TYPE(shim_thread) hash_list;
 
     struct shim_handle_map * handle_map;
 
@@ -98,6 +100,7 @@ struct shim_thread {
 
     void * stack, * stack_top, * stack_red;
     shim_tcb_t * shim_tcb;
+    uint64_t start_time_ns; /* CLOCK_MONOTONIC time of creation, for CLOCK_THREAD_CPUTIME_ID */
     void * frameptr;
 
     REFTYPE ref_count;
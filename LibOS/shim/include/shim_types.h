@@ -489,9 +489,25 @@ typedef struct atomic_int REFTYPE;
 
 #include <pal.h>
 
+/*
+ * Lock of LibOS (see lock() and unlock() in shim_internal.h). It is taken and released with atomic
+ * operations on `state`; `lock` is a PAL mutex used only to park threads while the lock is
+ * contended.
+ */
 struct shim_lock {
     PAL_HANDLE lock;
     IDTYPE owner;
+    int32_t state;
+#ifdef LOCK_PROFILE
+    struct shim_lock_class* class; /* statistics of all the locks created at the same place */
+    uint64_t acquired_tsc;
+#endif
+};
+
+/* Reader/writer lock of LibOS, for read-mostly data (see rwlock_read_lock() in shim_internal.h). */
+struct shim_rwlock {
+    struct shim_lock wlock; /* held by the writer */
+    int32_t state;          /* number of readers, and RWLOCK_WRITER */
 };
 
 typedef struct shim_aevent {
@@ -144,6 +144,7 @@ static inline int qstrcmpstr(const struct shim_qstr* qstr, const char* str, size
 
 /* heap allocation functions */
 int init_slab(void);
+void free_thread_slab_cache(void);
 
 #if defined(SLAB_DEBUG_PRINT) || defined(SLAB_DEBUG_TRACE)
 void* __malloc_debug(size_t size, const char* file, int line);
@@ -157,6 +158,7 @@ void* malloc(size_t size);
 void free(void* mem);
 void* malloc_copy(const void* mem, size_t size);
 #endif
+void* realloc(void* mem, size_t size);
 
 static_always_inline char* qstrtostr(struct shim_qstr* qstr, bool on_stack) {
     int len   = qstr->len;
@@ -450,7 +450,10 @@ static void destroy_handle(struct shim_handle* hdl) {
         free_mem_obj_to_mgr(handle_mgr, hdl);
 }
 
-void put_handle(struct shim_handle* hdl) {
+/* Drop a reference to `hdl` and destroy it if this was the last one. If `pal_close` is not NULL,
+ * the PAL handle of the destroyed handle is not closed but returned in `*pal_close`, so that the
+ * caller can close many of them in one batch. */
+static void __put_handle(struct shim_handle* hdl, PAL_HANDLE* pal_close) {
     int ref_count = REF_DEC(hdl->ref_count);
 
 #ifdef DEBUG_REF
@@ -500,7 +503,10 @@ void put_handle(struct shim_handle* hdl) {
 #ifdef DEBUG_REF
             debug("handle %p closes PAL handle %p\n", hdl, hdl->pal_handle);
 #endif
-            DkObjectClose(hdl->pal_handle);
+            if (pal_close)
+                *pal_close = hdl->pal_handle;
+            else
+                DkObjectClose(hdl->pal_handle);
             hdl->pal_handle = NULL;
         }
 
@@ -514,6 +520,10 @@ void put_handle(struct shim_handle* hdl) {
     }
 }
 
+void put_handle(struct shim_handle* hdl) {
+    __put_handle(hdl, NULL);
+}
+
 off_t get_file_size(struct shim_handle* hdl) {
     if (!hdl->fs || !hdl->fs->fs_ops)
         return -EINVAL;
@@ -656,20 +666,36 @@ void put_handle_map(struct shim_handle_map* map) {
         if (map->fd_top == FD_NULL)
             goto done;
 
+        /* PAL handles released by the map are closed in batches, e.g., on process exit */
+        PAL_STREAM_OP ops[STREAM_OPS_BATCH];
+        size_t cnt = 0;
+
         for (int i = 0; i <= map->fd_top; i++) {
             if (!map->map[i])
                 continue;
 
             if (map->map[i]->vfd != FD_NULL) {
                 struct shim_handle* handle = map->map[i]->handle;
+                PAL_HANDLE pal_handle = NULL;
 
                 if (handle)
-                    put_handle(handle);
+                    __put_handle(handle, &pal_handle);
+
+                if (pal_handle) {
+                    ops[cnt++] = (PAL_STREAM_OP){ .op = PAL_STREAM_OP_CLOSE, .handle = pal_handle };
+                    if (cnt == ARRAY_SIZE(ops)) {
+                        DkStreamsSubmit(ops, cnt);
+                        cnt = 0;
+                    }
+                }
             }
 
             free(map->map[i]);
         }
 
+        if (cnt)
+            DkStreamsSubmit(ops, cnt);
+
     done:
         destroy_lock(&map->lock);
         free(map->map);
@@ -677,30 +703,6 @@ void put_handle_map(struct shim_handle_map* map) {
     }
 }
 
-int flush_handle_map(struct shim_handle_map* map) {
-    get_handle_map(map);
-    lock(&map->lock);
-
-    if (map->fd_top == FD_NULL)
-        goto done;
-
-    /* now we go through the handle map and flush each handle */
-    for (int i = 0; i <= map->fd_top; i++) {
-        if (!HANDLE_ALLOCATED(map->map[i]))
-            continue;
-
-        struct shim_handle* handle = map->map[i]->handle;
-
-        if (handle)
-            flush_handle(handle);
-    }
-
-done:
-    unlock(&map->lock);
-    put_handle_map(map);
-    return 0;
-}
-
 int walk_handle_map(int (*callback)(struct shim_fd_handle*, struct shim_handle_map*),
                     struct shim_handle_map* map) {
     int ret = 0;
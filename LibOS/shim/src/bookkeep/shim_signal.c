@@ -301,6 +301,10 @@ static void memfault_upcall (PAL_PTR event, PAL_NUM arg, PAL_CONTEXT * context)
     shim_tcb_t * tcb = shim_get_tcb();
     assert(tcb);
 
+    /* memory migrated lazily on fork, see shim_lazy_mem.c; retry the access */
+    if (lazy_mem_fault((void *) arg))
+        goto ret_exception;
+
     if (tcb->test_range.cont_addr
         && (void *) arg >= tcb->test_range.start
         && (void *) arg <= tcb->test_range.end) {
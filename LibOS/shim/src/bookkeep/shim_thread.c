@@ -20,6 +20,7 @@
  * This file contains codes to maintain bookkeeping of threads in library OS.
  */
 
+#include <shim_clock.h>
 #include <shim_defs.h>
 #include <shim_internal.h>
 #include <shim_thread.h>
@@ -37,6 +38,10 @@
 static IDTYPE tid_alloc_idx __attribute_migratable = 0;
 
 static LISTP_TYPE(shim_thread) thread_list = LISTP_INIT;
+/* threads of thread_list indexed by tid, for lookup_thread() */
+#define THREAD_HASH_SIZE 1024 /* must be a power of two */
+#define THREAD_HASH(tid) ((tid) & (THREAD_HASH_SIZE - 1))
+static LISTP_TYPE(shim_thread) thread_hash[THREAD_HASH_SIZE];
 DEFINE_LISTP(shim_simple_thread);
 static LISTP_TYPE(shim_simple_thread) simple_thread_list = LISTP_INIT;
 struct shim_lock thread_list_lock;
@@ -84,7 +89,7 @@ static struct shim_thread* __lookup_thread(IDTYPE tid) {
 
     struct shim_thread* tmp;
 
-    LISTP_FOR_EACH_ENTRY(tmp, &thread_list, list) {
+    LISTP_FOR_EACH_ENTRY(tmp, &thread_hash[THREAD_HASH(tid)], hash_list) {
         if (tmp->tid == tid) {
             get_thread(tmp);
             return tmp;
@@ -94,6 +99,12 @@ static struct shim_thread* __lookup_thread(IDTYPE tid) {
     return NULL;
 }
 
+static void __del_thread_from_list(struct shim_thread* thread) {
+    assert(locked(&thread_list_lock));
+    LISTP_DEL_INIT(thread, &thread_list, list);
+    LISTP_DEL_INIT(thread, &thread_hash[THREAD_HASH(thread->tid)], hash_list);
+}
+
 struct shim_thread* lookup_thread(IDTYPE tid) {
     lock(&thread_list_lock);
     struct shim_thread* thread = __lookup_thread(tid);
@@ -154,6 +165,7 @@ struct shim_thread * alloc_new_thread (void)
     INIT_LIST_HEAD(thread, siblings);
     INIT_LISTP(&thread->exited_children);
     INIT_LIST_HEAD(thread, list);
+    INIT_LIST_HEAD(thread, hash_list);
     /* default value as sigalt stack isn't specified yet */
     thread->signal_altstack.ss_flags = SS_DISABLE;
     return thread;
@@ -182,6 +194,7 @@ struct shim_thread * get_new_thread (IDTYPE new_tid)
 
     struct shim_thread * cur_thread = get_cur_thread();
     thread->tid = new_tid;
+    get_clock_time(CLOCK_MONOTONIC, &thread->start_time_ns);
 
     if (cur_thread) {
         /* The newly created thread will be in the same thread group
@@ -448,6 +461,7 @@ void add_thread (struct shim_thread * thread)
 
     get_thread(thread);
     LISTP_ADD_AFTER(thread, prev, &thread_list, list);
+    LISTP_ADD(thread, &thread_hash[THREAD_HASH(thread->tid)], hash_list);
     unlock(&thread_list_lock);
 }
 
@@ -463,7 +477,7 @@ void del_thread (struct shim_thread * thread)
 
     lock(&thread_list_lock);
     /* thread->list goes on the thread_list */
-    LISTP_DEL_INIT(thread, &thread_list, list);
+    __del_thread_from_list(thread);
     unlock(&thread_list_lock);
     put_thread(thread);
 }
@@ -549,7 +563,7 @@ void cleanup_thread(IDTYPE caller, void* arg) {
     /* clean up the thread itself */
     lock(&thread_list_lock);
     thread->is_alive = false;
-    LISTP_DEL_INIT(thread, &thread_list, list);
+    __del_thread_from_list(thread);
 
     put_thread(thread);
 
@@ -697,6 +711,7 @@ BEGIN_CP_FUNC(thread)
         INIT_LIST_HEAD(new_thread, siblings);
         INIT_LISTP(&new_thread->exited_children);
         INIT_LIST_HEAD(new_thread, list);
+        INIT_LIST_HEAD(new_thread, hash_list);
 
         new_thread->in_vm  = false;
         new_thread->parent = NULL;
@@ -799,6 +814,8 @@ BEGIN_CP_FUNC(running_thread)
         new_tcb->tp = NULL;
         new_tcb->context.next = NULL;
         new_tcb->debug_buf = NULL;
+        new_tcb->slab_cache = NULL;
+        new_tcb->syscall_stats = NULL;
     }
 }
 END_CP_FUNC(running_thread)
@@ -865,6 +882,8 @@ BEGIN_RS_FUNC(running_thread)
         if (saved_tcb) {
             /* fork case */
             shim_tcb_t* tcb = shim_get_tcb();
+            /* the copy below replaces the slab cache this thread used during initialization */
+            free_thread_slab_cache();
             memcpy(tcb, saved_tcb, sizeof(*tcb));
             __shim_tcb_init(tcb);
             set_cur_thread(thread);
@@ -28,7 +28,7 @@
 #include <shim_fs.h>
 
 #include <pal.h>
-#include <list.h>
+#include <avl_tree.h>
 
 #include <asm/mman.h>
 #include <errno.h>
@@ -36,13 +36,12 @@
 
 /*
  * Internal bookkeeping for VMAs (virtual memory areas). This data
- * structure can only be accessed in this source file, with vma_list_lock
+ * structure can only be modified in this source file, with vma_tree_lock
  * held. No reference counting needed in this data structure.
  */
-DEFINE_LIST(shim_vma);
 /* struct shim_vma tracks the area of [start, end) */
 struct shim_vma {
-    LIST_TYPE(shim_vma)     list;
+    struct avl_tree_node    node;
     void *                  start;
     void *                  end;
     int                     prot;
@@ -50,6 +49,11 @@ struct shim_vma {
     off_t                   offset;
     struct shim_handle *    file;
     char                    comment[VMA_COMMENT_LEN];
+    /* augmented data of the subtree rooted at this VMA: lowest start,
+     * highest end and the largest unmapped gap between two of its VMAs */
+    void *                  subtree_start;
+    void *                  subtree_end;
+    size_t                  subtree_gap;
 };
 
 #define VMA_MGR_ALLOC   DEFAULT_VMA_COUNT
@@ -97,19 +101,118 @@ static inline void * __malloc (size_t size)
 #include <memmgr.h>
 
 /*
- * "vma_mgr" has no specific lock. "vma_list_lock" must be held when
- * allocating or freeing any VMAs.
+ * "vma_mgr" has no specific lock. "vma_tree_lock" must be held when
+ * allocating or freeing any VMAs. Memory of freed VMAs is never returned
+ * to the system, which is what makes lockless lookups (see below) safe.
  */
 static MEM_MGR vma_mgr = NULL;
 
+static bool vma_cmp (struct avl_tree_node * a, struct avl_tree_node * b);
+static void vma_update (struct avl_tree_node * node);
+
 /*
- * "vma_list" contains a sorted list of non-overlapping VMAs.
- * "vma_list_lock" must be held when accessing either the vma_list or any
- * field of a VMA.
+ * "vma_tree" contains non-overlapping VMAs sorted by address.
+ * "vma_tree_lock" must be held when modifying either the vma_tree or any
+ * field of a VMA, and when taking references to VMA files.
  */
-DEFINE_LISTP(shim_vma);
-static LISTP_TYPE(shim_vma) vma_list = LISTP_INIT;
-static struct shim_lock vma_list_lock;
+static struct avl_tree vma_tree = { .cmp = vma_cmp, .update = vma_update };
+static struct shim_lock vma_tree_lock;
+
+/*
+ * Lookups that only copy VMA fields run without vma_tree_lock, in the
+ * style of a seqlock: writers make "vma_seq" odd for the duration of every
+ * modification, readers traverse the tree optimistically and retry (or fall
+ * back to taking the lock) if "vma_seq" changed in the meantime.
+ */
+static uint64_t vma_seq;
+
+#define VMA_LOOKUP_RETRIES  3
+/* AVL trees are at most ~1.44 * log2(n) high; deeper walks hit a concurrent
+ * modification and will be retried */
+#define VMA_TREE_MAX_DEPTH  64
+
+static inline void __vma_write_begin (void)
+{
+    assert(locked(&vma_tree_lock));
+    __atomic_store_n(&vma_seq, vma_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void __vma_write_end (void)
+{
+    assert(locked(&vma_tree_lock));
+    __atomic_store_n(&vma_seq, vma_seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void lock_vmas (void)
+{
+    lock(&vma_tree_lock);
+    __vma_write_begin();
+}
+
+static inline void unlock_vmas (void)
+{
+    __vma_write_end();
+    unlock(&vma_tree_lock);
+}
+
+static inline uint64_t vma_read_begin (void)
+{
+    return __atomic_load_n(&vma_seq, __ATOMIC_ACQUIRE);
+}
+
+static inline bool vma_read_retry (uint64_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) || __atomic_load_n(&vma_seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline struct shim_vma * node2vma (struct avl_tree_node * node)
+{
+    return node ? container_of(node, struct shim_vma, node) : NULL;
+}
+
+static bool vma_cmp (struct avl_tree_node * a, struct avl_tree_node * b)
+{
+    return node2vma(a)->start <= node2vma(b)->start;
+}
+
+static void vma_update (struct avl_tree_node * node)
+{
+    struct shim_vma * vma   = node2vma(node);
+    struct shim_vma * left  = node2vma(node->left);
+    struct shim_vma * right = node2vma(node->right);
+
+    vma->subtree_start = vma->start;
+    vma->subtree_end   = vma->end;
+    vma->subtree_gap   = 0;
+    if (left) {
+        vma->subtree_start = left->subtree_start;
+        vma->subtree_gap   = MAX(left->subtree_gap,
+                                 (size_t) (vma->start - left->subtree_end));
+    }
+    if (right) {
+        vma->subtree_end = right->subtree_end;
+        vma->subtree_gap = MAX(vma->subtree_gap, right->subtree_gap);
+        vma->subtree_gap = MAX(vma->subtree_gap,
+                               (size_t) (right->subtree_start - vma->end));
+    }
+}
+
+static inline struct shim_vma * __first_vma (void)
+{
+    return node2vma(avl_tree_first(&vma_tree));
+}
+
+static inline struct shim_vma * __next_vma (struct shim_vma * vma)
+{
+    return node2vma(avl_tree_next(&vma->node));
+}
+
+static inline struct shim_vma * __prev_vma (struct shim_vma * vma)
+{
+    return node2vma(avl_tree_prev(&vma->node));
+}
 
 /*
  * Return true if [s, e) is exactly the area represented by vma.
@@ -165,12 +268,12 @@ static inline bool test_vma_overlap (struct shim_vma * vma,
 
 static inline void __assert_vma_list (void)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     struct shim_vma * tmp;
     struct shim_vma * prev __attribute__((unused)) = NULL;
 
-    LISTP_FOR_EACH_ENTRY(tmp, &vma_list, list) {
+    for (tmp = __first_vma() ; tmp ; tmp = __next_vma(tmp)) {
         /* Assert we are really sorted */
         assert(tmp->end > tmp->start);
         assert(!prev || prev->end <= tmp->start);
@@ -178,8 +281,8 @@ static inline void __assert_vma_list (void)
     }
 }
 
-// In a debug build only, assert that the VMA list is
-// sorted.  This should be called with the vma_list_lock held.
+// In a debug build only, assert that the VMA tree is
+// sorted.  This should be called with the vma_tree_lock held.
 static inline void assert_vma_list (void)
 {
 #ifdef DEBUG
@@ -187,83 +290,112 @@ static inline void assert_vma_list (void)
 #endif
 }
 
+static bool vma_end_above (void * addr, struct avl_tree_node * node)
+{
+    return *(void **) addr < node2vma(node)->end;
+}
+
 /*
  * __lookup_vma() returns the VMA that contains the address; otherwise,
  * returns NULL. "pprev" returns the highest VMA below the address.
  * __lookup_vma() fills "pprev" even when the function cannot find a
  * matching vma for "addr".
  *
- * vma_list_lock must be held when calling this function.
+ * vma_tree_lock must be held when calling this function.
  */
 static inline struct shim_vma *
 __lookup_vma (void * addr, struct shim_vma ** pprev)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
+
+    /* the lowest VMA that ends above "addr" either contains "addr" or is
+     * the lowest VMA above it */
+    struct shim_vma * vma = node2vma(avl_tree_lower_bound_fn(&vma_tree, &addr,
+                                                             vma_end_above));
+    struct shim_vma * found = (vma && vma->start <= addr) ? vma : NULL;
 
-    struct shim_vma * vma, * prev = NULL;
+    if (pprev)
+        *pprev = vma ? __prev_vma(vma) : node2vma(avl_tree_last(&vma_tree));
+    return found;
+}
+
+/*
+ * Lockless counterpart of the lookup above: returns the lowest VMA that
+ * ends above "addr". The result may be bogus if the VMA tree is modified
+ * concurrently, so it must be validated with vma_read_retry(). Only the
+ * memory of VMA objects (which is never unmapped) is accessed.
+ */
+static struct shim_vma * __lookup_vma_lockless (void * addr)
+{
+    struct avl_tree_node * node = __atomic_load_n(&vma_tree.root,
+                                                  __ATOMIC_RELAXED);
     struct shim_vma * found = NULL;
 
-    LISTP_FOR_EACH_ENTRY(vma, &vma_list, list) {
-        if (addr < vma->start)
-            break;
-        if (test_vma_contain(vma, addr, addr + 1)) {
+    for (int depth = 0 ; node && depth < VMA_TREE_MAX_DEPTH ; depth++) {
+        struct shim_vma * vma = node2vma(node);
+        if (addr < __atomic_load_n(&vma->end, __ATOMIC_RELAXED)) {
             found = vma;
-            break;
+            node = __atomic_load_n(&node->left, __ATOMIC_RELAXED);
+        } else {
+            node = __atomic_load_n(&node->right, __ATOMIC_RELAXED);
         }
-
-        assert(vma->end > vma->start);
-        assert(!prev || prev->end <= vma->start);
-        prev = vma;
     }
 
-    if (pprev) *pprev = prev;
-    return found;
+    return node ? NULL : found;
 }
 
 /*
- * __insert_vma() places "vma" after "prev", or at the beginning of
- * vma_list if "prev" is NULL. vma_list_lock must be held when calling
- * this function.
+ * __insert_vma() places "vma" right after "prev" (or at the beginning if
+ * "prev" is NULL) in vma_tree; "prev" is only used for sanity checks.
+ * vma_tree_lock must be held when calling this function.
  */
 static inline void
 __insert_vma (struct shim_vma * vma, struct shim_vma * prev)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
     assert(!prev || prev->end <= vma->start);
     assert(vma != prev);
 
     /* check the next entry */
-    struct shim_vma * next = prev ?
-            LISTP_NEXT_ENTRY(prev, &vma_list, list) :
-            LISTP_FIRST_ENTRY(&vma_list, struct shim_vma, list);
+    struct shim_vma * next = prev ? __next_vma(prev) : __first_vma();
 
     __UNUSED(next);
     assert(!next || vma->end <= next->start);
 
-    if (prev)
-        LISTP_ADD_AFTER(vma, prev, &vma_list, list);
-    else
-        LISTP_ADD(vma, &vma_list, list);
+    avl_tree_insert(&vma_tree, &vma->node);
 }
 
 /*
- * __remove_vma() removes "vma" after "prev", or at the beginnning of
- * vma_list if "prev" is NULL. vma_list_lock must be held when calling
- * this function.
+ * __remove_vma() removes "vma" from vma_tree; "prev" is the VMA right
+ * before it (or NULL). vma_tree_lock must be held when calling this
+ * function.
  */
 static inline void
 __remove_vma (struct shim_vma * vma, struct shim_vma * prev)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
     __UNUSED(prev);
     assert(vma != prev);
-    LISTP_DEL(vma, &vma_list, list);
+    avl_tree_delete(&vma_tree, &vma->node);
+}
+
+/*
+ * __update_vma() must be called after the bounds of "vma" changed without
+ * changing its order relative to the other VMAs. vma_tree_lock must be held
+ * when calling this function.
+ */
+static inline void __update_vma (struct shim_vma * vma)
+{
+    assert(locked(&vma_tree_lock));
+    /* re-inserting recomputes the augmented data on the path to the root */
+    avl_tree_delete(&vma_tree, &vma->node);
+    avl_tree_insert(&vma_tree, &vma->node);
 }
 
 /*
  * Storing a cursor pointing to the current heap top. With ASLR, the cursor
  * is randomized at initialization. The cursor is monotonically decremented
- * when allocating user VMAs. Updating this cursor needs holding vma_list_lock.
+ * when allocating user VMAs. Updating this cursor needs holding vma_tree_lock.
  */
 static void * current_heap_top;
 
@@ -282,7 +414,7 @@ static int
 __bkeep_preloaded (void * start, void * end, int prot, int flags,
                    const char * comment)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     if (!start || !end || start == end)
         return 0;
@@ -295,11 +427,11 @@ __bkeep_preloaded (void * start, void * end, int prot, int flags,
 int init_vma(void) {
     int ret = 0;
 
-    if (!create_lock(&vma_list_lock)) {
+    if (!create_lock(&vma_tree_lock)) {
         return -ENOMEM;
     }
 
-    lock(&vma_list_lock);
+    lock_vmas();
 
     for (int i = 0 ; i < RESERVED_VMAS ; i++)
         reserved_vmas[i] = &early_vmas[i];
@@ -350,11 +482,10 @@ int init_vma(void) {
             struct shim_vma * new = get_mem_obj_from_mgr(vma_mgr);
             assert(new);
             struct shim_vma * e = &early_vmas[i];
-            struct shim_vma * prev = LISTP_PREV_ENTRY(e, &vma_list, list);
+            struct shim_vma * prev = __prev_vma(e);
             debug("Converting early VMA [%p] %p-%p\n", e, e->start, e->end);
-            memcpy(new, e, sizeof(*e));
-            INIT_LIST_HEAD(new, list);
             __remove_vma(e, prev);
+            memcpy(new, e, sizeof(*e));
             __insert_vma(new, prev);
         }
 
@@ -385,13 +516,13 @@ int init_vma(void) {
     debug("heap top adjusted to %p\n", current_heap_top);
 
 out:
-    unlock(&vma_list_lock);
+    unlock_vmas();
     return ret;
 }
 
 static inline struct shim_vma * __get_new_vma (void)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     struct shim_vma * tmp = NULL;
 
@@ -413,13 +544,12 @@ static inline struct shim_vma * __get_new_vma (void)
         return NULL;
     }
     memset(tmp, 0, sizeof(*tmp));
-    INIT_LIST_HEAD(tmp, list);
     return tmp;
 }
 
 static inline void __restore_reserved_vmas (void)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     bool nothing_reserved;
     do {
@@ -440,7 +570,7 @@ static inline void __restore_reserved_vmas (void)
 
 static inline void __drop_vma (struct shim_vma * vma)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     if (vma->file)
         put_handle(vma->file);
@@ -498,7 +628,7 @@ static int __bkeep_mmap (struct shim_vma * prev,
                          struct shim_handle * file, off_t offset,
                          const char * comment)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     int ret = 0;
     struct shim_vma * new = __get_new_vma();
@@ -535,14 +665,14 @@ int bkeep_mmap (void * addr, size_t length, int prot, int flags,
 
     debug("bkeep_mmap: %p-%p\n", addr, addr + length);
 
-    lock(&vma_list_lock);
+    lock_vmas();
     struct shim_vma * prev = NULL;
     __lookup_vma(addr, &prev);
     int ret = __bkeep_mmap(prev, addr, addr + length, prot, flags, file, offset,
                            comment);
     assert_vma_list();
     __restore_reserved_vmas();
-    unlock(&vma_list_lock);
+    unlock_vmas();
     return ret;
 }
 
@@ -553,12 +683,12 @@ int bkeep_mmap (void * addr, size_t length, int prot, int flags,
  * (2) [start, end) overlaps with the ending of the VMA.
  * (3) [start, end) overlaps with the middle of the VMA. In this case, the VMA
  *     is splitted into two. The new VMA is stored in 'tailptr'.
- * In either of these cases, "vma" is the only one changed among vma_list.
+ * In either of these cases, "vma" is the only one changed among vma_tree.
  */
 static inline void __shrink_vma (struct shim_vma * vma, void * start, void * end,
                                  struct shim_vma ** tailptr)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     if (test_vma_startin(vma, start, end)) {
         /*
@@ -618,6 +748,7 @@ static inline void __shrink_vma (struct shim_vma * vma, void * start, void * end
 
     assert(!test_vma_overlap(vma, start, end));
     assert(vma->start < vma->end);
+    __update_vma(vma);
 }
 
 /*
@@ -635,20 +766,20 @@ static inline void __shrink_vma (struct shim_vma * vma, void * start, void * end
 static int __bkeep_munmap (struct shim_vma ** pprev,
                            void * start, void * end, int flags)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     struct shim_vma * prev = *pprev;
     struct shim_vma * cur, * next;
 
     if (!prev) {
-        cur = LISTP_FIRST_ENTRY(&vma_list, struct shim_vma, list);
+        cur = __first_vma();
         if (!cur)
             return 0;
     } else {
-        cur = LISTP_NEXT_ENTRY(prev, &vma_list, list);
+        cur = __next_vma(prev);
     }
 
-    next = cur ? LISTP_NEXT_ENTRY(cur, &vma_list, list) : NULL;
+    next = cur ? __next_vma(cur) : NULL;
 
     while (cur) {
         struct shim_vma * tail = NULL;
@@ -686,13 +817,13 @@ static int __bkeep_munmap (struct shim_vma ** pprev,
         }
 
         cur = next;
-        next = cur ? LISTP_NEXT_ENTRY(cur, &vma_list, list) : NULL;
+        next = cur ? __next_vma(cur) : NULL;
     }
 
     if (prev)
-        assert(cur == LISTP_NEXT_ENTRY(prev, &vma_list, list));
+        assert(cur == __next_vma(prev));
     else
-        assert(cur == LISTP_FIRST_ENTRY(&vma_list, struct shim_vma, list));
+        assert(cur == __first_vma());
 
     assert(!prev || prev->end <= start);
     assert(!cur || end <= cur->start);
@@ -707,7 +838,7 @@ int bkeep_munmap (void * addr, size_t length, int flags)
 
     debug("bkeep_munmap: %p-%p\n", addr, addr + length);
 
-    lock(&vma_list_lock);
+    lock_vmas();
     struct shim_vma * prev = NULL;
     __lookup_vma(addr, &prev);
     int ret = __bkeep_munmap(&prev, addr, addr + length, flags);
@@ -716,7 +847,7 @@ int bkeep_munmap (void * addr, size_t length, int flags)
     /* DEP 5/20/19: If this is a debugging region we are removing, take it out
      * of the checkpoint.  Otherwise, it will be restored erroneously after a fork. */
     remove_r_debug(addr);
-    unlock(&vma_list_lock);
+    unlock_vmas();
     return ret;
 }
 
@@ -733,19 +864,19 @@ int bkeep_munmap (void * addr, size_t length, int flags)
 static int __bkeep_mprotect (struct shim_vma * prev,
                              void * start, void * end, int prot, int flags)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
 
     struct shim_vma * cur, * next;
 
     if (!prev) {
-        cur = LISTP_FIRST_ENTRY(&vma_list, struct shim_vma, list);
+        cur = __first_vma();
         if (!cur)
             return 0;
     } else {
-        cur = LISTP_NEXT_ENTRY(prev, &vma_list, list);
+        cur = __next_vma(prev);
     }
 
-    next = cur ? LISTP_NEXT_ENTRY(cur, &vma_list, list) : NULL;
+    next = cur ? __next_vma(cur) : NULL;
 
     while (cur) {
         struct shim_vma * new, * tail = NULL;
@@ -805,12 +936,16 @@ static int __bkeep_mprotect (struct shim_vma * prev,
                 __insert_vma(new, prev);
                 assert(!prev || prev->end <= new->end);
                 assert(new->start < new->end);
+
+                /* Without a tail, "new" is the highest VMA processed so far */
+                if (cur->end <= new->start)
+                    cur = new;
             }
         }
 
         prev = cur;
         cur = next;
-        next = cur ? LISTP_NEXT_ENTRY(cur, &vma_list, list) : NULL;
+        next = cur ? __next_vma(cur) : NULL;
     }
 
     return 0;
@@ -823,28 +958,62 @@ int bkeep_mprotect (void * addr, size_t length, int prot, int flags)
 
     debug("bkeep_mprotect: %p-%p\n", addr, addr + length);
 
-    lock(&vma_list_lock);
+    lock_vmas();
     struct shim_vma * prev = NULL;
     __lookup_vma(addr, &prev);
     int ret = __bkeep_mprotect(prev, addr, addr + length, prot, flags);
     assert_vma_list();
     __restore_reserved_vmas();
-    unlock(&vma_list_lock);
+    unlock_vmas();
     return ret;
 }
 
+/*
+ * __find_gap() returns the highest VMA "vma" in the subtree of "node" such
+ * that vma->start <= "limit" and the unmapped gap between "vma" and the
+ * previous VMA of the subtree is at least "length" bytes, or NULL if there is
+ * no such VMA. The augmented data lets the search skip subtrees without
+ * large enough gaps, so it takes O(log n).
+ */
+static struct shim_vma * __find_gap (struct avl_tree_node * node,
+                                     void * limit, size_t length)
+{
+    struct shim_vma * vma = node2vma(node);
+    if (!vma || vma->subtree_gap < length)
+        return NULL;
+
+    struct shim_vma * left  = node2vma(node->left);
+    struct shim_vma * right = node2vma(node->right);
+
+    if (vma->start > limit)
+        return __find_gap(node->left, limit, length);
+
+    struct shim_vma * found = __find_gap(node->right, limit, length);
+    if (found)
+        return found;
+
+    if (right && right->subtree_start <= limit &&
+        (size_t) (right->subtree_start - vma->end) >= length)
+        return __next_vma(vma); /* the lowest VMA of the right subtree */
+
+    if (left && (size_t) (vma->start - left->subtree_end) >= length)
+        return vma;
+
+    return __find_gap(node->left, limit, length);
+}
+
 /*
  * Search for an unmapped area within [bottom, top) that is big enough
  * to allocate "length" bytes. The search approach is top-down.
  * If this function returns a non-NULL address, the corresponding VMA is
- * added to the VMA list.
+ * added to the VMA tree.
  */
 static void * __bkeep_unmapped (void * top_addr, void * bottom_addr,
                                 size_t length, int prot, int flags,
                                 struct shim_handle * file,
                                 off_t offset, const char * comment)
 {
-    assert(locked(&vma_list_lock));
+    assert(locked(&vma_tree_lock));
     assert(top_addr > bottom_addr);
 
     if (!length || length > (uintptr_t) top_addr - (uintptr_t) bottom_addr)
@@ -853,46 +1022,59 @@ static void * __bkeep_unmapped (void * top_addr, void * bottom_addr,
     struct shim_vma * prev = NULL;
     struct shim_vma * cur = __lookup_vma(top_addr, &prev);
 
-    while (true) {
-        /* Set the range for searching */
-        void * end = cur ? cur->start : top_addr;
-        void * start =
-            (prev && prev->end > bottom_addr) ? prev->end : bottom_addr;
-
-        assert(start <= end);
+    /* First, try the area right below "top_addr" */
+    void * end = cur ? cur->start : top_addr;
+    if (end <= bottom_addr)
+        return NULL;
 
-        /* Check if there is enough space between prev and cur */
-        if (length <= (uintptr_t) end - (uintptr_t) start) {
-            /* create a new VMA at the top of the range */
-            __bkeep_mmap(prev, end - length, end, prot, flags,
-                         file, offset, comment);
-            assert_vma_list();
+    void * start =
+        (prev && prev->end > bottom_addr) ? prev->end : bottom_addr;
+    assert(start <= end);
 
-            debug("bkeep_unmapped: %p-%p%s%s\n", end - length, end,
-                  comment ? " => " : "", comment ? : "");
+    if (length > (uintptr_t) end - (uintptr_t) start) {
+        if (!prev || prev->start <= bottom_addr)
+            return NULL;
 
-            return end - length;
+        /* Then, find the highest large enough gap between two VMAs below */
+        cur = __find_gap(vma_tree.root, prev->start, length);
+        if (cur) {
+            prev = __prev_vma(cur);
+            assert(prev);
+        } else {
+            /* ...or between "bottom_addr" and the lowest VMA */
+            prev = NULL;
+            cur = __first_vma();
         }
 
-        if (!prev || prev->start <= bottom_addr)
-            break;
+        end = cur->start;
+        start = (prev && prev->end > bottom_addr) ? prev->end : bottom_addr;
 
-        cur = prev;
-        prev = LISTP_PREV_ENTRY(cur, &vma_list, list);
+        /* the gap may be too small only because it was cut off by
+         * "bottom_addr"; then all lower gaps are out of range anyway */
+        if (end <= start || length > (uintptr_t) end - (uintptr_t) start)
+            return NULL;
     }
 
-    return NULL;
+    /* create a new VMA at the top of the range */
+    __bkeep_mmap(prev, end - length, end, prot, flags,
+                 file, offset, comment);
+    assert_vma_list();
+
+    debug("bkeep_unmapped: %p-%p%s%s\n", end - length, end,
+          comment ? " => " : "", comment ? : "");
+
+    return end - length;
 }
 
 void * bkeep_unmapped (void * top_addr, void * bottom_addr, size_t length,
                        int prot, int flags, off_t offset, const char * comment)
 {
-    lock(&vma_list_lock);
+    lock_vmas();
     void * addr = __bkeep_unmapped(top_addr, bottom_addr, length, prot, flags,
                                    NULL, offset, comment);
     assert_vma_list();
     __restore_reserved_vmas();
-    unlock(&vma_list_lock);
+    unlock_vmas();
     return addr;
 }
 
@@ -900,7 +1082,7 @@ void * bkeep_unmapped_heap (size_t length, int prot, int flags,
                             struct shim_handle * file,
                             off_t offset, const char * comment)
 {
-    lock(&vma_list_lock);
+    lock_vmas();
 
     void * bottom_addr = PAL_CB(user_address.start);
     void * top_addr = current_heap_top;
@@ -949,7 +1131,7 @@ void * bkeep_unmapped_heap (size_t length, int prot, int flags,
     }
 
     __restore_reserved_vmas();
-    unlock(&vma_list_lock);
+    unlock_vmas();
 #ifdef MAP_32BIT
     assert(!(flags & MAP_32BIT) || !addr || addr + length <= ADDR_32BIT);
 #endif
@@ -970,77 +1152,152 @@ __dump_vma (struct shim_vma_val * val, const struct shim_vma * vma)
     memcpy(val->comment, vma->comment, VMA_COMMENT_LEN);
 }
 
-int lookup_vma (void * addr, struct shim_vma_val * res)
+/*
+ * Lockless part of __lookup_overlap_vma(). Returns -EAGAIN if the lookup
+ * raced with a modification of the VMA tree, and -EBUSY if the found VMA
+ * has a file, since taking a reference to it requires vma_tree_lock.
+ */
+static int __lookup_overlap_vma_lockless (void * addr, void * end,
+                                          struct shim_vma_val * res)
 {
-    lock(&vma_list_lock);
+    uint64_t seq = vma_read_begin();
+    struct shim_vma * vma = __lookup_vma_lockless(addr);
+    struct shim_vma_val val;
+    bool found = false;
+
+    if (vma) {
+        val.addr = __atomic_load_n(&vma->start, __ATOMIC_RELAXED);
+        found = val.addr < end;
+        if (found && res) {
+            val.length = __atomic_load_n(&vma->end, __ATOMIC_RELAXED) - val.addr;
+            val.prot   = __atomic_load_n(&vma->prot, __ATOMIC_RELAXED);
+            val.flags  = __atomic_load_n(&vma->flags, __ATOMIC_RELAXED);
+            val.offset = __atomic_load_n(&vma->offset, __ATOMIC_RELAXED);
+            val.file   = __atomic_load_n(&vma->file, __ATOMIC_RELAXED);
+            memcpy(val.comment, vma->comment, VMA_COMMENT_LEN);
+        }
+    }
 
-    struct shim_vma * vma = __lookup_vma(addr, NULL);
-    if (!vma) {
-        unlock(&vma_list_lock);
+    if (vma_read_retry(seq))
+        return -EAGAIN;
+    if (!found)
+        return -ENOENT;
+    if (res) {
+        if (val.file)
+            return -EBUSY;
+        val.comment[VMA_COMMENT_LEN - 1] = 0;
+        *res = val;
+    }
+    return 0;
+}
+
+/*
+ * Looks up the lowest VMA overlapping with [addr, addr + length). Lookups
+ * run without vma_tree_lock unless they keep racing with modifications, or
+ * a reference to the VMA file must be taken.
+ */
+static int __lookup_overlap_vma (void * addr, size_t length,
+                                 struct shim_vma_val * res)
+{
+    for (int i = 0 ; i < VMA_LOOKUP_RETRIES ; i++) {
+        int ret = __lookup_overlap_vma_lockless(addr, addr + length, res);
+        if (ret == -EBUSY)
+            break;
+        if (ret != -EAGAIN)
+            return ret;
+    }
+
+    lock(&vma_tree_lock);
+
+    struct shim_vma * vma = node2vma(avl_tree_lower_bound_fn(&vma_tree, &addr,
+                                                             vma_end_above));
+    if (!vma || !test_vma_overlap(vma, addr, addr + length)) {
+        unlock(&vma_tree_lock);
         return -ENOENT;
     }
 
     if (res)
         __dump_vma(res, vma);
 
-    unlock(&vma_list_lock);
+    unlock(&vma_tree_lock);
     return 0;
 }
 
+int lookup_vma (void * addr, struct shim_vma_val * res)
+{
+    return __lookup_overlap_vma(addr, 1, res);
+}
+
 int lookup_overlap_vma (void * addr, size_t length, struct shim_vma_val * res)
 {
-    struct shim_vma * tmp, * vma = NULL;
+    return __lookup_overlap_vma(addr, length, res);
+}
 
-    lock(&vma_list_lock);
+/*
+ * Lockless part of is_in_adjacent_vmas(). Returns -EAGAIN if the lookup
+ * raced with a modification of the VMA tree.
+ */
+static int __is_in_adjacent_vmas_lockless (void * addr, void * end)
+{
+    uint64_t seq = vma_read_begin();
+    bool found = false;
 
-    LISTP_FOR_EACH_ENTRY(tmp, &vma_list, list)
-        if (test_vma_overlap (tmp, addr, addr + length)) {
-            vma = tmp;
+    /* every VMA must contain the end of the previous one; "addr" only grows,
+     * so this terminates even on inconsistent data */
+    while (true) {
+        struct shim_vma * vma = __lookup_vma_lockless(addr);
+        if (!vma)
             break;
-        }
 
+        void * vma_start = __atomic_load_n(&vma->start, __ATOMIC_RELAXED);
+        void * vma_end   = __atomic_load_n(&vma->end, __ATOMIC_RELAXED);
+        if (vma_start > addr || vma_end <= addr)
+            break;
+        if (end <= vma_end) {
+            found = true;
+            break;
+        }
+        addr = vma_end;
 
-    if (!vma) {
-        unlock(&vma_list_lock);
-        return -ENOENT;
+        if (vma_read_retry(seq))
+            return -EAGAIN;
     }
 
-    if (res)
-        __dump_vma(res, vma);
-
-    unlock(&vma_list_lock);
-    return 0;
+    if (vma_read_retry(seq))
+        return -EAGAIN;
+    return found;
 }
 
 bool is_in_adjacent_vmas (void * addr, size_t length)
 {
-    struct shim_vma* vma;
-    struct shim_vma* prev = NULL;
-    lock(&vma_list_lock);
+    for (int i = 0 ; i < VMA_LOOKUP_RETRIES ; i++) {
+        int ret = __is_in_adjacent_vmas_lockless(addr, addr + length);
+        if (ret != -EAGAIN)
+            return ret;
+    }
+
+    lock(&vma_tree_lock);
 
     /* we rely on the fact that VMAs are sorted (for adjacent VMAs) */
     assert_vma_list();
 
-    LISTP_FOR_EACH_ENTRY(vma, &vma_list, list) {
-        if (addr >= vma->start && addr < vma->end) {
-            assert(prev == NULL);
-            prev = vma;
+    bool found = false;
+    struct shim_vma * vma = __lookup_vma(addr, NULL);
+    while (vma) {
+        if (addr + length <= vma->end) {
+            found = true;
+            break;
         }
-        if (prev) {
-            if (prev != vma && prev->end != vma->start) {
-                /* prev and current VMAs are not adjacent */
-                break;
-            }
-            if ((addr + length) > vma->start && (addr + length) <= vma->end) {
-                unlock(&vma_list_lock);
-                return true;
-            }
-            prev = vma;
+        struct shim_vma * next = __next_vma(vma);
+        if (next && next->start != vma->end) {
+            /* current and next VMAs are not adjacent */
+            break;
         }
+        vma = next;
     }
 
-    unlock(&vma_list_lock);
-    return false;
+    unlock(&vma_tree_lock);
+    return found;
 }
 
 int dump_all_vmas (struct shim_vma_val * vmas, size_t max_count)
@@ -1048,9 +1305,9 @@ int dump_all_vmas (struct shim_vma_val * vmas, size_t max_count)
     struct shim_vma_val * val = vmas;
     struct shim_vma * vma;
     size_t cnt = 0;
-    lock(&vma_list_lock);
+    lock(&vma_tree_lock);
 
-    LISTP_FOR_EACH_ENTRY(vma, &vma_list, list) {
+    for (vma = __first_vma() ; vma ; vma = __next_vma(vma)) {
         if (VMA_TYPE(vma->flags))
             continue;
         if (vma->flags & VMA_UNMAPPED)
@@ -1069,7 +1326,7 @@ int dump_all_vmas (struct shim_vma_val * vmas, size_t max_count)
         val++;
     }
 
-    unlock(&vma_list_lock);
+    unlock(&vma_tree_lock);
     return cnt;
 }
 
@@ -1095,8 +1352,17 @@ BEGIN_CP_FUNC(vma)
             DO_CP(handle, vma->file, &new_vma->file);
 
         void * need_mapped = vma->addr;
+        /* index of the first chunk fetched by the child on demand, plus one (0 if none) */
+        size_t lazy_chunk = 0;
+
+        if (NEED_MIGRATE_MEMORY(vma) && store->lazy_mem && lazy_mem_eligible(vma)) {
+            long first = lazy_mem_add_range(store->lazy_mem, vma->addr, vma->length, pal_prot);
+            if (first < 0)
+                return first;
 
-        if (NEED_MIGRATE_MEMORY(vma)) {
+            lazy_chunk  = first + 1;
+            need_mapped = vma->addr + vma->length;
+        } else if (NEED_MIGRATE_MEMORY(vma)) {
             void* send_addr  = vma->addr;
             size_t send_size = vma->length;
             if (vma->file) {
@@ -1133,6 +1399,7 @@ BEGIN_CP_FUNC(vma)
         }
         ADD_CP_FUNC_ENTRY(off);
         ADD_CP_ENTRY(ADDR, need_mapped);
+        ADD_CP_ENTRY(SIZE, lazy_chunk);
     } else {
         new_vma = (struct shim_vma_val *) (base + off);
     }
@@ -1146,6 +1413,7 @@ BEGIN_RS_FUNC(vma)
 {
     struct shim_vma_val * vma = (void *) (base + GET_CP_FUNC_ENTRY());
     void * need_mapped = (void *) GET_CP_ENTRY(ADDR);
+    size_t lazy_chunk = GET_CP_ENTRY(SIZE);
     CP_REBASE(vma->file);
 
     int ret = bkeep_mmap(vma->addr, vma->length, vma->prot, vma->flags,
@@ -1157,6 +1425,13 @@ BEGIN_RS_FUNC(vma)
              vma->addr, vma->addr + vma->length, vma->flags, vma->prot);
 
     if (!(vma->flags & VMA_UNMAPPED)) {
+        if (lazy_chunk) {
+            ret = lazy_mem_restore_range(vma->addr, vma->length,
+                                         PAL_PROT(vma->prot, 0), lazy_chunk - 1);
+            if (ret < 0)
+                return ret;
+        }
+
         if (vma->file) {
             struct shim_mount * fs = vma->file->fs;
             get_handle(vma->file);
@@ -1286,7 +1561,7 @@ void debug_print_vma_list (void)
     SYS_PRINTF("vma bookkeeping:\n");
 
     struct shim_vma * vma;
-    LISTP_FOR_EACH_ENTRY(vma, &vma_list, list) {
+    for (vma = __first_vma() ; vma ; vma = __next_vma(vma)) {
         debug_print_vma(vma);
     }
 }
@@ -27,6 +27,7 @@
 #include <asm/prctl.h>
 #include <errno.h>
 #include <shim_checkpoint.h>
+#include <shim_clock.h>
 #include <shim_fs.h>
 #include <shim_handle.h>
 #include <shim_internal.h>
@@ -1391,6 +1392,7 @@ static ElfW(Addr)* __vdso_shim_clock_gettime __attribute_migratable = NULL;
 static ElfW(Addr)* __vdso_shim_gettimeofday __attribute_migratable  = NULL;
 static ElfW(Addr)* __vdso_shim_time __attribute_migratable          = NULL;
 static ElfW(Addr)* __vdso_shim_getcpu __attribute_migratable        = NULL;
+static ElfW(Addr)* __vdso_shim_clock_data __attribute_migratable    = NULL;
 
 static const struct {
     const char* name;
@@ -1415,6 +1417,11 @@ static const struct {
                  .name  = "__vdso_shim_getcpu",
                  .value = (ElfW(Addr))&__shim_getcpu,
                  .func  = &__vdso_shim_getcpu,
+             },
+             {
+                 .name  = "__vdso_shim_clock_data",
+                 .value = (ElfW(Addr))&g_clock_data,
+                 .func  = &__vdso_shim_clock_data,
              }};
 
 static int vdso_map_init(void) {
@@ -0,0 +1,672 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * cache.c
+ *
+ * Page cache for regular files of the 'chroot' filesystem.
+ *
+ * Every read or write of a host file is a PAL call, and under SGX an enclave exit plus a copy
+ * through untrusted memory. Applications doing many small reads and writes (SQLite, parsers of
+ * configuration files) pay this per call. With the cache enabled in the manifest
+ * (`fs.cache.size = <bytes>`), small requests are served from page-sized buffers inside the LibOS:
+ *
+ * - Pages are kept per file (struct shim_file_data, i.e. per dentry) and in one global LRU list;
+ *   the least recently used page is evicted (and written back if dirty) when the limit is reached.
+ * - Misses fill all missing pages of a request with one host read, and sequential misses also read
+ *   ahead FILE_CACHE_READAHEAD pages.
+ * - Writes only dirty pages. Dirty pages are written back in runs of contiguous pages on eviction,
+ *   fsync, when the last writer closes the file, before checkpointing (fork, execve) and at exit.
+ * - Requests of FILE_CACHE_DIRECT_SIZE or more go to the host directly (after writing back dirty
+ *   pages, and updating the cached pages they overwrite).
+ * - truncate drops the pages beyond the new size. Shared mmaps, and handles that cannot read the
+ *   host file, switch the file to direct I/O until all its handles are closed.
+ * - Between processes, the cache gives close-to-open consistency: the cache of a file is dropped
+ *   when its last handle in this process is closed, and a new one starts from the host contents.
+ *
+ * All state is protected by `file_cache_lock`, which is taken after the handle lock. The host I/O
+ * of direct requests is done without holding it, so that only misses and write-backs of small
+ * requests are serialized between files.
+ */
+
+#include <shim_internal.h>
+#include <shim_handle.h>
+#include <shim_fs.h>
+#include <shim_utils.h>
+
+#include <pal.h>
+#include <pal_error.h>
+
+#include <avl_tree.h>
+#include <list.h>
+
+#include <errno.h>
+
+#include <linux/fcntl.h>
+
+#include <asm/mman.h>
+
+#define FILE_CACHE_PAGE_SIZE    4096UL
+/* lower limit for `fs.cache.size`, so that one request never evicts its own pages */
+#define FILE_CACHE_MIN_PAGES    64
+/* requests of this size or larger bypass the cache */
+#define FILE_CACHE_DIRECT_SIZE  (16 * FILE_CACHE_PAGE_SIZE)
+/* pages read ahead on a sequential miss */
+#define FILE_CACHE_READAHEAD    8
+/* maximum number of pages filled or written back with one host request */
+#define FILE_CACHE_BATCH_PAGES  (FILE_CACHE_DIRECT_SIZE / FILE_CACHE_PAGE_SIZE + 1 + \
+                                 FILE_CACHE_READAHEAD)
+/* pages allocated at once by the page allocator */
+#define FILE_CACHE_MGR_ALLOC    16
+
+DEFINE_LIST(file_cache_page);
+struct file_cache_page {
+    struct shim_file_cache* cache;
+    uint64_t index;                     /* offset in the file / FILE_CACHE_PAGE_SIZE */
+    bool dirty;
+    struct avl_tree_node node;          /* in cache->pages */
+    LIST_TYPE(file_cache_page) lru;     /* in file_cache_lru */
+    char data[FILE_CACHE_PAGE_SIZE];
+};
+DEFINE_LISTP(file_cache_page);
+
+struct shim_file_cache {
+    struct avl_tree pages;              /* cached pages, by index */
+    off_t size;                         /* file size, including unwritten data */
+    int open_cnt;                       /* handles using this cache */
+    /* handle the dirty pages are written back with (the last one that wrote), never a closed
+     * handle: the cache is written back when it is closed */
+    struct shim_handle* writer;
+    int error;                          /* error of a write-back on eviction, reported by fsync */
+    bool direct;                        /* cache disabled for the file, use direct I/O */
+    uint64_t ra_next;                   /* page after the last filled one, for read-ahead */
+};
+
+static struct shim_lock file_cache_lock;
+
+#define SYSTEM_LOCK()   ({})
+#define SYSTEM_UNLOCK() ({})
+#define SYSTEM_LOCKED() locked(&file_cache_lock)
+
+#define OBJ_TYPE struct file_cache_page
+#include <memmgr.h>
+
+static MEM_MGR file_cache_mgr = NULL;
+static size_t file_cache_max_pages = 0;  /* 0 if the cache is disabled */
+static size_t file_cache_pages = 0;
+/* most recently used pages first */
+static LISTP_TYPE(file_cache_page) file_cache_lru;
+/* bounce buffer for filling pages, used under file_cache_lock */
+static char* file_cache_buf = NULL;
+
+int init_file_cache(void) {
+    char cfg[CONFIG_MAX];
+    if (!root_config || get_config(root_config, "fs.cache.size", cfg, sizeof(cfg)) <= 0)
+        return 0;
+
+    size_t max_pages = parse_int(cfg) / FILE_CACHE_PAGE_SIZE;
+    if (!max_pages)
+        return 0;
+    if (max_pages < FILE_CACHE_MIN_PAGES)
+        max_pages = FILE_CACHE_MIN_PAGES;
+
+    if (!create_lock(&file_cache_lock))
+        return -ENOMEM;
+
+    file_cache_buf = malloc(FILE_CACHE_BATCH_PAGES * FILE_CACHE_PAGE_SIZE);
+    if (!file_cache_buf)
+        return -ENOMEM;
+
+    lock(&file_cache_lock);
+    file_cache_mgr = create_mem_mgr(init_align_up(FILE_CACHE_MGR_ALLOC));
+    unlock(&file_cache_lock);
+    if (!file_cache_mgr) {
+        free(file_cache_buf);
+        file_cache_buf = NULL;
+        return -ENOMEM;
+    }
+
+    INIT_LISTP(&file_cache_lru);
+    file_cache_max_pages = max_pages;
+    debug("file cache enabled: %lu pages\n", file_cache_max_pages);
+    return 0;
+}
+
+static bool page_cmp(struct avl_tree_node* a, struct avl_tree_node* b) {
+    return container_of(a, struct file_cache_page, node)->index <=
+           container_of(b, struct file_cache_page, node)->index;
+}
+
+static bool page_index_cmp(void* index, struct avl_tree_node* node) {
+    return *(uint64_t*)index <= container_of(node, struct file_cache_page, node)->index;
+}
+
+static struct file_cache_page* next_page(struct file_cache_page* page) {
+    struct avl_tree_node* node = avl_tree_next(&page->node);
+    return node ? container_of(node, struct file_cache_page, node) : NULL;
+}
+
+static struct file_cache_page* find_page(struct shim_file_cache* cache, uint64_t index) {
+    struct avl_tree_node* node = avl_tree_lower_bound_fn(&cache->pages, &index, page_index_cmp);
+    if (!node)
+        return NULL;
+
+    struct file_cache_page* page = container_of(node, struct file_cache_page, node);
+    return page->index == index ? page : NULL;
+}
+
+static void touch_page(struct file_cache_page* page) {
+    LISTP_DEL(page, &file_cache_lru, lru);
+    LISTP_ADD(page, &file_cache_lru, lru);
+}
+
+static void free_page(struct file_cache_page* page) {
+    avl_tree_delete(&page->cache->pages, &page->node);
+    LISTP_DEL(page, &file_cache_lru, lru);
+    file_cache_pages--;
+    free_mem_obj_to_mgr(file_cache_mgr, page);
+}
+
+/* Writes back the run of contiguous dirty pages starting at `page` with one host write, and
+ * returns the page following the run in `*next`. */
+static int write_back_run(struct file_cache_page* page, struct file_cache_page** next) {
+    struct shim_file_cache* cache = page->cache;
+    struct iovec vec[FILE_CACHE_BATCH_PAGES];
+    struct file_cache_page* run[FILE_CACHE_BATCH_PAGES];
+    off_t offset = page->index * FILE_CACHE_PAGE_SIZE;
+    size_t cnt = 0;
+
+    assert(cache->writer);
+
+    if (offset >= cache->size) {
+        /* cannot happen after truncate, but never extend the file with a stale page */
+        page->dirty = false;
+        if (next)
+            *next = next_page(page);
+        return 0;
+    }
+
+    while (page && page->dirty && cnt < FILE_CACHE_BATCH_PAGES &&
+           (!cnt || page->index == run[cnt - 1]->index + 1)) {
+        off_t start = page->index * FILE_CACHE_PAGE_SIZE;
+        if (start >= cache->size)
+            break;
+
+        vec[cnt].iov_base = page->data;
+        vec[cnt].iov_len  = MIN(FILE_CACHE_PAGE_SIZE, (size_t)(cache->size - start));
+        run[cnt++] = page;
+        page = next_page(page);
+    }
+    if (next)
+        *next = page;
+
+    ssize_t ret = pal_stream_writev(cache->writer->pal_handle, /*seekable=*/true, offset, vec,
+                                    (int)cnt);
+    if (ret < 0)
+        return ret;
+
+    /* pages written completely are clean now */
+    size_t written = ret;
+    for (size_t i = 0; i < cnt && written >= vec[i].iov_len; i++) {
+        run[i]->dirty = false;
+        written -= vec[i].iov_len;
+    }
+    return run[cnt - 1]->dirty ? -EIO : 0;
+}
+
+static int write_back_cache(struct shim_file_cache* cache) {
+    int ret = 0;
+    struct avl_tree_node* node = avl_tree_first(&cache->pages);
+    struct file_cache_page* page = node ? container_of(node, struct file_cache_page, node) : NULL;
+
+    while (page) {
+        if (!page->dirty) {
+            page = next_page(page);
+            continue;
+        }
+
+        int err = write_back_run(page, &page);
+        if (err < 0) {
+            /* leave the pages dirty, a later fsync or close retries */
+            ret = err;
+            break;
+        }
+    }
+
+    if (!ret && cache->error) {
+        ret = cache->error;
+        cache->error = 0;
+    }
+    return ret;
+}
+
+/* Writes back the dirty pages in [first, last], so that the host file is up to date there. */
+static int write_back_range(struct shim_file_cache* cache, uint64_t first, uint64_t last) {
+    uint64_t index = first;
+    struct avl_tree_node* node = avl_tree_lower_bound_fn(&cache->pages, &index, page_index_cmp);
+    struct file_cache_page* page = node ? container_of(node, struct file_cache_page, node) : NULL;
+
+    while (page && page->index <= last) {
+        if (!page->dirty) {
+            page = next_page(page);
+            continue;
+        }
+
+        int ret = write_back_run(page, &page);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static void evict_page(void) {
+    struct file_cache_page* page = LISTP_LAST_ENTRY(&file_cache_lru, struct file_cache_page, lru);
+    assert(page);
+
+    if (page->dirty) {
+        int ret = write_back_run(page, NULL);
+        if (ret < 0) {
+            debug("file cache: write-back on eviction failed (%d)\n", ret);
+            page->cache->error = ret;
+        }
+    }
+    free_page(page);
+}
+
+static struct file_cache_page* alloc_page(struct shim_file_cache* cache, uint64_t index) {
+    while (file_cache_pages >= file_cache_max_pages)
+        evict_page();
+
+    struct file_cache_page* page = get_mem_obj_from_mgr_enlarge(file_cache_mgr,
+                                                                FILE_CACHE_MGR_ALLOC);
+    if (!page)
+        return NULL;
+
+    page->cache = cache;
+    page->index = index;
+    page->dirty = false;
+    avl_tree_insert(&cache->pages, &page->node);
+    INIT_LIST_HEAD(page, lru);
+    LISTP_ADD(page, &file_cache_lru, lru);
+    file_cache_pages++;
+    return page;
+}
+
+static void drop_pages(struct shim_file_cache* cache) {
+    struct avl_tree_node* node;
+    while ((node = avl_tree_first(&cache->pages)))
+        free_page(container_of(node, struct file_cache_page, node));
+}
+
+/* Reads `cnt` missing pages starting at `index` from the host with one read. Parts beyond the end
+ * of the host file are zeroed. */
+static int fill_pages(struct shim_file_cache* cache, PAL_HANDLE pal_handle, uint64_t index,
+                      size_t cnt, struct file_cache_page** pages) {
+    assert(cnt && cnt <= FILE_CACHE_BATCH_PAGES);
+
+    PAL_NUM bytes = DkStreamRead(pal_handle, index * FILE_CACHE_PAGE_SIZE,
+                                 cnt * FILE_CACHE_PAGE_SIZE, file_cache_buf, NULL, 0);
+    if (bytes == PAL_STREAM_ERROR) {
+        if (PAL_NATIVE_ERRNO != PAL_ERROR_ENDOFSTREAM)
+            return -PAL_ERRNO;
+        bytes = 0;
+    }
+    memset(file_cache_buf + bytes, 0, cnt * FILE_CACHE_PAGE_SIZE - bytes);
+
+    for (size_t i = 0; i < cnt; i++) {
+        struct file_cache_page* page = alloc_page(cache, index + i);
+        if (!page)
+            return -ENOMEM;
+        memcpy(page->data, file_cache_buf + i * FILE_CACHE_PAGE_SIZE, FILE_CACHE_PAGE_SIZE);
+        if (pages)
+            pages[i] = page;
+    }
+    cache->ra_next = index + cnt;
+    return 0;
+}
+
+/* Makes sure all pages in [first, last] are cached; on a sequential miss also reads ahead. The pages
+ * of the range are the most recently used ones afterwards. */
+static int fill_range(struct shim_file_cache* cache, PAL_HANDLE pal_handle, uint64_t first,
+                      uint64_t last) {
+    uint64_t eof_index = (cache->size + FILE_CACHE_PAGE_SIZE - 1) / FILE_CACHE_PAGE_SIZE;
+
+    /* filling the missing pages must not evict the cached ones */
+    for (uint64_t index = first; index <= last; index++) {
+        struct file_cache_page* page = find_page(cache, index);
+        if (page)
+            touch_page(page);
+    }
+
+    for (uint64_t index = first; index <= last; index++) {
+        if (find_page(cache, index))
+            continue;
+
+        uint64_t end = index + 1;
+        while (end <= last && !find_page(cache, end))
+            end++;
+
+        if (index == cache->ra_next) {
+            uint64_t ra_end = MIN(end + FILE_CACHE_READAHEAD, eof_index);
+            while (end < ra_end && !find_page(cache, end))
+                end++;
+        }
+
+        int ret = fill_pages(cache, pal_handle, index, end - index, NULL);
+        if (ret < 0)
+            return ret;
+        index = end - 1;
+    }
+    return 0;
+}
+
+static struct shim_file_cache* get_cache(struct shim_handle* hdl) {
+    assert(hdl->info.file.cached && FILE_HANDLE_DATA(hdl)->cache);
+    return FILE_HANDLE_DATA(hdl)->cache;
+}
+
+void file_cache_open(struct shim_handle* hdl, bool readable) {
+    struct shim_file_handle* file = &hdl->info.file;
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+
+    if (!file_cache_max_pages || file->cached || !hdl->dentry || data->type != FILE_REGULAR)
+        return;
+
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = data->cache;
+    if (!cache) {
+        /* the host file may have been changed by other processes since it was last cached here */
+        PAL_STREAM_ATTR attr;
+        if (!DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr))
+            goto out;
+
+        cache = calloc(1, sizeof(*cache));
+        if (!cache)
+            goto out;
+
+        cache->pages = (struct avl_tree){ .root = NULL, .cmp = page_cmp };
+        cache->size  = attr.pending_size;
+        data->cache  = cache;
+        atomic_set(&data->size, cache->size);
+        file->size = cache->size;
+    }
+
+    if (!readable && !cache->direct) {
+        /* a write-only handle cannot fill partially written pages, so the file will be written
+         * directly by this handle; write back and drop what is cached to stay coherent */
+        if (write_back_cache(cache) < 0)
+            debug("file cache: write-back failed, dropping dirty pages\n");
+        drop_pages(cache);
+        cache->direct = true;
+    }
+
+    cache->open_cnt++;
+    file->cached = true;
+out:
+    unlock(&file_cache_lock);
+}
+
+int file_cache_close(struct shim_handle* hdl) {
+    struct shim_file_handle* file = &hdl->info.file;
+    if (!file->cached)
+        return 0;
+
+    int ret = 0;
+    lock(&file_cache_lock);
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+    struct shim_file_cache* cache = get_cache(hdl);
+
+    if (cache->writer == hdl) {
+        ret = write_back_cache(cache);
+        if (ret < 0) {
+            /* nothing is left to write the dirty pages with */
+            debug("file cache: write-back on close failed (%d), dropping dirty pages\n", ret);
+            drop_pages(cache);
+        }
+        cache->writer = NULL;
+    }
+
+    if (!--cache->open_cnt) {
+        assert(!cache->writer);
+        drop_pages(cache);
+        data->cache = NULL;
+        free(cache);
+    }
+    file->cached = false;
+    unlock(&file_cache_lock);
+    return ret;
+}
+
+static ssize_t direct_read(PAL_HANDLE pal_handle, void* buf, size_t count, off_t offset) {
+    PAL_NUM bytes = DkStreamRead(pal_handle, offset, count, buf, NULL, 0);
+    if (bytes == PAL_STREAM_ERROR)
+        return PAL_NATIVE_ERRNO == PAL_ERROR_ENDOFSTREAM ? 0 : -PAL_ERRNO;
+    return bytes;
+}
+
+static ssize_t direct_write(PAL_HANDLE pal_handle, const void* buf, size_t count, off_t offset) {
+    PAL_NUM bytes = DkStreamWrite(pal_handle, offset, count, (void*)buf, NULL);
+    if (bytes == PAL_STREAM_ERROR)
+        return PAL_NATIVE_ERRNO == PAL_ERROR_ENDOFSTREAM ? 0 : -PAL_ERRNO;
+    return bytes;
+}
+
+ssize_t file_cache_read(struct shim_handle* hdl, void* buf, size_t count, off_t offset) {
+    ssize_t ret;
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = get_cache(hdl);
+
+    if (cache->direct) {
+        unlock(&file_cache_lock);
+        return direct_read(hdl->pal_handle, buf, count, offset);
+    }
+
+    uint64_t first = offset / FILE_CACHE_PAGE_SIZE;
+    uint64_t last;
+
+    if (count >= FILE_CACHE_DIRECT_SIZE) {
+        /* the host file is up to date in the range after the write-back */
+        last = (offset + count - 1) / FILE_CACHE_PAGE_SIZE;
+        if (cache->writer && (ret = write_back_range(cache, first, last)) < 0)
+            goto out;
+        unlock(&file_cache_lock);
+        return direct_read(hdl->pal_handle, buf, count, offset);
+    }
+
+    if (offset >= cache->size) {
+        ret = 0;
+        goto out;
+    }
+    count = MIN(count, (size_t)(cache->size - offset));
+    last  = (offset + count - 1) / FILE_CACHE_PAGE_SIZE;
+    if ((ret = fill_range(cache, hdl->pal_handle, first, last)) < 0)
+        goto out;
+
+    size_t done = 0;
+    for (uint64_t index = first; index <= last; index++) {
+        struct file_cache_page* page = find_page(cache, index);
+        /* cannot happen with FILE_CACHE_MIN_PAGES, but never rely on the eviction order */
+        if (!page && (ret = fill_pages(cache, hdl->pal_handle, index, 1, &page)) < 0)
+            break;
+        size_t page_off = (offset + done) % FILE_CACHE_PAGE_SIZE;
+        size_t len = MIN(count - done, FILE_CACHE_PAGE_SIZE - page_off);
+        memcpy((char*)buf + done, page->data + page_off, len);
+        done += len;
+    }
+    if (done)
+        ret = done;
+out:
+    unlock(&file_cache_lock);
+    return ret;
+}
+
+ssize_t file_cache_write(struct shim_handle* hdl, const void* buf, size_t count, off_t offset) {
+    ssize_t ret = 0;
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = get_cache(hdl);
+
+    if (cache->direct) {
+        unlock(&file_cache_lock);
+        return direct_write(hdl->pal_handle, buf, count, offset);
+    }
+
+    uint64_t first = offset / FILE_CACHE_PAGE_SIZE;
+    uint64_t last  = (offset + count - 1) / FILE_CACHE_PAGE_SIZE;
+
+    if (count >= FILE_CACHE_DIRECT_SIZE) {
+        /* while the lock is dropped, an older dirty page in the range could be evicted and
+         * written back over the new data, so write them back first */
+        if (cache->writer && (ret = write_back_range(cache, first, last)) < 0)
+            goto out;
+
+        unlock(&file_cache_lock);
+        ret = direct_write(hdl->pal_handle, buf, count, offset);
+        lock(&file_cache_lock);
+        if (ret <= 0)
+            goto out;
+
+        /* keep the cached pages it overwrote up to date (also the ones filled meanwhile) */
+        uint64_t index = first;
+        struct avl_tree_node* node = avl_tree_lower_bound_fn(&cache->pages, &index,
+                                                             page_index_cmp);
+        struct file_cache_page* page = node ? container_of(node, struct file_cache_page, node)
+                                            : NULL;
+        for (; page && page->index <= last; page = next_page(page)) {
+            off_t start = MAX((off_t)(page->index * FILE_CACHE_PAGE_SIZE), offset);
+            off_t end   = MIN((off_t)((page->index + 1) * FILE_CACHE_PAGE_SIZE), offset + ret);
+            if (start < end)
+                memcpy(page->data + start % FILE_CACHE_PAGE_SIZE, (const char*)buf + (start - offset),
+                       end - start);
+        }
+        if (offset + ret > cache->size)
+            cache->size = offset + ret;
+        goto out;
+    }
+
+    size_t done = 0;
+    for (uint64_t index = first; index <= last; index++) {
+        size_t page_off = (offset + done) % FILE_CACHE_PAGE_SIZE;
+        size_t len = MIN(count - done, FILE_CACHE_PAGE_SIZE - page_off);
+
+        struct file_cache_page* page = find_page(cache, index);
+        if (!page) {
+            off_t start = index * FILE_CACHE_PAGE_SIZE;
+            if (len == FILE_CACHE_PAGE_SIZE || start >= cache->size) {
+                /* nothing to read from the host */
+                if (!(page = alloc_page(cache, index))) {
+                    ret = -ENOMEM;
+                    break;
+                }
+                memset(page->data, 0, FILE_CACHE_PAGE_SIZE);
+            } else if ((ret = fill_pages(cache, hdl->pal_handle, index, 1, &page)) < 0) {
+                break;
+            }
+        }
+
+        memcpy(page->data + page_off, (const char*)buf + done, len);
+        page->dirty = true;
+        touch_page(page);
+        done += len;
+    }
+
+    if (done) {
+        if (offset + (off_t)done > cache->size)
+            cache->size = offset + done;
+        cache->writer = hdl;
+        ret = done;
+
+        if (hdl->flags & O_SYNC) {
+            int err = write_back_cache(cache);
+            if (err < 0)
+                ret = err;
+        }
+    }
+out:
+    unlock(&file_cache_lock);
+    return ret;
+}
+
+int file_cache_flush(struct shim_file_data* data) {
+    int ret = 0;
+    if (!file_cache_max_pages)
+        return 0;
+
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = data->cache;
+    if (cache && cache->writer)
+        ret = write_back_cache(cache);
+    unlock(&file_cache_lock);
+    return ret;
+}
+
+void file_cache_truncate(struct shim_file_data* data, off_t len) {
+    if (!file_cache_max_pages)
+        return;
+
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = data->cache;
+    if (!cache)
+        goto out;
+
+    uint64_t index = (len + FILE_CACHE_PAGE_SIZE - 1) / FILE_CACHE_PAGE_SIZE;
+    struct avl_tree_node* node;
+    while ((node = avl_tree_lower_bound_fn(&cache->pages, &index, page_index_cmp)))
+        free_page(container_of(node, struct file_cache_page, node));
+
+    /* bytes of a page beyond the end of file are always zero */
+    struct file_cache_page* page = len % FILE_CACHE_PAGE_SIZE ?
+                                   find_page(cache, len / FILE_CACHE_PAGE_SIZE) : NULL;
+    if (page)
+        memset(page->data + len % FILE_CACHE_PAGE_SIZE, 0,
+               FILE_CACHE_PAGE_SIZE - len % FILE_CACHE_PAGE_SIZE);
+
+    cache->size = len;
+out:
+    unlock(&file_cache_lock);
+}
+
+int file_cache_mmap(struct shim_handle* hdl, int flags) {
+    if (!hdl->info.file.cached)
+        return 0;
+
+    int ret = 0;
+    lock(&file_cache_lock);
+    struct shim_file_cache* cache = get_cache(hdl);
+
+    if (cache->writer)
+        ret = write_back_cache(cache);
+
+    if (!ret && (flags & MAP_SHARED) && !cache->direct) {
+        /* the mapping may change the file behind the cache's back */
+        drop_pages(cache);
+        cache->direct = true;
+    }
+    unlock(&file_cache_lock);
+    return ret;
+}
+
+void file_cache_sync_all(void) {
+    if (!file_cache_max_pages)
+        return;
+
+    lock(&file_cache_lock);
+    struct file_cache_page* page;
+    LISTP_FOR_EACH_ENTRY(page, &file_cache_lru, lru) {
+        if (page->dirty && write_back_run(page, NULL) < 0)
+            debug("file cache: write-back at exit failed\n");
+    }
+    unlock(&file_cache_lock);
+}
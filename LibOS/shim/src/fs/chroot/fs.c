@@ -404,13 +404,16 @@ static int __chroot_open (struct shim_dentry * dent,
         accmode = O_RDWR;
 
     PAL_HANDLE palhdl;
+    bool readable = oldmode != O_WRONLY;
 
     if (hdl && hdl->pal_handle) {
         palhdl = hdl->pal_handle;
     } else {
         palhdl = DkStreamOpen(uri, accmode, mode, creat, option);
 
-        if (!palhdl) {
+        if (palhdl) {
+            readable = accmode != O_WRONLY;
+        } else {
             if (PAL_NATIVE_ERRNO == PAL_ERROR_DENIED &&
                 accmode != oldmode)
                 palhdl = DkStreamOpen(uri, oldmode, mode, creat, option);
@@ -442,6 +445,7 @@ static int __chroot_open (struct shim_dentry * dent,
     hdl->info.file.size    = atomic_read(&data->size);
     hdl->info.file.data    = data;
 
+    file_cache_open(hdl, readable);
     return ret;
 }
 
@@ -622,15 +626,18 @@ static int chroot_hstat (struct shim_handle * hdl, struct stat * stat)
 }
 
 static int chroot_flush(struct shim_handle* hdl) {
-    int ret = DkStreamFlush(hdl->pal_handle);
+    int ret;
+    if (FILE_HANDLE_DATA(hdl) && (ret = file_cache_flush(FILE_HANDLE_DATA(hdl))) < 0)
+        return ret;
+
+    ret = DkStreamFlush(hdl->pal_handle);
     if (ret < 0)
         return ret;
     return 0;
 }
 
 static int chroot_close(struct shim_handle* hdl) {
-    __UNUSED(hdl);
-    return 0;
+    return file_cache_close(hdl);
 }
 
 static ssize_t chroot_read (struct shim_handle * hdl, void * buf, size_t count)
@@ -659,6 +666,14 @@ static ssize_t chroot_read (struct shim_handle * hdl, void * buf, size_t count)
 
     lock(&hdl->lock);
 
+    if (file->cached) {
+        ret = file_cache_read(hdl, buf, count, file->marker);
+        if (ret > 0)
+            file->marker += ret;
+        unlock(&hdl->lock);
+        goto out;
+    }
+
     PAL_NUM pal_ret = DkStreamRead(hdl->pal_handle, file->marker, count, buf, NULL, 0);
     if (pal_ret != PAL_STREAM_ERROR) {
         if (__builtin_add_overflow(pal_ret, 0, &ret))
@@ -700,6 +715,19 @@ static ssize_t chroot_write (struct shim_handle * hdl, const void * buf, size_t
 
     lock(&hdl->lock);
 
+    if (file->cached) {
+        ret = file_cache_write(hdl, buf, count, file->marker);
+        if (ret > 0) {
+            file->marker += ret;
+            if (file->marker > file->size) {
+                file->size = file->marker;
+                chroot_update_size(hdl, file, FILE_HANDLE_DATA(hdl));
+            }
+        }
+        unlock(&hdl->lock);
+        goto out;
+    }
+
     PAL_NUM pal_ret = DkStreamWrite(hdl->pal_handle, file->marker, count, (void *) buf, NULL);
     if (pal_ret != PAL_STREAM_ERROR) {
         if (__builtin_add_overflow(pal_ret, 0, &ret))
@@ -719,6 +747,65 @@ out:
     return ret;
 }
 
+static ssize_t chroot_writev(struct shim_handle* hdl, const struct iovec* vec, int vlen) {
+    ssize_t ret;
+    size_t count = 0;
+
+    for (int i = 0; i < vlen; i++)
+        if (vec[i].iov_base && __builtin_add_overflow(count, vec[i].iov_len, &count))
+            return -EINVAL;
+
+    if (count == 0)
+        return 0;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    if (!(hdl->acc_mode & MAY_WRITE))
+        return -EBADF;
+
+    struct shim_file_handle* file = &hdl->info.file;
+
+    off_t dummy_off_t;
+    if (file->type != FILE_TTY && __builtin_add_overflow(file->marker, count, &dummy_off_t))
+        return -EFBIG;
+
+    lock(&hdl->lock);
+
+    if (file->cached) {
+        /* small buffers are merged in the cache, large ones are written through it directly */
+        ret = 0;
+        for (int i = 0; i < vlen; i++) {
+            if (!vec[i].iov_base || !vec[i].iov_len)
+                continue;
+            ssize_t bytes = file_cache_write(hdl, vec[i].iov_base, vec[i].iov_len,
+                                             file->marker + ret);
+            if (bytes < 0) {
+                if (!ret)
+                    ret = bytes;
+                break;
+            }
+            ret += bytes;
+            if ((size_t)bytes < vec[i].iov_len)
+                break;
+        }
+    } else {
+        /* all buffers go to the host in one batch instead of one PAL call (and, on SGX, one
+         * enclave exit) each */
+        ret = pal_stream_writev(hdl->pal_handle, file->type != FILE_TTY, file->marker, vec, vlen);
+    }
+    if (ret > 0 && file->type != FILE_TTY) {
+        file->marker += ret;
+        if (file->marker > file->size) {
+            file->size = file->marker;
+            chroot_update_size(hdl, file, FILE_HANDLE_DATA(hdl));
+        }
+    }
+
+    unlock(&hdl->lock);
+    return ret;
+}
+
 static int chroot_mmap (struct shim_handle * hdl, void ** addr, size_t size,
                         int prot, int flags, off_t offset)
 {
@@ -735,6 +822,10 @@ static int chroot_mmap (struct shim_handle * hdl, void ** addr, size_t size,
 #endif
         return -EINVAL;
 
+    /* the mapping must see (and, if shared, not be shadowed by) the cached file contents */
+    if ((ret = file_cache_mmap(hdl, flags)) < 0)
+        return ret;
+
     void * alloc_addr =
         (void *) DkStreamMap(hdl->pal_handle, *addr, pal_prot, offset, size);
 
@@ -809,6 +900,8 @@ static int chroot_truncate (struct shim_handle * hdl, off_t len)
         atomic_set(&data->size, len);
     }
 
+    file_cache_truncate(FILE_HANDLE_DATA(hdl), len);
+
     PAL_NUM rv = DkStreamSetLength(hdl->pal_handle, len);
     if (rv) {
         // For an error, cast it back down to an int return code
@@ -900,22 +993,12 @@ static int chroot_readdir(struct shim_dentry* dent, struct shim_dirent** dirent)
             }
         }
 
-        /* TODO: If realloc gets enabled delete following and uncomment rest */
-        char* tmp = malloc(dirent_buf_size);
+        char* tmp = realloc(dirent_buf, dirent_buf_size);
         if (!tmp) {
             ret = -ENOMEM;
             goto out;
         }
-        memcpy(tmp, dirent_buf, dirent_cur_off);
-        free(dirent_buf);
         dirent_buf = tmp;
-        /*
-        dirent_buf = realloc(dirent_buf, dirent_buf_size);
-        if (!dirent_buf) {
-            ret = -ENOMEM;
-            goto out;
-        }
-        */
 
         size_t i = 0;
         while (i < bytes) {
@@ -977,8 +1060,14 @@ static int chroot_checkout (struct shim_handle * hdl)
 
     if (hdl->type == TYPE_FILE) {
         struct shim_file_data * data = FILE_HANDLE_DATA(hdl);
-        if (data)
+        if (data) {
+            /* the new process reads the file from the host */
+            if (file_cache_flush(data) < 0)
+                debug("writing back cached pages of %s failed\n", qstrgetstr(&hdl->uri));
             hdl->info.file.data = NULL;
+        }
+        /* the cache of this process stays with the original handle */
+        hdl->info.file.cached = false;
     }
 
     if (hdl->pal_handle) {
@@ -1153,6 +1242,7 @@ struct shim_fs_ops chroot_fs_ops = {
         .close       = &chroot_close,
         .read        = &chroot_read,
         .write       = &chroot_write,
+        .writev      = &chroot_writev,
         .mmap        = &chroot_mmap,
         .seek        = &chroot_seek,
         .hstat       = &chroot_hstat,
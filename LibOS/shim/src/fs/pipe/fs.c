@@ -56,6 +56,10 @@ static ssize_t pipe_write(struct shim_handle* hdl, const void* buf, size_t count
     return (ssize_t)bytes;
 }
 
+static ssize_t pipe_writev(struct shim_handle* hdl, const struct iovec* vec, int vlen) {
+    return pal_stream_writev(hdl->pal_handle, false, 0, vec, vlen);
+}
+
 static int pipe_hstat(struct shim_handle* hdl, struct stat* stat) {
     /* XXX: Is any of this right?
      * Shouldn't we be using hdl to figure something out?
@@ -153,6 +157,7 @@ static int pipe_setflags(struct shim_handle* hdl, int flags) {
 struct shim_fs_ops pipe_fs_ops = {
     .read     = &pipe_read,
     .write    = &pipe_write,
+    .writev   = &pipe_writev,
     .hstat    = &pipe_hstat,
     .checkout = &pipe_checkout,
     .poll     = &pipe_poll,
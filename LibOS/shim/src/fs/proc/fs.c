@@ -34,8 +34,11 @@ extern const struct pseudo_fs_ops fs_meminfo;
 
 extern const struct pseudo_fs_ops fs_cpuinfo;
 
+extern const struct pseudo_fs_ops fs_graphene;
+extern const struct pseudo_dir dir_graphene;
+
 static const struct pseudo_dir proc_root_dir = {
-    .size = 5,
+    .size = 6,
     .ent  = {
               { .name   = "self",
                 .fs_ops = &fs_thread,
@@ -52,6 +55,9 @@ static const struct pseudo_dir proc_root_dir = {
               { .name   = "cpuinfo",
                 .fs_ops = &fs_cpuinfo,
                 .type   = LINUX_DT_REG },
+              { .name   = "graphene",
+                .fs_ops = &fs_graphene,
+                .dir    = &dir_graphene },
             }
 };
 
@@ -0,0 +1,216 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*!
+ * \file
+ *
+ * This file contains the implementation of `/proc/graphene`, statistics of Graphene itself.
+ */
+
+#include "shim_clock.h"
+#include "shim_fs.h"
+#include "shim_internal.h"
+#include "shim_unistd.h"
+
+static int proc_graphene_set_str(struct shim_handle* hdl, int flags, char* str, size_t len) {
+    struct shim_str_data* data = calloc(1, sizeof(struct shim_str_data));
+    if (!data) {
+        free(str);
+        return -ENOMEM;
+    }
+
+    data->str          = str;
+    data->len          = len;
+    hdl->type          = TYPE_STR;
+    hdl->flags         = flags & ~O_RDONLY;
+    hdl->acc_mode      = MAY_READ;
+    hdl->info.str.data = data;
+    return 0;
+}
+
+/* appends to `str` (of `len` bytes, `max` allocated), which is freed on failure */
+#define ADD_INFO(fmt, ...) do {                                         \
+        int ret = proc_print_to_str(&str, len, &max, fmt,               \
+                                    ##__VA_ARGS__);                     \
+        if (ret < 0) {                                                  \
+            free(str);                                                  \
+            return ret;                                                 \
+        }                                                               \
+        len += ret;                                                     \
+    } while (0)
+
+/* One line per class of locks (see LOCK_PROFILE in shim_internal.h), times in microseconds. */
+static int proc_lock_stats_open(struct shim_handle* hdl, const char* name, int flags) {
+    __UNUSED(name);
+
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    size_t len = 0;
+    size_t max = 128;
+    char* str = malloc(max);
+    if (!str)
+        return -ENOMEM;
+
+#ifdef LOCK_PROFILE
+    size_t count;
+    const struct shim_lock_class* classes = lock_profile_classes(&count);
+
+    ADD_INFO("acquired contended wait max_wait hold max_hold lock (max_wait_at)\n");
+    for (size_t i = 0; i < count; i++) {
+        const struct shim_lock_class* c = &classes[i];
+        ADD_INFO("%lu %lu %lu %lu %lu %lu %s (%s:%d)\n", c->acquired, c->contended,
+                 clock_tsc_to_ns(c->wait_cycles) / 1000,
+                 clock_tsc_to_ns(c->max_wait_cycles) / 1000,
+                 clock_tsc_to_ns(c->hold_cycles) / 1000,
+                 clock_tsc_to_ns(c->max_hold_cycles) / 1000, c->name,
+                 c->max_wait_file ? : "-", c->max_wait_line);
+    }
+#else
+    ADD_INFO("lock profiling is disabled (build LibOS with LOCK_PROFILE=1)\n");
+#endif
+
+    return proc_graphene_set_str(hdl, flags, str, len);
+}
+
+struct syscall_stats_buf {
+    char* str;
+    size_t len;
+    size_t max;
+};
+
+static int print_thread_syscall_stats(IDTYPE tid, const struct shim_syscall_stat* stats,
+                                      void* arg) {
+    struct syscall_stats_buf* buf = arg;
+    uint64_t calls = 0, errors = 0, libos_cycles = 0, pal_cycles = 0;
+
+    for (int i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        calls        += stats[i].calls;
+        errors       += stats[i].errors;
+        libos_cycles += stats[i].libos_cycles;
+        pal_cycles   += stats[i].pal_cycles;
+    }
+
+    int ret = proc_print_to_str(&buf->str, buf->len, &buf->max, "%u %lu %lu %lu %lu\n", tid,
+                                calls, errors, clock_tsc_to_ns(libos_cycles) / 1000,
+                                clock_tsc_to_ns(pal_cycles) / 1000);
+    if (ret < 0)
+        return ret;
+    buf->len += ret;
+    return 0;
+}
+
+/*
+ * One line per syscall number which was called, with the sums of the counters of all threads (see
+ * shim_syscall_stats.c), then one line per running thread. Times are in microseconds; `hist` is
+ * the number of calls by latency, in the buckets listed in the header.
+ */
+static int proc_syscall_stats_open(struct shim_handle* hdl, const char* name, int flags) {
+    __UNUSED(name);
+
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    size_t len = 0;
+    size_t max = 128;
+    char* str = malloc(max);
+    if (!str)
+        return -ENOMEM;
+
+    if (!g_syscall_stats_enabled) {
+        ADD_INFO("syscall statistics are disabled (set sys.syscall_stats = 1 in the manifest)\n");
+        return proc_graphene_set_str(hdl, flags, str, len);
+    }
+
+    struct shim_syscall_stat* total = calloc(LIBOS_SYSCALL_BOUND, sizeof(*total));
+    if (!total) {
+        free(str);
+        return -ENOMEM;
+    }
+    syscall_stats_sum(total);
+
+    int ret;
+#define ADD_SYSCALL_INFO(fmt, ...) do {                                 \
+        ret = proc_print_to_str(&str, len, &max, fmt, ##__VA_ARGS__);   \
+        if (ret < 0)                                                    \
+            goto out;                                                   \
+        len += ret;                                                     \
+    } while (0)
+
+    if (!g_tsc_readable)
+        ADD_SYSCALL_INFO("latencies are not measured (the TSC cannot be read)\n");
+    ADD_SYSCALL_INFO("sysno calls errors libos pal hist(<1");
+    for (int j = 1; j < SYSCALL_STATS_HIST_SIZE - 1; j++)
+        ADD_SYSCALL_INFO(" <%lu", 1UL << j);
+    ADD_SYSCALL_INFO(" >=%lu)\n", 1UL << (SYSCALL_STATS_HIST_SIZE - 2));
+
+    for (int i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        const struct shim_syscall_stat* s = &total[i];
+        if (!s->calls)
+            continue;
+        ADD_SYSCALL_INFO("%d %lu %lu %lu %lu", i, s->calls, s->errors,
+                         clock_tsc_to_ns(s->libos_cycles) / 1000,
+                         clock_tsc_to_ns(s->pal_cycles) / 1000);
+        for (int j = 0; j < SYSCALL_STATS_HIST_SIZE; j++)
+            ADD_SYSCALL_INFO(" %u", s->hist[j]);
+        ADD_SYSCALL_INFO("\n");
+    }
+
+    ADD_SYSCALL_INFO("\ntid calls errors libos pal\n");
+#undef ADD_SYSCALL_INFO
+
+    struct syscall_stats_buf buf = {.str = str, .len = len, .max = max};
+    ret = syscall_stats_walk_threads(&print_thread_syscall_stats, &buf);
+    str = buf.str;
+    len = buf.len;
+out:
+    free(total);
+    if (ret < 0) {
+        free(str);
+        return ret;
+    }
+    return proc_graphene_set_str(hdl, flags, str, len);
+}
+
+static const struct pseudo_fs_ops fs_lock_stats = {
+    .mode = &proc_info_mode,
+    .stat = &proc_info_stat,
+    .open = &proc_lock_stats_open,
+};
+
+static const struct pseudo_fs_ops fs_syscall_stats = {
+    .mode = &proc_info_mode,
+    .stat = &proc_info_stat,
+    .open = &proc_syscall_stats_open,
+};
+
+const struct pseudo_fs_ops fs_graphene = {
+    .open = &pseudo_dir_open,
+    .mode = &pseudo_dir_mode,
+    .stat = &pseudo_dir_stat,
+};
+
+const struct pseudo_dir dir_graphene = {
+    .size = 2,
+    .ent  = {
+              { .name   = "lock_stats",
+                .fs_ops = &fs_lock_stats,
+                .type   = LINUX_DT_REG },
+              { .name   = "syscall_stats",
+                .fs_ops = &fs_syscall_stats,
+                .type   = LINUX_DT_REG },
+            }
+};
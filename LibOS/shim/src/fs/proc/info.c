@@ -22,13 +22,13 @@
 
 #include "shim_fs.h"
 
-static int proc_info_mode(const char* name, mode_t* mode) {
+int proc_info_mode(const char* name, mode_t* mode) {
     __UNUSED(name);
     *mode = FILE_R_MODE | S_IFREG;
     return 0;
 }
 
-static int proc_info_stat(const char* name, struct stat* buf) {
+int proc_info_stat(const char* name, struct stat* buf) {
     __UNUSED(name);
     memset(buf, 0, sizeof(struct stat));
     buf->st_dev  = 1;    /* dummy ID of device containing file */
@@ -92,21 +92,7 @@ retry:
     return 0;
 }
 
-// FIXME: remove once global realloc is enabled
-static void* realloc(void* ptr, size_t old_size, size_t new_size) {
-    void* tmp = malloc(new_size);
-    if (!tmp) {
-        return NULL;
-    }
-
-    memcpy(tmp, ptr, old_size);
-
-    free(ptr);
-
-    return tmp;
-}
-
-static int print_to_str(char** str, size_t off, size_t* size, const char* fmt, ...) {
+int proc_print_to_str(char** str, size_t off, size_t* size, const char* fmt, ...) {
     int ret;
     va_list ap;
 
@@ -120,7 +106,7 @@ retry:
     }
 
     if ((size_t)ret >= *size - off) {
-        char* tmp = realloc(*str, *size, *size + 128);
+        char* tmp = realloc(*str, *size + 128);
         if (!tmp) {
             return -ENOMEM;
         }
@@ -147,7 +133,8 @@ static int proc_cpuinfo_open(struct shim_handle* hdl, const char* name, int flag
     }
 
 #define ADD_INFO(fmt, ...) do {                                         \
-        int ret = print_to_str(&str, len, &max, fmt, ##__VA_ARGS__);    \
+        int ret = proc_print_to_str(&str, len, &max, fmt,               \
+                                    ##__VA_ARGS__);                     \
         if (ret < 0) {                                                  \
             free(str);                                                  \
             return ret;                                                 \
@@ -45,10 +45,24 @@ static MEM_MGR dentry_mgr = NULL;
 
 struct shim_dentry* dentry_root = NULL;
 
+/* All dentries with a parent, hashed by the parent and the name. Unlike `children` lists of
+ * directories, lookups here do not get slower with the size of the directory (think of
+ * site-packages or node_modules). Protected by dcache_lock. */
+static LISTP_TYPE(shim_dentry) dcache_htable[DCACHE_HASH_SIZE];
+
 static inline HASHTYPE hash_dentry(struct shim_dentry* start, const char* path, int len) {
     return rehash_path(start ? start->rel_path.hash : 0, path, len);
 }
 
+static inline LISTP_TYPE(shim_dentry)* dcache_bucket(struct shim_dentry* parent, const char* name,
+                                                     size_t namelen) {
+    return &dcache_htable[DCACHE_HASH(rehash_name((HASHTYPE)(uintptr_t)parent, name, namelen))];
+}
+
+static inline LISTP_TYPE(shim_dentry)* dentry_bucket(struct shim_dentry* dent) {
+    return dcache_bucket(dent->parent, qstrgetstr(&dent->name), dent->name.len);
+}
+
 static struct shim_dentry* alloc_dentry(void) {
     struct shim_dentry* dent =
         get_mem_obj_from_mgr_enlarge(dentry_mgr, size_align_up(DCACHE_MGR_ALLOC));
@@ -199,6 +213,7 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
         LISTP_ADD_TAIL(dent, &parent->children, siblings);
         dent->parent = parent;
         parent->nchildren++;
+        LISTP_ADD(dent, dentry_bucket(dent), hlist);
 
         if (!qstrempty(&parent->rel_path)) {
             const char* strs[] = {qstrgetstr(&parent->rel_path), "/", name};
@@ -229,14 +244,6 @@ struct shim_dentry* __lookup_dcache(struct shim_dentry* start, const char* name,
                                     HASHTYPE* hashptr) {
     assert(locked(&dcache_lock));
 
-    /* In this implementation, we just look at the children
-     * under the parent and see if there are matches.  It so,
-     * return it; if not, don't.
-     *
-     * To minimize disruption (and possibly for future optimization)
-     * we are keeping hashes, so let's start with that for a marginally
-     * faster comparison
-     */
     HASHTYPE hash = hash_dentry(start, name, namelen);
     struct shim_dentry *dent, *found = NULL;
 
@@ -254,29 +261,17 @@ struct shim_dentry* __lookup_dcache(struct shim_dentry* start, const char* name,
         goto out;
     }
 
-    LISTP_FOR_EACH_ENTRY(dent, &start->children, siblings) {
-        /* DEP 6/20/XX: The old code skipped mountpoints; I don't see any good
-         * reason for mount point lookup to fail, at least in this code.
-         * Keeping a note just in case.  That is why you always leave a note.
-         */
-        // if (dent->state & DENTRY_MOUNTPOINT)
-        //     continue;
+    /* Children of a directory have unique names, so the parent and the name identify a dentry.
+     * Negative dentries are found here as well, and spare a lookup in the underlying FS. */
+    const char* filename = get_file_name(name, namelen);
+    int fname_len        = name + namelen - filename;
 
+    LISTP_FOR_EACH_ENTRY(dent, dcache_bucket(start, filename, fname_len), hlist) {
         // Check for memory corruption
         assert((dent->state & DENTRY_INVALID_FLAGS) == 0);
 
-        /* Compare the hash first */
-        if (dent->rel_path.hash != hash)
-            continue;
-
-        /* I think comparing the relative path is adequate; with a global
-         * hash table, a full path comparison may be needed, but I think
-         * we can assume a parent has children with unique names */
-        const char* filename = get_file_name(name, namelen);
-        const char* dname    = dentry_get_name(dent);
-        int dname_len        = strlen(dname);
-        int fname_len        = name + namelen - filename;
-        if (dname_len != fname_len || memcmp(dname, filename, fname_len))
+        if (dent->parent != start || dent->name.len != (size_t)fname_len ||
+                memcmp(qstrgetstr(&dent->name), filename, fname_len))
             continue;
 
         /* If we get this far, we have a match */
@@ -311,6 +306,7 @@ int __del_dentry_tree(struct shim_dentry* root) {
         if (!LISTP_EMPTY(&cursor->children))
             __del_dentry_tree(cursor);
 
+        LISTP_DEL_INIT(cursor, dentry_bucket(cursor), hlist);
         LISTP_DEL_INIT(cursor, &root->children, siblings);
         cursor->parent = NULL;
         root->nchildren--;
@@ -403,6 +399,7 @@ BEGIN_RS_FUNC(dentry) {
         get_dentry(dent->parent);
         get_dentry(dent);
         LISTP_ADD_TAIL(dent, &dent->parent->children, siblings);
+        LISTP_ADD(dent, dentry_bucket(dent), hlist);
     }
 
     DEBUG_RS("hash=%08lx,path=%s,fs=%s", dent->rel_path.hash, dentry_get_path(dent, true, NULL),
@@ -82,14 +82,14 @@ static MEM_MGR mount_mgr = NULL;
 DEFINE_LISTP(shim_mount);
 /* Links to mount->list */
 static LISTP_TYPE(shim_mount) mount_list;
-static struct shim_lock mount_list_lock;
+static struct shim_rwlock mount_list_lock;
 
 int init_fs(void) {
     mount_mgr = create_mem_mgr(init_align_up(MOUNT_MGR_ALLOC));
     if (!mount_mgr)
         return -ENOMEM;
 
-    if (!create_lock(&mount_mgr_lock) || !create_lock(&mount_list_lock)) {
+    if (!create_lock(&mount_mgr_lock) || !create_rwlock(&mount_list_lock)) {
         destroy_mem_mgr(mount_mgr);
         return -ENOMEM;
     }
@@ -326,10 +326,10 @@ int __mount_fs(struct shim_mount* mount, struct shim_dentry* dent) {
     if ((ret = __del_dentry_tree(dent)) < 0)
         return ret;
 
-    lock(&mount_list_lock);
+    rwlock_write_lock(&mount_list_lock);
     get_mount(mount);
     LISTP_ADD_TAIL(mount, &mount_list, list);
-    unlock(&mount_list_lock);
+    rwlock_write_unlock(&mount_list_lock);
 
     do {
         struct shim_dentry* parent = dent->parent;
@@ -512,7 +512,7 @@ int walk_mounts(int (*walk)(struct shim_mount* mount, void* arg), void* arg) {
     int ret = 0;
     int nsrched = 0;
 
-    lock(&mount_list_lock);
+    rwlock_read_lock(&mount_list_lock);
 
     LISTP_FOR_EACH_ENTRY_SAFE(mount, n, &mount_list, list) {
         if ((ret = (*walk)(mount, arg)) < 0)
@@ -522,7 +522,7 @@ int walk_mounts(int (*walk)(struct shim_mount* mount, void* arg), void* arg) {
             nsrched++;
     }
 
-    unlock(&mount_list_lock);
+    rwlock_read_unlock(&mount_list_lock);
     return ret < 0 ? ret : (nsrched ? 0 : -ESRCH);
 }
 
@@ -531,7 +531,7 @@ struct shim_mount* find_mount_from_uri(const char* uri) {
     struct shim_mount* found = NULL;
     size_t longest_path = 0;
 
-    lock(&mount_list_lock);
+    rwlock_read_lock(&mount_list_lock);
     LISTP_FOR_EACH_ENTRY(mount, &mount_list, list) {
         if (qstrempty(&mount->uri))
             continue;
@@ -547,7 +547,7 @@ struct shim_mount* find_mount_from_uri(const char* uri) {
     if (found)
         get_mount(found);
 
-    unlock(&mount_list_lock);
+    rwlock_read_unlock(&mount_list_lock);
     return found;
 }
 
@@ -645,11 +645,11 @@ BEGIN_CP_FUNC(all_mounts) {
     __UNUSED(size);
     __UNUSED(objp);
     struct shim_mount* mount;
-    lock(&mount_list_lock);
+    rwlock_read_lock(&mount_list_lock);
     LISTP_FOR_EACH_ENTRY(mount, &mount_list, list) {
         DO_CP(mount, mount, NULL);
     }
-    unlock(&mount_list_lock);
+    rwlock_read_unlock(&mount_list_lock);
 
     /* add an empty entry to mark as migrated */
     ADD_CP_FUNC_ENTRY(0UL);
@@ -672,3 +672,49 @@ const char* get_file_name(const char* path, size_t len) {
         c--;
     return *c == '/' ? c + 1 : c;
 }
+
+ssize_t pal_stream_writev(PAL_HANDLE pal_hdl, bool seekable, off_t offset, const struct iovec* vec,
+                          int vlen) {
+    PAL_STREAM_OP ops[STREAM_OPS_BATCH];
+    ssize_t bytes = 0;
+    int i = 0;
+
+    while (i < vlen) {
+        size_t cnt = 0;
+        off_t op_offset = offset + (seekable ? bytes : 0);
+
+        /* each write is linked to the previous one: after a short write, the rest would create a
+         * hole in the output */
+        for (; i < vlen && cnt < ARRAY_SIZE(ops); i++) {
+            if (!vec[i].iov_base || !vec[i].iov_len)
+                continue;
+            ops[cnt] = (PAL_STREAM_OP){
+                .op     = PAL_STREAM_OP_WRITE,
+                .flags  = cnt ? PAL_STREAM_OP_LINK : 0,
+                .handle = pal_hdl,
+                .offset = op_offset,
+                .count  = vec[i].iov_len,
+                .buffer = vec[i].iov_base,
+            };
+            if (seekable)
+                op_offset += vec[i].iov_len;
+            cnt++;
+        }
+
+        if (!cnt)
+            break;
+
+        if (!DkStreamsSubmit(ops, cnt))
+            return bytes ?: -PAL_ERRNO;
+
+        for (size_t j = 0; j < cnt; j++) {
+            if (ops[j].result == PAL_STREAM_ERROR)
+                return bytes ?: -convert_pal_errno(ops[j].error);
+            bytes += ops[j].result;
+            if (ops[j].result < ops[j].count)
+                return bytes;
+        }
+    }
+
+    return bytes;
+}
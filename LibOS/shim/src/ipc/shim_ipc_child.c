@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <pal.h>
 #include <pal_error.h>
+#include <shim_checkpoint.h>
 #include <shim_handle.h>
 #include <shim_internal.h>
 #include <shim_ipc.h>
@@ -123,6 +124,9 @@ void ipc_port_with_child_fini(struct shim_ipc_port* port, IDTYPE vmid, unsigned
         "Child process %u got disconnected: assuming that child exited and "
         "forcing %d of its threads to exit\n",
         vmid & 0xFFFF, exited_threads_cnt);
+
+    /* the child won't fetch our memory anymore */
+    lazy_mem_release(vmid);
 }
 
 /* The exiting thread of this process calls this function to broadcast
@@ -212,3 +216,78 @@ int ipc_cld_exit_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port)
 
     return ret;
 }
+
+static struct shim_ipc_port* get_parent_port(IDTYPE* dest) {
+    struct shim_ipc_port* port = NULL;
+
+    lock(&cur_process.lock);
+    if (cur_process.parent && cur_process.parent->port) {
+        port  = cur_process.parent->port;
+        *dest = cur_process.parent->vmid;
+        get_ipc_port(port);
+    }
+    unlock(&cur_process.lock);
+    return port;
+}
+
+/* A child process sends this request when it touches memory of the parent that was not migrated
+ * with the checkpoint (see shim_lazy_mem.c). The parent answers once the memory [addr, addr+size)
+ * is in the memory shared between them, from where the child maps it. */
+int ipc_cld_getmem_send(void* addr, size_t size) {
+    IDTYPE dest;
+    struct shim_ipc_port* port = get_parent_port(&dest);
+    if (!port)
+        return -ESRCH;
+
+    size_t total_msg_size           = get_ipc_msg_duplex_size(sizeof(struct shim_ipc_cld_getmem));
+    struct shim_ipc_msg_duplex* msg = __alloca(total_msg_size);
+    init_ipc_msg_duplex(msg, IPC_CLD_GETMEM, total_msg_size, dest);
+
+    struct shim_ipc_cld_getmem* msgin = (struct shim_ipc_cld_getmem*)&msg->msg.msg;
+    msgin->addr = addr;
+    msgin->size = size;
+
+    debug("IPC send to %u: IPC_CLD_GETMEM(%p, %lu)\n", dest & 0xFFFF, addr, size);
+
+    int ret = send_ipc_message_duplex(msg, port, NULL, NULL);
+    put_ipc_port(port);
+    return ret;
+}
+
+int ipc_cld_getmem_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port) {
+    __UNUSED(port);
+    struct shim_ipc_cld_getmem* msgin = (struct shim_ipc_cld_getmem*)&msg->msg;
+
+    debug("IPC callback from %u: IPC_CLD_GETMEM(%p, %lu)\n", msg->src & 0xFFFF, msgin->addr,
+          msgin->size);
+
+    lazy_mem_serve(msgin->addr, msgin->size);
+    return RESPONSE_CALLBACK;
+}
+
+/* A child process sends this notification once it fetched all memory of the parent that was not
+ * migrated with the checkpoint, so that the parent can stop tracking it. */
+int ipc_cld_memdone_send(void) {
+    IDTYPE dest;
+    struct shim_ipc_port* port = get_parent_port(&dest);
+    if (!port)
+        return -ESRCH;
+
+    size_t total_msg_size    = get_ipc_msg_size(0);
+    struct shim_ipc_msg* msg = __alloca(total_msg_size);
+    init_ipc_msg(msg, IPC_CLD_MEMDONE, total_msg_size, dest);
+
+    debug("IPC send to %u: IPC_CLD_MEMDONE\n", dest & 0xFFFF);
+
+    int ret = send_ipc_message(msg, port);
+    put_ipc_port(port);
+    return ret;
+}
+
+int ipc_cld_memdone_callback(struct shim_ipc_msg* msg, struct shim_ipc_port* port) {
+    __UNUSED(port);
+    debug("IPC callback from %u: IPC_CLD_MEMDONE\n", msg->src & 0xFFFF);
+
+    lazy_mem_release(msg->src);
+    return 0;
+}
@@ -63,6 +63,8 @@ static ipc_callback ipc_callbacks[IPC_CODE_NUM] = {
 
     /* parents and children */
     /* CLD_EXIT         */ &ipc_cld_exit_callback,
+    /* CLD_GETMEM       */ &ipc_cld_getmem_callback,
+    /* CLD_MEMDONE      */ &ipc_cld_memdone_callback,
 
     /* pid namespace */
     IPC_NS_CALLBACKS(pid)
@@ -567,13 +569,11 @@ static int receive_ipc_message(struct shim_ipc_port* port) {
             if (expected_size + readahead > bufsize) {
                 while (expected_size + readahead > bufsize)
                     bufsize *= 2;
-                void* tmp_buf = malloc(bufsize);
+                void* tmp_buf = realloc(msg, bufsize);
                 if (!tmp_buf) {
                     ret = -ENOMEM;
                     goto out;
                 }
-                memcpy(tmp_buf, msg, bytes);
-                free(msg);
                 msg = tmp_buf;
             }
 
@@ -824,6 +824,7 @@ noreturn static void shim_ipc_helper(void* dummy) {
     put_thread(self);
     debug("IPC helper thread terminated\n");
 
+    free_thread_slab_cache();
     DkThreadExit(/*clear_child_tid=*/NULL);
 
 out_err_unlock:
@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <shim_clock.h>
 #include <shim_internal.h>
 #include <shim_ipc.h>
 #include <shim_utils.h>
@@ -107,7 +108,7 @@ DEFINE_LISTP(ns_query);
 static LISTP_TYPE(ns_query) ns_queries;
 
 static inline LEASETYPE get_lease(void) {
-    return DkSystemTimeQuery() + CONCAT2(NS_CAP, LEASE_TIME);
+    return get_time_us() + CONCAT2(NS_CAP, LEASE_TIME);
 }
 
 void CONCAT3(debug_print, NS, ranges)(void) {
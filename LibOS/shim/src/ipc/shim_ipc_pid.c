@@ -249,10 +249,10 @@ int get_all_pid_status(struct pid_status** status) {
     ipc_pid_queryall_send();
 
     int bufsize                   = RANGE_SIZE;
-    struct pid_status* status_buf = malloc(bufsize);
+    struct pid_status* status_buf = malloc(sizeof(*status_buf) * bufsize);
     int nstatus                   = 0;
 
-    if (!bufsize)
+    if (!status_buf)
         return -ENOMEM;
 
     LISTP_TYPE(range)* list = &offered_ranges;
@@ -359,7 +359,7 @@ retry:
                 while (nstatus + ret > newsize)
                     newsize *= 2;
 
-                struct pid_status* new_buf = malloc(newsize);
+                struct pid_status* new_buf = realloc(status_buf, sizeof(*new_buf) * newsize);
 
                 if (!new_buf) {
                     unlock(&range_map_lock);
@@ -368,9 +368,6 @@ retry:
                     return -ENOMEM;
                 }
 
-                memcpy(new_buf, status_buf, sizeof(struct pid_status) * nstatus);
-
-                free(status_buf);
                 status_buf = new_buf;
                 bufsize    = newsize;
             }
@@ -22,6 +22,7 @@
 
 #include <list.h>
 #include <pal.h>
+#include <shim_clock.h>
 #include <shim_internal.h>
 #include <shim_thread.h>
 #include <shim_utils.h>
@@ -71,7 +72,7 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     /* if event happens on object, time must be zero */
     assert(!object || (object && !time));
 
-    uint64_t now = DkSystemTimeQuery();
+    uint64_t now = get_time_us();
     if ((int64_t)now < 0) {
         return (int64_t)now;
     }
@@ -200,9 +201,9 @@ static void shim_async_helper(void* arg) {
     ret_events[0] = 0;
 
     while (true) {
-        uint64_t now = DkSystemTimeQuery();
+        uint64_t now = get_time_us();
         if ((int64_t)now < 0) {
-            debug("DkSystemTimeQuery failed with: %ld\n", (int64_t)now);
+            debug("get_time_us failed with: %ld\n", (int64_t)now);
             goto out_err;
         }
 
@@ -290,9 +291,9 @@ static void shim_async_helper(void* arg) {
         /* wait on async IO events + install_new_event + next expiring alarm/timer */
         PAL_BOL polled = DkStreamsWaitEvents(pals_cnt + 1, pals, pal_events, ret_events, sleep_time);
 
-        now = DkSystemTimeQuery();
+        now = get_time_us();
         if ((int64_t)now < 0) {
-            debug("DkSystemTimeQuery failed with: %ld\n", (int64_t)now);
+            debug("get_time_us failed with: %ld\n", (int64_t)now);
             goto out_err;
         }
 
@@ -357,6 +358,7 @@ static void shim_async_helper(void* arg) {
     free(pals);
     free(pal_events);
 
+    free_thread_slab_cache();
     DkThreadExit(/*clear_child_tid=*/NULL);
     return;
 
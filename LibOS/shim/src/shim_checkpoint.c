@@ -50,114 +50,105 @@ static uint64_t hash64(uint64_t key) {
     return key;
 }
 
-#define CP_HASH_SIZE  256
-#define CP_HASH(addr) ((hash64((ptr_t)(addr))) & (CP_HASH_SIZE - 1))
-
-typedef uint16_t FASTHASHTYPE;
-
-#define CP_MAP_ENTRY_NUM 64
-
-DEFINE_LIST(cp_map_entry);
-struct cp_map_entry
-{
-    LIST_TYPE(cp_map_entry) hlist;
-    struct shim_cp_map_entry entry;
-};
+/*
+ * The checkpoint map records which objects were already checkpointed (and at which offset), so
+ * that objects referenced several times are checkpointed only once. It is an open-addressing hash
+ * table with linear probing, keyed by the address of the object, which is doubled when it gets
+ * more than half full. Entries move when the table grows, so pointers returned by
+ * get_cp_map_entry() are only valid until the next insertion.
+ */
+#define CP_MAP_INIT_SIZE 1024 /* must be a power of two */
 
-DEFINE_LISTP(cp_map_entry);
 struct cp_map {
-    struct cp_map_buffer {
-        struct cp_map_buffer * next;
-        int num, cnt;
-        struct cp_map_entry entries[0];
-    } * buffers;
-
-    struct hash_map {
-        LISTP_TYPE(cp_map_entry) head[CP_HASH_SIZE];
-    } map;
+    size_t size;  /* number of slots */
+    size_t cnt;   /* number of used slots */
+    struct shim_cp_map_entry* entries;
 };
 
 void * create_cp_map (void)
 {
-    void * data = malloc(sizeof(struct cp_map) + sizeof(struct cp_map_buffer) +
-                         sizeof(struct cp_map_entry) * CP_MAP_ENTRY_NUM);
-
-    if (!data)
+    struct cp_map * map = malloc(sizeof(*map));
+    if (!map)
         return NULL;
 
-    struct cp_map * map = (struct cp_map *) data;
-    struct cp_map_buffer * buffer =
-                    (struct cp_map_buffer *) (data + sizeof(struct cp_map));
+    map->entries = malloc(sizeof(*map->entries) * CP_MAP_INIT_SIZE);
+    if (!map->entries) {
+        free(map);
+        return NULL;
+    }
 
-    memset(map, 0, sizeof(*map));
-    map->buffers = buffer;
-    buffer->next = NULL;
-    buffer->num  = CP_MAP_ENTRY_NUM;
-    buffer->cnt  = 0;
+    memset(map->entries, 0, sizeof(*map->entries) * CP_MAP_INIT_SIZE);
 
+    map->size = CP_MAP_INIT_SIZE;
+    map->cnt  = 0;
     return (void *) map;
 }
 
 void destroy_cp_map (void * map)
 {
     struct cp_map * m = (struct cp_map *) map;
-    struct cp_map_buffer * buffer = m->buffers, * next;
-
-    for (next = buffer ? buffer->next : NULL ;
-         buffer && next ;
-         buffer = next, next = next ? next->next : NULL)
-        free(buffer);
 
+    free(m->entries);
     free(m);
 }
 
+/* returns the slot of @addr, or the empty slot where it would be inserted */
 static inline
-struct cp_map_buffer * extend_cp_map (struct cp_map * map)
+struct shim_cp_map_entry * cp_map_slot (struct shim_cp_map_entry * entries,
+                                        size_t size, void * addr)
 {
-    struct cp_map_buffer * buffer =
-                malloc(sizeof(struct cp_map_buffer) +
-                       sizeof(struct cp_map_entry) * CP_MAP_ENTRY_NUM);
+    size_t i = hash64((ptr_t)addr) & (size - 1);
 
-    if (!buffer)
-        return NULL;
+    while (entries[i].addr && entries[i].addr != addr)
+        i = (i + 1) & (size - 1);
 
-    buffer->next = map->buffers;
-    map->buffers = buffer;
-    buffer->num  = CP_MAP_ENTRY_NUM;
-    buffer->cnt  = 0;
+    return &entries[i];
+}
 
-    return buffer;
+static int extend_cp_map (struct cp_map * map)
+{
+    size_t new_size = map->size * 2;
+    struct shim_cp_map_entry * new_entries =
+                malloc(sizeof(*new_entries) * new_size);
+
+    if (!new_entries)
+        return -ENOMEM;
+
+    memset(new_entries, 0, sizeof(*new_entries) * new_size);
+
+    for (size_t i = 0 ; i < map->size ; i++)
+        if (map->entries[i].addr)
+            *cp_map_slot(new_entries, new_size, map->entries[i].addr) =
+                    map->entries[i];
+
+    free(map->entries);
+    map->entries = new_entries;
+    map->size    = new_size;
+    return 0;
 }
 
 struct shim_cp_map_entry *
 get_cp_map_entry (void * map, void * addr, bool create)
 {
     struct cp_map * m = (struct cp_map *) map;
+    struct shim_cp_map_entry * e = cp_map_slot(m->entries, m->size, addr);
 
-    FASTHASHTYPE hash = CP_HASH(addr);
-    LISTP_TYPE(cp_map_entry) * head = &m->map.head[hash];
-    struct cp_map_entry * tmp;
-    struct shim_cp_map_entry * e = NULL;
-
-    LISTP_FOR_EACH_ENTRY(tmp, head, hlist)
-        if (tmp->entry.addr == addr)
-            e = &tmp->entry;
-
-    if (create && !e) {
-        struct cp_map_buffer * buffer = m->buffers;
+    if (e->addr)
+        return e;
 
-        if (buffer->cnt == buffer->num)
-            buffer = extend_cp_map(m);
-
-        struct cp_map_entry *new = &buffer->entries[buffer->cnt++];
-        INIT_LIST_HEAD(new, hlist);
-        LISTP_ADD(new, head, hlist);
+    if (!create)
+        return NULL;
 
-        new->entry.addr = addr;
-        new->entry.off  = 0;
-        e = &new->entry;
+    if ((m->cnt + 1) * 2 > m->size) {
+        /* if the table cannot grow, keep filling it while there is room */
+        if (extend_cp_map(m) < 0 && m->cnt + 1 == m->size)
+            return NULL;
+        e = cp_map_slot(m->entries, m->size, addr);
     }
 
+    m->cnt++;
+    e->addr = addr;
+    e->off  = 0;
     return e;
 }
 
@@ -322,6 +313,33 @@ BEGIN_RS_FUNC(qstr)
 }
 END_RS_FUNC(qstr)
 
+/* Submits `cnt` stream writes, resubmitting the rest after a short or interrupted write */
+static int submit_stream_writes(PAL_STREAM_OP* ops, size_t cnt) {
+    size_t done = 0;
+    while (done < cnt) {
+        if (!DkStreamsSubmit(&ops[done], cnt - done))
+            return -PAL_ERRNO;
+
+        for (; done < cnt; done++) {
+            if (ops[done].result == PAL_STREAM_ERROR) {
+                long err = convert_pal_errno(ops[done].error);
+                /* the write failed or was not even attempted; resubmit from here */
+                if (err != EINTR && err != EAGAIN && err != EWOULDBLOCK)
+                    return -err;
+                break;
+            }
+
+            if (ops[done].result < ops[done].count) {
+                /* short write; resubmit the rest */
+                ops[done].buffer += ops[done].result;
+                ops[done].count  -= ops[done].result;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
 static int send_checkpoint_on_stream (PAL_HANDLE stream,
                                       struct shim_cp_store * store)
 {
@@ -350,64 +368,133 @@ static int send_checkpoint_on_stream (PAL_HANDLE stream,
         }
     }
 
-    size_t total_bytes = store->offset;
-    size_t bytes = 0;
-
-    do {
-        PAL_NUM ret = DkStreamWrite(stream, 0, total_bytes - bytes,
-                                   (void *) store->base + bytes, NULL);
-
-        if (ret == PAL_STREAM_ERROR) {
-            if (PAL_ERRNO == EINTR || PAL_ERRNO == EAGAIN ||
-                PAL_ERRNO == EWOULDBLOCK)
-                continue;
-            return -PAL_ERRNO;
-        }
+    /* checkpoint data and all memory entries are sent with linked stream writes, in batches of
+     * STREAM_OPS_BATCH per PAL call */
+    PAL_STREAM_OP ops[STREAM_OPS_BATCH];
+    size_t ops_cnt = 0;
 
-        bytes += ret;
-    } while (bytes < total_bytes);
+    ops[ops_cnt++] = (PAL_STREAM_OP) {
+        .op = PAL_STREAM_OP_WRITE, .handle = stream,
+        .count = store->offset, .buffer = (void *) store->base,
+    };
 
-    for (int i = 0 ; i < mem_nentries ; i++) {
+    int ret = 0;
+    int i;
+    for (i = 0 ; i < mem_nentries ; i++) {
         size_t mem_size = mem_entries[i]->size;
         void * mem_addr = mem_entries[i]->addr;
 
-        if (!(mem_entries[i]->prot & PAL_PROT_READ) && mem_size > 0) {
+        if (!mem_size)
+            continue;
+
+        if (!(mem_entries[i]->prot & PAL_PROT_READ)) {
             /* Make the area readable */
-            if (!DkVirtualMemoryProtect(mem_addr, mem_size, mem_entries[i]->prot | PAL_PROT_READ))
-                return -PAL_ERRNO;
+            if (!DkVirtualMemoryProtect(mem_addr, mem_size, mem_entries[i]->prot | PAL_PROT_READ)) {
+                ret = -PAL_ERRNO;
+                break;
+            }
         }
 
-        bytes = 0;
-        int error = 0;
-        do {
-            PAL_NUM ret = DkStreamWrite(stream, 0, mem_size - bytes,
-                                       mem_addr + bytes, NULL);
-            if (ret == PAL_STREAM_ERROR) {
-                if (PAL_ERRNO == EINTR || PAL_ERRNO == EAGAIN ||
-                    PAL_ERRNO == EWOULDBLOCK)
-                    continue;
-                error = -PAL_ERRNO;
+        ops[ops_cnt++] = (PAL_STREAM_OP) {
+            .op = PAL_STREAM_OP_WRITE, .flags = PAL_STREAM_OP_LINK, .handle = stream,
+            .count = mem_size, .buffer = mem_addr,
+        };
+
+        if (ops_cnt == ARRAY_SIZE(ops)) {
+            ret = submit_stream_writes(ops, ops_cnt);
+            ops_cnt = 0;
+            if (ret < 0) {
+                /* this area was made readable too */
+                i++;
                 break;
             }
+        }
+    }
 
-            bytes += ret;
-        } while (bytes < mem_entries[i]->size);
+    if (!ret && ops_cnt)
+        ret = submit_stream_writes(ops, ops_cnt);
 
-        if (!(mem_entries[i]->prot & PAL_PROT_READ) && mem_size > 0) {
-            /* the area was made readable above; revert to original permissions */
-            if (!DkVirtualMemoryProtect(mem_addr, mem_size, mem_entries[i]->prot)) {
-                if (!error) {
-                    error = -PAL_ERRNO;
-                }
-            }
+    /* the areas were made readable above; revert to original permissions */
+    while (i--) {
+        if (!(mem_entries[i]->prot & PAL_PROT_READ) && mem_entries[i]->size > 0) {
+            if (!DkVirtualMemoryProtect(mem_entries[i]->addr, mem_entries[i]->size,
+                                        mem_entries[i]->prot) && !ret)
+                ret = -PAL_ERRNO;
         }
-        if (error < 0)
-            return error;
+    }
 
-        mem_entries[i]->size = mem_size;
+    return ret;
+}
+
+/*
+ * Pass the checkpoint data to the new process in memory shared with it, if the PAL supports this
+ * for process streams (Linux PAL), instead of pushing all of it through the stream. The data is
+ * laid out as on the stream, and the new process maps it copy-on-write at the checkpoint address.
+ *
+ * Memory that the new process fetches on demand (store->lazy_mem) is placed after the checkpoint
+ * data, and described in `lazy_hdr`.
+ *
+ * Returns -ENOSYS if the shared memory is not available; the checkpoint has to be sent on the
+ * stream then.
+ */
+static int send_checkpoint_on_shm (PAL_HANDLE stream,
+                                   struct shim_cp_store * store,
+                                   struct lazy_mem_header * lazy_hdr)
+{
+    size_t size = ALLOC_ALIGN_UP(store->offset + store->mem_size);
+    int ret = 0;
+
+    if (DkStreamSetLength(stream, size + lazy_mem_area_size(store->lazy_mem)))
+        return -ENOSYS;
+
+    void * shm = bkeep_unmapped_any(size, PROT_READ|PROT_WRITE, CP_VMA_FLAGS, 0, "cpstore");
+    if (!shm)
+        return -ENOSYS;
+
+    if (!DkStreamMap(stream, shm, PAL_PROT_READ|PAL_PROT_WRITE, 0, size)) {
+        debug("failed mapping checkpoint memory shared with the new process (%ld)\n", -PAL_ERRNO);
+        bkeep_munmap(shm, size, CP_VMA_FLAGS);
+        return -ENOSYS;
     }
 
-    return 0;
+    /* memory entries follow the checkpoint store in the order they were created */
+    void * mem_addr = (void *) store->base + store->offset + store->mem_size;
+    struct shim_mem_entry * mem_ent;
+    for (mem_ent = store->last_mem_entry ; mem_ent ; mem_ent = mem_ent->prev) {
+        mem_addr -= mem_ent->size;
+        mem_ent->data = mem_addr;
+    }
+
+    memcpy(shm, (void *) store->base, store->offset);
+
+    for (mem_ent = store->last_mem_entry ; mem_ent ; mem_ent = mem_ent->prev) {
+        if (!mem_ent->size)
+            continue;
+
+        bool unreadable = !(mem_ent->prot & PAL_PROT_READ);
+        if (unreadable &&
+            !DkVirtualMemoryProtect(mem_ent->addr, mem_ent->size, mem_ent->prot | PAL_PROT_READ)) {
+            ret = -PAL_ERRNO;
+            break;
+        }
+
+        memcpy(shm + ((void *) mem_ent->data - (void *) store->base), mem_ent->addr,
+               mem_ent->size);
+
+        if (unreadable &&
+            !DkVirtualMemoryProtect(mem_ent->addr, mem_ent->size, mem_ent->prot)) {
+            ret = -PAL_ERRNO;
+            break;
+        }
+    }
+
+    if (!ret && store->lazy_mem)
+        ret = lazy_mem_start(store->lazy_mem, stream, size, lazy_hdr);
+
+    /* the new process keeps the pages alive by mapping them */
+    bkeep_munmap(shm, size, CP_VMA_FLAGS);
+    DkStreamUnmap(shm, size);
+    return ret;
 }
 
 int restore_checkpoint (struct cp_header * cphdr, struct mem_header * memhdr,
@@ -560,6 +647,9 @@ int receive_handles_on_stream (struct palhdl_header * hdr, ptr_t base,
     return 0;
 }
 
+/* the largest checkpoint data (without memory) this process created so far */
+static size_t g_last_cp_size = 0;
+
 static void * cp_alloc (struct shim_cp_store * store, void * addr, size_t size)
 {
     // Keeping for api compatibility; not 100% sure this is needed
@@ -632,10 +722,15 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
 {
     int ret = 0;
     struct shim_process * new_process = NULL;
+    struct lazy_mem_snapshot * lazy_mem = NULL;
     struct newproc_header hdr;
     PAL_NUM bytes;
     memset(&hdr, 0, sizeof(hdr));
 
+    /* a child of a child which still fetches our memory needs all of it */
+    if (!exec && (ret = lazy_mem_fetch_all()) < 0)
+        return ret;
+
     /*
      * Create the process first. The new process requires some time
      * to initialize before starting to receive checkpoint data.
@@ -662,6 +757,12 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
     memset(&cpstore, 0, sizeof(cpstore));
     cpstore.alloc    = cp_alloc;
     cpstore.bound    = CP_INIT_VMA_SIZE;
+    /* allocate the store at once if previous checkpoints did not fit into the initial size */
+    while (cpstore.bound < g_last_cp_size + (g_last_cp_size >> 2))
+        cpstore.bound <<= 1;
+    /* only a forked child can fetch memory of this process later */
+    if (!exec)
+        cpstore.lazy_mem = lazy_mem = lazy_mem_create(proc);
 
     while (1) {
         /*
@@ -698,6 +799,13 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
 
     /* Checkpoint data created. */
     debug("checkpoint of %lu bytes created\n", checkpoint_size);
+    for (int i = 0 ; i < cpstore.nstats ; i++)
+        debug("checkpoint of %s: %lu bytes in %lu us\n", cpstore.stats[i].type,
+              cpstore.stats[i].bytes, cpstore.stats[i].time_us);
+
+    /* the next checkpoint is likely of similar size */
+    if (cpstore.offset > g_last_cp_size)
+        g_last_cp_size = cpstore.offset;
 
     hdr.checkpoint.hdr.addr = (void *) cpstore.base;
     hdr.checkpoint.hdr.size = checkpoint_size;
@@ -714,6 +822,13 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
         hdr.checkpoint.palhdl.nentries  = cpstore.palhdl_nentries;
     }
 
+    ret = send_checkpoint_on_shm(proc, &cpstore, &hdr.checkpoint.lazy_mem);
+    if (ret < 0 && (ret != -ENOSYS || lazy_mem)) {
+        debug("failed sending checkpoint in shared memory (ret = %d)\n", ret);
+        goto out;
+    }
+    hdr.checkpoint.shm = !ret;
+
     /*
      * Sending a header to the new process through the RPC stream to
      * notify the process to start receiving the checkpoint.
@@ -728,11 +843,13 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
         goto out;
     }
 
-    ret = send_checkpoint_on_stream(proc, &cpstore);
+    if (!hdr.checkpoint.shm) {
+        ret = send_checkpoint_on_stream(proc, &cpstore);
 
-    if (ret < 0) {
-        debug("failed sending checkpoint (ret = %d)\n", ret);
-        goto out;
+        if (ret < 0) {
+            debug("failed sending checkpoint (ret = %d)\n", ret);
+            goto out;
+        }
     }
 
     /*
@@ -783,6 +900,11 @@ int do_migrate_process (int (*migrate) (struct shim_cp_store *,
         snprintf(new_process_self_uri, sizeof(new_process_self_uri), URI_PREFIX_PIPE "%u", res.child_vmid);
         ipc_pid_sublease_send(res.child_vmid, thread->tid, new_process_self_uri, NULL);
 
+        if (lazy_mem) {
+            lazy_mem_attach(lazy_mem, res.child_vmid);
+            lazy_mem = NULL;
+        }
+
         /* listen on the new IPC port to the new child process */
         add_ipc_port_by_id(res.child_vmid, proc,
                 IPC_PORT_DIRCLD|IPC_PORT_LISTEN|IPC_PORT_KEEPALIVE,
@@ -800,6 +922,9 @@ out:
     if (new_process)
         free_process(new_process);
 
+    if (lazy_mem)
+        lazy_mem_destroy(lazy_mem);
+
     if (ret < 0) {
         if (proc)
             DkObjectClose(proc);
@@ -865,7 +990,15 @@ int do_migration (struct newproc_cp_header * hdr, void ** cpptr)
 
     PAL_FLG pal_prot = PAL_PROT_READ|PAL_PROT_WRITE;
 
-    PAL_PTR mapped = DkVirtualMemoryAlloc(mapaddr, mapsize, 0, pal_prot);
+    PAL_PTR mapped;
+    if (hdr->shm) {
+        /* the checkpoint data starts at offset 0 of the shared memory */
+        assert((void *) mapaddr == base);
+        mapped = DkStreamMap(PAL_CB(parent_process), mapaddr, pal_prot|PAL_PROT_WRITECOPY, 0,
+                             mapsize);
+    } else {
+        mapped = DkVirtualMemoryAlloc(mapaddr, mapsize, 0, pal_prot);
+    }
     if (!mapped)
         return -PAL_ERRNO;
 
@@ -876,23 +1009,27 @@ int do_migration (struct newproc_cp_header * hdr, void ** cpptr)
      */
     rebase = (long) ((uintptr_t) base - (uintptr_t) hdr->hdr.addr);
 
-    size_t total_bytes = 0;
-    while (total_bytes < size) {
-        PAL_NUM bytes = DkStreamRead(PAL_CB(parent_process), 0, size - total_bytes,
-                                     (void*)base + total_bytes, NULL, 0);
+    if (hdr->shm) {
+        debug("%lu bytes mapped from shared memory\n", size);
+    } else {
+        size_t total_bytes = 0;
+        while (total_bytes < size) {
+            PAL_NUM bytes = DkStreamRead(PAL_CB(parent_process), 0, size - total_bytes,
+                                         (void*)base + total_bytes, NULL, 0);
 
-        if (bytes == PAL_STREAM_ERROR) {
-            if (PAL_ERRNO == EINTR || PAL_ERRNO == EAGAIN ||
-                    PAL_ERRNO == EWOULDBLOCK)
-                continue;
-            return -PAL_ERRNO;
+            if (bytes == PAL_STREAM_ERROR) {
+                if (PAL_ERRNO == EINTR || PAL_ERRNO == EAGAIN ||
+                        PAL_ERRNO == EWOULDBLOCK)
+                    continue;
+                return -PAL_ERRNO;
+            }
+
+            total_bytes += bytes;
         }
 
-        total_bytes += bytes;
+        debug("%lu bytes read on stream\n", total_bytes);
     }
 
-    debug("%lu bytes read on stream\n", total_bytes);
-
     /* Receive socket or RPC handles from the parent process. */
     ret = receive_handles_on_stream(&hdr->palhdl, (ptr_t) base, rebase);
     if (ret < 0) {
@@ -900,6 +1037,10 @@ int do_migration (struct newproc_cp_header * hdr, void ** cpptr)
         return ret;
     }
 
+    /* memory of the parent fetched on demand; needed by the VMAs in the checkpoint */
+    if (hdr->shm && (ret = lazy_mem_init_child(&hdr->lazy_mem)) < 0)
+        return ret;
+
     migrated_memory_start = (void *) mapaddr;
     migrated_memory_end = (void *) mapaddr + mapsize;
     *cpptr = (void *) base;
@@ -0,0 +1,254 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * shim_clock.c
+ *
+ * Clocks of LibOS, computed from the TSC instead of asking the host (DkSystemTimeQuery(), an OCALL
+ * on SGX) on every query.
+ *
+ * The host time is only queried to calibrate the clock: the first time at least
+ * CLOCK_MIN_CALIB_US after startup, then every CLOCK_RECALIB_US. Each calibration measures the
+ * TSC frequency over the time since the previous one and rebases CLOCK_REALTIME on the host time.
+ * A frequency that differs by more than 1% from the current one is only taken over once it was
+ * measured CLOCK_MULT_CONFIRM times in a row (a single measurement may be distorted, e.g. by
+ * a preemption between reading the TSC and the host time); until then the clocks are rebased with
+ * the current frequency. CLOCK_MONOTONIC never goes back: it is rebased on the host time too,
+ * unless that is behind the time extrapolated from the TSC. Between calibrations, the clocks are
+ * read without locking from g_clock_data, which is also used by the vDSO (see vdso/vdso.c).
+ *
+ * The TSC is not used if it is not invariant, or if it cannot be read (e.g. in SGX1 enclaves,
+ * where RDTSC is emulated by the PAL as returning 0); then every query goes to the host, with
+ * microsecond precision, and CLOCK_MONOTONIC is the host time clamped to the latest value it
+ * returned.
+ */
+
+#include <pal.h>
+#include <shim_clock.h>
+#include <shim_internal.h>
+#include <shim_thread.h>
+
+#define CLOCK_MIN_CALIB_US 100000  /* first calibration after 100 ms */
+#define CLOCK_RECALIB_US   1000000 /* then every second */
+/* consistent measurements needed to change the TSC frequency by more than 1% */
+#define CLOCK_MULT_CONFIRM 2
+
+/* accepted TSC frequencies: 100 MHz - 10 GHz, in ns per tick << 32 */
+#define CLOCK_MIN_MULT ((1ULL << 32) / 10)
+#define CLOCK_MAX_MULT ((1ULL << 32) * 10)
+
+struct shim_clock_data g_clock_data;
+
+bool g_tsc_readable;
+/* TSC and host time at the previous calibration (or at startup) */
+static uint64_t g_calib_tsc;
+static uint64_t g_calib_us;
+/* TSC frequency measured differently from the current one, and how many times in a row */
+static uint64_t g_new_mult;
+static unsigned int g_new_mult_cnt;
+static uint64_t g_start_ns;
+/* latest CLOCK_MONOTONIC time taken from the host */
+static uint64_t g_host_monotonic_ns;
+
+/* Returns `a * 2^32 / b`, which must fit into 64 bits. */
+static uint64_t div_fixed32(uint64_t a, uint64_t b) {
+    while (b >> 32) {
+        a >>= 1;
+        b >>= 1;
+    }
+    return ((a / b) << 32) + (((a % b) << 32) / b);
+}
+
+static bool mults_close(uint64_t a, uint64_t b) {
+    return a >= b - b / 100 && a <= b + b / 100;
+}
+
+static bool tsc_is_invariant(void) {
+    PAL_IDX words[PAL_CPUID_WORD_NUM];
+
+    if (!DkCpuIdRetrieve(0x80000000, 0, words) || words[PAL_CPUID_WORD_EAX] < 0x80000007)
+        return false;
+    if (!DkCpuIdRetrieve(0x80000007, 0, words))
+        return false;
+    return words[PAL_CPUID_WORD_EDX] & (1 << 8);
+}
+
+/* Calibrates the clock against `host_us` read at `tsc`, unless another thread is doing it. */
+static void calibrate_clock(uint64_t tsc, uint64_t host_us) {
+    uint32_t seq = __atomic_load_n(&g_clock_data.seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&g_clock_data.seq, &seq, seq + 1, false,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    if (host_us < g_calib_us || tsc <= g_calib_tsc) {
+        /* the host time (or the TSC) went back, start measuring again */
+        g_calib_tsc = tsc;
+        g_calib_us  = host_us;
+        goto out;
+    }
+
+    uint64_t elapsed_us = host_us - g_calib_us;
+    if (elapsed_us < CLOCK_MIN_CALIB_US)
+        goto out;
+
+    uint64_t mult = div_fixed32(elapsed_us * 1000, tsc - g_calib_tsc);
+    uint64_t old_mult = g_clock_data.tsc_mult;
+    g_calib_tsc = tsc;
+    g_calib_us  = host_us;
+
+    /* ignore measurements distorted by jumps of the host time, and single outliers */
+    bool accept = mult >= CLOCK_MIN_MULT && mult <= CLOCK_MAX_MULT;
+    if (accept && old_mult && !mults_close(mult, old_mult)) {
+        if (g_new_mult && mults_close(mult, g_new_mult)) {
+            g_new_mult_cnt++;
+        } else {
+            g_new_mult     = mult;
+            g_new_mult_cnt = 1;
+        }
+        accept = g_new_mult_cnt >= CLOCK_MULT_CONFIRM;
+    }
+
+    if (accept) {
+        g_new_mult     = 0;
+        g_new_mult_cnt = 0;
+    } else if (old_mult) {
+        /* keep the frequency, but still follow the host time */
+        mult = old_mult;
+    } else {
+        goto out;
+    }
+
+    uint64_t host_ns      = host_us * 1000;
+    uint64_t monotonic_ns = MAX(host_ns, __atomic_load_n(&g_host_monotonic_ns, __ATOMIC_RELAXED));
+    if (g_clock_data.tsc_usable) {
+        uint64_t delta = tsc - g_clock_data.tsc_base;
+        uint64_t extrapolated_ns = g_clock_data.monotonic_base_ns +
+                                   (uint64_t)(((unsigned __int128)delta * old_mult) >> 32);
+        /* CLOCK_MONOTONIC follows CLOCK_REALTIME, but without its jumps back */
+        uint64_t rebased_ns = g_clock_data.monotonic_base_ns +
+                              (host_ns - MIN(host_ns, g_clock_data.realtime_base_ns));
+        monotonic_ns = MAX(extrapolated_ns, rebased_ns);
+    }
+
+    g_clock_data.tsc_base          = tsc;
+    g_clock_data.tsc_mult          = mult;
+    g_clock_data.tsc_period        = div_fixed32(CLOCK_RECALIB_US * 1000, mult);
+    g_clock_data.realtime_base_ns  = host_ns;
+    g_clock_data.monotonic_base_ns = monotonic_ns;
+    g_clock_data.tsc_usable        = 1;
+
+out:
+    __atomic_store_n(&g_clock_data.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int init_clock(void) {
+    uint64_t host_us = DkSystemTimeQuery();
+    if ((int64_t)host_us < 0)
+        return -PAL_ERRNO;
+
+    g_start_ns = host_us * 1000;
+
+    if (!tsc_is_invariant()) {
+        debug("TSC is not invariant, clocks are queried from the host\n");
+        return 0;
+    }
+
+    uint64_t tsc = clock_rdtsc();
+    if (!tsc || clock_rdtsc() == tsc) {
+        debug("TSC cannot be read, clocks are queried from the host\n");
+        return 0;
+    }
+
+    g_tsc_readable = true;
+    g_calib_tsc    = tsc;
+    g_calib_us     = host_us;
+    return 0;
+}
+
+/* Returns the time on the CLOCK_MONOTONIC (`monotonic`) or CLOCK_REALTIME timeline. */
+static int get_time_ns(bool monotonic, uint64_t* time_ns) {
+    if (clock_data_read(&g_clock_data, monotonic, /*check_period=*/true, time_ns))
+        return 0;
+
+    uint64_t tsc = g_tsc_readable ? clock_rdtsc() : 0;
+    uint64_t host_us = DkSystemTimeQuery();
+    if ((int64_t)host_us < 0)
+        return -PAL_ERRNO;
+
+    if (g_tsc_readable) {
+        calibrate_clock(tsc, host_us);
+        if (clock_data_read(&g_clock_data, monotonic, /*check_period=*/false, time_ns))
+            return 0;
+    }
+
+    *time_ns = host_us * 1000;
+    if (monotonic) {
+        /* the host time may go back */
+        uint64_t last = __atomic_load_n(&g_host_monotonic_ns, __ATOMIC_RELAXED);
+        while (last < *time_ns && !__atomic_compare_exchange_n(&g_host_monotonic_ns, &last,
+                                                               *time_ns, /*weak=*/true,
+                                                               __ATOMIC_RELAXED,
+                                                               __ATOMIC_RELAXED))
+            ;
+        *time_ns = MAX(*time_ns, last);
+    }
+    return 0;
+}
+
+/*
+ * The host provides no accounting of CPU time, so CLOCK_PROCESS_CPUTIME_ID and
+ * CLOCK_THREAD_CPUTIME_ID are approximated by the (monotonic) time since the process and the
+ * thread started, which is an upper bound of the CPU time they used.
+ */
+int get_clock_time(clockid_t clock, uint64_t* time_ns) {
+    int monotonic = clock_is_monotonic(clock);
+    if (monotonic >= 0)
+        return get_time_ns(monotonic, time_ns);
+
+    if (clock != CLOCK_PROCESS_CPUTIME_ID && clock != CLOCK_THREAD_CPUTIME_ID)
+        return -EINVAL;
+
+    uint64_t now_ns;
+    int ret = get_time_ns(/*monotonic=*/true, &now_ns);
+    if (ret < 0)
+        return ret;
+
+    uint64_t start_ns = g_start_ns;
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (clock == CLOCK_THREAD_CPUTIME_ID && cur_thread)
+        start_ns = cur_thread->start_time_ns;
+
+    *time_ns = now_ns - MIN(now_ns, start_ns);
+    return 0;
+}
+
+int get_clock_res(clockid_t clock, uint64_t* res_ns) {
+    if (clock_is_monotonic(clock) < 0 && clock != CLOCK_PROCESS_CPUTIME_ID &&
+        clock != CLOCK_THREAD_CPUTIME_ID)
+        return -EINVAL;
+
+    *res_ns = g_tsc_readable ? 1 : 1000;
+    return 0;
+}
+
+/* Drop-in replacement of DkSystemTimeQuery(): the CLOCK_REALTIME time in microseconds. */
+uint64_t get_time_us(void) {
+    uint64_t time_ns;
+    int ret = get_time_ns(/*monotonic=*/false, &time_ns);
+    if (ret < 0)
+        return ret;
+    return time_ns / 1000;
+}
@@ -28,6 +28,7 @@
 #include <shim_handle.h>
 #include <shim_vma.h>
 #include <shim_checkpoint.h>
+#include <shim_clock.h>
 #include <shim_fs.h>
 #include <shim_ipc.h>
 #include <shim_vdso.h>
@@ -546,6 +547,7 @@ noreturn void* shim_init(int argc, void* args)
 
     RUN_INIT(init_vma);
     RUN_INIT(init_slab);
+    RUN_INIT(init_clock);
     RUN_INIT(read_environs, envp);
     RUN_INIT(init_str_mgr);
     RUN_INIT(init_internal_map);
@@ -573,6 +575,9 @@ noreturn void* shim_init(int argc, void* args)
         RUN_INIT(init_manifest, PAL_CB(manifest_handle));
 
     RUN_INIT(init_mount_root);
+    RUN_INIT(init_file_cache);
+    RUN_INIT(init_lazy_mem);
+    RUN_INIT(init_syscall_stats);
     RUN_INIT(init_ipc);
     RUN_INIT(init_thread);
     RUN_INIT(init_mount);
@@ -602,6 +607,11 @@ noreturn void* shim_init(int argc, void* args)
         attr.secure = PAL_FALSE;
         if (!DkStreamAttributesSetByHandle(PAL_CB(parent_process), &attr))
             shim_do_exit(-PAL_ERRNO);
+
+        /* the parent handles our requests for its memory from now on */
+        int err = lazy_mem_start_prefetch();
+        if (err < 0)
+            debug("failed to start prefetching memory of the parent (%d)\n", err);
     }
 
     debug("shim process initialized\n");
@@ -903,6 +913,8 @@ noreturn void shim_clean_and_exit(int exit_code) {
 
     cur_process.exit_code = exit_code;
     store_all_msg_persist();
+    file_cache_sync_all();
+    lazy_mem_push_all();
     del_all_ipc_ports();
 
     if (shim_stdio && shim_stdio != (PAL_HANDLE) -1)
@@ -910,6 +922,9 @@ noreturn void shim_clean_and_exit(int exit_code) {
 
     shim_stdio = NULL;
     debug("process %u exited with status %d\n", cur_process.vmid & 0xFFFF, cur_process.exit_code);
+#ifdef LOCK_PROFILE
+    lock_profile_dump();
+#endif
     MASTER_LOCK();
 
     if (cur_process.exit_code == PAL_WAIT_FOR_CHILDREN_EXIT) {
@@ -0,0 +1,788 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * shim_lazy_mem.c
+ *
+ * Lazy migration of memory on fork.
+ *
+ * Normally fork() copies all memory of the process into the checkpoint before the child starts, so
+ * forking takes time proportional to the size of the parent. With `sys.fork.lazy_memory = 1` in
+ * the manifest, large private anonymous VMAs are instead fetched by the child on demand:
+ *
+ * - The parent does not copy them, but write-protects them and describes them in a snapshot for
+ *   the child. The snapshot lives in the memory shared with the child (see
+ *   send_checkpoint_on_shm()), after the checkpoint: a bitmap of the chunks present, followed by
+ *   one slot of LAZY_MEM_CHUNK_SIZE bytes per chunk. Chunks are aligned in the address space, so
+ *   that the snapshots of several children agree on them.
+ * - A chunk is copied into all snapshots that still need it when the parent is about to change it
+ *   (write fault, mprotect, munmap, mmap over it) and when a child asks for it; after this, the
+ *   parent's memory gets its write permission back. Memory is write-protected by this code exactly
+ *   as long as some snapshot needs it.
+ * - The child reserves these VMAs without access. When it touches a chunk (page fault, or a system
+ *   call argument checked with test_user_memory()), it asks the parent with IPC_CLD_GETMEM for the
+ *   next few chunks unless the bitmap says they are present already, and maps them copy-on-write
+ *   from the shared memory over the reservation.
+ * - A helper thread of the child prefetches all remaining chunks in the background and then sends
+ *   IPC_CLD_MEMDONE, after which the parent forgets the snapshot. The parent also forgets it when
+ *   the child exits. When the parent exits or execs first, it copies all chunks still missing.
+ *
+ * This relies on memory shared with the child process, so it is used only if the PAL supports
+ * resizing the process stream (Linux); otherwise all memory is sent with the checkpoint. Memory
+ * that the LibOS accesses without test_user_memory() is not migrated lazily: the stack of the
+ * forking thread (used by the child before it can talk to the parent) and small VMAs are always
+ * sent with the checkpoint. The child needs the parent to be alive until it fetched everything.
+ *
+ * All state is protected by `lazy_mem_lock`.
+ */
+
+#include <shim_internal.h>
+#include <shim_checkpoint.h>
+#include <shim_ipc.h>
+#include <shim_thread.h>
+#include <shim_utils.h>
+#include <shim_vma.h>
+
+#include <pal.h>
+#include <pal_error.h>
+
+#include <list.h>
+
+#include <errno.h>
+
+#include <asm/mman.h>
+
+#define LAZY_MEM_CHUNK_SIZE    (64 * 1024UL)
+/* smaller VMAs are sent with the checkpoint */
+#define LAZY_MEM_MIN_SIZE      (4 * LAZY_MEM_CHUNK_SIZE)
+/* chunks the child asks for at once */
+#define LAZY_MEM_FETCH_CHUNKS  8
+#define LAZY_MEM_STACK_SIZE    (g_pal_alloc_align * 4)
+
+struct lazy_mem_range {
+    void* addr;
+    size_t size;
+    int prot;     /* PAL_PROT_* of the VMA when it was checkpointed */
+    size_t first; /* index of the first chunk of the range in the snapshot */
+};
+
+/* parent side: memory not fetched yet by one child */
+DEFINE_LIST(lazy_mem_snapshot);
+struct lazy_mem_snapshot {
+    LIST_TYPE(lazy_mem_snapshot) list;
+    IDTYPE vmid;           /* of the child; 0 until it started */
+    void* area;            /* mapping of the shared memory: bitmap, then chunk slots */
+    size_t area_size;
+    size_t data_offset;    /* of the chunk slots in `area` */
+    size_t nchunks;
+    size_t nranges;
+    size_t max_ranges;
+    struct lazy_mem_range* ranges;
+};
+DEFINE_LISTP(lazy_mem_snapshot);
+static LISTP_TYPE(lazy_mem_snapshot) lazy_mem_snapshots = LISTP_INIT;
+
+/* child side: memory of the parent not fetched yet */
+static struct lazy_mem_range* lazy_mem_ranges;
+static size_t lazy_mem_nranges;
+static size_t lazy_mem_max_ranges;
+static unsigned long* lazy_mem_bitmap;  /* the parent's bitmap, mapped read-only */
+static unsigned long* lazy_mem_fetched; /* chunks mapped (or not needed anymore) */
+static size_t lazy_mem_data_offset;     /* of the chunk slots in the shared memory */
+static size_t lazy_mem_nchunks;
+static size_t lazy_mem_nfetched;
+
+static struct shim_lock lazy_mem_lock;
+static bool lazy_mem_enabled;
+/* set once there is any lazily migrated memory, so that other page faults don't take the lock */
+static bool lazy_mem_used;
+
+static inline bool test_chunk(unsigned long* bitmap, size_t idx) {
+    unsigned long word = __atomic_load_n(&bitmap[idx / BITS_PER_WORD], __ATOMIC_ACQUIRE);
+    return word & (1UL << (idx % BITS_PER_WORD));
+}
+
+static inline void set_chunk(unsigned long* bitmap, size_t idx) {
+    __atomic_fetch_or(&bitmap[idx / BITS_PER_WORD], 1UL << (idx % BITS_PER_WORD),
+                      __ATOMIC_RELEASE);
+}
+
+static inline size_t bitmap_size(size_t nchunks) {
+    return ALLOC_ALIGN_UP((nchunks + BITS_PER_WORD - 1) / BITS_PER_WORD * sizeof(unsigned long));
+}
+
+static inline void* chunk_of(void* addr) {
+    return ALIGN_DOWN_PTR(addr, LAZY_MEM_CHUNK_SIZE);
+}
+
+static inline void* range_end(struct lazy_mem_range* r) {
+    return r->addr + r->size;
+}
+
+static inline bool range_overlaps(struct lazy_mem_range* r, void* start, void* end) {
+    return r->addr < end && start < range_end(r);
+}
+
+static inline size_t range_nchunks(struct lazy_mem_range* r) {
+    return (ALIGN_UP_PTR(range_end(r), LAZY_MEM_CHUNK_SIZE) - chunk_of(r->addr))
+           / LAZY_MEM_CHUNK_SIZE;
+}
+
+/* index of the chunk containing `addr` */
+static inline size_t range_chunk(struct lazy_mem_range* r, void* addr) {
+    return r->first + (chunk_of(addr) - chunk_of(r->addr)) / LAZY_MEM_CHUNK_SIZE;
+}
+
+/* start of the chunk with index `idx`, clipped to the range */
+static inline void* range_chunk_addr(struct lazy_mem_range* r, size_t idx) {
+    void* addr = chunk_of(r->addr) + (idx - r->first) * LAZY_MEM_CHUNK_SIZE;
+    return MAX(addr, r->addr);
+}
+
+/* offset of `addr` in the chunk slots */
+static inline size_t range_offset(struct lazy_mem_range* r, void* addr) {
+    return r->first * LAZY_MEM_CHUNK_SIZE + (addr - chunk_of(r->addr));
+}
+
+static bool vma_writable(void* addr) {
+    struct shim_vma_val vma;
+    if (lookup_vma(addr, &vma) < 0)
+        return false;
+    if (vma.file)
+        put_handle(vma.file);
+    return vma.prot & PROT_WRITE;
+}
+
+int init_lazy_mem(void) {
+    if (!lock_created(&lazy_mem_lock) && !create_lock(&lazy_mem_lock))
+        return -ENOMEM;
+
+    char cfg[CONFIG_MAX];
+    if (root_config &&
+            get_config(root_config, "sys.fork.lazy_memory", cfg, sizeof(cfg)) == 1 &&
+            cfg[0] == '1')
+        lazy_mem_enabled = true;
+    return 0;
+}
+
+/*
+ * Parent side
+ */
+
+struct lazy_mem_snapshot* lazy_mem_create(PAL_HANDLE proc) {
+    /* the chunks are passed in memory shared with the child, which only some PALs support */
+    if (!lazy_mem_enabled || DkStreamSetLength(proc, 0))
+        return NULL;
+
+    struct lazy_mem_snapshot* snapshot = malloc(sizeof(*snapshot));
+    if (!snapshot)
+        return NULL;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    INIT_LIST_HEAD(snapshot, list);
+    return snapshot;
+}
+
+bool lazy_mem_eligible(struct shim_vma_val* vma) {
+    if (vma->file || (vma->flags & (VMA_INTERNAL | VMA_UNMAPPED)))
+        return false;
+    if ((vma->prot & (PROT_READ | PROT_WRITE)) != (PROT_READ | PROT_WRITE))
+        return false;
+    if (vma->length < LAZY_MEM_MIN_SIZE)
+        return false;
+
+    /* the child runs on this stack before it can fetch memory */
+    void* stack = current_stack();
+    return stack < vma->addr || stack >= vma->addr + vma->length;
+}
+
+/* Returns the index of the first chunk of the range in the snapshot. */
+long lazy_mem_add_range(struct lazy_mem_snapshot* snapshot, void* addr, size_t size, int prot) {
+    if (snapshot->nranges == snapshot->max_ranges) {
+        size_t max_ranges = snapshot->max_ranges ? snapshot->max_ranges * 2 : 16;
+        struct lazy_mem_range* ranges = malloc(sizeof(*ranges) * max_ranges);
+        if (!ranges)
+            return -ENOMEM;
+
+        if (snapshot->ranges) {
+            memcpy(ranges, snapshot->ranges, sizeof(*ranges) * snapshot->nranges);
+            free(snapshot->ranges);
+        }
+        snapshot->ranges     = ranges;
+        snapshot->max_ranges = max_ranges;
+    }
+
+    struct lazy_mem_range* r = &snapshot->ranges[snapshot->nranges++];
+    r->addr  = addr;
+    r->size  = size;
+    r->prot  = prot;
+    r->first = snapshot->nchunks;
+    snapshot->nchunks += range_nchunks(r);
+    return r->first;
+}
+
+size_t lazy_mem_area_size(struct lazy_mem_snapshot* snapshot) {
+    if (!snapshot || !snapshot->nranges)
+        return 0;
+    return bitmap_size(snapshot->nchunks) + snapshot->nchunks * LAZY_MEM_CHUNK_SIZE;
+}
+
+/* Gives the memory of the chunk back the protection of its VMAs. */
+static void unprotect_chunk(void* chunk) {
+    void* end = chunk + LAZY_MEM_CHUNK_SIZE;
+    struct shim_vma_val vma;
+
+    for (void* addr = chunk; addr < end; addr = vma.addr + vma.length) {
+        if (lookup_overlap_vma(addr, end - addr, &vma) < 0)
+            break;
+        if (vma.file) {
+            put_handle(vma.file);
+            continue;
+        }
+        if (!(vma.prot & PROT_WRITE) || (vma.flags & (VMA_INTERNAL | VMA_UNMAPPED)))
+            continue;
+
+        void* start = MAX(addr, vma.addr);
+        void* stop  = MIN(end, vma.addr + vma.length);
+        DkVirtualMemoryProtect(start, stop - start, PAL_PROT(vma.prot, 0));
+    }
+}
+
+/* Copies the chunk into all snapshots that still need it. Returns whether `addr` is in some
+ * snapshot, and in `copied` whether anything was copied. */
+static bool preserve_chunk(void* chunk, void* addr, bool* copied) {
+    assert(locked(&lazy_mem_lock));
+    void* chunk_end = chunk + LAZY_MEM_CHUNK_SIZE;
+    bool found = false;
+    *copied = false;
+
+    struct lazy_mem_snapshot* snapshot;
+    LISTP_FOR_EACH_ENTRY(snapshot, &lazy_mem_snapshots, list) {
+        for (size_t i = 0; i < snapshot->nranges; i++) {
+            struct lazy_mem_range* r = &snapshot->ranges[i];
+            if (!range_overlaps(r, chunk, chunk_end))
+                continue;
+            if (addr >= r->addr && addr < range_end(r))
+                found = true;
+
+            size_t idx = range_chunk(r, chunk);
+            if (test_chunk(snapshot->area, idx))
+                continue;
+
+            void* start = MAX(chunk, r->addr);
+            void* end   = MIN(chunk_end, range_end(r));
+            memcpy(snapshot->area + snapshot->data_offset + range_offset(r, start), start,
+                   end - start);
+            set_chunk(snapshot->area, idx);
+            *copied = true;
+        }
+    }
+    return found;
+}
+
+/* Copies all chunks overlapping [start, end) that snapshots still need, and unprotects them. */
+static void preserve_range(void* start, void* end) {
+    assert(locked(&lazy_mem_lock));
+
+    struct lazy_mem_snapshot* snapshot;
+    LISTP_FOR_EACH_ENTRY(snapshot, &lazy_mem_snapshots, list) {
+        for (size_t i = 0; i < snapshot->nranges; i++) {
+            struct lazy_mem_range* r = &snapshot->ranges[i];
+            if (!range_overlaps(r, start, end))
+                continue;
+
+            void* stop = MIN(end, range_end(r));
+            for (void* chunk = chunk_of(MAX(start, r->addr)); chunk < stop;
+                    chunk += LAZY_MEM_CHUNK_SIZE) {
+                if (test_chunk(snapshot->area, range_chunk(r, chunk)))
+                    continue;
+
+                bool copied;
+                preserve_chunk(chunk, chunk, &copied);
+                unprotect_chunk(chunk);
+            }
+        }
+    }
+}
+
+static bool chunk_needed(void* chunk) {
+    assert(locked(&lazy_mem_lock));
+    void* chunk_end = chunk + LAZY_MEM_CHUNK_SIZE;
+
+    struct lazy_mem_snapshot* snapshot;
+    LISTP_FOR_EACH_ENTRY(snapshot, &lazy_mem_snapshots, list) {
+        for (size_t i = 0; i < snapshot->nranges; i++) {
+            struct lazy_mem_range* r = &snapshot->ranges[i];
+            if (range_overlaps(r, chunk, chunk_end) && !test_chunk(snapshot->area,
+                                                                   range_chunk(r, chunk)))
+                return true;
+        }
+    }
+    return false;
+}
+
+static void free_snapshot(struct lazy_mem_snapshot* snapshot) {
+    if (snapshot->area) {
+        bkeep_munmap(snapshot->area, snapshot->area_size, CP_VMA_FLAGS);
+        DkStreamUnmap(snapshot->area, snapshot->area_size);
+    }
+    free(snapshot->ranges);
+    free(snapshot);
+}
+
+/* Forgets the snapshot; memory that only it still needed gets its write permission back. */
+static void release_snapshot(struct lazy_mem_snapshot* snapshot) {
+    assert(locked(&lazy_mem_lock));
+    LISTP_DEL(snapshot, &lazy_mem_snapshots, list);
+
+    for (size_t i = 0; i < snapshot->nranges; i++) {
+        struct lazy_mem_range* r = &snapshot->ranges[i];
+        for (void* chunk = chunk_of(r->addr); chunk < range_end(r); chunk += LAZY_MEM_CHUNK_SIZE) {
+            if (!test_chunk(snapshot->area, range_chunk(r, chunk)) && !chunk_needed(chunk))
+                unprotect_chunk(chunk);
+        }
+    }
+    free_snapshot(snapshot);
+}
+
+/* Maps the snapshot area placed at `offset` in the memory shared with the child process and
+ * write-protects the memory of the snapshot. Called after the checkpoint was copied. */
+int lazy_mem_start(struct lazy_mem_snapshot* snapshot, PAL_HANDLE proc, size_t offset,
+                   struct lazy_mem_header* hdr) {
+    if (!snapshot->nranges)
+        return 0;
+
+    size_t size = lazy_mem_area_size(snapshot);
+    void* area = bkeep_unmapped_any(size, PROT_READ | PROT_WRITE, CP_VMA_FLAGS, 0, "lazymem");
+    if (!area)
+        return -ENOMEM;
+
+    /* the slots are only written when chunks are copied, so this is cheap even for large parents */
+    if (!DkStreamMap(proc, area, PAL_PROT_READ | PAL_PROT_WRITE, offset, size)) {
+        int ret = -PAL_ERRNO;
+        bkeep_munmap(area, size, CP_VMA_FLAGS);
+        return ret;
+    }
+
+    snapshot->area        = area;
+    snapshot->area_size   = size;
+    snapshot->data_offset = bitmap_size(snapshot->nchunks);
+
+    lock(&lazy_mem_lock);
+    LISTP_ADD_TAIL(snapshot, &lazy_mem_snapshots, list);
+    __atomic_store_n(&lazy_mem_used, true, __ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < snapshot->nranges; i++) {
+        struct lazy_mem_range* r = &snapshot->ranges[i];
+        if (!DkVirtualMemoryProtect(r->addr, r->size, r->prot & ~PAL_PROT_WRITE)) {
+            int ret = -PAL_ERRNO;
+            release_snapshot(snapshot);
+            unlock(&lazy_mem_lock);
+            return ret;
+        }
+    }
+    unlock(&lazy_mem_lock);
+
+    hdr->offset  = offset;
+    hdr->nchunks = snapshot->nchunks;
+    hdr->nranges = snapshot->nranges;
+    return 0;
+}
+
+void lazy_mem_attach(struct lazy_mem_snapshot* snapshot, IDTYPE vmid) {
+    if (!snapshot->area) {
+        /* nothing was left for the child to fetch */
+        free_snapshot(snapshot);
+        return;
+    }
+
+    lock(&lazy_mem_lock);
+    snapshot->vmid = vmid;
+    unlock(&lazy_mem_lock);
+}
+
+/* Called instead of lazy_mem_attach() if the child process could not be started. */
+void lazy_mem_destroy(struct lazy_mem_snapshot* snapshot) {
+    if (!snapshot->area) {
+        free_snapshot(snapshot);
+        return;
+    }
+
+    lock(&lazy_mem_lock);
+    release_snapshot(snapshot);
+    unlock(&lazy_mem_lock);
+}
+
+static struct lazy_mem_snapshot* find_snapshot(IDTYPE vmid) {
+    assert(locked(&lazy_mem_lock));
+
+    struct lazy_mem_snapshot* snapshot;
+    LISTP_FOR_EACH_ENTRY(snapshot, &lazy_mem_snapshots, list) {
+        if (snapshot->vmid == vmid)
+            return snapshot;
+    }
+    return NULL;
+}
+
+/* Request of a child process for the memory [addr, addr+size). It may come before the child is
+ * attached to its snapshot, so all snapshots are served. */
+void lazy_mem_serve(void* addr, size_t size) {
+    lock(&lazy_mem_lock);
+    preserve_range(addr, addr + size);
+    unlock(&lazy_mem_lock);
+}
+
+/* The child process `vmid` fetched all memory it needs, or exited. */
+void lazy_mem_release(IDTYPE vmid) {
+    if (!__atomic_load_n(&lazy_mem_used, __ATOMIC_ACQUIRE))
+        return;
+
+    lock(&lazy_mem_lock);
+    struct lazy_mem_snapshot* snapshot = find_snapshot(vmid);
+    if (snapshot)
+        release_snapshot(snapshot);
+    unlock(&lazy_mem_lock);
+}
+
+/* Copies all memory that children still need, before this process exits or execs. */
+void lazy_mem_push_all(void) {
+    if (!__atomic_load_n(&lazy_mem_used, __ATOMIC_ACQUIRE))
+        return;
+
+    lock(&lazy_mem_lock);
+    struct lazy_mem_snapshot* snapshot;
+    LISTP_FOR_EACH_ENTRY(snapshot, &lazy_mem_snapshots, list) {
+        for (size_t i = 0; i < snapshot->nranges; i++) {
+            struct lazy_mem_range* r = &snapshot->ranges[i];
+            preserve_range(r->addr, range_end(r));
+        }
+    }
+    unlock(&lazy_mem_lock);
+}
+
+static bool parent_fault(void* addr) {
+    void* chunk = chunk_of(addr);
+    bool copied;
+
+    if (!preserve_chunk(chunk, addr, &copied))
+        return false;
+
+    /* if the chunk was preserved before (e.g. by another thread that faulted on it meanwhile),
+     * the fault is ours only if the memory should be writable */
+    if (!copied && !vma_writable(addr))
+        return false;
+
+    unprotect_chunk(chunk);
+    return true;
+}
+
+/*
+ * Child side
+ */
+
+/* Called during the restore of the checkpoint, before the VMAs are restored. */
+int lazy_mem_init_child(struct lazy_mem_header* hdr) {
+    if (!hdr->nranges)
+        return 0;
+
+    if (!lock_created(&lazy_mem_lock) && !create_lock(&lazy_mem_lock))
+        return -ENOMEM;
+
+    size_t size = bitmap_size(hdr->nchunks);
+    void* bitmap = bkeep_unmapped_any(size, PROT_READ, CP_VMA_FLAGS, 0, "lazymem");
+    if (!bitmap)
+        return -ENOMEM;
+
+    /* a shared mapping: chunks that the parent copies later show up here */
+    if (!DkStreamMap(PAL_CB(parent_process), bitmap, PAL_PROT_READ, hdr->offset, size)) {
+        int ret = -PAL_ERRNO;
+        bkeep_munmap(bitmap, size, CP_VMA_FLAGS);
+        return ret;
+    }
+
+    lazy_mem_fetched = malloc(size);
+    lazy_mem_ranges  = malloc(sizeof(*lazy_mem_ranges) * hdr->nranges);
+    if (!lazy_mem_fetched || !lazy_mem_ranges)
+        return -ENOMEM;
+
+    memset(lazy_mem_fetched, 0, size);
+    lazy_mem_bitmap      = bitmap;
+    lazy_mem_data_offset = hdr->offset + size;
+    lazy_mem_nchunks     = hdr->nchunks;
+    lazy_mem_max_ranges  = hdr->nranges;
+    return 0;
+}
+
+/* Restores a VMA of the parent whose memory is fetched on demand, starting with the chunk with
+ * index `first`. */
+int lazy_mem_restore_range(void* addr, size_t size, int prot, size_t first) {
+    if (lazy_mem_nranges == lazy_mem_max_ranges)
+        return -EINVAL;
+
+    /* keep the address range reserved until the memory is fetched */
+    if (!DkVirtualMemoryAlloc(addr, size, 0, PAL_PROT_NONE))
+        return -PAL_ERRNO;
+
+    struct lazy_mem_range* r = &lazy_mem_ranges[lazy_mem_nranges++];
+    r->addr  = addr;
+    r->size  = size;
+    r->prot  = prot;
+    r->first = first;
+    __atomic_store_n(&lazy_mem_used, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct lazy_mem_range* find_range(void* addr) {
+    for (size_t i = 0; i < lazy_mem_nranges; i++) {
+        struct lazy_mem_range* r = &lazy_mem_ranges[i];
+        if (addr >= r->addr && addr < range_end(r))
+            return r;
+    }
+    return NULL;
+}
+
+static void mark_fetched(size_t first, size_t end) {
+    assert(locked(&lazy_mem_lock));
+    bool done = lazy_mem_nfetched == lazy_mem_nchunks;
+
+    for (size_t idx = first; idx < end; idx++)
+        set_chunk(lazy_mem_fetched, idx);
+    lazy_mem_nfetched += end - first;
+
+    if (!done && lazy_mem_nfetched == lazy_mem_nchunks) {
+        debug("fetched all memory of the parent\n");
+        ipc_cld_memdone_send();
+    }
+}
+
+/* Maps the chunk of range `r` at `addr` and up to LAZY_MEM_FETCH_CHUNKS - 1 following chunks that
+ * are not mapped yet. Asks the parent for them first unless they are present already. */
+static int fetch_chunks(struct lazy_mem_range* r, void* addr) {
+    assert(locked(&lazy_mem_lock));
+    size_t first = range_chunk(r, addr);
+    size_t last  = r->first + range_nchunks(r);
+    size_t end   = first;
+    bool missing = false;
+
+    while (end < last && end - first < LAZY_MEM_FETCH_CHUNKS && !test_chunk(lazy_mem_fetched, end)) {
+        if (!test_chunk(lazy_mem_bitmap, end))
+            missing = true;
+        end++;
+    }
+    if (end == first)
+        return 0;
+
+    void* start = range_chunk_addr(r, first);
+    if (missing) {
+        void* stop = end < last ? range_chunk_addr(r, end) : range_end(r);
+        int ret = ipc_cld_getmem_send(start, stop - start);
+        if (ret < 0 && !test_chunk(lazy_mem_bitmap, first))
+            return ret;
+    }
+
+    /* the parent may have failed to copy some of the later chunks */
+    size_t present = first;
+    while (present < end && test_chunk(lazy_mem_bitmap, present))
+        present++;
+    if (present == first)
+        return -EFAULT;
+
+    void* stop = present < last ? range_chunk_addr(r, present) : range_end(r);
+    if (!DkStreamMap(PAL_CB(parent_process), start, r->prot | PAL_PROT_WRITECOPY,
+                     lazy_mem_data_offset + range_offset(r, start), stop - start))
+        return -PAL_ERRNO;
+
+    mark_fetched(first, present);
+    return 0;
+}
+
+static bool child_fault(void* addr) {
+    struct lazy_mem_range* r = find_range(addr);
+    if (!r)
+        return false;
+
+    /* mapped by another thread meanwhile, unless the application changed the protection since */
+    if (test_chunk(lazy_mem_fetched, range_chunk(r, addr)))
+        return vma_writable(addr);
+
+    int ret = fetch_chunks(r, addr);
+    if (ret < 0) {
+        debug("failed to fetch memory at %p from the parent (%d)\n", addr, ret);
+        return false;
+    }
+    return true;
+}
+
+static int child_prepare(void* addr, size_t size, bool discard) {
+    void* end = addr + size;
+
+    for (size_t i = 0; i < lazy_mem_nranges; i++) {
+        struct lazy_mem_range* r = &lazy_mem_ranges[i];
+        if (!range_overlaps(r, addr, end))
+            continue;
+
+        void* stop = MIN(end, range_end(r));
+        for (void* chunk = chunk_of(MAX(addr, r->addr)); chunk < stop;
+                chunk += LAZY_MEM_CHUNK_SIZE) {
+            size_t idx = range_chunk(r, chunk);
+            if (test_chunk(lazy_mem_fetched, idx))
+                continue;
+
+            void* start = range_chunk_addr(r, idx);
+            if (discard && start >= addr &&
+                    MIN(chunk + LAZY_MEM_CHUNK_SIZE, range_end(r)) <= end) {
+                /* the whole chunk is unmapped or replaced */
+                mark_fetched(idx, idx + 1);
+                continue;
+            }
+
+            int ret = fetch_chunks(r, start);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+int lazy_mem_fetch_all(void) {
+    if (!lazy_mem_nranges)
+        return 0;
+
+    /* the ranges don't change after the checkpoint is restored; take the lock per fetch only, so
+     * that page faults of other threads are not delayed for long */
+    for (size_t i = 0; i < lazy_mem_nranges; i++) {
+        struct lazy_mem_range* r = &lazy_mem_ranges[i];
+        for (void* chunk = chunk_of(r->addr); chunk < range_end(r); chunk += LAZY_MEM_CHUNK_SIZE) {
+            int ret = 0;
+            lock(&lazy_mem_lock);
+            if (!test_chunk(lazy_mem_fetched, range_chunk(r, chunk)))
+                ret = fetch_chunks(r, MAX(chunk, r->addr));
+            unlock(&lazy_mem_lock);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+noreturn static void lazy_mem_prefetch(void* dummy) {
+    __UNUSED(dummy);
+    struct shim_thread* self = get_cur_thread();
+
+    int ret = lazy_mem_fetch_all();
+    if (ret < 0)
+        debug("prefetching memory from the parent failed (%d)\n", ret);
+
+    __disable_preempt(self->shim_tcb);
+    put_thread(self);
+    free_thread_slab_cache();
+    DkThreadExit(/*clear_child_tid=*/NULL);
+}
+
+static void lazy_mem_prefetch_prepare(void* arg) {
+    struct shim_thread* self = (struct shim_thread*)arg;
+
+    shim_tcb_init();
+    set_cur_thread(self);
+    update_fs_base(0);
+    debug_setbuf(shim_get_tcb(), true);
+
+    void* stack = allocate_stack(LAZY_MEM_STACK_SIZE, g_pal_alloc_align, false);
+    if (!stack) {
+        put_thread(self);
+        DkThreadExit(/*clear_child_tid=*/NULL);
+        return;
+    }
+
+    /* swap stack to be sure we don't drain the small stack PAL provides */
+    self->stack_top = stack + LAZY_MEM_STACK_SIZE;
+    self->stack     = stack;
+    __SWITCH_STACK(self->stack_top, lazy_mem_prefetch, NULL);
+}
+
+/* Starts fetching the remaining memory of the parent in the background. Called once the child
+ * process can talk to the parent. */
+int lazy_mem_start_prefetch(void) {
+    if (!lazy_mem_nranges)
+        return 0;
+
+    struct shim_thread* thread = get_new_internal_thread();
+    if (!thread)
+        return -ENOMEM;
+
+    /* the thread may exit before its handle is set */
+    get_thread(thread);
+    PAL_HANDLE handle = thread_create(lazy_mem_prefetch_prepare, thread);
+    if (!handle) {
+        int ret = -PAL_ERRNO;
+        put_thread(thread);
+        put_thread(thread);
+        return ret;
+    }
+
+    thread->pal_handle = handle;
+    put_thread(thread);
+    return 0;
+}
+
+/*
+ * Both sides
+ */
+
+/* Called on page faults; returns true if the fault was caused by lazily migrated memory and the
+ * access should be retried. */
+bool lazy_mem_fault(void* addr) {
+    if (!__atomic_load_n(&lazy_mem_used, __ATOMIC_ACQUIRE))
+        return false;
+
+    lock(&lazy_mem_lock);
+    bool handled = child_fault(addr) || parent_fault(addr);
+    unlock(&lazy_mem_lock);
+    return handled;
+}
+
+/* Called before the memory [addr, addr+size) is protected (`discard` false) or unmapped or
+ * replaced (`discard` true). */
+int lazy_mem_prepare(void* addr, size_t size, bool discard) {
+    if (!__atomic_load_n(&lazy_mem_used, __ATOMIC_ACQUIRE))
+        return 0;
+
+    lock(&lazy_mem_lock);
+    int ret = child_prepare(addr, size, discard);
+    if (!ret)
+        preserve_range(addr, addr + size);
+    unlock(&lazy_mem_lock);
+    return ret;
+}
+
+/* Called before the memory of this process is dropped by execve(). */
+void lazy_mem_exec(void) {
+    lazy_mem_push_all();
+
+    if (!lazy_mem_nranges)
+        return;
+
+    lock(&lazy_mem_lock);
+    for (size_t i = 0; i < lazy_mem_nranges; i++) {
+        struct lazy_mem_range* r = &lazy_mem_ranges[i];
+        for (void* chunk = chunk_of(r->addr); chunk < range_end(r); chunk += LAZY_MEM_CHUNK_SIZE) {
+            size_t idx = range_chunk(r, chunk);
+            if (!test_chunk(lazy_mem_fetched, idx))
+                mark_fetched(idx, idx + 1);
+        }
+    }
+    unlock(&lazy_mem_lock);
+}
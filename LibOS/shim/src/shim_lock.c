@@ -0,0 +1,171 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * shim_lock.c
+ *
+ * Slow paths of the locks of LibOS (lock() and rwlock_read_lock() in shim_internal.h), taken only
+ * when the lock is contended. The fast paths are atomic operations on the lock and do not call
+ * the PAL, which is costly on SGX (the PAL mutexes are futexes in untrusted memory).
+ */
+
+#include <pal.h>
+#include <shim_internal.h>
+
+/* as many times as the PAL mutexes spin */
+#define LOCK_SPIN_COUNT 100
+
+void __lock_slow(struct shim_lock* l) {
+    /* spin as long as the owner may be about to release the lock, i.e. nobody is parked yet */
+    for (int i = 0; i < LOCK_SPIN_COUNT; i++) {
+        int32_t state = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        if (state == SHIM_LOCK_CONTENDED)
+            break;
+        if (state == SHIM_LOCK_UNLOCKED &&
+                __atomic_compare_exchange_n(&l->state, &state, SHIM_LOCK_LOCKED, /*weak=*/false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        CPU_RELAX();
+    }
+
+    /*
+     * Park until unlock() sees CONTENDED and releases the PAL mutex. The lock stays CONTENDED
+     * while taken after the wakeup, because other threads may still be parked. The wait may fail
+     * spuriously (e.g. EWOULDBLOCK on SGX), then we just check the lock again.
+     */
+    while (__atomic_exchange_n(&l->state, SHIM_LOCK_CONTENDED, __ATOMIC_ACQUIRE) !=
+               SHIM_LOCK_UNLOCKED)
+        DkSynchronizationObjectWait(l->lock, NO_TIMEOUT);
+}
+
+void __rwlock_read_lock_slow(struct shim_rwlock* l) {
+    for (int i = 0; i < LOCK_SPIN_COUNT; i++) {
+        CPU_RELAX();
+        int32_t state = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        if (!(state & RWLOCK_WRITER) &&
+                __atomic_compare_exchange_n(&l->state, &state, state + 1, /*weak=*/false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+    }
+
+    /* park until the writer is done; nobody can set RWLOCK_WRITER while we hold `wlock` */
+    lock(&l->wlock);
+    __atomic_add_fetch(&l->state, 1, __ATOMIC_ACQUIRE);
+    unlock(&l->wlock);
+}
+
+void __rwlock_wait_readers(struct shim_rwlock* l) {
+    /* new readers park on `wlock`, and the current ones hold the lock only briefly */
+    for (int i = 0; __atomic_load_n(&l->state, __ATOMIC_ACQUIRE) != RWLOCK_WRITER; i++) {
+        if (i < LOCK_SPIN_COUNT)
+            CPU_RELAX();
+        else
+            DkThreadYieldExecution();
+    }
+}
+
+#ifdef LOCK_PROFILE
+#define LOCK_PROFILE_MAX_CLASSES 256
+
+static struct shim_lock_class g_lock_classes[LOCK_PROFILE_MAX_CLASSES];
+
+/* Returns the class of the locks called `name`, or NULL if there are too many classes. The classes
+ * are only ever added, into the first free slot, so the lookup needs no lock. */
+struct shim_lock_class* lock_profile_class(const char* name) {
+    for (size_t i = 0; i < LOCK_PROFILE_MAX_CLASSES; i++) {
+        const char* cur = __atomic_load_n(&g_lock_classes[i].name, __ATOMIC_ACQUIRE);
+        if (!cur &&
+                __atomic_compare_exchange_n(&g_lock_classes[i].name, &cur, name, /*weak=*/false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return &g_lock_classes[i];
+        if (cur == name || !strcmp(cur, name))
+            return &g_lock_classes[i];
+    }
+    return NULL;
+}
+
+const struct shim_lock_class* lock_profile_classes(size_t* count) {
+    size_t i = 0;
+    while (i < LOCK_PROFILE_MAX_CLASSES && __atomic_load_n(&g_lock_classes[i].name,
+                                                           __ATOMIC_ACQUIRE))
+        i++;
+    *count = i;
+    return g_lock_classes;
+}
+
+static bool update_max(uint64_t* max, uint64_t val) {
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (val > cur) {
+        if (__atomic_compare_exchange_n(max, &cur, val, /*weak=*/true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+void lock_profile_acquired(struct shim_lock* l, bool contended, uint64_t wait_start_tsc,
+                           const char* file, int line) {
+    struct shim_lock_class* class = l->class;
+    uint64_t now = lock_profile_tsc();
+
+    __atomic_add_fetch(&class->acquired, 1, __ATOMIC_RELAXED);
+    l->acquired_tsc = now;
+
+    if (!contended)
+        return;
+
+    __atomic_add_fetch(&class->contended, 1, __ATOMIC_RELAXED);
+    if (!wait_start_tsc || !now)
+        return;
+
+    uint64_t wait = now - wait_start_tsc;
+    __atomic_add_fetch(&class->wait_cycles, wait, __ATOMIC_RELAXED);
+    if (update_max(&class->max_wait_cycles, wait)) {
+        /* racy, but only informative */
+        class->max_wait_file = file;
+        class->max_wait_line = line;
+    }
+}
+
+void lock_profile_released(struct shim_lock* l) {
+    struct shim_lock_class* class = l->class;
+    uint64_t now = lock_profile_tsc();
+
+    if (!l->acquired_tsc || !now)
+        return;
+
+    uint64_t hold = now - l->acquired_tsc;
+    l->acquired_tsc = 0;
+    __atomic_add_fetch(&class->hold_cycles, hold, __ATOMIC_RELAXED);
+    update_max(&class->max_hold_cycles, hold);
+}
+
+void lock_profile_dump(void) {
+    size_t count;
+    const struct shim_lock_class* classes = lock_profile_classes(&count);
+
+    for (size_t i = 0; i < count; i++) {
+        const struct shim_lock_class* c = &classes[i];
+        if (!c->acquired)
+            continue;
+        debug("lock %s: acquired %lu, contended %lu, wait %lu us (max %lu us at %s:%d), "
+              "hold %lu us (max %lu us)\n", c->name, c->acquired, c->contended,
+              clock_tsc_to_ns(c->wait_cycles) / 1000, clock_tsc_to_ns(c->max_wait_cycles) / 1000,
+              c->max_wait_file ? : "-", c->max_wait_line, clock_tsc_to_ns(c->hold_cycles) / 1000,
+              clock_tsc_to_ns(c->max_hold_cycles) / 1000);
+    }
+}
+#endif /* LOCK_PROFILE */
@@ -22,6 +22,10 @@
  *
  * When existing slabs are not sufficient, or a large (4k or greater)
  * allocation is requested, it ends up here (__system_alloc and __system_free).
+ *
+ * Each thread allocates small objects from its own cache (slab_cache_alloc and
+ * slab_cache_free), so that slab_mgr_lock is only taken to move objects in
+ * batches between the cache and the shared slab manager.
  */
 
 #include <asm/mman.h>
@@ -49,6 +53,9 @@ static struct shim_lock slab_mgr_lock;
 
 static SLAB_MGR slab_mgr = NULL;
 
+static_assert(sizeof(SLAB_CACHE_TYPE) <= 2048 - SLAB_HDR_SIZE,
+              "per-thread slab cache must fit into a slab object");
+
 /* Returns NULL on failure */
 void* __system_malloc(size_t size) {
     size_t alloc_size = ALLOC_ALIGN_UP(size);
@@ -95,6 +102,37 @@ void __system_free(void* addr, size_t size) {
         BUG();
 }
 
+/* Shrinks or grows an allocation of __system_malloc in place. Growing succeeds only if the address
+ * range right after the allocation is free. */
+bool __system_resize(void* addr, size_t old_size, size_t new_size) {
+    old_size = ALLOC_ALIGN_UP(old_size);
+    new_size = ALLOC_ALIGN_UP(new_size);
+
+    if (new_size <= old_size) {
+        if (new_size < old_size)
+            __system_free(addr + new_size, old_size - new_size);
+        return true;
+    }
+
+    void* tail = addr + old_size;
+    size_t tail_size = new_size - old_size;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL;
+
+    if (tail + tail_size < tail || tail + tail_size > PAL_CB(user_address.end))
+        return false;
+
+    /* reserves exactly [tail, tail + tail_size), or nothing if it is (partially) in use */
+    if (bkeep_unmapped(tail + tail_size, tail, tail_size, PROT_READ | PROT_WRITE, flags, 0,
+                       "slab") != tail)
+        return false;
+
+    if (!DkVirtualMemoryAlloc(tail, tail_size, 0, PAL_PROT_WRITE | PAL_PROT_READ)) {
+        bkeep_munmap(tail, tail_size, flags);
+        return false;
+    }
+    return true;
+}
+
 int init_slab(void) {
     if (!create_lock(&slab_mgr_lock)) {
         return -ENOMEM;
@@ -108,7 +146,65 @@ int init_slab(void) {
 
 EXTERN_ALIAS(init_slab);
 
+/* Returns the cache of the current thread, allocating it on first use (NULL on failure). */
+static SLAB_CACHE get_slab_cache(shim_tcb_t* tcb) {
+    if (!tcb->slab_cache) {
+        SLAB_CACHE cache = slab_alloc(slab_mgr, sizeof(*cache));
+        if (!cache)
+            return NULL;
+        memset(cache, 0, sizeof(*cache));
+        tcb->slab_cache = cache;
+    }
+    return tcb->slab_cache;
+}
+
+/* The cache is used without locking, so preemption is disabled for a signal handler not to call
+ * malloc() or free() in the middle of it. Threads without a LibOS TCB (yet) use the slab manager
+ * directly. */
+static void* thread_cache_alloc(size_t size) {
+    if (!slab_mgr || !shim_tcb_check_canary())
+        return slab_alloc(slab_mgr, size);
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    disable_preempt(tcb);
+    void* mem = slab_cache_alloc(slab_mgr, get_slab_cache(tcb), size);
+    enable_preempt(tcb);
+    return mem;
+}
+
+static void thread_cache_free(void* mem) {
+    if (!shim_tcb_check_canary()) {
+        slab_free(slab_mgr, mem);
+        return;
+    }
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    disable_preempt(tcb);
+    slab_cache_free(slab_mgr, get_slab_cache(tcb), mem);
+    enable_preempt(tcb);
+}
+
+/* Returns the objects cached by the current thread; called right before the thread exits or its
+ * TCB is overwritten. */
+void free_thread_slab_cache(void) {
+    if (!slab_mgr || !shim_tcb_check_canary())
+        return;
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    SLAB_CACHE cache = tcb->slab_cache;
+    if (!cache)
+        return;
+
+    disable_preempt(tcb);
+    tcb->slab_cache = NULL;
+    slab_cache_flush(slab_mgr, cache);
+    slab_free(slab_mgr, cache);
+    enable_preempt(tcb);
+}
+
 int reinit_slab(void) {
+    if (shim_tcb_check_canary())
+        shim_get_tcb()->slab_cache = NULL;
     if (slab_mgr) {
         destroy_slab_mgr(slab_mgr);
         slab_mgr = NULL;
@@ -125,7 +221,7 @@ void* malloc(size_t size)
 #ifdef SLAB_DEBUG_TRACE
     void* mem = slab_alloc_debug(slab_mgr, size, file, line);
 #else
-    void* mem = slab_alloc(slab_mgr, size);
+    void* mem = thread_cache_alloc(size);
 #endif
 
     if (!mem) {
@@ -159,34 +255,21 @@ void* calloc(size_t nmemb, size_t size) {
 }
 EXTERN_ALIAS(calloc);
 
-#if 0 /* Temporarily disabling this code */
-void * realloc(void * ptr, size_t new_size)
-{
-    /* TODO: We can't deal with this case right now */
-    assert(!memory_migrated(ptr));
-
-    size_t old_size = slab_get_buf_size(slab_mgr, ptr);
-
-    /*
-     * TODO: this realloc() implementation follows the GLIBC design, which
-     * will avoid reallocation when the buffer is large enough. Potentially
-     * this design can cause memory draining if user resizes an extremely
-     * large object to much smaller.
-     */
-    if (old_size >= new_size)
-        return ptr;
+void* realloc(void* mem, size_t size) {
+    if (!mem)
+        return malloc(size);
 
-    void * new_buf = malloc(new_size);
-    if (!new_buf)
-        return NULL;
+    if (memory_migrated(mem)) {
+        /* memory migrated from the parent cannot be resized or freed, only copied */
+        void* new_mem = malloc(size);
+        if (new_mem)
+            memcpy(new_mem, mem, MIN(slab_get_buf_size(mem), size));
+        return new_mem;
+    }
 
-    memcpy(new_buf, ptr, old_size);
-    /* realloc() does not zero the rest of the object */
-    free(ptr);
-    return new_buf;
+    return slab_realloc(slab_mgr, mem, size);
 }
 EXTERN_ALIAS(realloc);
-#endif
 
 // Copies data from `mem` to a newly allocated buffer of a specified size.
 #if defined(SLAB_DEBUG_PRINT) || defined(SLABD_DEBUG_TRACE)
@@ -227,7 +310,7 @@ void free(void* mem)
 #ifdef SLAB_DEBUG_TRACE
     slab_free_debug(slab_mgr, mem, file, line);
 #else
-    slab_free(slab_mgr, mem);
+    thread_cache_free(mem);
 #endif
 }
 #if !defined(SLAB_DEBUG_PRINT) && !defined(SLABD_DEBUG_TRACE)
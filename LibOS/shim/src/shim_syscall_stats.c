@@ -0,0 +1,185 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * shim_syscall_stats.c
+ *
+ * Syscall statistics (see BEGIN_SHIM and END_SHIM in shim_internal.h). Each thread updates its own
+ * counters without any locking or atomic operation; the counters are only summed up on read,
+ * racily. The counters of the threads which exited are folded into g_exited_stats.
+ */
+
+#include <list.h>
+#include <pal.h>
+#include <shim_clock.h>
+#include <shim_internal.h>
+#include <shim_unistd.h>
+#include <shim_utils.h>
+
+DEFINE_LIST(shim_syscall_stats);
+struct shim_syscall_stats {
+    IDTYPE tid;
+    LIST_TYPE(shim_syscall_stats) list;
+    struct shim_syscall_stat syscalls[LIBOS_SYSCALL_BOUND];
+};
+
+bool g_syscall_stats_enabled;
+
+/* protects g_thread_stats and g_exited_stats */
+static struct shim_lock g_syscall_stats_lock;
+DEFINE_LISTP(shim_syscall_stats);
+static LISTP_TYPE(shim_syscall_stats) g_thread_stats;
+static struct shim_syscall_stat g_exited_stats[LIBOS_SYSCALL_BOUND];
+
+int init_syscall_stats(void) {
+    char cfg[CONFIG_MAX];
+    if (!root_config || get_config(root_config, "sys.syscall_stats", cfg, sizeof(cfg)) != 1 ||
+            cfg[0] != '1')
+        return 0;
+
+    if (!lock_created(&g_syscall_stats_lock) && !create_lock(&g_syscall_stats_lock))
+        return -ENOMEM;
+
+    g_syscall_stats_enabled = true;
+    return 0;
+}
+
+static struct shim_syscall_stats* get_thread_stats(shim_tcb_t* tcb) {
+    if (tcb->syscall_stats)
+        return tcb->syscall_stats;
+
+    struct shim_syscall_stats* stats = calloc(1, sizeof(*stats));
+    if (!stats)
+        return NULL;
+
+    stats->tid = tcb->tid;
+    INIT_LIST_HEAD(stats, list);
+    lock(&g_syscall_stats_lock);
+    LISTP_ADD_TAIL(stats, &g_thread_stats, list);
+    unlock(&g_syscall_stats_lock);
+    tcb->syscall_stats = stats;
+
+    if (g_tsc_readable) {
+        PAL_TCB* pal_tcb = pal_get_tcb();
+        pal_tcb->pal_call_start  = clock_rdtsc();
+        pal_tcb->pal_call_timing = true;
+    }
+    return stats;
+}
+
+void syscall_stats_begin(struct shim_syscall_start* start) {
+    if (!g_tsc_readable)
+        return;
+
+    start->pal_cycles = pal_get_tcb()->pal_call_cycles;
+    start->tsc        = clock_rdtsc();
+}
+
+static int hist_bucket(uint64_t cycles) {
+    uint64_t us = clock_tsc_to_ns(cycles) / 1000;
+    int bucket = us ? 64 - __builtin_clzl(us) : 0;
+    return MIN(bucket, SYSCALL_STATS_HIST_SIZE - 1);
+}
+
+void syscall_stats_end(int sysno, long ret, const struct shim_syscall_start* start) {
+    if (sysno < 0 || sysno >= LIBOS_SYSCALL_BOUND)
+        return;
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    struct shim_syscall_stats* stats = get_thread_stats(tcb);
+    if (!stats)
+        return;
+
+    struct shim_syscall_stat* stat = &stats->syscalls[sysno];
+    stat->calls++;
+    if (ret < 0 && ret >= -4095)
+        stat->errors++;
+
+    /* the first call of the thread is not timed, it only enables the timing of PAL calls */
+    if (!start->tsc || !pal_get_tcb()->pal_call_timing)
+        return;
+
+    uint64_t total = clock_rdtsc() - start->tsc;
+    uint64_t pal   = MIN(pal_get_tcb()->pal_call_cycles - start->pal_cycles, total);
+    stat->libos_cycles += total - pal;
+    stat->pal_cycles   += pal;
+    if (__atomic_load_n(&g_clock_data.tsc_mult, __ATOMIC_RELAXED))
+        stat->hist[hist_bucket(total)]++;
+}
+
+static void add_stats(struct shim_syscall_stat* total, const struct shim_syscall_stat* stats) {
+    for (int i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        total[i].calls        += stats[i].calls;
+        total[i].errors       += stats[i].errors;
+        total[i].libos_cycles += stats[i].libos_cycles;
+        total[i].pal_cycles   += stats[i].pal_cycles;
+        for (int j = 0; j < SYSCALL_STATS_HIST_SIZE; j++)
+            total[i].hist[j] += stats[i].hist[j];
+    }
+}
+
+/* Called by the exiting thread itself. */
+void syscall_stats_thread_exit(void) {
+    if (!g_syscall_stats_enabled)
+        return;
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    struct shim_syscall_stats* stats = tcb->syscall_stats;
+    if (!stats)
+        return;
+
+    tcb->syscall_stats = NULL;
+    pal_get_tcb()->pal_call_timing = false;
+
+    lock(&g_syscall_stats_lock);
+    LISTP_DEL(stats, &g_thread_stats, list);
+    add_stats(g_exited_stats, stats->syscalls);
+    unlock(&g_syscall_stats_lock);
+    free(stats);
+}
+
+/* `total` must have LIBOS_SYSCALL_BOUND entries, zeroed. */
+void syscall_stats_sum(struct shim_syscall_stat* total) {
+    if (!g_syscall_stats_enabled)
+        return;
+
+    lock(&g_syscall_stats_lock);
+    add_stats(total, g_exited_stats);
+    struct shim_syscall_stats* stats;
+    LISTP_FOR_EACH_ENTRY(stats, &g_thread_stats, list) {
+        add_stats(total, stats->syscalls);
+    }
+    unlock(&g_syscall_stats_lock);
+}
+
+/* Calls `callback` with the counters of each running thread, until it fails. */
+int syscall_stats_walk_threads(int (*callback)(IDTYPE tid, const struct shim_syscall_stat* stats,
+                                               void* arg),
+                               void* arg) {
+    if (!g_syscall_stats_enabled)
+        return 0;
+
+    int ret = 0;
+    lock(&g_syscall_stats_lock);
+    struct shim_syscall_stats* stats;
+    LISTP_FOR_EACH_ENTRY(stats, &g_thread_stats, list) {
+        ret = callback(stats->tid, stats->syscalls, arg);
+        if (ret < 0)
+            break;
+    }
+    unlock(&g_syscall_stats_lock);
+    return ret;
+}
@@ -20,6 +20,7 @@
  * Implementation of system call "alarm", "setitmer" and "getitimer".
  */
 
+#include <shim_clock.h>
 #include <shim_internal.h>
 #include <shim_signal.h>
 #include <shim_table.h>
@@ -93,7 +94,7 @@ int shim_do_setitimer(int which, struct __kernel_itimerval* value,
     if (ovalue && test_user_memory(ovalue, sizeof(*ovalue), true))
         return -EFAULT;
 
-    unsigned long setup_time = DkSystemTimeQuery();
+    unsigned long setup_time = get_time_us();
 
     unsigned long next_value = value->it_value.tv_sec * 1000000 + value->it_value.tv_usec;
     unsigned long next_reset = value->it_interval.tv_sec * 1000000 + value->it_interval.tv_usec;
@@ -136,7 +137,7 @@ int shim_do_getitimer(int which, struct __kernel_itimerval* value) {
     if (test_user_memory(value, sizeof(*value), true))
         return -EFAULT;
 
-    unsigned long setup_time = DkSystemTimeQuery();
+    unsigned long setup_time = get_time_us();
 
     MASTER_LOCK();
     unsigned long current_timeout =
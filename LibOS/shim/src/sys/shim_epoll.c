@@ -43,8 +43,7 @@
 #define EPOLLRDHUP  0x2000
 #endif
 
-/* TODO: 1024 handles/FDs is a small number for high-load servers (e.g., Linux has ~3M) */
-#define MAX_EPOLL_HANDLES 1024
+#define EPOLL_SET_INIT_SIZE 64UL
 
 struct shim_mount epoll_builtin_fs;
 
@@ -53,13 +52,273 @@ struct shim_epoll_item {
     uint64_t data;
     unsigned int events;
     unsigned int revents;
+    unsigned int disarmed;           /* events already reported, for EPOLLET and EPOLLONESHOT */
     bool connected;
+    bool deleted;                    /* deleted while on `rearm_list`, freed when taken off it */
+    bool rearm_queued;               /* on `rearm_list` of the epoll */
+    size_t pal_idx;                  /* slot in the epoll's set, 0 if not there */
     struct shim_handle* handle;      /* reference to monitored object (socket, pipe, file, etc) */
     struct shim_handle* epoll;       /* reference to epoll object that monitors handle object */
+    struct avl_tree_node fd_node;    /* node in `fds_tree` of the epoll */
+    struct shim_epoll_item* rearm_next;
     LIST_TYPE(shim_epoll_item) list; /* list of shim_epoll_items, used by epoll object (via `fds`) */
     LIST_TYPE(shim_epoll_item) back; /* list of epolls, used by handle object (via `epolls`) */
+    LIST_TYPE(shim_epoll_item) ready;   /* `ready` list of the epoll */
+    LIST_TYPE(shim_epoll_item) pending; /* `pending` list of the epoll */
 };
 
+/*
+ * Arrays passed to DkStreamsWaitEvents(). Slot 0 is the event handle that signals epoll updates,
+ * slots 1..cnt-1 are the epoll items that have a PAL handle and something to wait for. The set is
+ * updated in place by epoll_ctl() and epoll_wait(), except while it is polled (`in_use`): then the
+ * set is only marked stale, and rebuilt from scratch before the next poll.
+ */
+struct shim_epoll_set {
+    size_t cnt;
+    size_t size;
+    bool in_use;
+    PAL_HANDLE* pal_handles;
+    struct shim_epoll_item** items;
+    PAL_FLG* pal_events;
+    PAL_FLG* ret_events;
+};
+
+static bool epoll_item_cmp(struct avl_tree_node* a, struct avl_tree_node* b) {
+    return container_of(a, struct shim_epoll_item, fd_node)->fd <=
+           container_of(b, struct shim_epoll_item, fd_node)->fd;
+}
+
+static bool epoll_item_fd_cmp(void* fd, struct avl_tree_node* node) {
+    return *(FDTYPE*)fd <= container_of(node, struct shim_epoll_item, fd_node)->fd;
+}
+
+static struct shim_epoll_item* find_epoll_item(struct shim_epoll_handle* epoll, FDTYPE fd) {
+    struct avl_tree_node* node = avl_tree_lower_bound_fn(&epoll->fds_tree, &fd,
+                                                         epoll_item_fd_cmp);
+    if (!node)
+        return NULL;
+
+    struct shim_epoll_item* epoll_item = container_of(node, struct shim_epoll_item, fd_node);
+    return epoll_item->fd == fd ? epoll_item : NULL;
+}
+
+static struct shim_epoll_set* alloc_epoll_set(struct shim_epoll_handle* epoll, size_t size) {
+    struct shim_epoll_set* set = malloc(sizeof(*set) + size * (sizeof(PAL_HANDLE) +
+                                        sizeof(struct shim_epoll_item*) + 2 * sizeof(PAL_FLG)));
+    if (!set)
+        return NULL;
+
+    set->size        = size;
+    set->in_use      = false;
+    set->pal_handles = (PAL_HANDLE*)(set + 1);
+    set->items       = (struct shim_epoll_item**)(set->pal_handles + size);
+    set->pal_events  = (PAL_FLG*)(set->items + size);
+    set->ret_events  = set->pal_events + size;
+
+    /* populate "event" handle so it waits on read (meaning epoll-update signal arrived) */
+    set->pal_handles[0] = event_handle(&epoll->event);
+    set->items[0]       = NULL;
+    set->pal_events[0]  = PAL_WAIT_READ;
+    set->cnt            = 1;
+    return set;
+}
+
+static PAL_FLG epoll_item_pal_events(struct shim_epoll_item* epoll_item) {
+    if (!epoll_item->connected || !epoll_item->handle->pal_handle)
+        return 0;
+
+    unsigned int events = epoll_item->events & ~epoll_item->disarmed;
+    PAL_FLG pal_events  = (events & (EPOLLIN | EPOLLRDNORM)) ? PAL_WAIT_READ  : 0;
+    pal_events         |= (events & (EPOLLOUT | EPOLLWRNORM)) ? PAL_WAIT_WRITE : 0;
+    return pal_events;
+}
+
+/* puts `epoll_item` into `set`, updates its slot or (if `pal_events` is 0) takes it out of `set` */
+static void set_epoll_slot(struct shim_epoll_set* set, struct shim_epoll_item* epoll_item,
+                           PAL_FLG pal_events) {
+    assert(!set->in_use);
+    size_t idx = epoll_item->pal_idx;
+
+    if (!pal_events) {
+        if (!idx)
+            return;
+
+        /* move the last slot into the freed one */
+        size_t last = --set->cnt;
+        if (idx != last) {
+            set->pal_handles[idx] = set->pal_handles[last];
+            set->pal_events[idx]  = set->pal_events[last];
+            set->items[idx]       = set->items[last];
+            set->items[idx]->pal_idx = idx;
+        }
+        epoll_item->pal_idx = 0;
+        return;
+    }
+
+    if (!idx) {
+        assert(set->cnt < set->size);
+        idx = set->cnt++;
+        epoll_item->pal_idx = idx;
+        set->items[idx]     = epoll_item;
+    }
+    set->pal_handles[idx] = epoll_item->handle->pal_handle;
+    set->pal_events[idx]  = pal_events;
+}
+
+/*
+ * Brings the slot of `epoll_item` in the epoll's set up to date with the item. Returns true if the
+ * set changed, i.e. threads currently waiting on the epoll must retry.
+ * Lock of shim_handle enclosing this epoll should be held while calling this function.
+ */
+static bool update_epoll_item(struct shim_epoll_handle* epoll,
+                              struct shim_epoll_item* epoll_item) {
+    if (!epoll_item->handle->pal_handle) {
+        /* pipe and socket may not have pal_handle yet (e.g. before bind()), check it before every
+         * epoll_wait() */
+        if (LIST_EMPTY(epoll_item, pending))
+            LISTP_ADD_TAIL(epoll_item, &epoll->pending, pending);
+        return false;
+    }
+    if (!LIST_EMPTY(epoll_item, pending))
+        LISTP_DEL_INIT(epoll_item, &epoll->pending, pending);
+
+    if (epoll->set_stale) {
+        /* the set is rebuilt before the next poll, but sets polled now may be outdated too */
+        epoll->set_gen++;
+        return true;
+    }
+
+    PAL_FLG pal_events = epoll_item_pal_events(epoll_item);
+    PAL_FLG old_events = epoll_item->pal_idx ? epoll->set->pal_events[epoll_item->pal_idx] : 0;
+    if (pal_events == old_events)
+        return false;
+
+    epoll->set_gen++;
+    if (epoll->set->in_use) {
+        epoll->set_stale = true;
+        return true;
+    }
+    set_epoll_slot(epoll->set, epoll_item, pal_events);
+    return true;
+}
+
+/* lock of shim_handle enclosing this epoll should be held while calling this function */
+static void rebuild_epoll_set(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_set* set = epoll->set;
+    assert(!set->in_use);
+
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+        epoll_item->pal_idx = 0;
+    }
+
+    set->cnt = 1;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+        set_epoll_slot(set, epoll_item, epoll_item_pal_events(epoll_item));
+    }
+    epoll->set_stale = false;
+}
+
+/*
+ * Makes sure that the epoll's set has room for `cnt` items (plus the event handle).
+ * Lock of shim_handle enclosing this epoll should be held while calling this function.
+ */
+static int reserve_epoll_set(struct shim_epoll_handle* epoll, size_t cnt) {
+    struct shim_epoll_set* set = epoll->set;
+    if (cnt + 1 <= set->size)
+        return 0;
+
+    struct shim_epoll_set* new_set = alloc_epoll_set(epoll, MAX(set->size * 2, cnt + 1));
+    if (!new_set)
+        return -ENOMEM;
+
+    if (set->in_use) {
+        /* the old set is still polled by another thread, which frees it when done */
+        epoll->set_stale = true;
+        epoll->set_gen++;
+    } else {
+        memcpy(new_set->pal_handles, set->pal_handles, set->cnt * sizeof(*set->pal_handles));
+        memcpy(new_set->items, set->items, set->cnt * sizeof(*set->items));
+        memcpy(new_set->pal_events, set->pal_events, set->cnt * sizeof(*set->pal_events));
+        new_set->cnt = set->cnt;
+        free(set);
+    }
+    epoll->set = new_set;
+    return 0;
+}
+
+/* lock of shim_handle enclosing this epoll should be held while calling this function */
+static void notify_epoll_waiters(struct shim_epoll_handle* epoll) {
+    /* if other threads are currently waiting on epoll_wait(), send a signal to update their
+     * epoll items (note that we send waiter_cnt number of signals -- to each waiting thread) */
+    if (epoll->waiter_cnt)
+        set_event(&epoll->event, epoll->waiter_cnt);
+}
+
+/*
+ * Removes `epoll_item` (already unbound from its handle) from the epoll and frees it. Returns true
+ * if the epoll's set changed. Lock of shim_handle enclosing this epoll should be held while calling
+ * this function.
+ */
+static bool remove_epoll_item(struct shim_epoll_handle* epoll,
+                              struct shim_epoll_item* epoll_item) {
+    bool changed = false;
+
+    /* a set polled now (the epoll's one or a private copy of a waiter) may refer to the item, make
+     * its waiter ignore the results instead of marking the freed item ready */
+    epoll->set_gen++;
+
+    if (epoll->set_stale) {
+        changed = true;
+    } else if (epoll_item->pal_idx) {
+        if (epoll->set->in_use)
+            epoll->set_stale = true;
+        else
+            set_epoll_slot(epoll->set, epoll_item, 0);
+        changed = true;
+    }
+
+    LISTP_DEL(epoll_item, &epoll->fds, list);
+    avl_tree_delete(&epoll->fds_tree, &epoll_item->fd_node);
+    if (!LIST_EMPTY(epoll_item, ready))
+        LISTP_DEL(epoll_item, &epoll->ready, ready);
+    if (!LIST_EMPTY(epoll_item, pending))
+        LISTP_DEL(epoll_item, &epoll->pending, pending);
+    epoll->fds_cnt--;
+
+    /* the item is no longer on `epolls` list of its handle, so rearm_epoll_handles() cannot queue
+     * it anymore, but it may still be queued from before */
+    if (__atomic_load_n(&epoll_item->rearm_queued, __ATOMIC_ACQUIRE))
+        epoll_item->deleted = true;
+    else
+        free(epoll_item);
+    return changed;
+}
+
+/*
+ * Re-arms edge-triggered items queued by rearm_epoll_handles(). Returns true if the epoll's set
+ * changed. Lock of shim_handle enclosing this epoll should be held while calling this function.
+ */
+static bool rearm_epoll_items(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_item* epoll_item = __atomic_exchange_n(&epoll->rearm_list, NULL,
+                                                             __ATOMIC_ACQUIRE);
+    bool changed = false;
+
+    while (epoll_item) {
+        struct shim_epoll_item* next = epoll_item->rearm_next;
+        __atomic_store_n(&epoll_item->rearm_queued, false, __ATOMIC_RELEASE);
+
+        if (epoll_item->deleted) {
+            free(epoll_item);
+        } else if (!(epoll_item->events & EPOLLONESHOT)) {
+            epoll_item->disarmed = 0;
+            changed |= update_epoll_item(epoll, epoll_item);
+        }
+        epoll_item = next;
+    }
+    return changed;
+}
+
 int shim_do_epoll_create1(int flags) {
     if ((flags & ~EPOLL_CLOEXEC))
         return -EINVAL;
@@ -68,22 +327,26 @@ int shim_do_epoll_create1(int flags) {
     if (!hdl)
         return -ENOMEM;
 
-    PAL_HANDLE* pal_handles = malloc(sizeof(*pal_handles) * MAX_EPOLL_HANDLES);
-    if (!pal_handles) {
-        put_handle(hdl);
-        return -ENOMEM;
-    }
-
     struct shim_epoll_handle* epoll = &hdl->info.epoll;
 
     hdl->type = TYPE_EPOLL;
     set_handle_fs(hdl, &epoll_builtin_fs);
-    epoll->maxfds      = MAX_EPOLL_HANDLES;
-    epoll->pal_cnt     = 0;
-    epoll->waiter_cnt  = 0;
-    epoll->pal_handles = pal_handles;
+    epoll->waiter_cnt = 0;
+    epoll->set_stale  = false;
+    epoll->set_gen    = 0;
+    epoll->fds_cnt    = 0;
+    epoll->rearm_list = NULL;
+    epoll->fds_tree   = (struct avl_tree){ .root = NULL, .cmp = epoll_item_cmp };
     create_event(&epoll->event);
     INIT_LISTP(&epoll->fds);
+    INIT_LISTP(&epoll->ready);
+    INIT_LISTP(&epoll->pending);
+
+    epoll->set = alloc_epoll_set(epoll, EPOLL_SET_INIT_SIZE);
+    if (!epoll->set) {
+        put_handle(hdl);
+        return -ENOMEM;
+    }
 
     int vfd = set_new_fd_handle(hdl, (flags & EPOLL_CLOEXEC) ? FD_CLOEXEC : 0, NULL);
     put_handle(hdl);
@@ -98,27 +361,6 @@ int shim_do_epoll_create(int size) {
     return shim_do_epoll_create1(0);
 }
 
-/* lock of shim_handle enclosing this epoll should be held while calling this function */
-static void update_epoll(struct shim_epoll_handle* epoll) {
-    assert(locked(&container_of(epoll, struct shim_handle, info.epoll)->lock));
-
-    struct shim_epoll_item* tmp;
-    epoll->pal_cnt = 0;
-
-    LISTP_FOR_EACH_ENTRY(tmp, &epoll->fds, list) {
-        if (!tmp->connected || !tmp->handle || !tmp->handle->pal_handle)
-            continue;
-
-        assert(epoll->pal_cnt < MAX_EPOLL_HANDLES);
-        epoll->pal_handles[epoll->pal_cnt++] = tmp->handle->pal_handle;
-    }
-
-    /* if other threads are currently waiting on epoll_wait(), send a signal to update their
-     * epoll items (note that we send waiter_cnt number of signals -- to each waiting thread) */
-    if (epoll->waiter_cnt)
-        set_event(&epoll->event, epoll->waiter_cnt);
-}
-
 void delete_from_epoll_handles(struct shim_handle* handle) {
     /* handle may be registered in several epolls, delete it from all of them via handle->epolls */
     while (1) {
@@ -135,24 +377,62 @@ void delete_from_epoll_handles(struct shim_handle* handle) {
         LISTP_DEL(epoll_item, &handle->epolls, back);
         unlock(&handle->lock);
 
-        /* second, get epoll to which this epoll-item belongs to, and remove epoll-item from
-         * epoll's `fds` list, and trigger update_epoll() to re-populate pal_handles */
+        /* second, get epoll to which this epoll-item belongs to, remove epoll-item from the epoll
+         * and free it */
         struct shim_handle* hdl         = epoll_item->epoll;
         struct shim_epoll_handle* epoll = &hdl->info.epoll;
 
         lock(&hdl->lock);
-        LISTP_DEL(epoll_item, &epoll->fds, list);
-        update_epoll(epoll);
+        if (remove_epoll_item(epoll, epoll_item))
+            notify_epoll_waiters(epoll);
         unlock(&hdl->lock);
 
-        /* finally, free this epoll-item and put reference to epoll it belonged to
-         * (note that epoll is deleted only after all handles referring to this epoll are
-         * deleted from it, so we keep track of this via refcounting) */
-        free(epoll_item);
+        /* finally, put reference to epoll the epoll-item belonged to (note that epoll is deleted
+         * only after all handles referring to this epoll are deleted from it, so we keep track of
+         * this via refcounting) */
         put_handle(hdl);
     }
 }
 
+/*
+ * Called after the application performed I/O on `handle`: re-arms edge-triggered epoll items of the
+ * handle which already reported events. The host is polled for readiness and not notified about
+ * new edges, so an edge-triggered item stops waiting for the events it reported until the
+ * application reads or writes (e.g. until read() returns EAGAIN).
+ */
+void rearm_epoll_handles(struct shim_handle* handle) {
+    /* unlocked peek: this is called on every read and write, most handles are not in any epoll */
+    if (LISTP_EMPTY(&handle->epolls))
+        return;
+
+    lock(&handle->lock);
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
+        /* EPOLLONESHOT items are re-armed only by EPOLL_CTL_MOD */
+        if (!__atomic_load_n(&epoll_item->disarmed, __ATOMIC_RELAXED) ||
+                (__atomic_load_n(&epoll_item->events, __ATOMIC_RELAXED) & EPOLLONESHOT))
+            continue;
+
+        bool queued = false;
+        if (!__atomic_compare_exchange_n(&epoll_item->rearm_queued, &queued, true,
+                                         /*weak=*/false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        /* epoll lock may not be taken under handle lock, so the item goes to a lock-free list
+         * which is processed by the next epoll_wait() */
+        struct shim_epoll_handle* epoll = &epoll_item->epoll->info.epoll;
+        epoll_item->rearm_next = __atomic_load_n(&epoll->rearm_list, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&epoll->rearm_list, &epoll_item->rearm_next,
+                                            epoll_item, /*weak=*/true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+
+        if (!epoll_item->rearm_next && __atomic_load_n(&epoll->waiter_cnt, __ATOMIC_RELAXED))
+            set_event(&epoll->event, 1);
+    }
+    unlock(&handle->lock);
+}
+
 int shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* event) {
     struct shim_thread* cur = get_cur_thread();
     int ret                 = 0;
@@ -182,11 +462,9 @@ int shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* eve
 
     switch (op) {
         case EPOLL_CTL_ADD: {
-            LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                if (epoll_item->fd == fd) {
-                    ret = -EEXIST;
-                    goto out;
-                }
+            if (find_epoll_item(epoll, fd)) {
+                ret = -EEXIST;
+                goto out;
             }
 
             struct shim_handle* hdl = get_fd_handle(fd, NULL, cur->handle_map);
@@ -200,8 +478,9 @@ int shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* eve
                 put_handle(hdl);
                 goto out;
             }
-            if (epoll->pal_cnt == MAX_EPOLL_HANDLES) {
-                ret = -ENOSPC;
+
+            ret = reserve_epoll_set(epoll, epoll->fds_cnt + 1);
+            if (ret < 0) {
                 put_handle(hdl);
                 goto out;
             }
@@ -215,18 +494,24 @@ int shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* eve
             }
 
             debug("add fd %d (handle %p) to epoll handle %p\n", fd, hdl, epoll);
-            epoll_item->fd        = fd;
-            epoll_item->events    = event->events;
-            epoll_item->data      = event->data;
-            epoll_item->revents   = 0;
-            epoll_item->handle    = hdl;
-            epoll_item->epoll     = epoll_hdl;
-            epoll_item->connected = true;
+            epoll_item->fd           = fd;
+            epoll_item->events       = event->events;
+            epoll_item->data         = event->data;
+            epoll_item->revents      = 0;
+            epoll_item->disarmed     = 0;
+            epoll_item->handle       = hdl;
+            epoll_item->epoll        = epoll_hdl;
+            epoll_item->connected    = true;
+            epoll_item->deleted      = false;
+            epoll_item->rearm_queued = false;
+            epoll_item->pal_idx      = 0;
+            INIT_LIST_HEAD(epoll_item, ready);
+            INIT_LIST_HEAD(epoll_item, pending);
             get_handle(epoll_hdl);
 
             /* register hdl (corresponding to FD) in epoll (corresponding to EPFD):
              * - bind hdl to epoll-item via the `back` list
-             * - bind epoll-item to epoll via the `list` list */
+             * - bind epoll-item to epoll via the `list` list and `fds_tree` */
             lock(&hdl->lock);
             INIT_LIST_HEAD(epoll_item, back);
             LISTP_ADD_TAIL(epoll_item, &hdl->epolls, back);
@@ -235,54 +520,55 @@ int shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* eve
             /* note that we already grabbed epoll_hdl->lock so can safely update epoll */
             INIT_LIST_HEAD(epoll_item, list);
             LISTP_ADD_TAIL(epoll_item, &epoll->fds, list);
+            avl_tree_insert(&epoll->fds_tree, &epoll_item->fd_node);
+            epoll->fds_cnt++;
 
             put_handle(hdl);
 
-            update_epoll(epoll);
+            if (update_epoll_item(epoll, epoll_item))
+                notify_epoll_waiters(epoll);
             break;
         }
 
         case EPOLL_CTL_MOD: {
-            LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                if (epoll_item->fd == fd) {
-                    epoll_item->events = event->events;
-                    epoll_item->data   = event->data;
-
-                    debug("modified fd %d at epoll handle %p\n", fd, epoll);
-                    update_epoll(epoll);
-                    goto out;
-                }
+            epoll_item = find_epoll_item(epoll, fd);
+            if (!epoll_item) {
+                ret = -ENOENT;
+                break;
             }
 
-            ret = -ENOENT;
+            epoll_item->events   = event->events;
+            epoll_item->data     = event->data;
+            epoll_item->disarmed = 0;
+
+            debug("modified fd %d at epoll handle %p\n", fd, epoll);
+            if (update_epoll_item(epoll, epoll_item))
+                notify_epoll_waiters(epoll);
             break;
         }
 
         case EPOLL_CTL_DEL: {
-            LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                if (epoll_item->fd == fd) {
-                    struct shim_handle* hdl = epoll_item->handle;
-                    debug("delete fd %d (handle %p) from epoll handle %p\n", fd, hdl, epoll);
-
-                    /* unregister hdl (corresponding to FD) in epoll (corresponding to EPFD):
-                     * - unbind hdl from epoll-item via the `back` list
-                     * - unbind epoll-item from epoll via the `list` list */
-                    lock(&hdl->lock);
-                    LISTP_DEL(epoll_item, &hdl->epolls, back);
-                    unlock(&hdl->lock);
-
-                    /* note that we already grabbed epoll_hdl->lock so we can safely update epoll */
-                    LISTP_DEL(epoll_item, &epoll->fds, list);
-
-                    put_handle(epoll_hdl);
-                    free(epoll_item);
-
-                    update_epoll(epoll);
-                    goto out;
-                }
+            epoll_item = find_epoll_item(epoll, fd);
+            if (!epoll_item) {
+                ret = -ENOENT;
+                break;
             }
 
-            ret = -ENOENT;
+            struct shim_handle* hdl = epoll_item->handle;
+            debug("delete fd %d (handle %p) from epoll handle %p\n", fd, hdl, epoll);
+
+            /* unregister hdl (corresponding to FD) in epoll (corresponding to EPFD):
+             * - unbind hdl from epoll-item via the `back` list
+             * - unbind epoll-item from epoll and free it */
+            lock(&hdl->lock);
+            LISTP_DEL(epoll_item, &hdl->epolls, back);
+            unlock(&hdl->lock);
+
+            /* note that we already grabbed epoll_hdl->lock so we can safely update epoll */
+            if (remove_epoll_item(epoll, epoll_item))
+                notify_epoll_waiters(epoll);
+
+            put_handle(epoll_hdl);
             break;
         }
 
@@ -297,6 +583,27 @@ out:
     return ret;
 }
 
+/* lock of shim_handle enclosing this epoll should be held while calling this function */
+static bool mark_epoll_item_ready(struct shim_epoll_handle* epoll,
+                                  struct shim_epoll_item* epoll_item, PAL_FLG ret_events) {
+    bool changed = false;
+
+    if (ret_events & PAL_WAIT_ERROR) {
+        epoll_item->revents  |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+        epoll_item->connected = false;
+        /* handle disconnected, must remove it from the set */
+        changed = update_epoll_item(epoll, epoll_item);
+    }
+    if (ret_events & PAL_WAIT_READ)
+        epoll_item->revents |= EPOLLIN | EPOLLRDNORM;
+    if (ret_events & PAL_WAIT_WRITE)
+        epoll_item->revents |= EPOLLOUT | EPOLLWRNORM;
+
+    if (LIST_EMPTY(epoll_item, ready))
+        LISTP_ADD_TAIL(epoll_item, &epoll->ready, ready);
+    return changed;
+}
+
 int shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxevents,
                        int timeout_ms) {
     if (maxevents <= 0)
@@ -314,118 +621,128 @@ int shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxeve
     }
 
     struct shim_epoll_handle* epoll = &epoll_hdl->info.epoll;
-    bool need_update = false;
+    struct shim_epoll_item* epoll_item;
+    struct shim_epoll_item* tmp;
+    bool changed = false;
 
     lock(&epoll_hdl->lock);
 
     /* loop to retry on interrupted epoll waits (due to epoll being concurrently updated) */
     while (1) {
-        /* wait on epoll's PAL handles + one "event" handle that signals epoll updates */
-        PAL_HANDLE* pal_handles = malloc((epoll->pal_cnt + 1) * sizeof(PAL_HANDLE));
-        if (!pal_handles) {
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            return -ENOMEM;
-        }
+        changed |= rearm_epoll_items(epoll);
 
-        /* allocate one memory region to hold two PAL_FLG arrays: events and revents */
-        PAL_FLG* pal_events = malloc((epoll->pal_cnt + 1) * sizeof(PAL_FLG) * 2);
-        if (!pal_events) {
-            free(pal_handles);
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            return -ENOMEM;
+        LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp, &epoll->pending, pending) {
+            changed |= update_epoll_item(epoll, epoll_item);
         }
-        PAL_FLG* ret_events = pal_events + (epoll->pal_cnt + 1);
-
-        /* populate pal_events with read/write events from user-supplied epoll items */
-        int pal_cnt = 0;
-        struct shim_epoll_item* epoll_item;
-        LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-            if (!epoll_item->handle || !epoll_item->handle->pal_handle)
-                continue;
-
-            pal_handles[pal_cnt] = epoll_item->handle->pal_handle;
-            pal_events[pal_cnt]  = (epoll_item->events & (EPOLLIN | EPOLLRDNORM)) ? PAL_WAIT_READ  : 0;
-            pal_events[pal_cnt] |= (epoll_item->events & (EPOLLOUT | EPOLLWRNORM)) ? PAL_WAIT_WRITE : 0;
-            ret_events[pal_cnt]  = 0;
-            pal_cnt++;
+
+        if (epoll->set_stale && !epoll->set->in_use)
+            rebuild_epoll_set(epoll);
+
+        struct shim_epoll_set* set = epoll->set;
+        if (set->in_use || epoll->set_stale) {
+            /* another thread polls the shared set, poll a private copy of the epoll's items */
+            set = alloc_epoll_set(epoll, epoll->fds_cnt + 1);
+            if (!set) {
+                unlock(&epoll_hdl->lock);
+                put_handle(epoll_hdl);
+                return -ENOMEM;
+            }
+            LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+                PAL_FLG pal_events = epoll_item_pal_events(epoll_item);
+                if (!pal_events)
+                    continue;
+                set->pal_handles[set->cnt] = epoll_item->handle->pal_handle;
+                set->items[set->cnt]       = epoll_item;
+                set->pal_events[set->cnt]  = pal_events;
+                set->cnt++;
+            }
         }
+        set->in_use = true;
+
+        for (size_t i = 0; i < set->cnt; i++)
+            set->ret_events[i] = 0;
 
-        /* populate "event" handle so it waits on read (meaning epoll-update signal arrived);
-         * note that we don't increment pal_cnt because this is a special not-user-supplied item */
-        pal_handles[pal_cnt] = epoll->event.event;
-        pal_events[pal_cnt]  = PAL_WAIT_READ;
-        ret_events[pal_cnt]  = 0;
+        /* if some events are not reported yet, only check for other events without waiting */
+        uint64_t gen = epoll->set_gen;
+        int64_t timeout_us = LISTP_EMPTY(&epoll->ready) ? timeout_ms * 1000 : 0;
 
         epoll->waiter_cnt++;  /* mark epoll as being waited on (so epoll-update signal is sent) */
         unlock(&epoll_hdl->lock);
 
         /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
-        PAL_BOL polled = DkStreamsWaitEvents(pal_cnt + 1, pal_handles, pal_events, ret_events, timeout_ms * 1000);
+        PAL_BOL polled = DkStreamsWaitEvents(set->cnt, set->pal_handles, set->pal_events,
+                                             set->ret_events, timeout_us);
 
         lock(&epoll_hdl->lock);
         epoll->waiter_cnt--;
-
-        /* update user-supplied epoll items' revents with ret_events of polled PAL handles */
-        if (!ret_events[pal_cnt] && polled) {
-            /* only if epoll was not updated concurrently and something was actually polled */
-            for (int i = 0; i < pal_cnt; i++) {
-                LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                    if (!epoll_item->handle || !epoll_item->handle->pal_handle)
-                        continue;
-                    if (epoll_item->handle->pal_handle != pal_handles[i])
-                        continue;
-
-                    if (ret_events[i] & PAL_WAIT_ERROR) {
-                        epoll_item->revents  |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-                        epoll_item->connected = false;
-                        /* handle disconnected, must remove it from epoll list */
-                        need_update = true;
-                    }
-                    if (ret_events[i] & PAL_WAIT_READ)
-                        epoll_item->revents |= EPOLLIN | EPOLLRDNORM;
-                    if (ret_events[i] & PAL_WAIT_WRITE)
-                        epoll_item->revents |= EPOLLOUT | EPOLLWRNORM;
-                    break;
-                }
+        set->in_use = false;
+
+        PAL_FLG event_handle_update = set->ret_events[0];
+
+        /* update epoll items with ret_events of polled PAL handles, only if epoll was not updated
+         * concurrently and something was actually polled; go from the end, so that items taken out
+         * of the set do not move unvisited slots */
+        bool set_updated = gen != epoll->set_gen;
+        if (polled && !event_handle_update && !set_updated) {
+            for (size_t i = set->cnt - 1; i > 0; i--) {
+                if (set->ret_events[i])
+                    changed |= mark_epoll_item_ready(epoll, set->items[i], set->ret_events[i]);
             }
         }
 
-        PAL_FLG event_handle_update = ret_events[pal_cnt];
-        free(pal_handles);
-        free(pal_events);
+        if (set != epoll->set)
+            free(set);
 
         if (event_handle_update) {
             /* retry if epoll was updated concurrently (similar to Linux semantics) */
             unlock(&epoll_hdl->lock);
             wait_event(&epoll->event);
             lock(&epoll_hdl->lock);
-        } else {
+        } else if (!set_updated) {
             /* no need to retry, exit the while loop */
             break;
         }
     }
 
-    /* update user-supplied events array with all events detected till now on epoll */
+    /* report events of ready items, harvesting only the ready list; items with events left to
+     * report (level-triggered errors, or not fitting into `events`) are moved to its end */
     int nevents = 0;
-    struct shim_epoll_item* epoll_item;
-    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-        if (nevents == maxevents)
-            break;
+    LISTP_TYPE(shim_epoll_item) still_ready = LISTP_INIT;
+    while (nevents < maxevents && !LISTP_EMPTY(&epoll->ready)) {
+        epoll_item = LISTP_FIRST_ENTRY(&epoll->ready, struct shim_epoll_item, ready);
+        LISTP_DEL_INIT(epoll_item, &epoll->ready, ready);
 
         unsigned int monitored_events = epoll_item->events | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-        if (epoll_item->revents & monitored_events) {
-            events[nevents].events = epoll_item->revents & monitored_events;
-            events[nevents].data   = epoll_item->data;
+        unsigned int revents = epoll_item->revents & monitored_events & ~epoll_item->disarmed;
+        if (!revents) {
+            epoll_item->revents = 0;
+            continue;
+        }
+
+        events[nevents].events = revents;
+        events[nevents].data   = epoll_item->data;
+        nevents++;
+
+        if (epoll_item->events & EPOLLONESHOT) {
+            /* disabled until EPOLL_CTL_MOD */
+            epoll_item->disarmed = ~0u;
+            epoll_item->revents  = 0;
+        } else if (epoll_item->events & EPOLLET) {
+            /* not reported again until re-armed */
+            epoll_item->disarmed |= revents & (EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM);
+            epoll_item->revents   = 0;
+        } else {
             epoll_item->revents &= ~epoll_item->events; /* informed user about revents, may clear */
-            nevents++;
         }
+        changed |= update_epoll_item(epoll, epoll_item);
+
+        if (epoll_item->revents)
+            LISTP_ADD_TAIL(epoll_item, &still_ready, ready);
     }
+    LISTP_SPLICE_TAIL(&still_ready, &epoll->ready, ready, shim_epoll_item);
 
-    /* some handles were disconnected and thus must be removed from the epoll list */
-    if (need_update)
-        update_epoll(epoll);
+    if (changed)
+        notify_epoll_waiters(epoll);
 
     unlock(&epoll_hdl->lock);
     put_handle(epoll_hdl);
@@ -443,7 +760,17 @@ int shim_do_epoll_pwait(int epfd, struct __kernel_epoll_event* events, int maxev
 static int epoll_close(struct shim_handle* hdl) {
     struct shim_epoll_handle* epoll = &hdl->info.epoll;
 
-    free(epoll->pal_handles);
+    /* items deleted while queued for re-arming are freed only here */
+    struct shim_epoll_item* epoll_item = __atomic_exchange_n(&epoll->rearm_list, NULL,
+                                                             __ATOMIC_ACQUIRE);
+    while (epoll_item) {
+        struct shim_epoll_item* next = epoll_item->rearm_next;
+        assert(epoll_item->deleted);
+        free(epoll_item);
+        epoll_item = next;
+    }
+
+    free(epoll->set);
     destroy_event(&epoll->event);
 
     /* epoll is finally closed only after all FDs referring to it have been closed */
@@ -481,6 +808,7 @@ BEGIN_CP_FUNC(epoll_item) {
         new_epoll_item->events     = epoll_item->events;
         new_epoll_item->data       = epoll_item->data;
         new_epoll_item->revents    = epoll_item->revents;
+        new_epoll_item->disarmed   = epoll_item->disarmed;
 
         LISTP_ADD(new_epoll_item, new_list, list);
 
@@ -498,13 +826,41 @@ BEGIN_RS_FUNC(epoll_item) {
 
     CP_REBASE(*list);
 
+    /* the rest of the epoll state refers to the parent's memory, start from scratch */
+    struct shim_epoll_handle* epoll = container_of(list, struct shim_epoll_handle, fds);
+    struct shim_handle* epoll_hdl   = container_of(epoll, struct shim_handle, info.epoll);
+    epoll->waiter_cnt = 0;
+    epoll->set_stale  = true;
+    epoll->set_gen    = 0;
+    epoll->fds_cnt    = 0;
+    epoll->rearm_list = NULL;
+    epoll->fds_tree   = (struct avl_tree){ .root = NULL, .cmp = epoll_item_cmp };
+    INIT_LISTP(&epoll->ready);
+    INIT_LISTP(&epoll->pending);
+
     LISTP_FOR_EACH_ENTRY(epoll_item, list, list) {
         CP_REBASE(epoll_item->handle);
         CP_REBASE(epoll_item->back);
         CP_REBASE(epoll_item->list);
 
+        epoll_item->epoll        = epoll_hdl;
+        epoll_item->connected    = true;
+        epoll_item->deleted      = false;
+        epoll_item->rearm_queued = false;
+        epoll_item->pal_idx      = 0;
+        INIT_LIST_HEAD(epoll_item, ready);
+        INIT_LIST_HEAD(epoll_item, pending);
+        avl_tree_insert(&epoll->fds_tree, &epoll_item->fd_node);
+        epoll->fds_cnt++;
+
         DEBUG_RS("fd=%d,path=%s,type=%s,uri=%s", epoll_item->fd, qstrgetstr(&epoll_item->handle->path),
                  epoll_item->handle->fs_type, qstrgetstr(&epoll_item->handle->uri));
     }
+
+    epoll->event.event = NULL;
+    create_event(&epoll->event);
+    epoll->set = alloc_epoll_set(epoll, MAX(epoll->fds_cnt + 1, EPOLL_SET_INIT_SIZE));
+    if (!epoll->set)
+        return -ENOMEM;
 }
 END_RS_FUNC(epoll_item)
@@ -28,6 +28,7 @@
 
 #include <pal.h>
 #include <pal_error.h>
+#include <shim_checkpoint.h>
 #include <shim_fs.h>
 #include <shim_internal.h>
 #include <shim_ipc.h>
@@ -186,6 +187,9 @@ static int shim_do_execve_rtld(struct shim_handle* hdl, const char** argv, const
     if ((ret = close_cloexec_handle(cur_thread->handle_map)) < 0)
         return ret;
 
+    /* all memory is dropped below; hand over what children still fetch from it */
+    lazy_mem_exec();
+
     put_handle(cur_thread->exec);
     get_handle(hdl);
     cur_thread->exec = hdl;
@@ -222,8 +226,6 @@ static int shim_do_execve_rtld(struct shim_handle* hdl, const char** argv, const
     return 0;
 }
 
-#include <shim_checkpoint.h>
-
 static BEGIN_MIGRATION_DEF(execve, struct shim_thread* thread, struct shim_process* proc,
                            const char** envp) {
     DEFINE_MIGRATE(process, proc, sizeof(struct shim_process));
@@ -487,6 +489,7 @@ reopen:
     debug(
         "Temporary process %u is exiting after emulating execve (by forking new process to replace"
         " this one); will wait for forked process to exit...\n", cur_process.vmid & 0xFFFF);
+    lazy_mem_push_all();
     MASTER_LOCK();
     DkProcessExit(PAL_WAIT_FOR_CHILDREN_EXIT);
 
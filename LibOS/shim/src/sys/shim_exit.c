@@ -140,9 +140,13 @@ noreturn void thread_or_process_exit(int error_code, int term_signal) {
         if (ret < 0) {
             debug("failed to set up async cleanup_thread (exiting without clear child tid),"
                   " return code: %ld\n", ret);
+            syscall_stats_thread_exit();
+            free_thread_slab_cache();
             DkThreadExit(NULL);
         }
 
+        syscall_stats_thread_exit();
+        free_thread_slab_cache();
         DkThreadExit(&cur_thread->clear_child_tid_pal);
     }
 
@@ -33,8 +33,10 @@
 
 #include "api.h"
 #include "assert.h"
+#include "hash.h"
 #include "list.h"
 #include "pal.h"
+#include "shim_clock.h"
 #include "shim_internal.h"
 #include "shim_thread.h"
 #include "shim_types.h"
@@ -49,10 +51,13 @@ struct futex_waiter {
     struct shim_thread* thread;
     uint32_t bitset;
     LIST_TYPE(futex_waiter) list;
-    /* futex field is guarded by g_futex_list_lock, do not use it without taking that lock first.
-     * This is needed to ensure that a waiter knows what futex they were sleeping on, after they
-     * wake-up (because they could have been requeued to another futex).*/
+    /* futex field is guarded by the lock of the futex hash bucket, do not use it without taking
+     * that lock first. This is needed to ensure that a waiter knows what futex they were sleeping
+     * on, after they wake-up (because they could have been requeued to another futex).
+     * bucket field is the bucket of that futex; it can be read without any lock (to find out which
+     * lock to take), but is changed only with the lock of both old and new bucket held. */
     struct shim_futex* futex;
+    struct futex_bucket* bucket;
 };
 
 DEFINE_LIST(shim_futex);
@@ -62,13 +67,32 @@ struct shim_futex {
     LISTP_TYPE(futex_waiter) waiters;
     LIST_TYPE(shim_futex) list;
     /* This lock guards every access to *uaddr (futex word value) and waiters (above).
-     * Always take g_futex_list_lock before taking this lock. */
+     * Always take the lock of the futex hash bucket before taking this lock. */
     spinlock_t lock;
     REFTYPE _ref_count;
 };
 
-static LISTP_TYPE(shim_futex) g_futex_list = LISTP_INIT;
-static spinlock_t g_futex_list_lock = INIT_SPINLOCK_UNLOCKED;
+/*
+ * Active futexes (the ones with waiters) are kept in a hash table keyed by the futex address,
+ * similarly to the Linux kernel. Each bucket has its own lock, so operations on unrelated futexes
+ * do not contend on a global lock and lookups do not scan all futexes in the process.
+ */
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+struct futex_bucket {
+    LISTP_TYPE(shim_futex) futexes;
+    /* Guards `futexes` list and `futex` and `bucket` fields of waiters of these futexes. */
+    spinlock_t lock;
+};
+
+/* All-zero is a valid initial state of a bucket (empty list and unlocked spinlock). */
+static struct futex_bucket g_futex_table[FUTEX_HASH_SIZE];
+
+static struct futex_bucket* get_futex_bucket(uint32_t* uaddr) {
+    /* Futex words are 4-byte aligned; hash the remaining bits. */
+    return &g_futex_table[hash_u64((uintptr_t)uaddr >> 2) >> (64 - FUTEX_HASH_BITS)];
+}
 
 static void get_futex(struct shim_futex* futex) {
     REF_INC(futex->_ref_count);
@@ -148,20 +172,51 @@ static void unlock_two_futexes(struct shim_futex* futex1, struct shim_futex* fut
 }
 
 /*
- * Adds `futex` to `g_futex_list`.
+ * Locks two futex hash buckets in ascending order of their addresses (same bucket is locked only
+ * once). If a bucket is NULL, it is just skipped.
+ */
+static void lock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
+    if (bucket1 == bucket2 || !bucket2) {
+        bucket2 = NULL;
+    } else if (!bucket1 || bucket2 < bucket1) {
+        struct futex_bucket* tmp = bucket1;
+        bucket1 = bucket2;
+        bucket2 = tmp;
+    }
+
+    if (bucket1) {
+        spinlock_lock_signal_off(&bucket1->lock);
+    }
+    if (bucket2) {
+        spinlock_lock_signal_off(&bucket2->lock);
+    }
+}
+
+static void unlock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
+    if (bucket1) {
+        spinlock_unlock_signal_on(&bucket1->lock);
+    }
+    if (bucket2 && bucket2 != bucket1) {
+        spinlock_unlock_signal_on(&bucket2->lock);
+    }
+}
+
+/*
+ * Adds `futex` to its hash bucket `bucket`.
  *
- * `g_futex_list_lock` should be held while calling this function and you must ensure that nobody
+ * `bucket->lock` should be held while calling this function and you must ensure that nobody
  * is using `futex` (e.g. you have just created it).
  */
-static void enqueue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&g_futex_list_lock));
+static void enqueue_futex(struct futex_bucket* bucket, struct shim_futex* futex) {
+    assert(spinlock_is_locked(&bucket->lock));
+    assert(bucket == get_futex_bucket(futex->uaddr));
 
     get_futex(futex);
-    LISTP_ADD_TAIL(futex, &g_futex_list, list);
+    LISTP_ADD_TAIL(futex, &bucket->futexes, list);
 }
 
 /*
- * Checks whether `futex` has no waiters and is on `g_futex_list`.
+ * Checks whether `futex` has no waiters and is in the futex hash table.
  *
  * This requires only `futex->lock` to be held.
  */
@@ -172,35 +227,42 @@ static bool check_dequeue_futex(struct shim_futex* futex) {
 }
 
 static void _maybe_dequeue_futex(struct shim_futex* futex) {
+    struct futex_bucket* bucket = get_futex_bucket(futex->uaddr);
+
     assert(spinlock_is_locked(&futex->lock));
-    assert(spinlock_is_locked(&g_futex_list_lock));
+    assert(spinlock_is_locked(&bucket->lock));
 
     if (check_dequeue_futex(futex)) {
-        LISTP_DEL_INIT(futex, &g_futex_list, list);
+        LISTP_DEL_INIT(futex, &bucket->futexes, list);
         /* We still hold this futex reference (in the caller), so this won't call free. */
         put_futex(futex);
     }
 }
 
 /*
- * If `futex` has no waiters and is on `g_futex_list`, takes it off that list.
+ * If `futex` has no waiters and is in the futex hash table, takes it out of there.
  *
- * Neither `g_futex_list_lock` nor `futex->lock` should be held while calling this,
+ * Neither the bucket lock nor `futex->lock` should be held while calling this,
  * it acquires these locks itself.
  */
 static void maybe_dequeue_futex(struct shim_futex* futex) {
-    spinlock_lock_signal_off(&g_futex_list_lock);
+    struct futex_bucket* bucket = get_futex_bucket(futex->uaddr);
+
+    spinlock_lock_signal_off(&bucket->lock);
     spinlock_lock_signal_off(&futex->lock);
     _maybe_dequeue_futex(futex);
     spinlock_unlock_signal_on(&futex->lock);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    spinlock_unlock_signal_on(&bucket->lock);
 }
 
 /*
  * Same as `maybe_dequeue_futex`, but works for two futexes, any of which might be NULL.
  */
 static void maybe_dequeue_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    spinlock_lock_signal_off(&g_futex_list_lock);
+    struct futex_bucket* bucket1 = futex1 ? get_futex_bucket(futex1->uaddr) : NULL;
+    struct futex_bucket* bucket2 = futex2 ? get_futex_bucket(futex2->uaddr) : NULL;
+
+    lock_two_buckets(bucket1, bucket2);
     lock_two_futexes(futex1, futex2);
     if (futex1) {
         _maybe_dequeue_futex(futex1);
@@ -209,13 +271,13 @@ static void maybe_dequeue_two_futexes(struct shim_futex* futex1, struct shim_fut
         _maybe_dequeue_futex(futex2);
     }
     unlock_two_futexes(futex1, futex2);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    unlock_two_buckets(bucket1, bucket2);
 }
 
 /*
  * Adds `waiter` to `futex` waiters list.
- * You need to make sure that this futex is still on `g_futex_list`, but in most cases it follows
- * from the program control flow.
+ * You need to make sure that this futex is still in the futex hash table, but in most cases it
+ * follows from the program control flow.
  *
  * Increases refcount of current thread by 1 (in thread_setwait)
  * and of `futex` by 1.
@@ -231,6 +293,7 @@ static void add_futex_waiter(struct futex_waiter* waiter,
     waiter->bitset = bitset;
     get_futex(futex);
     waiter->futex = futex;
+    waiter->bucket = get_futex_bucket(futex->uaddr);
     LISTP_ADD_TAIL(waiter, &futex->waiters, list);
 }
 
@@ -250,20 +313,23 @@ static struct shim_thread* remove_futex_waiter(struct futex_waiter* waiter,
 
 /*
  * Moves waiter from `futex1` to `futex2`.
- * As in `add_futex_waiter`, `futex2` needs to be on `g_futex_list`.
+ * As in `add_futex_waiter`, `futex2` needs to be in the futex hash table.
  *
- * `futex1->lock` and `futex2->lock` need to be held.
+ * `futex1->lock` and `futex2->lock` need to be held, as well as the locks of their buckets.
  */
 static void move_futex_waiter(struct futex_waiter* waiter,
                               struct shim_futex* futex1,
                               struct shim_futex* futex2) {
     assert(spinlock_is_locked(&futex1->lock));
     assert(spinlock_is_locked(&futex2->lock));
+    assert(spinlock_is_locked(&get_futex_bucket(futex1->uaddr)->lock));
+    assert(spinlock_is_locked(&get_futex_bucket(futex2->uaddr)->lock));
 
     LISTP_DEL_INIT(waiter, &futex1->waiters, list);
     get_futex(futex2);
     put_futex(waiter->futex);
     waiter->futex = futex2;
+    __atomic_store_n(&waiter->bucket, get_futex_bucket(futex2->uaddr), __ATOMIC_RELAXED);
     LISTP_ADD_TAIL(waiter, &futex2->waiters, list);
 }
 
@@ -290,16 +356,17 @@ static struct shim_futex* create_new_futex(uint32_t* uaddr) {
 }
 
 /*
- * Finds a futex in `g_futex_list`.
- * Must be called with `g_futex_list_lock` held.
+ * Finds a futex in the hash bucket `bucket` (which must be the bucket of `uaddr`).
+ * Must be called with `bucket->lock` held.
  * Increases refcount of futex by 1.
  */
-static struct shim_futex* find_futex(uint32_t* uaddr) {
-    assert(spinlock_is_locked(&g_futex_list_lock));
+static struct shim_futex* find_futex(struct futex_bucket* bucket, uint32_t* uaddr) {
+    assert(spinlock_is_locked(&bucket->lock));
+    assert(bucket == get_futex_bucket(uaddr));
 
     struct shim_futex* futex;
 
-    LISTP_FOR_EACH_ENTRY(futex, &g_futex_list, list) {
+    LISTP_FOR_EACH_ENTRY(futex, &bucket->futexes, list) {
         if (futex->uaddr == uaddr) {
             get_futex(futex);
             return futex;
@@ -318,25 +385,26 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
     struct shim_futex* futex = NULL;
     struct shim_thread* thread = NULL;
     struct shim_futex* tmp = NULL;
+    struct futex_bucket* bucket = get_futex_bucket(uaddr);
 
-    spinlock_lock_signal_off(&g_futex_list_lock);
-    futex = find_futex(uaddr);
+    spinlock_lock_signal_off(&bucket->lock);
+    futex = find_futex(bucket, uaddr);
     if (!futex) {
-        spinlock_unlock_signal_on(&g_futex_list_lock);
+        spinlock_unlock_signal_on(&bucket->lock);
         tmp = create_new_futex(uaddr);
         if (!tmp) {
             return -ENOMEM;
         }
-        spinlock_lock_signal_off(&g_futex_list_lock);
-        futex = find_futex(uaddr);
+        spinlock_lock_signal_off(&bucket->lock);
+        futex = find_futex(bucket, uaddr);
         if (!futex) {
-            enqueue_futex(tmp);
+            enqueue_futex(bucket, tmp);
             futex = tmp;
             tmp = NULL;
         }
     }
     spinlock_lock_signal_off(&futex->lock);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    spinlock_unlock_signal_on(&bucket->lock);
 
     if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != val) {
         ret = -EAGAIN;
@@ -359,13 +427,22 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
         ret = -ETIMEDOUT;
     }
 
-    spinlock_lock_signal_off(&g_futex_list_lock);
-    /* We might have been requeued. Grab the (possibly new) futex reference. */
+    /* We might have been requeued. Lock the bucket of the (possibly new) futex; if we get requeued
+     * to another bucket in the meantime, try again. */
+    while (true) {
+        bucket = __atomic_load_n(&waiter.bucket, __ATOMIC_RELAXED);
+        spinlock_lock_signal_off(&bucket->lock);
+        if (bucket == __atomic_load_n(&waiter.bucket, __ATOMIC_RELAXED)) {
+            break;
+        }
+        spinlock_unlock_signal_on(&bucket->lock);
+    }
+    /* Grab the (possibly new) futex reference. */
     futex = waiter.futex;
     assert(futex);
     get_futex(futex);
     spinlock_lock_signal_off(&futex->lock);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    spinlock_unlock_signal_on(&bucket->lock);
 
     if (!LIST_EMPTY(&waiter, list)) {
         /* If we woke up due to time out, we were not removed from the waiters list (opposite
@@ -379,7 +456,7 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
     put_futex(waiter.futex);
 
 out_with_futex_lock: ; // C is awesome!
-    /* Because dequeuing a futex requires `g_futex_list_lock` which we do not hold at this moment,
+    /* Because dequeuing a futex requires the bucket lock which we do not hold at this moment,
      * we check if we actually need to do it now (locks acquisition and dequeuing). */
     bool needs_dequeue = check_dequeue_futex(futex);
 
@@ -447,14 +524,16 @@ static int futex_wake(uint32_t* uaddr, int to_wake, uint32_t bitset) {
         return -EINVAL;
     }
 
-    spinlock_lock_signal_off(&g_futex_list_lock);
-    futex = find_futex(uaddr);
+    struct futex_bucket* bucket = get_futex_bucket(uaddr);
+
+    spinlock_lock_signal_off(&bucket->lock);
+    futex = find_futex(bucket, uaddr);
     if (!futex) {
-        spinlock_unlock_signal_on(&g_futex_list_lock);
+        spinlock_unlock_signal_on(&bucket->lock);
         return 0;
     }
     spinlock_lock_signal_off(&futex->lock);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    spinlock_unlock_signal_on(&bucket->lock);
 
     woken = move_to_wake_queue(futex, bitset, to_wake, &queue);
 
@@ -490,13 +569,15 @@ static int futex_wake_op(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake1, int t
     int ret = 0;
     bool needs_dequeue1 = false;
     bool needs_dequeue2 = false;
+    struct futex_bucket* bucket1 = get_futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = get_futex_bucket(uaddr2);
 
-    spinlock_lock_signal_off(&g_futex_list_lock);
-    futex1 = find_futex(uaddr1);
-    futex2 = find_futex(uaddr2);
+    lock_two_buckets(bucket1, bucket2);
+    futex1 = find_futex(bucket1, uaddr1);
+    futex2 = find_futex(bucket2, uaddr2);
 
     lock_two_futexes(futex1, futex2);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
+    unlock_two_buckets(bucket1, bucket2);
 
     unsigned int op = (val3 >> 28) & 0x7; // highest bit is for FUTEX_OP_OPARG_SHIFT
     unsigned int cmp = (val3 >> 24) & 0xf;
@@ -611,28 +692,31 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
         return -EINVAL;
     }
 
-    spinlock_lock_signal_off(&g_futex_list_lock);
-    futex2 = find_futex(uaddr2);
+    /* Both buckets must be locked while moving waiters between them. */
+    struct futex_bucket* bucket1 = get_futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = get_futex_bucket(uaddr2);
+
+    lock_two_buckets(bucket1, bucket2);
+    futex2 = find_futex(bucket2, uaddr2);
     if (!futex2) {
-        spinlock_unlock_signal_on(&g_futex_list_lock);
+        unlock_two_buckets(bucket1, bucket2);
         tmp = create_new_futex(uaddr2);
         if (!tmp) {
             return -ENOMEM;
         }
         needs_dequeue2 = true;
 
-        spinlock_lock_signal_off(&g_futex_list_lock);
-        futex2 = find_futex(uaddr2);
+        lock_two_buckets(bucket1, bucket2);
+        futex2 = find_futex(bucket2, uaddr2);
         if (!futex2) {
-            enqueue_futex(tmp);
+            enqueue_futex(bucket2, tmp);
             futex2 = tmp;
             tmp = NULL;
         }
     }
-    futex1 = find_futex(uaddr1);
+    futex1 = find_futex(bucket1, uaddr1);
 
     lock_two_futexes(futex1, futex2);
-    spinlock_unlock_signal_on(&g_futex_list_lock);
 
     if (val != NULL) {
         if (__atomic_load_n(uaddr1, __ATOMIC_RELAXED) != *val) {
@@ -668,6 +752,7 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
 
 out_unlock:
     unlock_two_futexes(futex1, futex2);
+    unlock_two_buckets(bucket1, bucket2);
 
     if (needs_dequeue1 || needs_dequeue2) {
         maybe_dequeue_two_futexes(futex1, futex2);
@@ -716,7 +801,7 @@ static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, ui
         if (cmd != FUTEX_WAIT) {
             /* For FUTEX_WAIT, timeout is interpreted as a relative value, which differs from other
              * futex operations, where timeout is interpreted as an absolute value. */
-            uint64_t current_time = DkSystemTimeQuery();
+            uint64_t current_time = get_time_us();
             if (!current_time) {
                 return -EINVAL;
             }
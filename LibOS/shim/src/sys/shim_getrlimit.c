@@ -60,10 +60,10 @@ static struct __kernel_rlimit64 __rlim[RLIM_NLIMITS] __attribute_migratable = {
     [RLIMIT_RTTIME]     = {RLIM_INFINITY, RLIM_INFINITY},
 };
 
-static struct shim_lock rlimit_lock;
+static struct shim_rwlock rlimit_lock;
 
 int init_rlimit(void) {
-    if (!create_lock(&rlimit_lock)) {
+    if (!create_rwlock(&rlimit_lock)) {
         return -ENOMEM;
     }
     return 0;
@@ -71,17 +71,17 @@ int init_rlimit(void) {
 
 uint64_t get_rlimit_cur(int resource) {
     assert(resource >= 0 && RLIM_NLIMITS > resource);
-    lock(&rlimit_lock);
+    rwlock_read_lock(&rlimit_lock);
     uint64_t rlim = __rlim[resource].rlim_cur;
-    unlock(&rlimit_lock);
+    rwlock_read_unlock(&rlimit_lock);
     return rlim;
 }
 
 void set_rlimit_cur(int resource, uint64_t rlim) {
     assert(resource >= 0 && RLIM_NLIMITS > resource);
-    lock(&rlimit_lock);
+    rwlock_write_lock(&rlimit_lock);
     __rlim[resource].rlim_cur = rlim;
-    unlock(&rlimit_lock);
+    rwlock_write_unlock(&rlimit_lock);
 }
 
 int shim_do_getrlimit(int resource, struct __kernel_rlimit* rlim) {
@@ -90,10 +90,10 @@ int shim_do_getrlimit(int resource, struct __kernel_rlimit* rlim) {
     if (!rlim || test_user_memory(rlim, sizeof(*rlim), true))
         return -EFAULT;
 
-    lock(&rlimit_lock);
+    rwlock_read_lock(&rlimit_lock);
     rlim->rlim_cur = __rlim[resource].rlim_cur;
     rlim->rlim_max = __rlim[resource].rlim_max;
-    unlock(&rlimit_lock);
+    rwlock_read_unlock(&rlimit_lock);
     return 0;
 }
 
@@ -108,15 +108,15 @@ int shim_do_setrlimit(int resource, struct __kernel_rlimit* rlim) {
     if (rlim->rlim_cur > rlim->rlim_max)
         return -EINVAL;
 
-    lock(&rlimit_lock);
+    rwlock_write_lock(&rlimit_lock);
     if (rlim->rlim_max > __rlim[resource].rlim_max && cur_thread->euid) {
-        unlock(&rlimit_lock);
+        rwlock_write_unlock(&rlimit_lock);
         return -EPERM;
     }
 
     __rlim[resource].rlim_cur = rlim->rlim_cur;
     __rlim[resource].rlim_max = rlim->rlim_max;
-    unlock(&rlimit_lock);
+    rwlock_write_unlock(&rlimit_lock);
     return 0;
 }
 
@@ -138,32 +138,33 @@ int shim_do_prlimit64(pid_t pid, int resource, const struct __kernel_rlimit64* n
             return -EFAULT;
     }
 
-    if (new_rlim) {
-        if (test_user_memory((void*)new_rlim, sizeof(*new_rlim), false)) {
-            ret = -EFAULT;
-            goto out;
-        }
-        if (new_rlim->rlim_cur > new_rlim->rlim_max) {
-            ret = -EINVAL;
-            goto out;
+    if (!new_rlim) {
+        /* getrlimit() of glibc ends up here */
+        if (old_rlim) {
+            rwlock_read_lock(&rlimit_lock);
+            *old_rlim = __rlim[resource];
+            rwlock_read_unlock(&rlimit_lock);
         }
+        return 0;
     }
 
-    lock(&rlimit_lock);
+    if (test_user_memory((void*)new_rlim, sizeof(*new_rlim), false))
+        return -EFAULT;
+    if (new_rlim->rlim_cur > new_rlim->rlim_max)
+        return -EINVAL;
 
-    if (new_rlim) {
-        if (new_rlim->rlim_max > __rlim[resource].rlim_max && cur_thread->euid) {
-            ret = -EPERM;
-            goto out;
-        }
+    rwlock_write_lock(&rlimit_lock);
+
+    if (new_rlim->rlim_max > __rlim[resource].rlim_max && cur_thread->euid) {
+        ret = -EPERM;
+        goto out;
     }
 
     if (old_rlim)
         *old_rlim = __rlim[resource];
-    if (new_rlim)
-        __rlim[resource] = *new_rlim;
+    __rlim[resource] = *new_rlim;
 
 out:
-    unlock(&rlimit_lock);
+    rwlock_write_unlock(&rlimit_lock);
     return ret;
 }
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <pal.h>
 #include <pal_error.h>
+#include <shim_checkpoint.h>
 #include <shim_fs.h>
 #include <shim_handle.h>
 #include <shim_internal.h>
@@ -96,6 +97,16 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t
         }
     }
 
+    if (flags & MAP_FIXED) {
+        /* the new mapping replaces memory that may be migrated lazily */
+        ret = lazy_mem_prepare(addr, length, /*discard=*/true);
+        if (ret < 0) {
+            if (hdl)
+                put_handle(hdl);
+            return (void*)ret;
+        }
+    }
+
     if (addr) {
         bkeep_mmap(addr, length, prot, flags, hdl, offset, NULL);
     } else {
@@ -150,6 +161,10 @@ int shim_do_mprotect(void* addr, size_t length, int prot) {
     if (!IS_ALLOC_ALIGNED(length))
         length = ALLOC_ALIGN_UP(length);
 
+    int ret = lazy_mem_prepare(addr, length, /*discard=*/false);
+    if (ret < 0)
+        return ret;
+
     if (bkeep_mprotect(addr, length, prot, 0) < 0)
         return -EPERM;
 
@@ -186,6 +201,10 @@ int shim_do_munmap(void* addr, size_t length) {
     if (vma.file)
         put_handle(vma.file);
 
+    int ret = lazy_mem_prepare(addr, length, /*discard=*/true);
+    if (ret < 0)
+        return ret;
+
     /* Protect first to make sure no overlapping with internal
      * mappings */
     if (bkeep_mprotect(addr, length, PROT_NONE, 0) < 0)
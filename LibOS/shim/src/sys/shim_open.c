@@ -71,6 +71,7 @@ size_t shim_do_read (int fd, void * buf, size_t count)
     }
 
     int ret = do_handle_read(hdl, buf, count);
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -102,6 +103,7 @@ size_t shim_do_write (int fd, const void * buf, size_t count)
         return -EBADF;
 
     int ret = do_handle_write(hdl, buf, count);
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -988,6 +988,7 @@ int shim_do_accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
         return -EBADF;
 
     int ret = __do_accept(hdl, flags & O_CLOEXEC, addr, addrlen);
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -1000,6 +1001,7 @@ int shim_do_accept4(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags
     int ret = __do_accept(
         hdl, (flags & SOCK_CLOEXEC ? O_CLOEXEC : 0) | (flags & SOCK_NONBLOCK ? O_NONBLOCK : 0),
         addr, addrlen);
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -1125,6 +1127,7 @@ out_locked:
 
     unlock(&hdl->lock);
 out:
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -1247,16 +1250,15 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, int nbufs, int flags, stru
             /* realloc peek buffer to accommodate expected read size */
             if (expected_size > peek_buffer->size - peek_buffer->start) {
                 size_t expand = expected_size - (peek_buffer->size - peek_buffer->start);
-                struct shim_peek_buffer* old_peek_buffer = peek_buffer;
-                peek_buffer = malloc(sizeof(*peek_buffer) + old_peek_buffer->size + expand);
-                if (!peek_buffer) {
+                struct shim_peek_buffer* new_peek_buffer =
+                    realloc(peek_buffer, sizeof(*peek_buffer) + peek_buffer->size + expand);
+                if (!new_peek_buffer) {
                     ret = -ENOMEM;
                     lock(&hdl->lock);
                     goto out_locked;
                 }
-                memcpy(peek_buffer, old_peek_buffer, sizeof(*peek_buffer) + old_peek_buffer->size);
+                peek_buffer = new_peek_buffer;
                 peek_buffer->size += expand;
-                free(old_peek_buffer);
             }
         }
 
@@ -1379,6 +1381,7 @@ out_locked:
     unlock(&hdl->lock);
     free(peek_buffer);
 out:
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
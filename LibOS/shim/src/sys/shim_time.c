@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <pal.h>
 #include <pal_error.h>
+#include <shim_clock.h>
 #include <shim_fs.h>
 #include <shim_handle.h>
 #include <shim_internal.h>
@@ -38,26 +39,26 @@ int shim_do_gettimeofday(struct __kernel_timeval* tv, struct __kernel_timezone*
     if (tz && test_user_memory(tz, sizeof(*tz), true))
         return -EFAULT;
 
-    long time = DkSystemTimeQuery();
+    uint64_t time;
+    int ret = get_clock_time(CLOCK_REALTIME, &time);
+    if (ret < 0)
+        return ret;
 
-    if (time == -1)
-        return -PAL_ERRNO;
-
-    tv->tv_sec  = time / 1000000;
-    tv->tv_usec = time % 1000000;
+    tv->tv_sec  = time / 1000000000;
+    tv->tv_usec = time % 1000000000 / 1000;
     return 0;
 }
 
 time_t shim_do_time(time_t* tloc) {
-    long time = DkSystemTimeQuery();
-
-    if (time == -1)
-        return -PAL_ERRNO;
+    uint64_t time;
+    int ret = get_clock_time(CLOCK_REALTIME, &time);
+    if (ret < 0)
+        return ret;
 
     if (tloc && test_user_memory(tloc, sizeof(*tloc), true))
         return -EFAULT;
 
-    time_t t = time / 1000000;
+    time_t t = time / 1000000000;
 
     if (tloc)
         *tloc = t;
@@ -66,36 +67,35 @@ time_t shim_do_time(time_t* tloc) {
 }
 
 int shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
-    /* all clock are the same */
-    __UNUSED(which_clock);
-
     if (!tp)
         return -EINVAL;
 
     if (test_user_memory(tp, sizeof(*tp), true))
         return -EFAULT;
 
-    long time = DkSystemTimeQuery();
+    uint64_t time;
+    int ret = get_clock_time(which_clock, &time);
+    if (ret < 0)
+        return ret;
 
-    if (time == -1)
-        return -PAL_ERRNO;
-
-    tp->tv_sec  = time / 1000000;
-    tp->tv_nsec = (time % 1000000) * 1000;
+    tp->tv_sec  = time / 1000000000;
+    tp->tv_nsec = time % 1000000000;
     return 0;
 }
 
 int shim_do_clock_getres(clockid_t which_clock, struct timespec* tp) {
-    /* all clock are the same */
-    __UNUSED(which_clock);
-
     if (!tp)
         return -EINVAL;
 
     if (test_user_memory(tp, sizeof(*tp), true))
         return -EFAULT;
 
+    uint64_t res;
+    int ret = get_clock_res(which_clock, &res);
+    if (ret < 0)
+        return ret;
+
     tp->tv_sec  = 0;
-    tp->tv_nsec = 1000;
+    tp->tv_nsec = res;
     return 0;
 }
@@ -72,6 +72,7 @@ ssize_t shim_do_readv(int fd, const struct iovec* vec, int vlen) {
 
     ret = bytes;
 out:
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
@@ -115,6 +116,11 @@ ssize_t shim_do_writev(int fd, const struct iovec* vec, int vlen) {
         goto out;
     }
 
+    if (hdl->fs->fs_ops->writev) {
+        ret = hdl->fs->fs_ops->writev(hdl, vec, vlen);
+        goto out;
+    }
+
     ssize_t bytes = 0;
 
     for (int i = 0; i < vlen; i++) {
@@ -134,6 +140,7 @@ ssize_t shim_do_writev(int fd, const struct iovec* vec, int vlen) {
 
     ret = bytes;
 out:
+    rearm_epoll_handles(hdl);
     put_handle(hdl);
     return ret;
 }
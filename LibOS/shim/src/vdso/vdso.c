@@ -19,6 +19,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <shim_clock.h>
 #include <shim_types.h>
 
 /*
@@ -31,16 +32,34 @@ static int (*shim_clock_gettime)(clockid_t clock, struct timespec* t)    = NULL;
 static int (*shim_gettimeofday)(struct timeval* tv, struct timezone* tz) = NULL;
 static time_t (*shim_time)(time_t* t)                                    = NULL;
 static long (*shim_getcpu)(unsigned* cpu, struct getcpu_cache* unused)   = NULL;
+static const struct shim_clock_data* shim_clock_data                     = NULL;
 
 EXPORT_SYMBOL(shim_clock_gettime);
 EXPORT_SYMBOL(shim_gettimeofday);
 EXPORT_SYMBOL(shim_time);
 EXPORT_SYMBOL(shim_getcpu);
+EXPORT_SYMBOL(shim_clock_data);
 
 #define EXPORT_WEAK_SYMBOL(name) \
     __typeof__(__vdso_##name) name __attribute__((weak, alias("__vdso_" #name)))
 
+/*
+ * The clocks are read from the clock data of LibOS (see shim_clock.c) without entering LibOS, as
+ * long as it is calibrated; otherwise LibOS is called to recalibrate it or to query the host.
+ */
+static bool vdso_clock_read(bool monotonic, uint64_t* time_ns) {
+    return shim_clock_data && clock_data_read(shim_clock_data, monotonic, /*check_period=*/true,
+                                              time_ns);
+}
+
 int __vdso_clock_gettime(clockid_t clock, struct timespec* t) {
+    int monotonic = clock_is_monotonic(clock);
+    uint64_t time_ns;
+    if (t && monotonic >= 0 && vdso_clock_read(monotonic, &time_ns)) {
+        t->tv_sec  = time_ns / 1000000000;
+        t->tv_nsec = time_ns % 1000000000;
+        return 0;
+    }
     if (shim_clock_gettime)
         return (*shim_clock_gettime)(clock, t);
     return -ENOSYS;
@@ -48,6 +67,12 @@ int __vdso_clock_gettime(clockid_t clock, struct timespec* t) {
 EXPORT_WEAK_SYMBOL(clock_gettime);
 
 int __vdso_gettimeofday(struct timeval* tv, struct timezone* tz) {
+    uint64_t time_ns;
+    if (tv && !tz && vdso_clock_read(/*monotonic=*/false, &time_ns)) {
+        tv->tv_sec  = time_ns / 1000000000;
+        tv->tv_usec = time_ns / 1000 % 1000000;
+        return 0;
+    }
     if (shim_gettimeofday)
         return (*shim_gettimeofday)(tv, tz);
     return -ENOSYS;
@@ -55,6 +80,13 @@ int __vdso_gettimeofday(struct timeval* tv, struct timezone* tz) {
 EXPORT_WEAK_SYMBOL(gettimeofday);
 
 time_t __vdso_time(time_t* t) {
+    uint64_t time_ns;
+    if (vdso_clock_read(/*monotonic=*/false, &time_ns)) {
+        time_t ret = time_ns / 1000000000;
+        if (t)
+            *t = ret;
+        return ret;
+    }
     if (shim_time)
         return (*shim_time)(t);
     return -ENOSYS;
@@ -0,0 +1,101 @@
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define NTRIES     10000
+#define MAX_PAIRS  16
+#define MAX_IDLERS 64
+
+/* Measures FUTEX_WAIT/FUTEX_WAKE ping-pong between pairs of threads, while other threads sleep on
+ * their own futexes. Every futex with waiters is "live" in Graphene, so the idle threads make the
+ * lookups of the ping-pong futexes more expensive, unless futexes are hashed. */
+
+static uint32_t turns[MAX_PAIRS];
+static uint32_t idle_words[MAX_IDLERS];
+static uint32_t idle_ready;
+
+static long futex(uint32_t* uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static void* idler(void* arg) {
+    uint32_t* word = arg;
+    __atomic_add_fetch(&idle_ready, 1, __ATOMIC_RELAXED);
+    while (!__atomic_load_n(word, __ATOMIC_ACQUIRE))
+        futex(word, FUTEX_WAIT_PRIVATE, 0);
+    return NULL;
+}
+
+static void* player(void* arg) {
+    uintptr_t id = (uintptr_t)arg;
+    uint32_t* turn = &turns[id / 2];
+    uint32_t me = id % 2;
+
+    for (int i = 0; i < NTRIES; i++) {
+        uint32_t cur;
+        while ((cur = __atomic_load_n(turn, __ATOMIC_ACQUIRE)) != me)
+            futex(turn, FUTEX_WAIT_PRIVATE, cur);
+        __atomic_store_n(turn, !me, __ATOMIC_RELEASE);
+        futex(turn, FUTEX_WAKE_PRIVATE, 1);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int pairs  = 4;
+    int idlers = 32;
+    pthread_t players[MAX_PAIRS * 2];
+    pthread_t idle_threads[MAX_IDLERS];
+
+    if (argc >= 2) {
+        pairs = atoi(argv[1]);
+        if (pairs <= 0 || pairs > MAX_PAIRS)
+            return 1;
+    }
+    if (argc >= 3) {
+        idlers = atoi(argv[2]);
+        if (idlers < 0 || idlers > MAX_IDLERS)
+            return 1;
+    }
+
+    for (int i = 0; i < idlers; i++) {
+        if (pthread_create(&idle_threads[i], NULL, idler, &idle_words[i])) {
+            printf("pthread_create failed\n");
+            return 1;
+        }
+    }
+    while (__atomic_load_n(&idle_ready, __ATOMIC_RELAXED) != (uint32_t)idlers)
+        usleep(1000);
+    /* give the idle threads time to actually fall asleep */
+    usleep(100000);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    for (uintptr_t i = 0; i < (uintptr_t)pairs * 2; i++) {
+        if (pthread_create(&players[i], NULL, player, (void*)i)) {
+            printf("pthread_create failed\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < pairs * 2; i++)
+        pthread_join(players[i], NULL);
+
+    gettimeofday(&end, NULL);
+
+    for (int i = 0; i < idlers; i++) {
+        __atomic_store_n(&idle_words[i], 1, __ATOMIC_RELEASE);
+        futex(&idle_words[i], FUTEX_WAKE_PRIVATE, 1);
+        pthread_join(idle_threads[i], NULL);
+    }
+
+    unsigned long long us = (end.tv_sec - start.tv_sec) * 1000000ULL + end.tv_usec - start.tv_usec;
+    printf("futex ping-pong of %d thread pairs with %d idle waiters: %.0f round trips/second\n",
+           pairs, idlers, 1.0 * NTRIES * pairs * 1000000 / us);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define NTRIES      100000
+#define MAX_THREADS 32
+
+/* Measures the throughput of syscalls which only take internal locks of Graphene, run by a growing
+ * number of threads: getrlimit() takes the read-mostly rlimit lock as a reader, fcntl(F_GETFD)
+ * takes the lock of the handle map of the process, and dup() + close() take it to modify the map.
+ * With uncontended locks that do not enter the PAL, a single thread runs without any PAL call. */
+
+static int g_fd;
+static pthread_barrier_t g_barrier;
+
+static void op_getrlimit(void) {
+    struct rlimit rlim;
+    if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        abort();
+}
+
+static void op_fcntl(void) {
+    if (fcntl(g_fd, F_GETFD) < 0)
+        abort();
+}
+
+static void op_dup_close(void) {
+    int fd = dup(g_fd);
+    if (fd < 0 || close(fd) < 0)
+        abort();
+}
+
+static const struct {
+    const char* name;
+    void (*op)(void);
+} g_ops[] = {
+    {"getrlimit", op_getrlimit},
+    {"fcntl(F_GETFD)", op_fcntl},
+    {"dup+close", op_dup_close},
+};
+
+static void* worker(void* arg) {
+    void (*op)(void) = arg;
+
+    pthread_barrier_wait(&g_barrier);
+    for (int i = 0; i < NTRIES; i++)
+        op();
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int max_threads = 8;
+    pthread_t threads[MAX_THREADS];
+
+    if (argc >= 2) {
+        max_threads = atoi(argv[1]);
+        if (max_threads <= 0 || max_threads > MAX_THREADS)
+            return 1;
+    }
+
+    g_fd = open("/dev/null", O_RDONLY);
+    if (g_fd < 0) {
+        printf("open failed\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(g_ops) / sizeof(g_ops[0]); i++) {
+        for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+            pthread_barrier_init(&g_barrier, NULL, nthreads);
+
+            struct timeval start, end;
+            gettimeofday(&start, NULL);
+
+            for (int j = 0; j < nthreads; j++) {
+                if (pthread_create(&threads[j], NULL, worker, g_ops[i].op)) {
+                    printf("pthread_create failed\n");
+                    return 1;
+                }
+            }
+            for (int j = 0; j < nthreads; j++)
+                pthread_join(threads[j], NULL);
+
+            gettimeofday(&end, NULL);
+            pthread_barrier_destroy(&g_barrier);
+
+            unsigned long long us = (end.tv_sec - start.tv_sec) * 1000000ULL + end.tv_usec -
+                                    start.tv_usec;
+            printf("%s with %d threads: %.0f calls/second\n", g_ops[i].name, nthreads,
+                   1.0 * NTRIES * nthreads * 1000000 / us);
+        }
+    }
+
+    close(g_fd);
+    return 0;
+}
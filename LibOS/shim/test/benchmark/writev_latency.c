@@ -0,0 +1,55 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define NTRIES   1000
+#define MAX_IOVS 64
+#define IOV_SIZE 64
+
+/* Measures writev() of many small buffers to a file, the typical pattern of logging; Graphene
+ * submits such a writev() to the host as one batch of writes */
+int main(int argc, char** argv) {
+    int iovcnt = MAX_IOVS;
+    static char bufs[MAX_IOVS][IOV_SIZE];
+    struct iovec iov[MAX_IOVS];
+
+    if (argc >= 2) {
+        iovcnt = atoi(argv[1]);
+        if (iovcnt <= 0 || iovcnt > MAX_IOVS)
+            return 1;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        snprintf(bufs[i], IOV_SIZE, "%63d", i);
+        bufs[i][IOV_SIZE - 1] = '\n';
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len  = IOV_SIZE;
+    }
+
+    int fd = open("writev_latency.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("open error");
+        return 1;
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    for (int i = 0; i < NTRIES; i++) {
+        if (writev(fd, iov, iovcnt) != iovcnt * IOV_SIZE) {
+            perror("writev error");
+            return 1;
+        }
+    }
+
+    gettimeofday(&end, NULL);
+    close(fd);
+    unlink("writev_latency.tmp");
+
+    unsigned long long us = (end.tv_sec - start.tv_sec) * 1000000ULL + end.tv_usec - start.tv_usec;
+    printf("writev of %d x %d bytes: %llu us per call\n", iovcnt, IOV_SIZE, us / NTRIES);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/* This test checks the clocks of Graphene, read both through the vDSO (as glibc does) and through
+ * the syscall, across the recalibrations of the clock against the host. */
+
+#define ITERATIONS 100000
+
+static uint64_t ts_to_ns(const struct timespec* ts) {
+    return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static int get_ns(clockid_t clock, int use_syscall, uint64_t* ns) {
+    struct timespec ts;
+    int ret = use_syscall ? syscall(SYS_clock_gettime, clock, &ts) : clock_gettime(clock, &ts);
+    if (ret < 0)
+        return -1;
+    *ns = ts_to_ns(&ts);
+    return 0;
+}
+
+static int test_monotonic(clockid_t clock, const char* name) {
+    uint64_t prev = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t now;
+        if (get_ns(clock, i % 16 == 0, &now) < 0) {
+            perror("clock_gettime");
+            return 1;
+        }
+        if (now < prev) {
+            printf("%s went back: %lu ns after %lu ns\n", name, now, prev);
+            return 1;
+        }
+        prev = now;
+    }
+    return 0;
+}
+
+static int test_sleep(void) {
+    uint64_t start, end;
+    struct timespec req = {.tv_sec = 0, .tv_nsec = 300000000};
+
+    if (get_ns(CLOCK_MONOTONIC, 0, &start) < 0 || nanosleep(&req, NULL) < 0 ||
+        get_ns(CLOCK_MONOTONIC, 0, &end) < 0) {
+        perror("clock_gettime or nanosleep");
+        return 1;
+    }
+    if (end - start < ts_to_ns(&req) || end - start > 10 * ts_to_ns(&req)) {
+        printf("CLOCK_MONOTONIC measured %lu ns of sleep of %lu ns\n", end - start,
+               ts_to_ns(&req));
+        return 1;
+    }
+    return 0;
+}
+
+static int test_realtime(void) {
+    struct timeval tv;
+    uint64_t realtime;
+
+    if (get_ns(CLOCK_REALTIME, 0, &realtime) < 0 || gettimeofday(&tv, NULL) < 0) {
+        perror("clock_gettime or gettimeofday");
+        return 1;
+    }
+    time_t t = time(NULL);
+
+    uint64_t tv_ns = tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+    if (tv_ns + 1000 < realtime || tv_ns > realtime + 1000000000ULL ||
+        (uint64_t)t + 1 < realtime / 1000000000ULL || (uint64_t)t > (uint64_t)tv.tv_sec + 1) {
+        printf("CLOCK_REALTIME (%lu ns), gettimeofday() (%lu ns) and time() (%ld s) disagree\n",
+               realtime, tv_ns, t);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_getres(void) {
+    static const clockid_t clocks[] = {CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC_RAW,
+                                       CLOCK_BOOTTIME, CLOCK_PROCESS_CPUTIME_ID,
+                                       CLOCK_THREAD_CPUTIME_ID};
+    struct timespec res;
+
+    for (size_t i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++) {
+        if (clock_getres(clocks[i], &res) < 0) {
+            perror("clock_getres");
+            return 1;
+        }
+        if (res.tv_sec || !res.tv_nsec || res.tv_nsec > 1000000) {
+            printf("clock %d has a resolution of %ld.%09ld s\n", clocks[i], res.tv_sec,
+                   res.tv_nsec);
+            return 1;
+        }
+    }
+
+    if (clock_getres(-42, &res) == 0 || errno != EINVAL) {
+        printf("clock_getres() of an invalid clock did not fail with EINVAL\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    setbuf(stdout, NULL);
+
+    if (test_monotonic(CLOCK_MONOTONIC, "CLOCK_MONOTONIC") ||
+        test_monotonic(CLOCK_MONOTONIC_COARSE, "CLOCK_MONOTONIC_COARSE") ||
+        test_monotonic(CLOCK_PROCESS_CPUTIME_ID, "CLOCK_PROCESS_CPUTIME_ID") ||
+        test_monotonic(CLOCK_THREAD_CPUTIME_ID, "CLOCK_THREAD_CPUTIME_ID"))
+        return 1;
+
+    /* sleep across a recalibration of the clock */
+    if (test_sleep() || test_monotonic(CLOCK_MONOTONIC, "CLOCK_MONOTONIC"))
+        return 1;
+
+    if (test_realtime() || test_getres())
+        return 1;
+
+    puts("Test completed successfully");
+    return 0;
+}
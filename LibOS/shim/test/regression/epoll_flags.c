@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* more than the 1024 FDs an epoll could monitor before */
+#define MANY_FDS 1100
+
+static int wait_events(int efd, struct epoll_event* events, int maxevents) {
+    int n = epoll_wait(efd, events, maxevents, 0);
+    if (n < 0) {
+        perror("epoll_wait");
+        exit(1);
+    }
+    return n;
+}
+
+static void write_byte(int fd) {
+    char c = 0;
+    if (write(fd, &c, 1) != 1) {
+        perror("write");
+        exit(1);
+    }
+}
+
+static void read_byte(int fd) {
+    char c;
+    if (read(fd, &c, 1) != 1) {
+        perror("read");
+        exit(1);
+    }
+}
+
+static void ctl_fd(int efd, int op, int fd, unsigned int events) {
+    struct epoll_event event = { .events = events, .data.fd = fd };
+    if (epoll_ctl(efd, op, fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+static int test_edge_triggered(void) {
+    struct epoll_event event;
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    int efd = epoll_create1(0);
+    if (efd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    ctl_fd(efd, EPOLL_CTL_ADD, fds[0], EPOLLIN | EPOLLET);
+
+    write_byte(fds[1]);
+    write_byte(fds[1]);
+    if (wait_events(efd, &event, 1) != 1 || event.data.fd != fds[0]) {
+        fprintf(stderr, "EPOLLET: event not reported\n");
+        return 1;
+    }
+    /* data is still there, but there was no new edge */
+    if (wait_events(efd, &event, 1) != 0) {
+        fprintf(stderr, "EPOLLET: event reported twice\n");
+        return 1;
+    }
+
+    read_byte(fds[0]);
+    read_byte(fds[0]);
+    write_byte(fds[1]);
+    if (wait_events(efd, &event, 1) != 1) {
+        fprintf(stderr, "EPOLLET: new event not reported\n");
+        return 1;
+    }
+
+    close(efd);
+    close(fds[0]);
+    close(fds[1]);
+    printf("EPOLLET test passed\n");
+    return 0;
+}
+
+static int test_oneshot(void) {
+    struct epoll_event event;
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    int efd = epoll_create1(0);
+    if (efd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    ctl_fd(efd, EPOLL_CTL_ADD, fds[0], EPOLLIN | EPOLLONESHOT);
+
+    write_byte(fds[1]);
+    if (wait_events(efd, &event, 1) != 1 || event.data.fd != fds[0]) {
+        fprintf(stderr, "EPOLLONESHOT: event not reported\n");
+        return 1;
+    }
+
+    /* disabled until EPOLL_CTL_MOD, even for new data */
+    read_byte(fds[0]);
+    write_byte(fds[1]);
+    if (wait_events(efd, &event, 1) != 0) {
+        fprintf(stderr, "EPOLLONESHOT: event reported while disabled\n");
+        return 1;
+    }
+
+    ctl_fd(efd, EPOLL_CTL_MOD, fds[0], EPOLLIN | EPOLLONESHOT);
+    if (wait_events(efd, &event, 1) != 1) {
+        fprintf(stderr, "EPOLLONESHOT: event not reported after EPOLL_CTL_MOD\n");
+        return 1;
+    }
+
+    close(efd);
+    close(fds[0]);
+    close(fds[1]);
+    printf("EPOLLONESHOT test passed\n");
+    return 0;
+}
+
+static int test_many_fds(void) {
+    static struct epoll_event events[MANY_FDS];
+    static int dup_fds[MANY_FDS];
+    int fds[2];
+    int closed_fds[2];
+
+    struct rlimit rlim = { .rlim_cur = MANY_FDS + 16, .rlim_max = MANY_FDS + 16 };
+    if (setrlimit(RLIMIT_NOFILE, &rlim) < 0) {
+        perror("setrlimit");
+        return 1;
+    }
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    int efd = epoll_create1(0);
+    if (efd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    for (int i = 0; i < MANY_FDS; i++) {
+        dup_fds[i] = dup(fds[0]);
+        if (dup_fds[i] < 0) {
+            perror("dup");
+            return 1;
+        }
+        ctl_fd(efd, EPOLL_CTL_ADD, dup_fds[i], EPOLLIN);
+    }
+
+    write_byte(fds[1]);
+    int n = wait_events(efd, events, MANY_FDS);
+    if (n != MANY_FDS) {
+        fprintf(stderr, "%d FDs: %d events reported\n", MANY_FDS, n);
+        return 1;
+    }
+
+    /* deleted FDs and closed files must not be reported anymore */
+    for (int i = 0; i < MANY_FDS / 2; i++)
+        ctl_fd(efd, EPOLL_CTL_DEL, dup_fds[i], 0);
+
+    if (pipe(closed_fds) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    ctl_fd(efd, EPOLL_CTL_ADD, closed_fds[0], EPOLLIN);
+    write_byte(closed_fds[1]);
+    close(closed_fds[0]);
+    close(closed_fds[1]);
+
+    n = wait_events(efd, events, MANY_FDS);
+    if (n != MANY_FDS - MANY_FDS / 2) {
+        fprintf(stderr, "%d FDs left: %d events reported\n", MANY_FDS - MANY_FDS / 2, n);
+        return 1;
+    }
+
+    printf("epoll with %d FDs test passed\n", MANY_FDS);
+    return 0;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    if (test_edge_triggered() || test_oneshot() || test_many_fds())
+        return 1;
+    return 0;
+}
@@ -0,0 +1,191 @@
+/* Coherence of the chroot file cache (the manifest enables it with `fs.cache.size`): reads after
+ * small and large writes, truncate, mmap and fork. */
+
+#define _XOPEN_SOURCE 700
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_DIR  "tmp"
+#define TEST_FILE TEST_DIR "/file_cache.tmp"
+
+#define PAGE_SIZE  4096
+/* larger than the requests served from the cache */
+#define LARGE_SIZE (32 * PAGE_SIZE)
+
+static char buf[LARGE_SIZE];
+static char expected[LARGE_SIZE];
+
+static void fill(char* data, size_t size, char seed) {
+    for (size_t i = 0; i < size; i++)
+        data[i] = seed + i % 61;
+}
+
+static void pwrite_all(int fd, const void* data, size_t size, off_t offset) {
+    ssize_t ret = pwrite(fd, data, size, offset);
+    if (ret < 0)
+        err(1, "pwrite");
+    if ((size_t)ret != size)
+        errx(1, "short pwrite: %zd of %zu bytes", ret, size);
+}
+
+static void check_read(int fd, off_t offset, size_t size, const char* msg) {
+    memset(buf, 0, size);
+    ssize_t ret = pread(fd, buf, size, offset);
+    if (ret < 0)
+        err(1, "pread");
+    if ((size_t)ret != size)
+        errx(1, "%s: short pread: %zd of %zu bytes", msg, ret, size);
+    if (memcmp(buf, expected + offset, size))
+        errx(1, "%s: wrong data", msg);
+}
+
+static void test_read_after_write(int fd) {
+    /* small unaligned writes that stay in the cache */
+    fill(expected, LARGE_SIZE, 'a');
+    for (off_t off = 0; off < LARGE_SIZE; off += 1000)
+        pwrite_all(fd, expected + off, off + 1000 < LARGE_SIZE ? 1000 : LARGE_SIZE - off, off);
+    check_read(fd, 100, 5000, "small read after small writes");
+    check_read(fd, 0, LARGE_SIZE, "large read after small writes");
+
+    /* another handle of the same file */
+    int fd2 = open(TEST_FILE, O_RDONLY);
+    if (fd2 < 0)
+        err(1, "open");
+    check_read(fd2, 3 * PAGE_SIZE + 7, 2 * PAGE_SIZE, "read through another handle");
+
+    /* a large write over cached pages, then small reads of them */
+    fill(expected + PAGE_SIZE / 2, LARGE_SIZE - PAGE_SIZE, 'A');
+    pwrite_all(fd, expected + PAGE_SIZE / 2, LARGE_SIZE - PAGE_SIZE, PAGE_SIZE / 2);
+    check_read(fd, 0, PAGE_SIZE, "small read after large write");
+    check_read(fd2, LARGE_SIZE - 2 * PAGE_SIZE, 2 * PAGE_SIZE, "small read at the end");
+
+    if (close(fd2) < 0)
+        err(1, "close");
+    printf("read after write OK\n");
+}
+
+static void test_truncate(int fd) {
+    struct stat st;
+
+    /* the page at the new end of file is cached and dirty */
+    pwrite_all(fd, expected + 2 * PAGE_SIZE, 100, 2 * PAGE_SIZE);
+    if (ftruncate(fd, 2 * PAGE_SIZE + 50) < 0)
+        err(1, "ftruncate");
+    if (fstat(fd, &st) < 0)
+        err(1, "fstat");
+    if (st.st_size != 2 * PAGE_SIZE + 50)
+        errx(1, "wrong size after truncate: %ld", (long)st.st_size);
+    if (pread(fd, buf, PAGE_SIZE, 3 * PAGE_SIZE) != 0)
+        errx(1, "read beyond the truncated end of file returned data");
+
+    /* extending again reads zeros, not the old contents */
+    if (ftruncate(fd, 4 * PAGE_SIZE) < 0)
+        err(1, "ftruncate");
+    memset(expected + 2 * PAGE_SIZE + 50, 0, 2 * PAGE_SIZE - 50);
+    check_read(fd, 2 * PAGE_SIZE, 2 * PAGE_SIZE, "read after extending truncate");
+    printf("truncate OK\n");
+}
+
+static void test_mmap(int fd) {
+    /* data written through the cache is seen by a new mapping */
+    fill(expected, PAGE_SIZE, '0');
+    pwrite_all(fd, expected, 300, 0);
+    char* map = mmap(NULL, 4 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        err(1, "mmap");
+    if (memcmp(map, expected, 300))
+        errx(1, "mapping does not see cached writes");
+
+    /* data written through the mapping is seen by reads */
+    memcpy(map + PAGE_SIZE, "mapped", 6);
+    if (msync(map, 4 * PAGE_SIZE, MS_SYNC) < 0)
+        err(1, "msync");
+    memcpy(expected + PAGE_SIZE, "mapped", 6);
+    check_read(fd, PAGE_SIZE, 6, "read of data written through the mapping");
+
+    if (munmap(map, 4 * PAGE_SIZE) < 0)
+        err(1, "munmap");
+    printf("mmap OK\n");
+}
+
+static void test_fork(int fd) {
+    /* dirty cached data is inherited by the child */
+    fill(expected, 2 * PAGE_SIZE, 'p');
+    pwrite_all(fd, expected, 2 * PAGE_SIZE, 0);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0) {
+        check_read(fd, 0, 2 * PAGE_SIZE, "read of the parent's data in the child");
+
+        int fd2 = open(TEST_FILE, O_RDWR);
+        if (fd2 < 0)
+            err(1, "open");
+        check_read(fd2, 10, PAGE_SIZE, "read of the parent's data through a new handle");
+
+        fill(expected, PAGE_SIZE, 'c');
+        pwrite_all(fd2, expected, PAGE_SIZE, PAGE_SIZE);
+        if (close(fd2) < 0 || close(fd) < 0)
+            err(1, "close");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+
+    /* close-to-open consistency: the child's data is seen after reopening */
+    if (close(fd) < 0)
+        err(1, "close");
+    fd = open(TEST_FILE, O_RDONLY);
+    if (fd < 0)
+        err(1, "open");
+    fill(expected + PAGE_SIZE, PAGE_SIZE, 'c');
+    check_read(fd, 0, 2 * PAGE_SIZE, "read of the child's data in the parent");
+    if (close(fd) < 0)
+        err(1, "close");
+    printf("fork OK\n");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    if (mkdir(TEST_DIR, 0777) < 0 && errno != EEXIST)
+        err(1, "mkdir");
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+
+    test_read_after_write(fd);
+    test_truncate(fd);
+    /* closes `fd` */
+    test_fork(fd);
+
+    /* a shared mapping switches the file to direct I/O until all its handles are closed, so this
+     * test comes last */
+    fd = open(TEST_FILE, O_RDWR);
+    if (fd < 0)
+        err(1, "open");
+    test_mmap(fd);
+    if (close(fd) < 0)
+        err(1, "close");
+
+    if (unlink(TEST_FILE) < 0)
+        err(1, "unlink");
+    printf("TEST OK\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+/* fork() with `sys.fork.lazy_memory = 1` in the manifest: the child fetches large memory regions of
+ * the parent on demand. Checks that the child sees the parent's memory as of the fork, also when
+ * the parent changes it first, and munmap/mprotect of regions the child did not fetch yet. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* larger than the regions sent with the checkpoint */
+#define REGION_SIZE  (4 * 1024 * 1024)
+#define HEAP_CHUNK   (16 * 1024)
+#define HEAP_CHUNKS  64
+#define STACK_SIZE   (32 * 1024)
+
+static char* heap[HEAP_CHUNKS];
+static char* region;   /* read and changed by the parent after fork */
+static char* region2;  /* unmapped and mprotected by the child before touching it */
+static char* read_buf; /* buffer of a read() blocked during fork */
+static int read_pipe[2];
+
+static void fill(char* data, size_t size, char seed) {
+    for (size_t i = 0; i < size; i++)
+        data[i] = seed + i % 251;
+}
+
+/* checks data[start..end) written by fill(data, ..., seed) */
+static void check(const char* data, size_t start, size_t end, char seed, const char* what) {
+    for (size_t i = start; i < end; i++)
+        if (data[i] != (char)(seed + i % 251))
+            errx(1, "child: wrong %s data at offset %zu", what, i);
+}
+
+static void* reader(void* arg) {
+    (void)arg;
+    ssize_t ret = read(read_pipe[0], read_buf, 16);
+    if (ret == 16 && !memcmp(read_buf, "data after fork!", 16))
+        printf("blocked read: OK\n");
+    else if (ret < 0 && errno == EFAULT)
+        printf("blocked read: EFAULT\n");
+    else
+        printf("blocked read: unexpected result %zd (errno %d)\n", ret, errno);
+    return NULL;
+}
+
+static void child(int sync_fd, const char* stack) {
+    char c;
+    /* wait until the parent changed its memory */
+    if (read(sync_fd, &c, 1) != 1)
+        errx(1, "child: read from pipe");
+
+    check(stack, 0, STACK_SIZE, 's', "stack");
+    for (int i = 0; i < HEAP_CHUNKS; i++)
+        check(heap[i], 0, HEAP_CHUNK, 'h' + i, "heap");
+    check(region, 0, REGION_SIZE, 'm', "mmap");
+
+    /* the first half of region2 is unmapped, the rest made read-only, before it is fetched */
+    if (munmap(region2, REGION_SIZE / 2) < 0)
+        err(1, "child: munmap");
+    if (mprotect(region2 + REGION_SIZE / 2, REGION_SIZE / 2, PROT_READ) < 0)
+        err(1, "child: mprotect");
+    check(region2, REGION_SIZE / 2, REGION_SIZE, 'r', "mprotected");
+    if (mprotect(region2 + REGION_SIZE / 2, REGION_SIZE / 2, PROT_READ | PROT_WRITE) < 0)
+        err(1, "child: mprotect");
+    fill(region2 + REGION_SIZE / 2, REGION_SIZE / 2, 'R');
+    check(region2 + REGION_SIZE / 2, 0, REGION_SIZE / 2, 'R', "written");
+
+    /* the unmapped half can be mapped again, as fresh memory */
+    char* p = mmap(region2, REGION_SIZE / 2, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (p == MAP_FAILED)
+        err(1, "child: mmap");
+    for (size_t i = 0; i < REGION_SIZE / 2; i++)
+        if (p[i])
+            errx(1, "child: remapped memory is not zeroed");
+
+    /* this changes only the child's copy */
+    fill(region, REGION_SIZE, 'c');
+    exit(0);
+}
+
+int main(void) {
+    char stack[STACK_SIZE];
+    int sync_pipe[2];
+
+    setbuf(stdout, NULL);
+
+    fill(stack, STACK_SIZE, 's');
+    for (int i = 0; i < HEAP_CHUNKS; i++) {
+        if (!(heap[i] = malloc(HEAP_CHUNK)))
+            errx(1, "malloc");
+        fill(heap[i], HEAP_CHUNK, 'h' + i);
+    }
+
+    region = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    region2 = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    read_buf = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED || region2 == MAP_FAILED || read_buf == MAP_FAILED)
+        err(1, "mmap");
+    fill(region, REGION_SIZE, 'm');
+    fill(region2, REGION_SIZE, 'r');
+    memset(read_buf, 0, REGION_SIZE);
+
+    if (pipe(sync_pipe) < 0 || pipe(read_pipe) < 0)
+        err(1, "pipe");
+
+    /* a thread blocked in read() into lazily migrated memory during fork; see the EFAULT caveat of
+     * sys.fork.lazy_memory in the manifest documentation */
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reader, NULL))
+        errx(1, "pthread_create");
+    sleep(1);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0)
+        child(sync_pipe[0], stack);
+
+    if (write(read_pipe[1], "data after fork!", 16) != 16)
+        err(1, "write");
+    if (pthread_join(thread, NULL))
+        errx(1, "pthread_join");
+
+    /* change everything before the child reads it */
+    fill(stack, STACK_SIZE, 'S');
+    for (int i = 0; i < HEAP_CHUNKS; i++)
+        fill(heap[i], HEAP_CHUNK, 'H' + i);
+    fill(region, REGION_SIZE, 'M');
+    if (munmap(region2, REGION_SIZE) < 0)
+        err(1, "munmap");
+
+    if (write(sync_pipe[1], "x", 1) != 1)
+        err(1, "write");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+
+    /* the child's writes are not visible in the parent */
+    for (size_t i = 0; i < REGION_SIZE; i++)
+        if (region[i] != (char)('M' + i % 251))
+            errx(1, "parent: memory changed by the child");
+
+    printf("TEST OK\n");
+    return 0;
+}
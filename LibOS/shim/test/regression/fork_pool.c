@@ -0,0 +1,78 @@
+/* fork() with a pool of pre-started processes (`loader.fork_pool_size` in the manifest): forks more
+ * children than the pool holds, one after another and at the same time, with and without exec. */
+
+#define _XOPEN_SOURCE 700
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* the manifest sets a smaller pool */
+#define SEQUENTIAL_CHILDREN 8
+#define CONCURRENT_CHILDREN 6
+#define EXEC_CHILDREN       4
+
+static void wait_child(pid_t pid, int expected_status) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != expected_status)
+        errx(1, "child %d: unexpected status 0x%x", pid, status);
+}
+
+static pid_t fork_exit(int status, int delay) {
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        if (delay)
+            sleep(delay);
+        exit(status);
+    }
+    return pid;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    for (int i = 0; i < SEQUENTIAL_CHILDREN; i++)
+        wait_child(fork_exit(i, /*delay=*/0), i);
+    printf("sequential fork+exit OK\n");
+
+    pid_t pids[CONCURRENT_CHILDREN];
+    for (int i = 0; i < CONCURRENT_CHILDREN; i++)
+        pids[i] = fork_exit(i + 1, /*delay=*/1);
+    for (int i = 0; i < CONCURRENT_CHILDREN; i++)
+        wait_child(pids[i], i + 1);
+    printf("concurrent fork+exit OK\n");
+
+    for (int i = 0; i < EXEC_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            err(1, "fork");
+        if (pid == 0) {
+            char* const argv[] = {"./exec_victim", NULL};
+            execv(argv[0], argv);
+            err(1, "execv");
+        }
+        wait_child(pid, 0);
+    }
+    printf("fork+exec OK\n");
+
+    /* a child uses its own pool */
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        for (int i = 0; i < SEQUENTIAL_CHILDREN; i++)
+            wait_child(fork_exit(i, /*delay=*/0), i);
+        exit(0);
+    }
+    wait_child(pid, 0);
+    printf("fork in child OK\n");
+
+    printf("TEST OK\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* This test checks the syscall statistics of Graphene in /proc/graphene/syscall_stats, enabled by
+ * the manifest. */
+
+#define CALLS 1000
+
+/* Finds the counters of `sysno` in the statistics. */
+static int get_stats(int sysno, unsigned long* calls, unsigned long* errors) {
+    char line[1024];
+    int found = 0;
+
+    FILE* f = fopen("/proc/graphene/syscall_stats", "r");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+
+    /* the lines of the syscalls end with an empty line, the lines of the threads follow */
+    while (fgets(line, sizeof(line), f) && line[0] != '\n') {
+        int nr;
+        if (sscanf(line, "%d %lu %lu", &nr, calls, errors) == 3 && nr == sysno) {
+            found = 1;
+            break;
+        }
+    }
+    fclose(f);
+
+    if (!found) {
+        printf("no statistics of syscall %d\n", sysno);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    unsigned long calls, errors;
+
+    setbuf(stdout, NULL);
+
+    for (int i = 0; i < CALLS; i++) {
+        syscall(SYS_getppid);
+        if (syscall(SYS_close, -1) != -1 || errno != EBADF) {
+            printf("close(-1) did not fail with EBADF\n");
+            return 1;
+        }
+    }
+
+    if (get_stats(SYS_getppid, &calls, &errors) < 0)
+        return 1;
+    if (calls < CALLS || errors) {
+        printf("getppid: %lu calls, %lu errors\n", calls, errors);
+        return 1;
+    }
+
+    if (get_stats(SYS_close, &calls, &errors) < 0)
+        return 1;
+    if (calls < CALLS || errors < CALLS) {
+        printf("close: %lu calls, %lu errors\n", calls, errors);
+        return 1;
+    }
+
+    puts("Test completed successfully");
+    return 0;
+}
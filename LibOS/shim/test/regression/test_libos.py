@@ -103,6 +103,15 @@ class TC_01_Bootstrap(RegressionTestCase):
         stdout, _ = self.run_binary(['system'], timeout=60)
         self.assertIn('hello from system', stdout)
 
+    def test_205_fork_pool(self):
+        stdout, _ = self.run_binary(['fork_pool'], timeout=60)
+
+        self.assertIn('sequential fork+exit OK', stdout)
+        self.assertIn('concurrent fork+exit OK', stdout)
+        self.assertIn('fork+exec OK', stdout)
+        self.assertIn('fork in child OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_210_exec_invalid_args(self):
         stdout, _ = self.run_binary(['exec_invalid_args'])
 
@@ -207,6 +216,20 @@ class TC_03_FileCheckPolicy(RegressionTestCase):
         self.assertNotIn('Allowing access to an unknown file due to file_check_policy settings: file:trusted_testfile', stderr)
         self.assertIn('file_check_policy succeeded', stdout)
 
+    def test_004_trusted_and_allowed_fail(self):
+        # a file listed both as trusted and allowed must still be checked against its hash
+        manifest = self.get_manifest('file_check_policy_trusted_and_allowed')
+        with open('trusted_and_allowed_testfile', 'r+') as f:
+            content = f.read()
+            f.seek(0)
+            f.write(content.upper())
+        try:
+            with self.expect_returncode(2):
+                self.run_binary([manifest, 'trusted_and_allowed_testfile'])
+        finally:
+            with open('trusted_and_allowed_testfile', 'w') as f:
+                f.write(content)
+
 class TC_30_Syscall(RegressionTestCase):
     def test_000_getcwd(self):
         stdout, _ = self.run_binary(['getcwd'])
@@ -336,6 +359,13 @@ class TC_30_Syscall(RegressionTestCase):
 
         self.assertIn('Test successful!', stdout)
 
+    def test_054_fork_lazy_memory(self):
+        stdout, _ = self.run_binary(['fork_lazy_memory'], timeout=60)
+
+        # a host syscall blocked during fork may fail with EFAULT (documented caveat)
+        self.assertRegex(stdout, 'blocked read: (OK|EFAULT)')
+        self.assertIn('TEST OK', stdout)
+
     @unittest.skip('sigaltstack isn\'t correctly implemented')
     def test_060_sigaltstack(self):
         stdout, _ = self.run_binary(['sigaltstack'])
@@ -374,6 +404,14 @@ class TC_30_Syscall(RegressionTestCase):
         self.assertIn('Got signal 17', stdout)
         self.assertIn('Handler was invoked 1 time(s).', stdout)
 
+    def test_100_clock(self):
+        stdout, _ = self.run_binary(['clock'])
+        self.assertIn('Test completed successfully', stdout)
+
+    def test_110_syscall_stats(self):
+        stdout, _ = self.run_binary(['syscall_stats'])
+        self.assertIn('Test completed successfully', stdout)
+
 @unittest.skipUnless(HAS_SGX,
     'This test is only meaningful on SGX PAL because only SGX catches raw '
     'syscalls and redirects to Graphene\'s LibOS. If we will add seccomp to '
@@ -408,6 +446,7 @@ class TC_40_FileSystem(RegressionTestCase):
         self.assertIn('/proc/self', stdout)
         self.assertIn('/proc/meminfo', stdout)
         self.assertIn('/proc/cpuinfo', stdout)
+        self.assertIn('/proc/graphene', stdout)
         self.assertIn('/proc/2/cwd/proc.c', stdout)
         self.assertIn('/lib/libpthread.so', stdout)
         self.assertIn('stack', stdout)
@@ -443,6 +482,14 @@ class TC_40_FileSystem(RegressionTestCase):
         stdout, _ = self.run_binary(['str_close_leak'], timeout=60)
         self.assertIn("Success", stdout)
 
+    def test_050_file_cache(self):
+        stdout, _ = self.run_binary(['file_cache'], timeout=60)
+        self.assertIn('read after write OK', stdout)
+        self.assertIn('truncate OK', stdout)
+        self.assertIn('fork OK', stdout)
+        self.assertIn('mmap OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
 class TC_80_Socket(RegressionTestCase):
     def test_000_getsockopt(self):
         stdout, _ = self.run_binary(['getsockopt'])
@@ -456,6 +503,12 @@ class TC_80_Socket(RegressionTestCase):
         # epoll_wait timeout
         self.assertIn('epoll_wait test passed', stdout)
 
+    def test_011_epoll_flags(self):
+        stdout, _ = self.run_binary(['epoll_flags'])
+        self.assertIn('EPOLLET test passed', stdout)
+        self.assertIn('EPOLLONESHOT test passed', stdout)
+        self.assertIn('epoll with 1100 FDs test passed', stdout)
+
     def test_020_poll(self):
         stdout, _ = self.run_binary(['poll'])
         self.assertIn('poll(POLLOUT) returned 1 file descriptors', stdout)
@@ -212,9 +212,16 @@ int get_base_name(const char* path, char* buf, size_t* size);
 
 struct config;
 DEFINE_LISTP(config);
+struct config_chunk;
 struct config_store {
     LISTP_TYPE(config) root;
     LISTP_TYPE(config) entries;
+    /* index of all nodes by parent node and key token, see config.c */
+    struct config ** hash;
+    size_t           hash_size, hash_cnt;
+    /* nodes are allocated from chunks, free nodes are kept in a list */
+    struct config_chunk * chunks;
+    struct config *  free_nodes;
     void *           raw_data;
     int              raw_size;
     void *           (*malloc) (size_t);
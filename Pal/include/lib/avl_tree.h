@@ -51,6 +51,10 @@ struct avl_tree {
     /* This should be a total order (<=) on tree nodes. If two elements compare equal, the newer
      * will be on the left (side of smaller elements) from the older one. */
     bool (*cmp)(struct avl_tree_node*, struct avl_tree_node*);
+    /* Optional (may be NULL). Called on a node whenever its subtree has changed, after it was
+     * called on the node's children. Allows keeping augmented data of a subtree (e.g. its maximum)
+     * in the root of that subtree. */
+    void (*update)(struct avl_tree_node*);
 };
 
 void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node);
@@ -61,6 +65,7 @@ void avl_tree_delete(struct avl_tree* tree, struct avl_tree_node* node);
  * it should really be a new node) and they both should compare equal with respect to tree.cmp or
  * bad things will happen. You have been warned. Probably the only usecase of this function is to
  * optimize delete + insert of a node with the same key.
+ * This function does not call `tree->update`, so it cannot be used on augmented trees.
  */
 void avl_tree_swap_node(struct avl_tree_node* old_node, struct avl_tree_node* new_node);
 
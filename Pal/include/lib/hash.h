@@ -0,0 +1,46 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * hash.h
+ *
+ * Hash functions for the hash tables of PAL and LibOS (not cryptographic).
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fibonacci hashing of an integer (e.g. a pointer): the high bits of the result are well mixed,
+ * so a table of 2^n buckets should use `hash_u64(val) >> (64 - n)`. */
+static inline uint64_t hash_u64(uint64_t val) {
+    return val * 0x9e3779b97f4a7c15ULL;
+}
+
+/* FNV-1a of `len` bytes of `str`, started from `seed` (e.g. the hash of a parent object) and
+ * folded so that the low bits can be used as a bucket index too. */
+static inline uint64_t hash_str(const char* str, size_t len, uint64_t seed) {
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+#endif /* HASH_H */
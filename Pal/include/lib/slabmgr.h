@@ -39,6 +39,8 @@
 #ifndef system_free
 #error "macro \"void * system_free(void * ptr, int size)\" not declared"
 #endif
+// `system_resize(addr, old_size, new_size)` is optional: it resizes a mapping of `system_malloc`
+// in place and returns false if it cannot.
 #ifndef SYSTEM_LOCK
 #define SYSTEM_LOCK() ({})
 #endif
@@ -63,8 +65,6 @@
  * alignment for malloc and calloc. */
 #define OBJ_PADDING 15
 
-#define LARGE_OBJ_PADDING 8
-
 DEFINE_LIST(slab_obj);
 
 typedef struct __attribute__((packed)) slab_obj {
@@ -146,8 +146,8 @@ typedef struct slab_mgr {
 
 typedef struct __attribute__((packed)) large_mem_obj {
     // offset 0
-    unsigned long size;  // User buffer size (i.e. excluding control structures)
-    unsigned char large_padding[LARGE_OBJ_PADDING];
+    unsigned long size;      // User buffer size (i.e. excluding control structures)
+    unsigned long map_size;  // Size of the whole mapping (may exceed size + control structures)
     // offset 16
     unsigned char level;
     unsigned char padding[OBJ_PADDING];
@@ -161,6 +161,12 @@ typedef struct __attribute__((packed)) large_mem_obj {
 #define RAW_TO_LEVEL(raw_ptr)     (*((const unsigned char*)(raw_ptr) - OBJ_PADDING - 1))
 #define RAW_TO_OBJ(raw_ptr, type) container_of((raw_ptr), type, raw)
 
+#ifdef ALLOC_ALIGNMENT
+#define __LARGE_MAP_SIZE(size) ALIGN_UP_POW2(sizeof(LARGE_MEM_OBJ_TYPE) + (size), ALLOC_ALIGNMENT)
+#else
+#define __LARGE_MAP_SIZE(size) (sizeof(LARGE_MEM_OBJ_TYPE) + (size))
+#endif
+
 #define __SUM_OBJ_SIZE(slab_size, size) (((slab_size) + SLAB_HDR_SIZE) * (size))
 #define __MIN_MEM_SIZE()                (sizeof(SLAB_AREA_TYPE))
 #define __MAX_MEM_SIZE(slab_size, size) (__MIN_MEM_SIZE() + __SUM_OBJ_SIZE((slab_size), (size)))
@@ -325,36 +331,23 @@ static inline int enlarge_slab_mgr(SLAB_MGR mgr, int level) {
     return 0;
 }
 
-static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
-    SLAB_OBJ mobj;
-    int i;
-    int level = -1;
-
-    for (i = 0; i < SLAB_LEVEL; i++)
-        if (size <= slab_levels[i]) {
-            level = i;
-            break;
-        }
-
-    if (level == -1) {
-        LARGE_MEM_OBJ mem = (LARGE_MEM_OBJ)system_malloc(sizeof(LARGE_MEM_OBJ_TYPE) + size);
-        if (!mem)
-            return NULL;
-
-        mem->size      = size;
-        OBJ_LEVEL(mem) = (unsigned char)-1;
+/* Returns the level of objects of `size` bytes, or -1 for large objects. */
+static inline int slab_level(size_t size) {
+    for (int i = 0; i < SLAB_LEVEL; i++)
+        if (size <= slab_levels[i])
+            return i;
+    return -1;
+}
 
-        return OBJ_RAW(mem);
-    }
+// SYSTEM_LOCK needs to be held by the caller on entry.
+static inline SLAB_OBJ __slab_get_obj(SLAB_MGR mgr, int level) {
+    SLAB_OBJ mobj;
 
-    SYSTEM_LOCK();
     assert(mgr->addr[level] <= mgr->addr_top[level]);
     if (mgr->addr[level] == mgr->addr_top[level] && LISTP_EMPTY(&mgr->free_list[level])) {
         int ret = enlarge_slab_mgr(mgr, level);
-        if (ret < 0) {
-            SYSTEM_UNLOCK();
+        if (ret < 0)
             return NULL;
-        }
     }
 
     if (!LISTP_EMPTY(&mgr->free_list[level])) {
@@ -366,29 +359,62 @@ static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
     }
     assert(mgr->addr[level] <= mgr->addr_top[level]);
     OBJ_LEVEL(mobj) = level;
-    SYSTEM_UNLOCK();
+    return mobj;
+}
+
+// SYSTEM_LOCK needs to be held by the caller on entry.
+static inline void __slab_put_obj(SLAB_MGR mgr, int level, SLAB_OBJ mobj) {
+    INIT_LIST_HEAD(mobj, __list);
+    LISTP_ADD_TAIL(mobj, &mgr->free_list[level], __list);
+}
 
+static inline void* __slab_obj_raw(SLAB_OBJ mobj, int level) {
 #ifdef SLAB_CANARY
     unsigned long* m = (unsigned long*)((void*)OBJ_RAW(mobj) + slab_levels[level]);
     *m               = SLAB_CANARY_STRING;
+#else
+    __UNUSED(level);
 #endif
 
     return OBJ_RAW(mobj);
 }
 
+// `map_size` needs to be at least __LARGE_MAP_SIZE(size).
+static inline void* __slab_alloc_large(size_t size, size_t map_size) {
+    LARGE_MEM_OBJ mem = (LARGE_MEM_OBJ)system_malloc(map_size);
+    if (!mem)
+        return NULL;
+
+    mem->size      = size;
+    mem->map_size  = map_size;
+    OBJ_LEVEL(mem) = (unsigned char)-1;
+
+    return OBJ_RAW(mem);
+}
+
+static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
+    SLAB_OBJ mobj;
+    int level = slab_level(size);
+
+    if (level == -1)
+        return __slab_alloc_large(size, __LARGE_MAP_SIZE(size));
+
+    SYSTEM_LOCK();
+    mobj = __slab_get_obj(mgr, level);
+    SYSTEM_UNLOCK();
+
+    if (!mobj)
+        return NULL;
+
+    return __slab_obj_raw(mobj, level);
+}
+
 #ifdef SLAB_DEBUG
 static inline void* slab_alloc_debug(SLAB_MGR mgr, size_t size, const char* file, int line) {
     void* mem = slab_alloc(mgr, size);
-    int i;
-    int level = -1;
-
-    for (i = 0; i < SLAB_LEVEL; i++)
-        if (size <= slab_levels[i]) {
-            level = i;
-            break;
-        }
+    int level = slab_level(size);
 
-    if (level != -1) {
+    if (mem && level != -1) {
         struct slab_debug* debug =
             (struct slab_debug*)(mem + slab_levels[level] + SLAB_CANARY_SIZE);
         debug->alloc.file = file;
@@ -424,21 +450,10 @@ static inline size_t slab_get_buf_size(const void* ptr) {
     return slab_levels[level];
 }
 
-static inline void slab_free(SLAB_MGR mgr, void* obj) {
-    /* In a general purpose allocator, free of NULL is allowed (and is a
-     * nop). We might want to enforce stricter rules for our allocator if
-     * we're sure that no clients rely on being able to free NULL. */
-    if (!obj)
-        return;
-
+/* Returns the level of `obj`, which is not a large object. */
+static inline int __slab_check_obj(void* obj) {
     unsigned char level = RAW_TO_LEVEL(obj);
 
-    if (level == (unsigned char)-1) {
-        LARGE_MEM_OBJ mem = RAW_TO_OBJ(obj, LARGE_MEM_OBJ_TYPE);
-        system_free(mem, mem->size + sizeof(LARGE_MEM_OBJ_TYPE));
-        return;
-    }
-
     /* If this happens, either the heap is already corrupted, or someone's
      * freeing something that's wrong, which will most likely lead to heap
      * corruption. Either way, panic if this happens. TODO: this doesn't allow
@@ -457,11 +472,153 @@ static inline void slab_free(SLAB_MGR mgr, void* obj) {
     assert(*m == SLAB_CANARY_STRING);
 #endif
 
-    SLAB_OBJ mobj = RAW_TO_OBJ(obj, SLAB_OBJ_TYPE);
+    return level;
+}
+
+static inline void slab_free(SLAB_MGR mgr, void* obj) {
+    /* In a general purpose allocator, free of NULL is allowed (and is a
+     * nop). We might want to enforce stricter rules for our allocator if
+     * we're sure that no clients rely on being able to free NULL. */
+    if (!obj)
+        return;
+
+    if (RAW_TO_LEVEL(obj) == (unsigned char)-1) {
+        LARGE_MEM_OBJ mem = RAW_TO_OBJ(obj, LARGE_MEM_OBJ_TYPE);
+        system_free(mem, mem->map_size);
+        return;
+    }
+
+    int level = __slab_check_obj(obj);
 
     SYSTEM_LOCK();
-    INIT_LIST_HEAD(mobj, __list);
-    LISTP_ADD_TAIL(mobj, &mgr->free_list[level], __list);
+    __slab_put_obj(mgr, level, RAW_TO_OBJ(obj, SLAB_OBJ_TYPE));
+    SYSTEM_UNLOCK();
+}
+
+/*
+ * Resizes `obj` to `size` bytes, in place if possible: small objects stay in place as long as
+ * they fit into their level, large objects as long as they fit into their mapping (or the mapping
+ * can be resized in place with `system_resize`). Large objects which have to move get twice the
+ * size they need, so that a buffer growing step by step is copied only O(log n) times. Returns
+ * NULL on failure, in which case `obj` is left untouched.
+ */
+static inline void* slab_realloc(SLAB_MGR mgr, void* obj, size_t size) {
+    if (!obj)
+        return slab_alloc(mgr, size);
+
+    size_t old_size;
+    size_t map_size = __LARGE_MAP_SIZE(size);
+
+    if (RAW_TO_LEVEL(obj) == (unsigned char)-1) {
+        LARGE_MEM_OBJ mem = RAW_TO_OBJ(obj, LARGE_MEM_OBJ_TYPE);
+        old_size = mem->size;
+
+        /* keep the mapping unless it is more than twice as big as needed */
+        if (map_size <= mem->map_size && map_size > mem->map_size / 2) {
+            mem->size = size;
+            return obj;
+        }
+
+#ifdef system_resize
+        size_t new_map_size = map_size <= mem->map_size ? map_size
+                                                        : MAX(map_size, mem->map_size * 2);
+        if (system_resize(mem, mem->map_size, new_map_size)) {
+            mem->size     = size;
+            mem->map_size = new_map_size;
+            return obj;
+        }
+#endif
+
+        if (map_size <= mem->map_size) {
+            mem->size = size;
+            return obj;
+        }
+
+        map_size = MAX(map_size, mem->map_size * 2);
+    } else {
+        int level = __slab_check_obj(obj);
+        if (size <= slab_levels[level])
+            return obj;
+        old_size = slab_levels[level];
+    }
+
+    void* new_obj = slab_level(size) == -1 ? __slab_alloc_large(size, map_size)
+                                           : slab_alloc(mgr, size);
+    if (!new_obj)
+        return NULL;
+
+    memcpy(new_obj, obj, MIN(old_size, size));
+    slab_free(mgr, obj);
+    return new_obj;
+}
+
+/*
+ * Per-thread caches ("magazines") of free objects of each level, to keep SYSTEM_LOCK off the fast
+ * path of multi-threaded users. A cache is owned by a single thread, which allocates from and
+ * frees to it without locking. An empty cache is refilled, and a full one drained, by
+ * SLAB_CACHE_BATCH objects at a time, under a single acquisition of SYSTEM_LOCK. Large objects
+ * bypass the caches.
+ */
+#ifndef SLAB_CACHE_SIZE
+#define SLAB_CACHE_SIZE 24
+#endif
+#define SLAB_CACHE_BATCH (SLAB_CACHE_SIZE / 2)
+
+typedef struct slab_cache {
+    unsigned int cnt[SLAB_LEVEL];
+    SLAB_OBJ objs[SLAB_LEVEL][SLAB_CACHE_SIZE];
+} SLAB_CACHE_TYPE, *SLAB_CACHE;
+
+static inline void* slab_cache_alloc(SLAB_MGR mgr, SLAB_CACHE cache, size_t size) {
+    int level = slab_level(size);
+
+    if (!cache || level == -1)
+        return slab_alloc(mgr, size);
+
+    if (!cache->cnt[level]) {
+        SYSTEM_LOCK();
+        while (cache->cnt[level] < SLAB_CACHE_BATCH) {
+            SLAB_OBJ mobj = __slab_get_obj(mgr, level);
+            if (!mobj)
+                break;
+            cache->objs[level][cache->cnt[level]++] = mobj;
+        }
+        SYSTEM_UNLOCK();
+
+        if (!cache->cnt[level])
+            return NULL;
+    }
+
+    return __slab_obj_raw(cache->objs[level][--cache->cnt[level]], level);
+}
+
+static inline void slab_cache_free(SLAB_MGR mgr, SLAB_CACHE cache, void* obj) {
+    if (!obj)
+        return;
+
+    if (!cache || RAW_TO_LEVEL(obj) == (unsigned char)-1) {
+        slab_free(mgr, obj);
+        return;
+    }
+
+    int level = __slab_check_obj(obj);
+
+    if (cache->cnt[level] == SLAB_CACHE_SIZE) {
+        SYSTEM_LOCK();
+        while (cache->cnt[level] > SLAB_CACHE_SIZE - SLAB_CACHE_BATCH)
+            __slab_put_obj(mgr, level, cache->objs[level][--cache->cnt[level]]);
+        SYSTEM_UNLOCK();
+    }
+
+    cache->objs[level][cache->cnt[level]++] = RAW_TO_OBJ(obj, SLAB_OBJ_TYPE);
+}
+
+/* Returns all objects in `cache` to `mgr`, e.g. when the thread owning it exits. */
+static inline void slab_cache_flush(SLAB_MGR mgr, SLAB_CACHE cache) {
+    SYSTEM_LOCK();
+    for (int level = 0; level < SLAB_LEVEL; level++)
+        while (cache->cnt[level])
+            __slab_put_obj(mgr, level, cache->objs[level][--cache->cnt[level]]);
     SYSTEM_UNLOCK();
 }
 
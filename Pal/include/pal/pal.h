@@ -103,6 +103,12 @@ typedef struct pal_tcb {
     struct pal_tcb * self;
     /* uint64_t for alignment */
     uint64_t libos_tcb[(PAL_LIBOS_TCB_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+    /* Accounting of the time spent by the thread in PAL calls, in TSC ticks. Enabled by the LibOS
+     * (e.g. for its syscall statistics) by setting `pal_call_timing`, only where the TSC can be
+     * read cheaply. Upcalls made during PAL calls are counted as time in the PAL. */
+    bool pal_call_timing;
+    uint64_t pal_call_start;
+    uint64_t pal_call_cycles;
     /* data private to PAL implementation follows this struct. */
 } PAL_TCB;
 
@@ -419,6 +425,10 @@ DkVirtualMemoryProtect(PAL_PTR addr, PAL_NUM size, PAL_FLG prot);
 *
 * \param uri the URI of the manifest file or the executable to be loaded in the new process.
 * \param args an array of strings -- the arguments to be passed to the new process.
+*
+* On some hosts (Linux), the returned process stream also carries a memory object shared with the
+* new process: one side sizes it with #DkStreamSetLength() and maps it with #DkStreamMap(), the
+* other side maps it through its parent process stream. Both sides may map it several times.
 */
 PAL_HANDLE
 DkProcessCreate(PAL_STR uri, PAL_STR* args);
@@ -597,6 +607,49 @@ DkStreamSetLength(PAL_HANDLE handle, PAL_NUM length);
 PAL_BOL
 DkStreamFlush(PAL_HANDLE handle);
 
+/*! operations that can be submitted via DkStreamsSubmit() */
+enum PAL_STREAM_OP_TYPE {
+    PAL_STREAM_OP_READ = 0, /*!< as DkStreamRead() */
+    PAL_STREAM_OP_WRITE,    /*!< as DkStreamWrite() */
+    PAL_STREAM_OP_FLUSH,    /*!< as DkStreamFlush() */
+    PAL_STREAM_OP_CLOSE,    /*!< as DkObjectClose(); the handle is freed */
+};
+
+/*! execute the operation only if the previous operation in the vector completed fully (succeeded
+ *  and, for reads and writes, transferred all `count` bytes); otherwise the operation fails with
+ *  #PAL_ERROR_TRYAGAIN without being executed */
+#define PAL_STREAM_OP_LINK 0x1
+
+/*! stream operation submitted via DkStreamsSubmit() */
+typedef struct _PAL_STREAM_OP {
+    PAL_NUM op;        /*!< one of #PAL_STREAM_OP_TYPE */
+    PAL_FLG flags;     /*!< #PAL_STREAM_OP_LINK or 0 */
+    PAL_HANDLE handle;
+    PAL_NUM offset;    /*!< as in DkStreamRead() and DkStreamWrite() */
+    PAL_NUM count;     /*!< as in DkStreamRead() and DkStreamWrite() */
+    PAL_PTR buffer;    /*!< as in DkStreamRead() and DkStreamWrite() */
+    PAL_NUM result;    /*!< [out] number of bytes read/written (0 for flush and close), or
+                            #PAL_STREAM_ERROR */
+    PAL_NUM error;     /*!< [out] PAL error code if `result` is #PAL_STREAM_ERROR */
+} PAL_STREAM_OP;
+
+/*!
+ * \brief Perform a vector of stream operations at once.
+ *
+ * Operations are executed in order, and each one has the same effect as the corresponding
+ * DkStream* call. The point of this API is the cost: where the host allows, the PAL hands all
+ * operations over to the host at once instead of one by one (e.g., the Linux-SGX PAL performs
+ * plain file reads, writes and flushes as well as closes of host FDs with a single OCALL).
+ * Operations should thus be independent of each other, unless chained with #PAL_STREAM_OP_LINK.
+ *
+ * \param ops vector of operations; `result` and `error` of each are filled in on return
+ * \param count number of operations in `ops`
+ * \return true if operations were performed (some of them may have failed, see `result` and
+ *  `error`), false if the vector is malformed and no operation was performed
+ */
+PAL_BOL
+DkStreamsSubmit(PAL_STREAM_OP* ops, PAL_NUM count);
+
 /*!
  * \brief Send a PAL handle over another handle.
  *
@@ -29,6 +29,23 @@ static void avl_tree_init_node(struct avl_tree_node* node) {
     node->balance = 0;
 }
 
+static void avl_tree_update_node(struct avl_tree* tree, struct avl_tree_node* node) {
+    if (tree->update) {
+        tree->update(node);
+    }
+}
+
+/* Recomputes augmented data of `node` and all its ancestors, bottom-up. */
+static void avl_tree_update_path(struct avl_tree* tree, struct avl_tree_node* node) {
+    if (!tree->update) {
+        return;
+    }
+    while (node) {
+        tree->update(node);
+        node = node->parent;
+    }
+}
+
 /* Inserts a node into tree, but leaves it unbalanced, i.e. all nodes on path from root to newly
  * inserted node could have their balance field off by +1/-1 */
 static void avl_tree_insert_unbalanced(struct avl_tree* tree,
@@ -85,7 +102,7 @@ static void fixup_link(struct avl_tree_node* old_node,
  * The naming convention is: `p` is topmost node and parent of `q`, which in turn is parent of `r`.
  */
 
-static void rot1L(struct avl_tree_node* q, struct avl_tree_node* p) {
+static void rot1L(struct avl_tree* tree, struct avl_tree_node* q, struct avl_tree_node* p) {
     assert(q->parent == p);
     assert(p->right == q);
     assert(q->balance == 1 || q->balance == 0);
@@ -108,9 +125,12 @@ static void rot1L(struct avl_tree_node* q, struct avl_tree_node* p) {
         p->balance = 1;
         q->balance = -1;
     }
+
+    avl_tree_update_node(tree, p);
+    avl_tree_update_node(tree, q);
 }
 
-static void rot1R(struct avl_tree_node* q, struct avl_tree_node* p) {
+static void rot1R(struct avl_tree* tree, struct avl_tree_node* q, struct avl_tree_node* p) {
     assert(q->parent == p);
     assert(p->left == q);
     assert(q->balance == -1 || q->balance == 0);
@@ -133,9 +153,13 @@ static void rot1R(struct avl_tree_node* q, struct avl_tree_node* p) {
         p->balance = -1;
         q->balance = 1;
     }
+
+    avl_tree_update_node(tree, p);
+    avl_tree_update_node(tree, q);
 }
 
-static void rot2RL(struct avl_tree_node* r, struct avl_tree_node* q, struct avl_tree_node* p) {
+static void rot2RL(struct avl_tree* tree, struct avl_tree_node* r, struct avl_tree_node* q,
+                   struct avl_tree_node* p) {
     assert(q->parent == p);
     assert(p->right == q);
     assert(q->balance == -1);
@@ -174,9 +198,14 @@ static void rot2RL(struct avl_tree_node* r, struct avl_tree_node* q, struct avl_
         q->balance = 0;
     }
     r->balance = 0;
+
+    avl_tree_update_node(tree, p);
+    avl_tree_update_node(tree, q);
+    avl_tree_update_node(tree, r);
 }
 
-static void rot2LR(struct avl_tree_node* r, struct avl_tree_node* q, struct avl_tree_node* p) {
+static void rot2LR(struct avl_tree* tree, struct avl_tree_node* r, struct avl_tree_node* q,
+                   struct avl_tree_node* p) {
     assert(q->parent == p);
     assert(p->left == q);
     assert(q->balance == 1);
@@ -215,12 +244,17 @@ static void rot2LR(struct avl_tree_node* r, struct avl_tree_node* q, struct avl_
         p->balance = 0;
     }
     r->balance = 0;
+
+    avl_tree_update_node(tree, p);
+    avl_tree_update_node(tree, q);
+    avl_tree_update_node(tree, r);
 }
 
 /* Does appropriate rotation of node, which mush have disturbed balance (i.e. +2/-2).
  * Returns whether height might have changed and sets `new_root_ptr` to root of this subtree after
  * rotation. */
-static bool avl_tree_do_balance(struct avl_tree_node* node, struct avl_tree_node** new_root_ptr) {
+static bool avl_tree_do_balance(struct avl_tree* tree, struct avl_tree_node* node,
+                                struct avl_tree_node** new_root_ptr) {
     assert(node->balance == -2 || node->balance == 2);
 
     struct avl_tree_node* child = NULL;
@@ -231,12 +265,12 @@ static bool avl_tree_do_balance(struct avl_tree_node* node, struct avl_tree_node
         if (child->balance == 1) {
             assert(child->right);
             *new_root_ptr = child->right;
-            rot2LR(child->right, child, node);
+            rot2LR(tree, child->right, child, node);
             return true;
         } else { // child->balance <= 0
             *new_root_ptr = child;
             ret = child->balance != 0;
-            rot1R(child, node);
+            rot1R(tree, child, node);
             return ret;
         }
     } else { // node->balance == 2
@@ -244,12 +278,12 @@ static bool avl_tree_do_balance(struct avl_tree_node* node, struct avl_tree_node
         if (child->balance >= 0) {
             *new_root_ptr = child;
             ret = child->balance != 0;
-            rot1L(child, node);
+            rot1L(tree, child, node);
             return ret;
         } else { // child->balance == -1
             assert(child->left);
             *new_root_ptr = child->left;
-            rot2RL(child->left, child, node);
+            rot2RL(tree, child->left, child, node);
             return true;
         }
     }
@@ -268,8 +302,8 @@ enum side {
  *
  * Returns the root of the subtree that balancing stopped at.
  */
-static struct avl_tree_node* avl_tree_balance(struct avl_tree_node* node, enum side side,
-                                              bool height_increased) {
+static struct avl_tree_node* avl_tree_balance(struct avl_tree* tree, struct avl_tree_node* node,
+                                              enum side side, bool height_increased) {
     assert(node);
 
     while (1) {
@@ -296,7 +330,7 @@ static struct avl_tree_node* avl_tree_balance(struct avl_tree_node* node, enum s
 
         assert(-2 <= node->balance && node->balance <= 2);
         if (node->balance == -2 || node->balance == 2) {
-             height_changed = avl_tree_do_balance(node, &node);
+             height_changed = avl_tree_do_balance(tree, node, &node);
              /* On inserting height never changes. */
              height_changed = height_increased ? false : height_changed;
         }
@@ -322,6 +356,7 @@ void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node) {
     /* Inserting into an empty tree. */
     if (!tree->root) {
         tree->root = node;
+        avl_tree_update_node(tree, node);
         return;
     }
 
@@ -332,15 +367,18 @@ void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node) {
     struct avl_tree_node* new_root;
 
     if (node->parent->left == node) {
-        new_root = avl_tree_balance(node->parent, LEFT, /*height_increased=*/true);
+        new_root = avl_tree_balance(tree, node->parent, LEFT, /*height_increased=*/true);
     } else {
         assert(node->parent->right == node);
-        new_root = avl_tree_balance(node->parent, RIGHT, /*height_increased=*/true);
+        new_root = avl_tree_balance(tree, node->parent, RIGHT, /*height_increased=*/true);
     }
 
     if (!new_root->parent) {
         tree->root = new_root;
     }
+
+    /* Rotations updated the nodes they moved off the path, fix the path itself. */
+    avl_tree_update_path(tree, node);
 }
 
 void avl_tree_swap_node(struct avl_tree_node* old_node, struct avl_tree_node* new_node) {
@@ -487,12 +525,15 @@ void avl_tree_delete(struct avl_tree* tree, struct avl_tree_node* node) {
 
     /* After removal the tree might need balancing. */
     if (node->parent) {
-        new_root = avl_tree_balance(node->parent, side, /*height_increased=*/false);
+        new_root = avl_tree_balance(tree, node->parent, side, /*height_increased=*/false);
     }
 
     if ((new_root && !new_root->parent) || !node->parent) {
         tree->root = new_root;
     }
+
+    /* `node->parent` still points to the parent `node` was removed from. */
+    avl_tree_update_path(tree, node->parent);
 }
 
 static struct avl_tree_node*
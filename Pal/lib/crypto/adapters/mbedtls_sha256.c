@@ -0,0 +1,166 @@
+/* Copyright (C) 2020 Intel Corporation
+
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * SHA-256 block function for mbedTLS (MBEDTLS_SHA256_PROCESS_ALT in crypto/config.h).
+ *
+ * Uses the SHA extensions (SHA-NI) of the CPU if they are available, and a portable implementation
+ * otherwise. SHA-256 is what trusted files are verified with, so this speeds up opening them (and
+ * loading of trusted libraries) considerably.
+ *
+ * Like mbedTLS' AES-NI support, the SHA-NI support is detected with CPUID, which inside an SGX
+ * enclave is emulated by the PAL exception handler. The result is cached.
+ */
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "mbedtls/sha256.h"
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define S0(x)      (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define S1(x)      (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define S2(x)      (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S3(x)      (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define F0(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define F1(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+
+static void sha256_process_generic(uint32_t state[8], const unsigned char data[64]) {
+    uint32_t w[64];
+    uint32_t a[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+               (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+        w[i] = S1(w[i - 2]) + w[i - 7] + S0(w[i - 15]) + w[i - 16];
+
+    for (int i = 0; i < 8; i++)
+        a[i] = state[i];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = a[7] + S3(a[4]) + F1(a[4], a[5], a[6]) + sha256_k[i] + w[i];
+        uint32_t t2 = S2(a[0]) + F0(a[0], a[1], a[2]);
+        a[7] = a[6];
+        a[6] = a[5];
+        a[5] = a[4];
+        a[4] = a[3] + t1;
+        a[3] = a[2];
+        a[2] = a[1];
+        a[1] = a[0];
+        a[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; i++)
+        state[i] += a[i];
+}
+
+/* four rounds with message words `msg` (already in big-endian order) and constants `k` */
+#define SHA256_ROUNDS4(msg, k)                                              \
+    do {                                                                    \
+        __m128i _m = _mm_add_epi32(msg, _mm_loadu_si128((const void*)(k))); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, _m);                 \
+        _m     = _mm_shuffle_epi32(_m, 0x0E);                               \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _m);                 \
+    } while (0)
+
+/* computes the next four message words from the previous 16 (in m0..m3, m0 being the oldest) */
+#define SHA256_SCHEDULE(m0, m1, m2, m3)                                     \
+    do {                                                                    \
+        m0 = _mm_sha256msg1_epu32(m0, m1);                                  \
+        m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4));                 \
+        m0 = _mm_sha256msg2_epu32(m0, m3);                                  \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_process_shani(uint32_t state[8], const unsigned char data[64]) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* SHA-NI works on state words in the order (ABEF, CDGH) */
+    __m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const void*)&state[0]), 0xB1); /* CDAB */
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const void*)&state[4]), 0x1B); /* EFGH */
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                 /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                       /* CDGH */
+
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+
+    __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const void*)(data + 0)), bswap);
+    __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const void*)(data + 16)), bswap);
+    __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const void*)(data + 32)), bswap);
+    __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const void*)(data + 48)), bswap);
+
+    SHA256_ROUNDS4(m0, &sha256_k[0]);
+    SHA256_ROUNDS4(m1, &sha256_k[4]);
+    SHA256_ROUNDS4(m2, &sha256_k[8]);
+    SHA256_ROUNDS4(m3, &sha256_k[12]);
+    for (int i = 16; i < 64; i += 16) {
+        SHA256_SCHEDULE(m0, m1, m2, m3);
+        SHA256_ROUNDS4(m0, &sha256_k[i]);
+        SHA256_SCHEDULE(m1, m2, m3, m0);
+        SHA256_ROUNDS4(m1, &sha256_k[i + 4]);
+        SHA256_SCHEDULE(m2, m3, m0, m1);
+        SHA256_ROUNDS4(m2, &sha256_k[i + 8]);
+        SHA256_SCHEDULE(m3, m0, m1, m2);
+        SHA256_ROUNDS4(m3, &sha256_k[i + 12]);
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+
+    /* back to (ABCD, EFGH) */
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);          /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);          /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);       /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);          /* HGFE */
+    _mm_storeu_si128((void*)&state[0], state0);
+    _mm_storeu_si128((void*)&state[4], state1);
+}
+
+/* 0 - not checked yet, 1 - not supported, 2 - supported */
+static int g_sha256_shani_support = 0;
+
+static bool sha256_has_shani(void) {
+    int support = __atomic_load_n(&g_sha256_shani_support, __ATOMIC_RELAXED);
+    if (!support) {
+        uint32_t eax = 7, ebx, ecx = 0, edx;
+        __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        /* CPUID.(EAX=07H, ECX=0):EBX.SHA[bit 29] */
+        support = (ebx & (1U << 29)) ? 2 : 1;
+        __atomic_store_n(&g_sha256_shani_support, support, __ATOMIC_RELAXED);
+    }
+    return support == 2;
+}
+
+int mbedtls_internal_sha256_process(mbedtls_sha256_context* ctx, const unsigned char data[64]) {
+    if (sha256_has_shani())
+        sha256_process_shani(ctx->state, data);
+    else
+        sha256_process_generic(ctx->state, data);
+    return 0;
+}
@@ -19,9 +19,16 @@
  *
  * This file contains functions to read app config (manifest) file and create
  * a tree to lookup / access config values.
+ *
+ * Besides the tree (which keeps the order of keys for enumeration), all nodes
+ * are indexed in one hash table by their parent node and their key token, so
+ * that looking up a key costs one hash lookup per token regardless of how many
+ * siblings it has (manifests may list thousands of trusted files or mounts).
+ * Nodes are allocated in chunks.
  */
 
 #include <api.h>
+#include <hash.h>
 #include <list.h>
 #include <pal_error.h>
 
@@ -37,8 +44,114 @@ struct config {
     LIST_TYPE(config) list;
     LISTP_TYPE(config) children;
     LIST_TYPE(config) siblings;
+    struct config* parent;
+    struct config* hnext; /* next node in the hash bucket (or in the free list) */
+};
+
+#define CONFIG_HASH_INIT_SIZE 64 /* must be a power of two */
+#define CONFIG_CHUNK_NODES    64
+
+struct config_chunk {
+    struct config_chunk* next;
+    struct config nodes[CONFIG_CHUNK_NODES];
 };
 
+static void init_config_store(struct config_store* store) {
+    INIT_LISTP(&store->root);
+    INIT_LISTP(&store->entries);
+    store->hash       = NULL;
+    store->hash_size  = 0;
+    store->hash_cnt   = 0;
+    store->chunks     = NULL;
+    store->free_nodes = NULL;
+}
+
+/* hash of the key token, mixed with the parent node */
+static size_t config_hash(const struct config* parent, const char* key, size_t klen) {
+    return hash_str(key, klen, hash_u64((uintptr_t)parent));
+}
+
+static struct config* config_lookup(struct config_store* store, const struct config* parent,
+                                    const char* key, size_t klen) {
+    if (!store->hash)
+        return NULL;
+
+    struct config* e = store->hash[config_hash(parent, key, klen) & (store->hash_size - 1)];
+    for (; e; e = e->hnext)
+        if (e->parent == parent && e->klen == klen && !memcmp(e->key, key, klen))
+            return e;
+
+    return NULL;
+}
+
+static int config_hash_add(struct config_store* store, struct config* e) {
+    if (store->hash_cnt >= store->hash_size) {
+        size_t new_size = store->hash_size ? store->hash_size * 2 : CONFIG_HASH_INIT_SIZE;
+        struct config** new_hash = store->malloc(sizeof(*new_hash) * new_size);
+
+        if (new_hash) {
+            memset(new_hash, 0, sizeof(*new_hash) * new_size);
+            for (size_t i = 0; i < store->hash_size; i++) {
+                struct config* n;
+                for (struct config* tmp = store->hash[i]; tmp; tmp = n) {
+                    n = tmp->hnext;
+                    size_t idx = config_hash(tmp->parent, tmp->key, tmp->klen) & (new_size - 1);
+                    tmp->hnext = new_hash[idx];
+                    new_hash[idx] = tmp;
+                }
+            }
+            /* stores that are never freed (e.g. the manifest of the untrusted SGX loader) have no
+             * free function; the old table is just leaked there */
+            if (store->hash && store->free)
+                store->free(store->hash);
+            store->hash      = new_hash;
+            store->hash_size = new_size;
+        } else if (!store->hash) {
+            return -PAL_ERROR_NOMEM;
+        }
+        /* if the table cannot grow, the chains just get longer */
+    }
+
+    size_t idx = config_hash(e->parent, e->key, e->klen) & (store->hash_size - 1);
+    e->hnext = store->hash[idx];
+    store->hash[idx] = e;
+    store->hash_cnt++;
+    return 0;
+}
+
+static void config_hash_del(struct config_store* store, struct config* e) {
+    struct config** p = &store->hash[config_hash(e->parent, e->key, e->klen) &
+                                     (store->hash_size - 1)];
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+    store->hash_cnt--;
+}
+
+static struct config* alloc_config_node(struct config_store* store) {
+    if (!store->free_nodes) {
+        struct config_chunk* chunk = store->malloc(sizeof(*chunk));
+        if (!chunk)
+            return NULL;
+
+        chunk->next   = store->chunks;
+        store->chunks = chunk;
+        for (int i = CONFIG_CHUNK_NODES - 1; i >= 0; i--) {
+            chunk->nodes[i].hnext = store->free_nodes;
+            store->free_nodes     = &chunk->nodes[i];
+        }
+    }
+
+    struct config* e  = store->free_nodes;
+    store->free_nodes = e->hnext;
+    return e;
+}
+
+static void free_config_node(struct config_store* store, struct config* e) {
+    e->hnext          = store->free_nodes;
+    store->free_nodes = e;
+}
+
 static int __add_config(struct config_store* store, const char* key, size_t klen, const char* val,
                         size_t vlen, struct config** entry) {
     LISTP_TYPE(config)* list = &store->root;
@@ -55,20 +168,24 @@ static int __add_config(struct config_store* store, const char* key, size_t klen
             if (token[len] == '.')
                 break;
 
-        LISTP_FOR_EACH_ENTRY(e, list, siblings) {
-            if (e->klen == len && !memcmp(e->key, token, len))
-                goto next;
-        }
+        e = config_lookup(store, parent, token, len);
+        if (e)
+            goto next;
 
-        e = store->malloc(sizeof(struct config));
+        e = alloc_config_node(store);
         if (!e)
             return -PAL_ERROR_NOMEM;
 
-        e->key  = token;
-        e->klen = len;
-        e->val  = NULL;
-        e->vlen = 0;
-        e->buf  = NULL;
+        e->key    = token;
+        e->klen   = len;
+        e->val    = NULL;
+        e->vlen   = 0;
+        e->buf    = NULL;
+        e->parent = parent;
+        if (config_hash_add(store, e) < 0) {
+            free_config_node(store, e);
+            return -PAL_ERROR_NOMEM;
+        }
         INIT_LIST_HEAD(e, list);
         LISTP_ADD_TAIL(e, &store->entries, list);
         INIT_LISTP(&e->children);
@@ -99,8 +216,7 @@ static int __add_config(struct config_store* store, const char* key, size_t klen
 }
 
 static struct config* __get_config(struct config_store* store, const char* key) {
-    LISTP_TYPE(config)* list = &store->root;
-    struct config* e         = NULL;
+    struct config* e = NULL;
 
     while (*key) {
         const char* token = key;
@@ -109,18 +225,13 @@ static struct config* __get_config(struct config_store* store, const char* key)
             if (token[len] == '.')
                 break;
 
-        LISTP_FOR_EACH_ENTRY(e, list, siblings) {
-            if (e->klen == len && !memcmp(e->key, token, len))
-                goto next;
-        }
-
-        return NULL;
+        e = config_lookup(store, e, token, len);
+        if (!e)
+            return NULL;
 
-    next:
         if (token[len])
             len++;
         key += len;
-        list = &e->children;
     }
 
     return e;
@@ -174,20 +285,12 @@ ssize_t get_config_entries_size(struct config_store* store, const char* key) {
 
 static int __del_config(struct config_store* store, LISTP_TYPE(config)* root, struct config* p,
                         const char* key) {
-    struct config* e;
-    struct config* found = NULL;
     size_t len = 0;
     for (; key[len]; len++)
         if (key[len] == '.')
             break;
 
-    LISTP_FOR_EACH_ENTRY(e, root, siblings) {
-        if (e->klen == len && !memcmp(e->key, key, len)) {
-            found = e;
-            break;
-        }
-    }
-
+    struct config* found = config_lookup(store, p, key, len);
     if (!found)
         return -PAL_ERROR_INVAL;
 
@@ -208,9 +311,10 @@ static int __del_config(struct config_store* store, LISTP_TYPE(config)* root, st
         p->vlen -= (found->klen + 1);
     LISTP_DEL(found, root, siblings);
     LISTP_DEL(found, &store->entries, list);
+    config_hash_del(store, found);
     if (found->buf)
         store->free(found->buf);
-    store->free(found);
+    free_config_node(store, found);
 
     return 0;
 }
@@ -252,8 +356,7 @@ int set_config(struct config_store* store, const char* key, const char* val) {
 
 int read_config(struct config_store* store, int (*filter)(const char* key, int ken),
                 const char** errstring) {
-    INIT_LISTP(&store->root);
-    INIT_LISTP(&store->entries);
+    init_config_store(store);
 
     char* ptr     = store->raw_data;
     char* ptr_end = store->raw_data + store->raw_size;
@@ -385,20 +488,27 @@ inval:
 
 int free_config(struct config_store* store) {
     struct config* e;
-    struct config* n;
-    LISTP_FOR_EACH_ENTRY_SAFE(e, n, &store->entries, list) {
+    LISTP_FOR_EACH_ENTRY(e, &store->entries, list) {
         store->free(e->buf);
-        store->free(e);
     }
 
-    INIT_LISTP(&store->root);
-    INIT_LISTP(&store->entries);
+    struct config_chunk* chunk = store->chunks;
+    while (chunk) {
+        struct config_chunk* next = chunk->next;
+        store->free(chunk);
+        chunk = next;
+    }
+
+    if (store->hash)
+        store->free(store->hash);
+
+    init_config_store(store);
     return 0;
 }
 
 static int __dup_config(const struct config_store* ss, const LISTP_TYPE(config) * sr,
-                        struct config_store* ts, LISTP_TYPE(config) * tr, void** data,
-                        size_t* size) {
+                        struct config_store* ts, struct config* tp, LISTP_TYPE(config) * tr,
+                        void** data, size_t* size) {
     struct config* e;
     struct config* new;
 
@@ -445,15 +555,20 @@ static int __dup_config(const struct config_store* ss, const LISTP_TYPE(config)
             memcpy(val, e->val, e->vlen);
         }
 
-        new = ts->malloc(sizeof(struct config));
+        new = alloc_config_node(ts);
         if (!new)
             return -PAL_ERROR_NOMEM;
 
-        new->key  = key;
-        new->klen = e->klen;
-        new->val  = val;
-        new->vlen = e->vlen;
-        new->buf  = buf;
+        new->key    = key;
+        new->klen   = e->klen;
+        new->val    = val;
+        new->vlen   = e->vlen;
+        new->buf    = buf;
+        new->parent = tp;
+        if (config_hash_add(ts, new) < 0) {
+            free_config_node(ts, new);
+            return -PAL_ERROR_NOMEM;
+        }
         INIT_LIST_HEAD(new, list);
         LISTP_ADD_TAIL(new, &ts->entries, list);
         INIT_LISTP(&new->children);
@@ -461,7 +576,7 @@ static int __dup_config(const struct config_store* ss, const LISTP_TYPE(config)
         LISTP_ADD_TAIL(new, tr, siblings);
 
         if (!LISTP_EMPTY(&e->children)) {
-            int ret = __dup_config(ss, &e->children, ts, &new->children, data, size);
+            int ret = __dup_config(ss, &e->children, ts, new, &new->children, data, size);
             if (ret < 0)
                 return ret;
         }
@@ -471,8 +586,7 @@ static int __dup_config(const struct config_store* ss, const LISTP_TYPE(config)
 }
 
 int copy_config(struct config_store* store, struct config_store* new_store) {
-    INIT_LISTP(&new_store->root);
-    INIT_LISTP(&new_store->entries);
+    init_config_store(new_store);
 
     struct config* e;
     size_t size = 0;
@@ -495,7 +609,8 @@ int copy_config(struct config_store* store, struct config_store* new_store) {
     new_store->raw_data = data;
     new_store->raw_size = size;
 
-    return __dup_config(store, &store->root, new_store, &new_store->root, &dataptr, &datasz);
+    return __dup_config(store, &store->root, new_store, NULL, &new_store->root, &dataptr,
+                        &datasz);
 }
 
 static int __write_config(void* f, int (*write)(void*, void*, int), struct config_store* store,
@@ -0,0 +1,93 @@
+#include "api.h"
+#include "pal.h"
+#include "pal_debug.h"
+#include "pal_error.h"
+
+#define FILE_URI "file:streams_submit.tmp"
+
+/* more operations than fit into one OCALL batch of the SGX PAL */
+#define REJECTED_OPS 80
+
+int main(int argc, char** argv, char** envp) {
+    char hello[] = "Hello", world[] = " World";
+    char buf1[5], buf2[6], buf3[16];
+
+    PAL_HANDLE hdl = DkStreamOpen(FILE_URI, PAL_ACCESS_RDWR, PAL_SHARE_OWNER_W | PAL_SHARE_OWNER_R,
+                                  PAL_CREATE_TRY, 0);
+    if (!hdl) {
+        pal_printf("DkStreamOpen failed\n");
+        return 1;
+    }
+
+    PAL_STREAM_OP writes[] = {
+        { .op = PAL_STREAM_OP_WRITE, .handle = hdl, .offset = 0, .count = 5, .buffer = hello },
+        { .op = PAL_STREAM_OP_WRITE, .flags = PAL_STREAM_OP_LINK, .handle = hdl, .offset = 5,
+          .count = 6, .buffer = world },
+        { .op = PAL_STREAM_OP_FLUSH, .flags = PAL_STREAM_OP_LINK, .handle = hdl },
+    };
+    if (!DkStreamsSubmit(writes, ARRAY_SIZE(writes))) {
+        pal_printf("DkStreamsSubmit failed\n");
+        return 1;
+    }
+    if (writes[0].result == 5 && writes[1].result == 6 && writes[2].result == 0)
+        pal_printf("Batched writes OK\n");
+
+    PAL_STREAM_OP reads[] = {
+        { .op = PAL_STREAM_OP_READ, .handle = hdl, .offset = 0, .count = 5, .buffer = buf1 },
+        { .op = PAL_STREAM_OP_READ, .handle = hdl, .offset = 5, .count = 6, .buffer = buf2 },
+        /* short read at the end of file, so the linked write below must not be executed */
+        { .op = PAL_STREAM_OP_READ, .handle = hdl, .offset = 0, .count = 16, .buffer = buf3 },
+        { .op = PAL_STREAM_OP_WRITE, .flags = PAL_STREAM_OP_LINK, .handle = hdl, .offset = 0,
+          .count = 5, .buffer = world },
+    };
+    if (!DkStreamsSubmit(reads, ARRAY_SIZE(reads))) {
+        pal_printf("DkStreamsSubmit failed\n");
+        return 1;
+    }
+    if (reads[0].result == 5 && !memcmp(buf1, hello, 5) && reads[1].result == 6 &&
+            !memcmp(buf2, world, 6))
+        pal_printf("Batched reads OK\n");
+    if (reads[2].result == 11 && reads[3].result == PAL_STREAM_ERROR &&
+            reads[3].error == PAL_ERROR_TRYAGAIN)
+        pal_printf("Linked operation canceled\n");
+
+    /* the first batch of host syscalls is rejected as a whole on SGX (the buffer of the first
+     * write runs past the enclave); the operations queued after it must still be executed */
+    PAL_STREAM_OP rejected[REJECTED_OPS];
+    memset(rejected, 0, sizeof(rejected));
+    for (size_t i = 0; i < ARRAY_SIZE(rejected); i++) {
+        rejected[i].op     = PAL_STREAM_OP_READ;
+        rejected[i].handle = hdl;
+        rejected[i].count  = 5;
+        rejected[i].buffer = buf1;
+    }
+    rejected[0].op     = PAL_STREAM_OP_WRITE;
+    rejected[0].offset = 16;
+    rejected[0].count  = 1UL << 40;
+    rejected[0].buffer = hello;
+    memset(buf1, 0, sizeof(buf1));
+    if (!DkStreamsSubmit(rejected, ARRAY_SIZE(rejected))) {
+        pal_printf("DkStreamsSubmit failed\n");
+        return 1;
+    }
+    if (rejected[ARRAY_SIZE(rejected) - 1].result == 5 && !memcmp(buf1, hello, 5))
+        pal_printf("Operations after rejected batch OK\n");
+
+    PAL_STREAM_OP close_op = { .op = PAL_STREAM_OP_CLOSE, .handle = hdl };
+    if (!DkStreamsSubmit(&close_op, 1)) {
+        pal_printf("DkStreamsSubmit failed\n");
+        return 1;
+    }
+    if (close_op.result == 0)
+        pal_printf("Batched close OK\n");
+
+    hdl = DkStreamOpen(FILE_URI, PAL_ACCESS_RDONLY, 0, 0, 0);
+    if (hdl) {
+        char buf[12] = {0};
+        if (DkStreamRead(hdl, 0, sizeof(buf) - 1, buf, NULL, 0) == 11)
+            pal_printf("File contents: %s\n", buf);
+        DkStreamDelete(hdl, 0);
+        DkObjectClose(hdl);
+    }
+    return 0;
+}
@@ -27,6 +27,7 @@ int main(int argc, char** argv, char** envp) {
     PRINT_SYMBOL(DkStreamUnmap);
     PRINT_SYMBOL(DkStreamSetLength);
     PRINT_SYMBOL(DkStreamFlush);
+    PRINT_SYMBOL(DkStreamsSubmit);
     PRINT_SYMBOL(DkSendHandle);
     PRINT_SYMBOL(DkReceiveHandle);
     PRINT_SYMBOL(DkStreamAttributesQuery);
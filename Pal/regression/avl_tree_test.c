@@ -13,9 +13,9 @@ noreturn void __abort(void) {
     DkProcessExit(1);
 }
 
-#define EXIT_UNBALANCED() do {                              \
-        pal_printf("Unbalanced tree at: %u\n", __LINE__);   \
-        DkProcessExit(1);                                   \
+#define EXIT_UNBALANCED() do {                                          \
+        pal_printf("Unbalanced or corrupted tree at: %u\n", __LINE__); \
+        DkProcessExit(1);                                               \
     } while(0)
 
 static uint32_t _seed;
@@ -49,6 +49,7 @@ struct A {
     struct avl_tree_node node;
     int64_t key;
     bool freed;
+    size_t subtree_size; /* augmented data maintained by tree.update */
 };
 
 static struct A* node2struct(struct avl_tree_node* node) {
@@ -63,9 +64,20 @@ static bool cmp_gen(void* x, struct avl_tree_node* y) {
     return *(int64_t*)x <= node2struct(y)->key;
 }
 
+static void update_size(struct avl_tree_node* node) {
+    size_t size = 1;
+    if (node->left) {
+        size += node2struct(node->left)->subtree_size;
+    }
+    if (node->right) {
+        size += node2struct(node->right)->subtree_size;
+    }
+    node2struct(node)->subtree_size = size;
+}
+
 #define ELEMENTS_COUNT 0x1000
 #define RAND_DEL_COUNT 0x100
-static struct avl_tree tree = { .root = NULL, .cmp = cmp };
+static struct avl_tree tree = { .root = NULL, .cmp = cmp, .update = update_size };
 static struct A t[ELEMENTS_COUNT];
 
 
@@ -89,6 +101,27 @@ static size_t get_tree_size(struct avl_tree_node* node) {
     return get_tree_size(node->left) + 1 + get_tree_size(node->right);
 }
 
+/* Returns whether augmented subtree sizes are correct. */
+static bool check_subtree_sizes(struct avl_tree_node* node, size_t* size) {
+    if (!node) {
+        *size = 0;
+        return true;
+    }
+
+    size_t a = 0;
+    size_t b = 0;
+    bool ret = check_subtree_sizes(node->left, &a);
+    ret &= check_subtree_sizes(node->right, &b);
+
+    *size = a + 1 + b;
+    return ret && node2struct(node)->subtree_size == *size;
+}
+
+static bool tree_is_ok(void) {
+    size_t size;
+    return debug_avl_tree_is_balanced(&tree) && check_subtree_sizes(tree.root, &size);
+}
+
 static void do_test(int32_t (*get_num)(void)) {
     size_t i;
 
@@ -96,7 +129,7 @@ static void do_test(int32_t (*get_num)(void)) {
         t[i].key = get_num();
         t[i].freed = false;
         avl_tree_insert(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_ok()) {
             EXIT_UNBALANCED();
         }
     }
@@ -165,7 +198,7 @@ static void do_test(int32_t (*get_num)(void)) {
     /* get_num returns int32_t, but tmp.key is a int64_t, so this cannot overflow. */
     struct A tmp = { .key = val + 100 };
     avl_tree_insert(&tree, &tmp.node);
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_ok()) {
         EXIT_UNBALANCED();
     }
 
@@ -190,7 +223,7 @@ static void do_test(int32_t (*get_num)(void)) {
     }
 
     avl_tree_delete(&tree, &tmp.node);
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_ok()) {
         EXIT_UNBALANCED();
     }
 
@@ -201,7 +234,7 @@ static void do_test(int32_t (*get_num)(void)) {
             t[r].freed = true;
             avl_tree_delete(&tree, &t[r].node);
             i--;
-            if (!debug_avl_tree_is_balanced(&tree)) {
+            if (!tree_is_ok()) {
                 EXIT_UNBALANCED();
             }
         }
@@ -210,7 +243,7 @@ static void do_test(int32_t (*get_num)(void)) {
         if (!t[i].freed) {
             avl_tree_delete(&tree, &t[i].node);
             t[i].freed = true;
-            if (!debug_avl_tree_is_balanced(&tree)) {
+            if (!tree_is_ok()) {
                 EXIT_UNBALANCED();
             }
         }
@@ -227,7 +260,7 @@ static void test_ordering(void) {
     for (i = ELEMENTS_COUNT - 1; i >= 0; i--) {
         t[i].key = i / (ELEMENTS_COUNT / DIFF_ELEMENTS);
         avl_tree_insert(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_ok()) {
             EXIT_UNBALANCED();
         }
     }
@@ -247,7 +280,7 @@ static void test_ordering(void) {
 
     for (i = 0; i < ELEMENTS_COUNT; i++) {
         avl_tree_delete(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_ok()) {
             EXIT_UNBALANCED();
         }
     }
@@ -274,6 +274,7 @@ class TC_02_Symbols(RegressionTestCase):
         'DkStreamUnmap',
         'DkStreamSetLength',
         'DkStreamFlush',
+        'DkStreamsSubmit',
         'DkSendHandle',
         'DkReceiveHandle',
         'DkStreamAttributesQuery',
@@ -434,6 +435,19 @@ class TC_20_SingleProcess(RegressionTestCase):
         # disallowed unless sgx.allow_file_creation is explicitly set to 1.
         self.assertIn('File Creation Test 4 OK', stderr)
 
+    def test_102_streams_submit(self):
+        try:
+            pathlib.Path('streams_submit.tmp').unlink()
+        except FileNotFoundError:
+            pass
+        _, stderr = self.run_binary(['StreamsSubmit'])
+        self.assertIn('Batched writes OK', stderr)
+        self.assertIn('Batched reads OK', stderr)
+        self.assertIn('Linked operation canceled', stderr)
+        self.assertIn('Operations after rejected batch OK', stderr)
+        self.assertIn('Batched close OK', stderr)
+        self.assertIn('File contents: Hello World', stderr)
+
     def test_110_directory(self):
         for path in ['dir_exist.tmp', 'dir_nonexist.tmp', 'dir_delete.tmp']:
             try:
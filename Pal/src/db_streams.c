@@ -661,6 +661,83 @@ PAL_BOL DkStreamFlush(PAL_HANDLE handle) {
     LEAVE_PAL_CALL_RETURN(PAL_TRUE);
 }
 
+/* Execute a single operation submitted via DkStreamsSubmit() on its own. Return the number of
+   bytes read/written (0 for flush and close), or negative PAL error code. */
+int64_t _DkStreamOpExecute(PAL_STREAM_OP* op) {
+    int ret;
+
+    switch (op->op) {
+        case PAL_STREAM_OP_READ:
+            return _DkStreamRead(op->handle, op->offset, op->count, (void*)op->buffer, NULL, 0);
+        case PAL_STREAM_OP_WRITE:
+            return _DkStreamWrite(op->handle, op->offset, op->count, (void*)op->buffer, NULL, 0);
+        case PAL_STREAM_OP_FLUSH:
+            ret = _DkStreamFlush(op->handle);
+            return ret < 0 ? ret : 0;
+        case PAL_STREAM_OP_CLOSE:
+            ret = _DkObjectClose(op->handle);
+            return ret < 0 ? ret : 0;
+        default:
+            return -PAL_ERROR_INVAL;
+    }
+}
+
+/* Record the outcome of a submitted operation (number of bytes or negative PAL error code). */
+void _DkStreamOpSetResult(PAL_STREAM_OP* op, int64_t ret) {
+    if (ret < 0) {
+        op->result = PAL_STREAM_ERROR;
+        op->error  = -ret;
+    } else {
+        op->result = ret;
+        op->error  = 0;
+    }
+}
+
+/* Return true if a submitted operation completed fully, i.e., an operation linked to it via
+   PAL_STREAM_OP_LINK may be executed. */
+bool _DkStreamOpCompleted(const PAL_STREAM_OP* op) {
+    if (op->result == PAL_STREAM_ERROR)
+        return false;
+    if (op->op == PAL_STREAM_OP_READ || op->op == PAL_STREAM_OP_WRITE)
+        return op->result == op->count;
+    return true;
+}
+
+/* PAL call DkStreamsSubmit: Perform a vector of stream operations, with as few host round trips
+   as the host allows. Return true if the operations were performed (each one reports its own
+   result), or false if the vector is malformed. Error code is notified. */
+PAL_BOL DkStreamsSubmit(PAL_STREAM_OP* ops, PAL_NUM count) {
+    ENTER_PAL_CALL(DkStreamsSubmit);
+
+    if (!ops && count) {
+        _DkRaiseFailure(PAL_ERROR_INVAL);
+        LEAVE_PAL_CALL_RETURN(PAL_FALSE);
+    }
+
+    for (PAL_NUM i = 0; i < count; i++) {
+        if (!ops[i].handle || ops[i].op > PAL_STREAM_OP_CLOSE ||
+                ((ops[i].op == PAL_STREAM_OP_READ || ops[i].op == PAL_STREAM_OP_WRITE) &&
+                 !ops[i].buffer)) {
+            _DkRaiseFailure(PAL_ERROR_INVAL);
+            LEAVE_PAL_CALL_RETURN(PAL_FALSE);
+        }
+        ops[i].result = PAL_STREAM_ERROR;
+        ops[i].error  = PAL_ERROR_TRYAGAIN;
+    }
+
+    if (!count)
+        LEAVE_PAL_CALL_RETURN(PAL_TRUE);
+
+    int ret = _DkStreamsSubmit(ops, count);
+
+    if (ret < 0) {
+        _DkRaiseFailure(-ret);
+        LEAVE_PAL_CALL_RETURN(PAL_FALSE);
+    }
+
+    LEAVE_PAL_CALL_RETURN(PAL_TRUE);
+}
+
 /* PAL call DkSendHandle: Write to a process handle.
    Return 1 on success and 0 on failure */
 PAL_BOL DkSendHandle(PAL_HANDLE handle, PAL_HANDLE cargo) {
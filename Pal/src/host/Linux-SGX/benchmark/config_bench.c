@@ -0,0 +1,214 @@
+/*
+ * Host-only benchmark of the manifest config store (Pal/lib/graphene/config.c).
+ *
+ * Generates manifests with a growing number of trusted files (each with a checksum, as in
+ * .manifest.sgx files) and mounts, and measures what PAL and LibOS initialization do with them:
+ * parsing the manifest with read_config(), enumerating the trusted files and looking up the URI and
+ * checksum of each of them (as init_trusted_files() does), copying the store (as LibOS does at
+ * startup) and freeing it. With the hashed index of config.c, the cost per trusted file stays
+ * constant as the manifest grows (before, every lookup walked all siblings of each key token).
+ * All looked up values are checked, also in a store without a free function (as the one of the
+ * untrusted SGX loader) whose index has to grow.
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "api.h"
+#include "pal_error.h"
+
+#include "graphene/config.c"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static char* generate_manifest(size_t nfiles, size_t* size) {
+    size_t bufsize = 4096 + nfiles * 256;
+    char* buf = malloc(bufsize);
+    if (!buf)
+        return NULL;
+
+    size_t off = 0;
+    off += snprintf(buf + off, bufsize - off,
+                    "# generated manifest\n"
+                    "loader.preload = file:libsysdb.so\n"
+                    "loader.exec = file:app\n"
+                    "sgx.enclave_size = 1G\n"
+                    "sgx.thread_num = 16\n");
+    for (size_t i = 0; i < nfiles / 16 + 1; i++)
+        off += snprintf(buf + off, bufsize - off,
+                        "fs.mount.mnt%zu.type = chroot\n"
+                        "fs.mount.mnt%zu.path = /mnt/%zu\n"
+                        "fs.mount.mnt%zu.uri = file:/mnt/%zu\n", i, i, i, i, i);
+    for (size_t i = 0; i < nfiles; i++)
+        off += snprintf(buf + off, bufsize - off,
+                        "sgx.trusted_files.file%zu = file:/usr/lib/lib%zu.so\n"
+                        "sgx.trusted_checksum.file%zu = %064zx\n", i, i, i, i);
+
+    *size = off;
+    return buf;
+}
+
+/* the lookups of init_trusted_files() in enclave_framework.c */
+static int lookup_trusted_files(struct config_store* store, size_t nfiles) {
+    char key[CONFIG_MAX];
+    char val[CONFIG_MAX];
+    char expected[CONFIG_MAX];
+
+    ssize_t cfgsize = get_config_entries_size(store, "sgx.trusted_files");
+    if (cfgsize <= 0)
+        return -1;
+
+    char* cfgbuf = malloc(cfgsize);
+    if (!cfgbuf)
+        return -1;
+
+    int nuris = get_config_entries(store, "sgx.trusted_files", cfgbuf, cfgsize);
+    if (nuris < 0 || (size_t)nuris != nfiles) {
+        free(cfgbuf);
+        return -1;
+    }
+
+    const char* k = cfgbuf;
+    for (int i = 0; i < nuris; i++) {
+        size_t idx = strtoul(k + strlen("file"), NULL, 10);
+
+        snprintf(key, sizeof(key), "sgx.trusted_files.%s", k);
+        snprintf(expected, sizeof(expected), "file:/usr/lib/lib%zu.so", idx);
+        if (get_config(store, key, val, sizeof(val)) < 0 || strcmp(val, expected))
+            goto fail;
+
+        snprintf(key, sizeof(key), "sgx.trusted_checksum.%s", k);
+        snprintf(expected, sizeof(expected), "%064zx", idx);
+        if (get_config(store, key, val, sizeof(val)) < 0 || strcmp(val, expected))
+            goto fail;
+
+        k += strlen(k) + 1;
+    }
+
+    free(cfgbuf);
+    return 0;
+
+fail:
+    fprintf(stderr, "FAILED: wrong value of %s\n", key);
+    free(cfgbuf);
+    return -1;
+}
+
+/* load_manifest() of the untrusted SGX loader reads the manifest into a store without a free
+ * function; the index must still be able to grow past its initial size */
+static int check_store_without_free(void) {
+    size_t size;
+    char* manifest = generate_manifest(100, &size);
+    if (!manifest)
+        return -1;
+
+    struct config_store store = {
+        .raw_data = manifest,
+        .raw_size = size,
+        .malloc   = malloc,
+        .free     = NULL,
+    };
+    const char* errstring = NULL;
+    if (read_config(&store, NULL, &errstring) < 0) {
+        fprintf(stderr, "FAILED: cannot read the manifest without free(): %s\n", errstring);
+        return -1;
+    }
+    /* nodes and the index are leaked, as in the SGX loader */
+    int ret = lookup_trusted_files(&store, 100);
+    free(manifest);
+    return ret;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-f max number of trusted files] [-n iterations]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t max_files  = 10000;
+    size_t iterations = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+        switch (opt) {
+            case 'f': max_files  = strtoul(optarg, NULL, 10); break;
+            case 'n': iterations = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!max_files || !iterations)
+        usage(argv[0]);
+
+    if (check_store_without_free() < 0)
+        return 1;
+
+    printf("%8s %12s %12s %12s %12s %14s\n", "files", "read (us)", "lookup (us)", "copy (us)",
+           "free (us)", "lookup/file (ns)");
+
+    for (size_t nfiles = 10; nfiles <= max_files; nfiles *= 10) {
+        size_t size;
+        char* manifest = generate_manifest(nfiles, &size);
+        if (!manifest) {
+            fprintf(stderr, "FAILED: cannot allocate the manifest\n");
+            return 1;
+        }
+
+        uint64_t read_ns = 0, lookup_ns = 0, copy_ns = 0, free_ns = 0;
+        for (size_t i = 0; i < iterations; i++) {
+            struct config_store store = {
+                .raw_data = manifest,
+                .raw_size = size,
+                .malloc   = malloc,
+                .free     = free,
+            };
+            struct config_store copy = {
+                .malloc = malloc,
+                .free   = free,
+            };
+            const char* errstring = NULL;
+
+            uint64_t start = now_ns();
+            if (read_config(&store, NULL, &errstring) < 0) {
+                fprintf(stderr, "FAILED: cannot read the manifest: %s\n", errstring);
+                return 1;
+            }
+            uint64_t t1 = now_ns();
+            if (lookup_trusted_files(&store, nfiles) < 0)
+                return 1;
+            uint64_t t2 = now_ns();
+            if (copy_config(&store, &copy) < 0) {
+                fprintf(stderr, "FAILED: cannot copy the config store\n");
+                return 1;
+            }
+            uint64_t t3 = now_ns();
+            if (lookup_trusted_files(&copy, nfiles) < 0)
+                return 1;
+            uint64_t t4 = now_ns();
+            free_config(&store);
+            free_config(&copy);
+            free(copy.raw_data);
+            uint64_t t5 = now_ns();
+
+            read_ns   += t1 - start;
+            lookup_ns += t2 - t1;
+            copy_ns   += t3 - t2;
+            free_ns   += t5 - t4;
+        }
+
+        printf("%8zu %12.1f %12.1f %12.1f %12.1f %14.1f\n", nfiles,
+               (double)read_ns / iterations / 1000, (double)lookup_ns / iterations / 1000,
+               (double)copy_ns / iterations / 1000, (double)free_ns / iterations / 1000,
+               (double)lookup_ns / iterations / nfiles);
+        free(manifest);
+    }
+
+    return 0;
+}
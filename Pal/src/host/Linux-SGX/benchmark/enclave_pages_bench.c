@@ -0,0 +1,318 @@
+/*
+ * Host-only test and benchmark of the enclave heap allocator (enclave_pages.c).
+ *
+ * The allocator only does bookkeeping of address ranges and never touches the memory itself, so it
+ * is compiled here together with a handful of stand-ins for the enclave environment (locks, debug
+ * prints, `pal_sec`) and operates on a fake heap address range.
+ *
+ * First, random allocations and frees on a small heap are checked against a trivial page-by-page
+ * model, and the VMA tree is validated after every operation. Then, for a growing number of
+ * non-mergeable VMAs, the benchmark measures the cost of fixed-address allocation, free and
+ * any-address allocation. With the VMA tree, all of them grow logarithmically with the number of
+ * VMAs (with the previous list-based allocator they grew linearly).
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* keep the enclave-only headers out, the definitions enclave_pages.c needs from them follow */
+#define PAL_INTERNAL_H
+#define PAL_LINUX_H
+#define PAL_SECURITY_H
+
+#include "api.h"
+#include "atomic.h"
+#include "pal_error.h"
+
+#define PRESET_PAGESIZE (1 << 12)
+#define MEMORY_GAP      PRESET_PAGESIZE
+
+/* the model test provokes errors on purpose, so the allocator stays silent */
+#define SGX_DBG(class, fmt...) do { } while (0)
+
+typedef struct { bool locked; } PAL_LOCK;
+#define LOCK_INIT { .locked = false }
+
+static void _DkInternalLock(PAL_LOCK* lock) {
+    assert(!lock->locked);
+    lock->locked = true;
+}
+
+static void _DkInternalUnlock(PAL_LOCK* lock) {
+    assert(lock->locked);
+    lock->locked = false;
+}
+
+static bool _DkInternalIsLocked(PAL_LOCK* lock) {
+    return lock->locked;
+}
+
+static void ocall_exit(int exitcode, int is_exitgroup) {
+    (void)is_exitgroup;
+    exit(exitcode);
+}
+
+static struct {
+    void* heap_min;
+    void* heap_max;
+    void* exec_addr;
+    size_t exec_size;
+} pal_sec;
+
+void warn(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+noreturn void __abort(void) {
+    abort();
+}
+
+#include "../enclave_pages.c"
+#include "avl_tree.c"
+
+#define PAGE_SIZE   PRESET_PAGESIZE
+#define HEAP_BOTTOM ((void*)0x100000000UL)
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void reset_heap(size_t heap_pages) {
+    g_heap_vma_tree.root = NULL;
+    g_heap_vma_pool_used = 0;
+    g_heap_vma_num       = 0;
+    g_free_vma           = NULL;
+    g_allocated_pages.counter = 0;
+
+    pal_sec.heap_min  = HEAP_BOTTOM;
+    pal_sec.heap_max  = HEAP_BOTTOM + heap_pages * PAGE_SIZE;
+    pal_sec.exec_addr = NULL;
+    pal_sec.exec_size = 0;
+    if (init_enclave_pages() < 0)
+        abort();
+}
+
+/* checks ordering, bounds and augmented data of the whole VMA tree; returns number of VMAs */
+static size_t check_subtree(struct avl_tree_node* node, const char** err) {
+    if (!node)
+        return 0;
+
+    struct heap_vma* vma = node2vma(node);
+    struct heap_vma* left = node2vma(node->left);
+    struct heap_vma* right = node2vma(node->right);
+    size_t cnt = check_subtree(node->left, err) + 1 + check_subtree(node->right, err);
+
+    if (vma->bottom >= vma->top || vma->bottom < g_heap_bottom || vma->top > g_heap_top)
+        *err = "VMA out of heap bounds";
+    if ((left && left->subtree_top > vma->bottom) || (right && right->subtree_bottom < vma->top))
+        *err = "overlapping or unordered VMAs";
+
+    size_t gap = 0;
+    if (left)
+        gap = MAX(left->subtree_gap, (size_t)(vma->bottom - left->subtree_top));
+    if (right)
+        gap = MAX(gap, MAX(right->subtree_gap, (size_t)(right->subtree_bottom - vma->top)));
+    if (vma->subtree_bottom != (left ? left->subtree_bottom : vma->bottom) ||
+            vma->subtree_top != (right ? right->subtree_top : vma->top) || vma->subtree_gap != gap)
+        *err = "stale augmented data";
+    return cnt;
+}
+
+static const char* check_tree(void) {
+    const char* err = NULL;
+    if (!debug_avl_tree_is_balanced(&g_heap_vma_tree))
+        return "unbalanced tree";
+    if (check_subtree(g_heap_vma_tree.root, &err) != g_heap_vma_num)
+        return "wrong number of VMAs";
+    return err;
+}
+
+/* page-by-page model of the heap: 0 - free, 1 - normal, 2 - PAL internal */
+#define MODEL_PAGES 512
+static char g_model[MODEL_PAGES];
+
+static bool model_get(size_t page, size_t cnt, char type) {
+    for (size_t i = page; i < page + cnt; i++)
+        if (g_model[i] && g_model[i] != type)
+            return false;
+    for (size_t i = page; i < page + cnt; i++)
+        g_model[i] = type;
+    return true;
+}
+
+/* highest page at which `cnt` pages fit into a free area larger than `cnt` pages, or -1 */
+static long model_find(size_t cnt) {
+    size_t run = 0;
+    for (long i = MODEL_PAGES - 1; i >= -1; i--) {
+        if (i >= 0 && !g_model[i]) {
+            run++;
+            continue;
+        }
+        if (run > cnt)
+            return i + 1 + run - cnt;
+        run = 0;
+    }
+    return -1;
+}
+
+static bool model_free(size_t page, size_t cnt) {
+    char type = 0;
+    for (size_t i = page; i < page + cnt; i++) {
+        if (g_model[i] && type && g_model[i] != type)
+            return false;
+        type = g_model[i] ?: type;
+    }
+    for (size_t i = page; i < page + cnt; i++)
+        g_model[i] = 0;
+    return true;
+}
+
+static size_t model_used(void) {
+    size_t used = 0;
+    for (size_t i = 0; i < MODEL_PAGES; i++)
+        used += !!g_model[i];
+    return used;
+}
+
+static int test_against_model(size_t iterations) {
+    reset_heap(MODEL_PAGES);
+    memset(g_model, 0, sizeof(g_model));
+
+    for (size_t it = 0; it < iterations; it++) {
+        size_t page = rand() % MODEL_PAGES;
+        size_t cnt  = 1 + rand() % 8;
+        if (page + cnt > MODEL_PAGES)
+            cnt = MODEL_PAGES - page;
+        char type = 1 + rand() % 2;
+        void* addr = HEAP_BOTTOM + page * PAGE_SIZE;
+
+        bool ok, expected;
+        switch (rand() % 3) {
+            case 0:
+                expected = model_get(page, cnt, type);
+                ok = get_enclave_pages(addr, cnt * PAGE_SIZE, type == 2) == addr;
+                break;
+            case 1: {
+                long found = model_find(cnt);
+                void* ret = get_enclave_pages(NULL, cnt * PAGE_SIZE, type == 2);
+                expected = found >= 0;
+                ok = ret != NULL;
+                if (found >= 0) {
+                    model_get(found, cnt, type);
+                    ok = ret == HEAP_BOTTOM + found * PAGE_SIZE;
+                }
+                break;
+            }
+            default:
+                expected = model_free(page, cnt);
+                ok = free_enclave_pages(addr, cnt * PAGE_SIZE) == 0;
+                break;
+        }
+
+        const char* err = check_tree();
+        if (!err && ok != expected)
+            err = "result differs from the model";
+        if (!err && (size_t)g_allocated_pages.counter != model_used())
+            err = "wrong number of allocated pages";
+        if (err) {
+            fprintf(stderr, "FAILED: %s after %zu operations\n", err, it + 1);
+            return 1;
+        }
+    }
+    printf("model test: %zu operations OK\n", iterations);
+    return 0;
+}
+
+static int bench(size_t vmas_cnt, size_t iterations) {
+    /* heap with `vmas_cnt` one-page VMAs of alternating types (never merged) at the top, and a
+     * large free area below them */
+    size_t heap_pages = vmas_cnt * 4;
+    reset_heap(heap_pages);
+    for (size_t i = 0; i < vmas_cnt; i++) {
+        if (!get_enclave_pages(NULL, PAGE_SIZE, i % 2)) {
+            fprintf(stderr, "FAILED: cannot allocate VMA %zu\n", i);
+            return 1;
+        }
+    }
+    void* vmas_bottom = g_heap_top - vmas_cnt * PAGE_SIZE;
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        size_t idx = rand() % vmas_cnt;
+        void* addr = vmas_bottom + idx * PAGE_SIZE;
+        bool is_pal_internal = (vmas_cnt - 1 - idx) % 2;
+        if (!get_enclave_pages(addr, PAGE_SIZE, is_pal_internal))
+            return 1;
+    }
+    uint64_t remap_ns = now_ns() - start;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        size_t idx = rand() % vmas_cnt;
+        void* addr = vmas_bottom + idx * PAGE_SIZE;
+        bool is_pal_internal = (vmas_cnt - 1 - idx) % 2;
+        if (free_enclave_pages(addr, PAGE_SIZE) < 0 ||
+                !get_enclave_pages(addr, PAGE_SIZE, is_pal_internal))
+            return 1;
+    }
+    uint64_t free_ns = now_ns() - start;
+
+    start = now_ns();
+    for (size_t i = 0; i < iterations; i++) {
+        void* addr = get_enclave_pages(NULL, 2 * PAGE_SIZE, /*is_pal_internal=*/false);
+        if (!addr || free_enclave_pages(addr, 2 * PAGE_SIZE) < 0)
+            return 1;
+    }
+    uint64_t any_ns = now_ns() - start;
+
+    const char* err = check_tree();
+    if (err) {
+        fprintf(stderr, "FAILED: %s\n", err);
+        return 1;
+    }
+
+    printf("%6zu VMAs: fixed-address alloc = %.0f ns, free + alloc = %.0f ns, "
+           "any-address alloc + free = %.0f ns\n", vmas_cnt, (double)remap_ns / iterations,
+           (double)free_ns / iterations, (double)any_ns / iterations);
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-n iterations] [-m max VMAs]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = 100000;
+    size_t max_vmas   = MAX_HEAP_VMAS / 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+        switch (opt) {
+            case 'n': iterations = strtoul(optarg, NULL, 10); break;
+            case 'm': max_vmas   = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!iterations || !max_vmas || max_vmas > MAX_HEAP_VMAS / 2)
+        usage(argv[0]);
+
+    srand(1337);
+    if (test_against_model(iterations))
+        return 1;
+
+    for (size_t vmas_cnt = 10; vmas_cnt <= max_vmas; vmas_cnt *= 10)
+        if (bench(vmas_cnt, iterations))
+            return 1;
+    return 0;
+}
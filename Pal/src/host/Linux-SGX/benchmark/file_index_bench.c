@@ -0,0 +1,189 @@
+/*
+ * Host-only test and benchmark of the index of trusted and allowed files (enclave_file_index.c).
+ *
+ * Builds the index for a growing number of trusted files (plus a few allowed files and
+ * directories, as in typical manifests) and measures the lookup done by load_trusted_file() on
+ * each file open: trusted files, files in allowed directories and unknown files. The results are
+ * checked against the previous implementation, a linear scan of all files with
+ * path_is_equal_or_subpath(), which is also timed for comparison. With the index, the lookup cost
+ * does not depend on the number of files.
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* keep the enclave-only headers out, enclave_file_index.c only needs malloc() and free() */
+#define PAL_INTERNAL_H
+
+#include "api.h"
+#include "pal_error.h"
+
+#include "../enclave_file_index.c"
+
+#define URI_LEN 128
+
+struct file {
+    struct file_index_node node;
+    bool trusted;
+    size_t uri_len;
+    char uri[URI_LEN];
+};
+
+static const char* g_allowed[] = {
+    "file:/tmp/", "file:/dev/urandom", "file:/etc", "file:/proc/self/", "file:/var/cache/app",
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool is_trusted(struct file_index_node* node) {
+    return container_of(node, struct file, node)->trusted;
+}
+
+static bool is_allowed(struct file_index_node* node) {
+    return !container_of(node, struct file, node)->trusted;
+}
+
+static struct file* index_lookup(struct file_index* index, const char* path, size_t path_len) {
+    struct file_index_node* node = file_index_find(index, path, path_len, is_trusted);
+    if (!node)
+        node = file_index_find(index, path, path_len, is_allowed);
+    if (!node)
+        node = file_index_find_ancestor(index, path, path_len, URI_PREFIX_FILE_LEN, is_allowed);
+    return node ? container_of(node, struct file, node) : NULL;
+}
+
+/* the previous lookup of load_trusted_file() */
+static bool path_is_equal_or_subpath(const struct file* f, const char* path, size_t path_len) {
+    if (f->uri_len > path_len || memcmp(f->uri, path, f->uri_len))
+        return false;
+    if (f->uri_len == path_len)
+        return true;
+    if (f->uri[f->uri_len - 1] == '/' || path[f->uri_len] == '/')
+        return true;
+    if (f->uri_len == URI_PREFIX_FILE_LEN && !memcmp(f->uri, URI_PREFIX_FILE, URI_PREFIX_FILE_LEN))
+        return true;
+    return false;
+}
+
+static struct file* linear_lookup(struct file* files, size_t nfiles, const char* path,
+                                  size_t path_len) {
+    for (size_t i = 0; i < nfiles; i++) {
+        if (files[i].trusted) {
+            if (files[i].uri_len == path_len && !memcmp(files[i].uri, path, path_len))
+                return &files[i];
+        } else if (path_is_equal_or_subpath(&files[i], path, path_len)) {
+            return &files[i];
+        }
+    }
+    return NULL;
+}
+
+/* the i-th path to look up: a trusted file, a file in an allowed directory or an unknown file */
+static size_t lookup_path(size_t i, size_t nfiles, char* buf) {
+    switch (i % 4) {
+        case 0:
+        case 1:
+            return snprintf(buf, URI_LEN, "file:/usr/lib/python3.8/pkg%zu/mod%zu.py",
+                            (i * 7919) % nfiles % 100, (i * 7919) % nfiles);
+        case 2:
+            return snprintf(buf, URI_LEN, "%s/dir/f%zu", g_allowed[i % ARRAY_SIZE(g_allowed)], i);
+        default:
+            return snprintf(buf, URI_LEN, "file:/usr/lib/python3.8/pkg%zu/unknown%zu.py", i % 100,
+                            i);
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-f max number of trusted files] [-n lookups]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t max_files = 10000;
+    size_t nlookups  = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+        switch (opt) {
+            case 'f': max_files = strtoul(optarg, NULL, 10); break;
+            case 'n': nlookups  = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!max_files || !nlookups)
+        usage(argv[0]);
+
+    printf("%8s %16s %16s\n", "files", "index (ns/open)", "linear (ns/open)");
+
+    for (size_t ntrusted = 10; ntrusted <= max_files; ntrusted *= 10) {
+        size_t nfiles = ntrusted + ARRAY_SIZE(g_allowed);
+        struct file* files = calloc(nfiles, sizeof(*files));
+        struct file_index index = { 0 };
+        if (!files) {
+            fprintf(stderr, "FAILED: cannot allocate files\n");
+            return 1;
+        }
+
+        /* trusted files first, as init_trusted_files() registers them */
+        for (size_t i = 0; i < nfiles; i++) {
+            struct file* f = &files[i];
+            if (i < ntrusted) {
+                f->trusted = true;
+                f->uri_len = snprintf(f->uri, URI_LEN, "file:/usr/lib/python3.8/pkg%zu/mod%zu.py",
+                                      i % 100, i);
+            } else {
+                f->uri_len = snprintf(f->uri, URI_LEN, "%s", g_allowed[i - ntrusted]);
+            }
+            f->node.uri     = f->uri;
+            f->node.uri_len = f->uri_len;
+            if (file_index_add(&index, &f->node) < 0) {
+                fprintf(stderr, "FAILED: cannot add a file to the index\n");
+                return 1;
+            }
+        }
+
+        char path[URI_LEN];
+        for (size_t i = 0; i < nlookups; i++) {
+            size_t len = lookup_path(i, ntrusted, path);
+            if (index_lookup(&index, path, len) != linear_lookup(files, nfiles, path, len)) {
+                fprintf(stderr, "FAILED: lookup of %s differs from the linear scan\n", path);
+                return 1;
+            }
+        }
+
+        uint64_t start = now_ns();
+        size_t found = 0;
+        for (size_t i = 0; i < nlookups; i++) {
+            size_t len = lookup_path(i, ntrusted, path);
+            found += !!index_lookup(&index, path, len);
+        }
+        uint64_t index_ns = now_ns() - start;
+
+        start = now_ns();
+        for (size_t i = 0; i < nlookups; i++) {
+            size_t len = lookup_path(i, ntrusted, path);
+            found -= !!linear_lookup(files, nfiles, path, len);
+        }
+        uint64_t linear_ns = now_ns() - start;
+
+        if (found) {
+            fprintf(stderr, "FAILED: lookups differ\n");
+            return 1;
+        }
+
+        printf("%8zu %16.1f %16.1f\n", ntrusted, (double)index_ns / nlookups,
+               (double)linear_ns / nlookups);
+        free(index.buckets);
+        free(files);
+    }
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Host-only harness for the adaptive Exitless policy (rpc_queue.h).
+ *
+ * RPC threads run the real untrusted-side loop rpc_worker_loop() with a synthetic OCALL handler
+ * that either returns immediately ("fast" OCALL) or sleeps ("blocking" OCALL). Producer threads
+ * emulate sgx_exitless_ocall() in enclave_ocalls.c: adaptive spin budget, futex-wait fallback and
+ * enclave-exit fallback (which wakes up a parked RPC thread, as sgx_ocall_dispatch() does).
+ *
+ * The harness runs a burst of requests, an idle period and another burst, and checks that:
+ *   - all requests are served with correct results,
+ *   - blocking OCALLs end up with the minimal spin budget,
+ *   - during the idle period RPC threads above the minimum park and burn (almost) no CPU.
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rpc_queue.h"
+
+rpc_queue_t* g_rpc_queue;
+
+enum { OCALL_FAST = 0, OCALL_BLOCKING, OCALL_TYPES };
+
+static size_t g_producers_cnt = 2;
+static size_t g_workers_cnt   = 4;
+static size_t g_workers_min   = 0;
+static size_t g_requests_cnt  = 2000; /* per producer and burst */
+static unsigned long g_idle_ms = 300;
+
+static bool g_stop;
+static size_t g_running;      /* RPC threads not yet stopped */
+static uint64_t g_avg_spins[OCALL_TYPES];
+static uint64_t g_exits;      /* requests performed via "enclave exit" fallback */
+static uint64_t g_sleeps;     /* requests waited for via futex */
+static uint64_t g_errors;
+
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long futex(int* uaddr, int op, int val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static long handle_ocall(uint64_t ocall_index, void* buffer) {
+    if (ocall_index == OCALL_BLOCKING) {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000000 };
+        nanosleep(&ts, NULL);
+    }
+    return (long)buffer * 2 + 1;
+}
+
+/* "enclave exit" path: untrusted runtime wakes up an RPC thread, then executes the OCALL */
+static long exit_ocall(uint64_t code, void* ms) {
+    __atomic_add_fetch(&g_exits, 1, __ATOMIC_RELAXED);
+    rpc_queue_wake_worker(g_rpc_queue, futex);
+    return handle_ocall(code, ms);
+}
+
+/* mirrors sgx_exitless_ocall() */
+static long exitless_ocall(size_t ring_idx, uint64_t code, void* ms) {
+    rpc_request_t req = { .ocall_index = code, .buffer = ms };
+    spinlock_init(&req.lock);
+    spinlock_lock(&req.lock);
+
+    if (!rpc_enqueue(g_rpc_queue, ring_idx, &req))
+        return exit_ocall(code, ms);
+
+    if (rpc_queue_all_parked(g_rpc_queue) && rpc_cancel(g_rpc_queue, ring_idx, &req))
+        return exit_ocall(code, ms);
+
+    uint64_t spins;
+    bool finished = rpc_spin_wait(&req, rpc_spin_budget(&g_avg_spins[code]), &spins);
+    rpc_spin_update(&g_avg_spins[code], spins, finished);
+
+    if (!finished) {
+        __atomic_add_fetch(&g_sleeps, 1, __ATOMIC_RELAXED);
+        int c = SPINLOCK_UNLOCKED;
+        if (!spinlock_cmpxchg(&req.lock, &c, SPINLOCK_LOCKED_NO_WAITERS)) {
+            do {
+                if (c == SPINLOCK_LOCKED_WITH_WAITERS ||
+                        spinlock_cmpxchg(&req.lock, &c, SPINLOCK_LOCKED_WITH_WAITERS))
+                    futex(&req.lock.lock, FUTEX_WAIT_PRIVATE, SPINLOCK_LOCKED_WITH_WAITERS);
+                c = SPINLOCK_UNLOCKED;
+            } while (!spinlock_cmpxchg(&req.lock, &c, SPINLOCK_LOCKED_WITH_WAITERS));
+        }
+    }
+    return req.result;
+}
+
+static void* worker(void* arg) {
+    rpc_worker_loop(g_rpc_queue, (size_t)arg, handle_ocall, futex, &g_stop);
+    __atomic_sub_fetch(&g_running, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void* producer(void* arg) {
+    size_t ring_idx = (size_t)arg;
+    for (size_t i = 0; i < g_requests_cnt; i++) {
+        /* every 64th OCALL blocks in the host */
+        uint64_t code = i % 64 == 63 ? OCALL_BLOCKING : OCALL_FAST;
+        if (exitless_ocall(ring_idx, code, (void*)i) != (long)i * 2 + 1)
+            __atomic_add_fetch(&g_errors, 1, __ATOMIC_RELAXED);
+        if (i % 64 == 0)
+            sched_yield(); /* producers may outnumber cores */
+    }
+    return NULL;
+}
+
+static int burst(const char* name) {
+    pthread_t producers[g_producers_cnt];
+    uint64_t exits = g_exits, sleeps = g_sleeps;
+
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+    for (size_t i = 0; i < g_producers_cnt; i++)
+        if (pthread_create(&producers[i], NULL, producer, (void*)i))
+            return -1;
+    for (size_t i = 0; i < g_producers_cnt; i++)
+        pthread_join(producers[i], NULL);
+    uint64_t elapsed = now_ns(CLOCK_MONOTONIC) - start;
+
+    printf("%s: %zu requests in %.3f s, exits = %lu, futex waits = %lu, awake RPC threads = %d\n",
+           name, g_producers_cnt * g_requests_cnt, elapsed / 1e9, g_exits - exits,
+           g_sleeps - sleeps, __atomic_load_n(&g_rpc_queue->awake_cnt, __ATOMIC_RELAXED));
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-p producers] [-w rpc threads] [-m min awake rpc threads] "
+            "[-n requests] [-i idle ms]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w:m:n:i:")) != -1) {
+        switch (opt) {
+            case 'p': g_producers_cnt = strtoul(optarg, NULL, 10); break;
+            case 'w': g_workers_cnt   = strtoul(optarg, NULL, 10); break;
+            case 'm': g_workers_min   = strtoul(optarg, NULL, 10); break;
+            case 'n': g_requests_cnt  = strtoul(optarg, NULL, 10); break;
+            case 'i': g_idle_ms       = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!g_producers_cnt || g_producers_cnt > RPC_MAX_RINGS || !g_workers_cnt ||
+            g_workers_cnt > MAX_RPC_THREADS || g_workers_min > g_workers_cnt)
+        usage(argv[0]);
+
+    if (posix_memalign((void**)&g_rpc_queue, RPC_CACHELINE_SIZE, sizeof(*g_rpc_queue)))
+        return 1;
+    rpc_queue_init(g_rpc_queue, g_producers_cnt, g_workers_cnt, g_workers_min);
+
+    pthread_t workers[g_workers_cnt];
+    g_running = g_workers_cnt;
+    for (size_t i = 0; i < g_workers_cnt; i++)
+        if (pthread_create(&workers[i], NULL, worker, (void*)i))
+            return 1;
+
+    if (burst("burst 1") < 0)
+        return 1;
+
+    uint64_t cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    struct timespec idle = { .tv_sec = g_idle_ms / 1000, .tv_nsec = g_idle_ms % 1000 * 1000000 };
+    nanosleep(&idle, NULL);
+    uint64_t idle_cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    int idle_awake = __atomic_load_n(&g_rpc_queue->awake_cnt, __ATOMIC_RELAXED);
+    printf("idle %lu ms: CPU time = %.3f s, awake RPC threads = %d (min %zu, max %zu)\n",
+           g_idle_ms, idle_cpu / 1e9, idle_awake, g_workers_min, g_workers_cnt);
+
+    if (burst("burst 2") < 0)
+        return 1;
+
+    printf("spin budget: fast OCALL = %lu, blocking OCALL = %lu\n",
+           rpc_spin_budget(&g_avg_spins[OCALL_FAST]),
+           rpc_spin_budget(&g_avg_spins[OCALL_BLOCKING]));
+
+    /* stop RPC threads; keep ringing the doorbell since they may be just about to park */
+    __atomic_store_n(&g_stop, true, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&g_running, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&g_rpc_queue->doorbell, 1, __ATOMIC_RELEASE);
+        futex(&g_rpc_queue->doorbell, FUTEX_WAKE_PRIVATE, (int)g_workers_cnt);
+        usleep(1000);
+    }
+    for (size_t i = 0; i < g_workers_cnt; i++)
+        pthread_join(workers[i], NULL);
+
+    int ret = 0;
+    if (g_errors) {
+        fprintf(stderr, "FAILED: %lu wrong results\n", g_errors);
+        ret = 1;
+    }
+    if (idle_awake != (int)g_workers_min) {
+        fprintf(stderr, "FAILED: %d RPC threads stayed awake while idle\n", idle_awake);
+        ret = 1;
+    }
+    /* with more spinning threads than CPUs, every spin-wait lasts a whole scheduler time slice
+     * and the learned budgets are meaningless */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < (long)(g_producers_cnt + g_workers_cnt)) {
+        printf("only %ld CPUs for %zu threads, not checking spin budgets\n", cpus,
+               g_producers_cnt + g_workers_cnt);
+    } else if (rpc_spin_budget(&g_avg_spins[OCALL_BLOCKING]) != RPC_SPIN_BUDGET_MIN) {
+        fprintf(stderr, "FAILED: blocking OCALLs did not converge to the minimal spin budget\n");
+        ret = 1;
+    }
+    return ret;
+}
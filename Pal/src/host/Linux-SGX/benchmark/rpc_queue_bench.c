@@ -0,0 +1,169 @@
+/*
+ * Stress test and throughput benchmark of the Exitless RPC queue (rpc_queue.h).
+ *
+ * Producer threads play the role of enclave threads: each owns one ring and keeps up to `depth`
+ * requests in flight. Consumer threads play the role of RPC threads with a simplified copy of
+ * rpc_worker_loop(): they dequeue with rpc_dequeue() and mark themselves busy like RPC threads do,
+ * but serve a trivial "syscall", never park, and yield the CPU while idle (see relax()). The real
+ * loop, parking included, is exercised by rpc_pool_bench.c.
+ * At the end, the benchmark verifies that every request was served exactly once and with the
+ * correct result, and prints the achieved throughput.
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rpc_queue.h"
+
+rpc_queue_t* g_rpc_queue;
+
+static size_t g_producers_cnt = 4;
+static size_t g_consumers_cnt = 2;
+static size_t g_requests_cnt  = 1000000; /* per producer */
+static size_t g_depth         = 1;       /* in-flight requests per producer */
+
+static bool g_stop;
+static uint64_t g_served[MAX_RPC_THREADS];
+static uint64_t g_stolen[MAX_RPC_THREADS];
+static uint64_t g_errors;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Spin with `pause`, but yield the CPU from time to time: producers and consumers may outnumber
+ * the available cores, in which case pure spinning would stall the benchmark. */
+static void relax(unsigned int* spins) {
+    if (++*spins % 64 == 0)
+        sched_yield();
+    else
+        __asm__ volatile("pause");
+}
+
+static void* consumer(void* arg) {
+    size_t worker_idx = (size_t)arg;
+    rpc_worker_t* worker = &g_rpc_queue->workers[worker_idx];
+    unsigned int spins = 0;
+
+    while (!__atomic_load_n(&g_stop, __ATOMIC_RELAXED)) {
+        rpc_request_t* req = rpc_dequeue(g_rpc_queue, worker_idx, g_consumers_cnt);
+        if (!req) {
+            relax(&spins);
+            continue;
+        }
+
+        __atomic_store_n(&worker->busy, true, __ATOMIC_RELAXED);
+        /* "syscall": result is derived from the request, so that producers can verify it */
+        req->result = (long)req->buffer * 2 + 1;
+        g_served[worker_idx]++;
+        if (req->ocall_index % g_consumers_cnt != worker_idx)
+            g_stolen[worker_idx]++;
+        __atomic_store_n(&worker->busy, false, __ATOMIC_RELAXED);
+
+        spinlock_unlock(&req->lock);
+    }
+    return NULL;
+}
+
+static void* producer(void* arg) {
+    size_t ring_idx = (size_t)arg;
+    rpc_request_t* reqs = calloc(g_depth, sizeof(*reqs));
+    if (!reqs)
+        abort();
+    unsigned int spins = 0;
+
+    for (size_t done = 0; done < g_requests_cnt; done += g_depth) {
+        size_t batch = g_requests_cnt - done < g_depth ? g_requests_cnt - done : g_depth;
+
+        for (size_t i = 0; i < batch; i++) {
+            reqs[i].ocall_index = ring_idx;
+            reqs[i].buffer      = (void*)(done + i);
+            reqs[i].result      = -1;
+            spinlock_init(&reqs[i].lock);
+            spinlock_lock(&reqs[i].lock);
+            while (!rpc_enqueue(g_rpc_queue, ring_idx, &reqs[i]))
+                relax(&spins);
+        }
+
+        for (size_t i = 0; i < batch; i++) {
+            while (spinlock_trylock(&reqs[i].lock))
+                relax(&spins);
+            if (reqs[i].result != (long)(done + i) * 2 + 1)
+                __atomic_add_fetch(&g_errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    free(reqs);
+    return NULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-p producers] [-c consumers] [-n requests] [-d depth]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:n:d:")) != -1) {
+        switch (opt) {
+            case 'p': g_producers_cnt = strtoul(optarg, NULL, 10); break;
+            case 'c': g_consumers_cnt = strtoul(optarg, NULL, 10); break;
+            case 'n': g_requests_cnt  = strtoul(optarg, NULL, 10); break;
+            case 'd': g_depth         = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!g_producers_cnt || g_producers_cnt > RPC_MAX_RINGS || !g_consumers_cnt ||
+            g_consumers_cnt > MAX_RPC_THREADS || !g_depth || g_depth > RPC_RING_SIZE)
+        usage(argv[0]);
+
+    if (posix_memalign((void**)&g_rpc_queue, RPC_CACHELINE_SIZE, sizeof(*g_rpc_queue)))
+        return 1;
+    rpc_queue_init(g_rpc_queue, g_producers_cnt, g_consumers_cnt, g_consumers_cnt);
+
+    pthread_t consumers[g_consumers_cnt];
+    pthread_t producers[g_producers_cnt];
+
+    for (size_t i = 0; i < g_consumers_cnt; i++)
+        if (pthread_create(&consumers[i], NULL, consumer, (void*)i))
+            return 1;
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < g_producers_cnt; i++)
+        if (pthread_create(&producers[i], NULL, producer, (void*)i))
+            return 1;
+    for (size_t i = 0; i < g_producers_cnt; i++)
+        pthread_join(producers[i], NULL);
+    uint64_t elapsed = now_ns() - start;
+
+    __atomic_store_n(&g_stop, true, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < g_consumers_cnt; i++)
+        pthread_join(consumers[i], NULL);
+
+    uint64_t total = g_producers_cnt * g_requests_cnt;
+    uint64_t served = 0, stolen = 0;
+    for (size_t i = 0; i < g_consumers_cnt; i++) {
+        served += g_served[i];
+        stolen += g_stolen[i];
+    }
+
+    printf("%zu producers, %zu consumers, depth %zu: %lu requests in %.3f s, "
+           "throughput = %.0f requests/second, latency = %.1f ns, stolen = %lu\n",
+           g_producers_cnt, g_consumers_cnt, g_depth, total, elapsed / 1e9,
+           total * 1e9 / elapsed, (double)elapsed * g_producers_cnt / total, stolen);
+
+    if (served != total || g_errors) {
+        fprintf(stderr, "FAILED: served %lu of %lu requests, %lu wrong results\n", served, total,
+                g_errors);
+        return 1;
+    }
+    return 0;
+}
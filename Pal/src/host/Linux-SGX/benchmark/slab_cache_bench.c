@@ -0,0 +1,244 @@
+/*
+ * Host-only benchmark of the per-thread caches of the slab allocator (Pal/include/lib/slabmgr.h),
+ * as used by malloc() and free() of LibOS.
+ *
+ * A growing number of threads allocate and free small objects of mixed sizes from a single slab
+ * manager protected by a mutex (like slab_mgr_lock of LibOS), once with slab_alloc()/slab_free(),
+ * which take the lock on every call, and once with slab_cache_alloc()/slab_cache_free() on a cache
+ * per thread, which take it once per batch of objects. Every object is filled with a pattern of
+ * its owner and checked before it is freed, to catch objects handed out twice; objects allocated
+ * by one thread are also freed by another one, as happens in LibOS.
+ *
+ * Runs on an ordinary Linux host, no SGX hardware is required.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static pthread_mutex_t g_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* system_mmap(size_t size) {
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+#define system_malloc(size)     system_mmap(size)
+#define system_free(addr, size) munmap(addr, size)
+#define SYSTEM_LOCK()           pthread_mutex_lock(&g_slab_lock)
+#define SYSTEM_UNLOCK()         pthread_mutex_unlock(&g_slab_lock)
+#define SLAB_CANARY
+#define STARTUP_SIZE 16
+
+#include "api.h"
+#include "slabmgr.h"
+
+#define MAX_THREADS 256
+#define LIVE_OBJS   64 /* objects held by a thread at a time */
+
+noreturn void __abort(void) {
+    abort();
+}
+
+int pal_printf(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+static SLAB_MGR g_mgr;
+static bool g_use_cache;
+static size_t g_iterations = 200000;
+static size_t g_nthreads;
+static pthread_barrier_t g_barrier;
+
+/* objects passed from each thread to the next one, which frees them */
+static struct {
+    pthread_mutex_t lock;
+    void* objs[LIVE_OBJS];
+    size_t sizes[LIVE_OBJS];
+    size_t cnt;
+} g_mailbox[MAX_THREADS];
+
+static __thread SLAB_CACHE_TYPE t_cache;
+static size_t g_errors;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void* bench_alloc(size_t size) {
+    return g_use_cache ? slab_cache_alloc(g_mgr, &t_cache, size) : slab_alloc(g_mgr, size);
+}
+
+static void bench_free(void* obj) {
+    if (g_use_cache)
+        slab_cache_free(g_mgr, &t_cache, obj);
+    else
+        slab_free(g_mgr, obj);
+}
+
+static void check_and_free(void* obj, size_t size, unsigned char pattern) {
+    unsigned char* p = obj;
+    if (p[0] != pattern || p[size / 2] != pattern || p[size - 1] != pattern)
+        __atomic_add_fetch(&g_errors, 1, __ATOMIC_RELAXED);
+    bench_free(obj);
+}
+
+static void* thread_func(void* arg) {
+    size_t id = (size_t)arg;
+    void* objs[LIVE_OBJS] = { 0 };
+    size_t sizes[LIVE_OBJS];
+    unsigned int seed = id + 1;
+
+    pthread_barrier_wait(&g_barrier);
+
+    for (size_t i = 0; i < g_iterations; i++) {
+        size_t slot = rand_r(&seed) % LIVE_OBJS;
+        if (objs[slot])
+            check_and_free(objs[slot], sizes[slot], (unsigned char)id);
+
+        /* mostly small objects, as allocated by LibOS */
+        size_t size = 16 << (rand_r(&seed) % 7);
+        size = size - rand_r(&seed) % (size / 2);
+        objs[slot] = bench_alloc(size);
+        if (!objs[slot]) {
+            fprintf(stderr, "FAILED: out of memory\n");
+            exit(1);
+        }
+        memset(objs[slot], (unsigned char)id, size);
+        sizes[slot] = size;
+
+        /* hand an object over to the next thread now and then */
+        if (i % 16 == 0 && g_nthreads > 1) {
+            size_t next = (id + 1) % g_nthreads;
+            pthread_mutex_lock(&g_mailbox[next].lock);
+            if (g_mailbox[next].cnt < LIVE_OBJS) {
+                /* the pattern of the mailbox objects is the one of the receiving thread */
+                memset(objs[slot], (unsigned char)next, size);
+                g_mailbox[next].objs[g_mailbox[next].cnt]  = objs[slot];
+                g_mailbox[next].sizes[g_mailbox[next].cnt] = size;
+                g_mailbox[next].cnt++;
+                objs[slot] = NULL;
+            }
+            pthread_mutex_unlock(&g_mailbox[next].lock);
+        }
+        if (i % 64 == 0) {
+            pthread_mutex_lock(&g_mailbox[id].lock);
+            while (g_mailbox[id].cnt) {
+                g_mailbox[id].cnt--;
+                check_and_free(g_mailbox[id].objs[g_mailbox[id].cnt],
+                               g_mailbox[id].sizes[g_mailbox[id].cnt], (unsigned char)id);
+            }
+            pthread_mutex_unlock(&g_mailbox[id].lock);
+        }
+    }
+
+    for (size_t slot = 0; slot < LIVE_OBJS; slot++)
+        if (objs[slot])
+            check_and_free(objs[slot], sizes[slot], (unsigned char)id);
+
+    /* wait for the other threads to stop handing objects over */
+    pthread_barrier_wait(&g_barrier);
+    pthread_mutex_lock(&g_mailbox[id].lock);
+    while (g_mailbox[id].cnt) {
+        g_mailbox[id].cnt--;
+        check_and_free(g_mailbox[id].objs[g_mailbox[id].cnt],
+                       g_mailbox[id].sizes[g_mailbox[id].cnt], (unsigned char)id);
+    }
+    pthread_mutex_unlock(&g_mailbox[id].lock);
+
+    /* as free_thread_slab_cache() of LibOS does on thread exit */
+    if (g_use_cache)
+        slab_cache_flush(g_mgr, &t_cache);
+    return NULL;
+}
+
+static double run(size_t nthreads, bool use_cache) {
+    pthread_t threads[MAX_THREADS];
+
+    g_nthreads  = nthreads;
+    g_use_cache = use_cache;
+    pthread_barrier_init(&g_barrier, NULL, nthreads);
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, thread_func, (void*)i)) {
+            fprintf(stderr, "FAILED: cannot create a thread\n");
+            exit(1);
+        }
+    for (size_t i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    uint64_t time_ns = now_ns() - start;
+
+    pthread_barrier_destroy(&g_barrier);
+    return (double)time_ns / (nthreads * g_iterations);
+}
+
+/* Returns the number of free objects of `level` in the manager. */
+static size_t count_free(int level) {
+    size_t cnt = 0;
+    SLAB_OBJ obj;
+    LISTP_FOR_EACH_ENTRY(obj, &g_mgr->free_list[level], __list) {
+        cnt++;
+    }
+    return cnt + (g_mgr->addr_top[level] - g_mgr->addr[level]) /
+                 (slab_levels[level] + SLAB_HDR_SIZE);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-t max threads] [-n iterations per thread]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads = 32;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+        switch (opt) {
+            case 't': max_threads  = strtoul(optarg, NULL, 10); break;
+            case 'n': g_iterations = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!max_threads || max_threads > MAX_THREADS || !g_iterations)
+        usage(argv[0]);
+
+    g_mgr = create_slab_mgr();
+    if (!g_mgr) {
+        fprintf(stderr, "FAILED: cannot create the slab manager\n");
+        return 1;
+    }
+    for (size_t i = 0; i < MAX_THREADS; i++)
+        pthread_mutex_init(&g_mailbox[i].lock, NULL);
+
+    printf("%8s %16s %16s %8s\n", "threads", "shared (ns/op)", "cached (ns/op)", "speedup");
+
+    for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        double shared = run(nthreads, false);
+        double cached = run(nthreads, true);
+        printf("%8zu %16.1f %16.1f %7.1fx\n", nthreads, shared, cached, shared / cached);
+    }
+
+    if (g_errors) {
+        fprintf(stderr, "FAILED: %zu objects were corrupted\n", g_errors);
+        return 1;
+    }
+    for (int level = 0; level < SLAB_LEVEL; level++)
+        if (count_free(level) != g_mgr->size[level]) {
+            fprintf(stderr, "FAILED: %zu objects of level %d were not freed\n",
+                    g_mgr->size[level] - count_free(level), level);
+            return 1;
+        }
+
+    destroy_slab_mgr(g_mgr);
+    return 0;
+}
@@ -398,3 +398,114 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     *cargo = handle;
     return 0;
 }
+
+/* Host syscall that performs stream operation `op` on `handle` in an OCALL batch, or -1 if the
+ * operation needs in-enclave processing and must go through the regular per-handle path. Only
+ * plain files qualify: trusted files are verified against their hashes, and pipes, sockets and
+ * processes are (or may be) encrypted. */
+static int batch_syscall(PAL_HANDLE handle, uint64_t op) {
+    if (!IS_HANDLE_TYPE(handle, file) || handle->file.stubs)
+        return -1;
+
+    switch (op) {
+        case PAL_STREAM_OP_READ:
+            return OCALL_BATCH_PREAD;
+        case PAL_STREAM_OP_WRITE:
+            return OCALL_BATCH_PWRITE;
+        case PAL_STREAM_OP_FLUSH:
+            return OCALL_BATCH_FSYNC;
+        default:
+            return -1;
+    }
+}
+
+/* Perform all syscalls queued in `batch` and store their results into the stream operations they
+ * belong to (`owners`; NULL for deferred closes, whose results are ignored as in ocall_close()). */
+static void flush_batch(struct ocall_batch* batch, PAL_STREAM_OP** owners) {
+    size_t cnt = batch->cnt;
+    int ret = ocall_batch(batch);
+
+    for (size_t i = 0; i < cnt; i++) {
+        if (!owners[i]) {
+            /* the handle of a deferred close is already gone, so its FD must not be leaked when
+             * the whole batch was rejected */
+            if (IS_ERR(ret))
+                ocall_close(batch->ops[i].ms_fd);
+            continue;
+        }
+
+        long result = IS_ERR(ret) ? ret : batch->ops[i].ms_result;
+        if (result == -ECANCELED)
+            _DkStreamOpSetResult(owners[i], -PAL_ERROR_TRYAGAIN);
+        else if (IS_ERR(result))
+            _DkStreamOpSetResult(owners[i], unix_to_pal_error(ERRNO(result)));
+        else if (!result && batch->ops[i].ms_op == OCALL_BATCH_PREAD)
+            _DkStreamOpSetResult(owners[i], -PAL_ERROR_ENDOFSTREAM); /* as in _DkStreamRead() */
+        else
+            _DkStreamOpSetResult(owners[i], result);
+    }
+}
+
+/* _DkStreamsSubmit for internal use. Plain file reads, writes and flushes are queued as host
+ * syscalls, and so are the closes of host FDs done by the handles' close callbacks; all queued
+ * syscalls are then performed with a single OCALL per OCALL_BATCH_MAX syscalls. All other
+ * operations are executed one by one, after the syscalls queued before them. */
+int _DkStreamsSubmit(PAL_STREAM_OP* ops, size_t count) {
+    struct ocall_batch batch = { .cnt = 0 };
+    PAL_STREAM_OP* owners[OCALL_BATCH_MAX];
+
+    for (size_t i = 0; i < count; i++) {
+        PAL_STREAM_OP* op = &ops[i];
+        int host_op = batch_syscall(op->handle, op->op);
+
+        /* a deferred close may take up to MAX_FDS slots */
+        if (batch.cnt + (host_op >= 0 ? 1 : MAX_FDS) > OCALL_BATCH_MAX)
+            flush_batch(&batch, owners);
+
+        /* is the previous operation still queued? then the host checks the link itself */
+        bool prev_queued = i && batch.cnt && owners[batch.cnt - 1] == &ops[i - 1];
+        bool linked = (op->flags & PAL_STREAM_OP_LINK) && i;
+
+        if (host_op >= 0) {
+            if (linked && !prev_queued && !_DkStreamOpCompleted(&ops[i - 1])) {
+                _DkStreamOpSetResult(op, -PAL_ERROR_TRYAGAIN);
+                continue;
+            }
+            owners[batch.cnt] = op;
+            batch.ops[batch.cnt++] = (ms_ocall_batch_op_t){
+                .ms_op     = host_op,
+                .ms_fd     = op->handle->file.fd,
+                .ms_flags  = linked && prev_queued ? OCALL_BATCH_LINK : 0,
+                .ms_buf    = (void*)op->buffer,
+                .ms_count  = op->count,
+                .ms_offset = op->offset,
+            };
+            continue;
+        }
+
+        if (linked && prev_queued)
+            flush_batch(&batch, owners);
+        if (linked && !_DkStreamOpCompleted(&ops[i - 1])) {
+            _DkStreamOpSetResult(op, -PAL_ERROR_TRYAGAIN);
+            continue;
+        }
+
+        if (op->op == PAL_STREAM_OP_CLOSE) {
+            /* the handle is torn down right away, but the closes of its host FDs are queued */
+            size_t first = batch.cnt;
+            SET_ENCLAVE_TLS(ocall_batch, &batch);
+            int64_t ret = _DkStreamOpExecute(op);
+            SET_ENCLAVE_TLS(ocall_batch, NULL);
+            for (size_t j = first; j < batch.cnt; j++)
+                owners[j] = NULL;
+            _DkStreamOpSetResult(op, ret);
+            continue;
+        }
+
+        flush_batch(&batch, owners);
+        _DkStreamOpSetResult(op, _DkStreamOpExecute(op));
+    }
+
+    flush_batch(&batch, owners);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Index of trusted and allowed files by their (normalized) URI.
+ *
+ * The index is a chained hash table which doubles when it has as many nodes as buckets. Nodes are
+ * embedded in the objects of the caller and are never removed. Looking up a file takes one hash
+ * lookup, and finding the allowed directory containing a file one hash lookup per component of its
+ * path, independently of the number of files in the manifest. The caller does the locking.
+ */
+
+#include "api.h"
+#include "enclave_file_index.h"
+#include "hash.h"
+#include "pal_internal.h"
+
+#define FILE_INDEX_INIT_SIZE 256 /* must be a power of two */
+
+static size_t uri_hash(const char* uri, size_t uri_len) {
+    return hash_str(uri, uri_len, /*seed=*/0);
+}
+
+int file_index_add(struct file_index* index, struct file_index_node* node) {
+    if (index->cnt >= index->nbuckets) {
+        size_t new_nbuckets = index->nbuckets ? index->nbuckets * 2 : FILE_INDEX_INIT_SIZE;
+        struct file_index_node** new_buckets = malloc(sizeof(*new_buckets) * new_nbuckets);
+
+        if (new_buckets) {
+            memset(new_buckets, 0, sizeof(*new_buckets) * new_nbuckets);
+            for (size_t i = 0; i < index->nbuckets; i++) {
+                struct file_index_node* next;
+                for (struct file_index_node* n = index->buckets[i]; n; n = next) {
+                    next = n->next;
+                    size_t b = uri_hash(n->uri, n->uri_len) & (new_nbuckets - 1);
+                    n->next = new_buckets[b];
+                    new_buckets[b] = n;
+                }
+            }
+            free(index->buckets);
+            index->buckets  = new_buckets;
+            index->nbuckets = new_nbuckets;
+        } else if (!index->buckets) {
+            return -PAL_ERROR_NOMEM;
+        }
+        /* if the table cannot grow, the chains just get longer */
+    }
+
+    size_t b = uri_hash(node->uri, node->uri_len) & (index->nbuckets - 1);
+    node->next = index->buckets[b];
+    index->buckets[b] = node;
+    index->cnt++;
+    return 0;
+}
+
+/* Finds a node of `uri` accepted by `match` (any node if `match` is NULL); the same URI may have
+ * several nodes. */
+struct file_index_node* file_index_find(struct file_index* index, const char* uri, size_t uri_len,
+                                        bool (*match)(struct file_index_node* node)) {
+    if (!index->buckets)
+        return NULL;
+
+    struct file_index_node* n = index->buckets[uri_hash(uri, uri_len) & (index->nbuckets - 1)];
+    for (; n; n = n->next)
+        if (n->uri_len == uri_len && !memcmp(n->uri, uri, uri_len) && (!match || match(n)))
+            return n;
+
+    return NULL;
+}
+
+/*
+ * Finds the node (accepted by `match`) of the deepest directory containing `path`, which must be
+ * normalized. A directory may be given with or without the trailing slash, and the first
+ * `root_len` characters of `path` (the URI prefix) stand for the root directory.
+ */
+struct file_index_node* file_index_find_ancestor(struct file_index* index, const char* path,
+                                                 size_t path_len, size_t root_len,
+                                                 bool (*match)(struct file_index_node* node)) {
+    struct file_index_node* n;
+
+    for (size_t len = path_len; len > root_len; len--) {
+        if (path[len - 1] != '/')
+            continue;
+        /* "dir/" */
+        if (len < path_len && (n = file_index_find(index, path, len, match)))
+            return n;
+        /* "dir" */
+        if (len - 1 > root_len && (n = file_index_find(index, path, len - 1, match)))
+            return n;
+    }
+
+    if (root_len < path_len && (n = file_index_find(index, path, root_len, match)))
+        return n;
+
+    return NULL;
+}
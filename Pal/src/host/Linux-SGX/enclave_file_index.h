@@ -0,0 +1,22 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+/* index of trusted and allowed files by URI, see enclave_file_index.c */
+struct file_index_node {
+    struct file_index_node* next;
+    const char* uri;
+    size_t uri_len;
+};
+
+struct file_index {
+    struct file_index_node** buckets;
+    size_t nbuckets;
+    size_t cnt;
+};
+
+int file_index_add(struct file_index* index, struct file_index_node* node);
+struct file_index_node* file_index_find(struct file_index* index, const char* uri, size_t uri_len,
+                                        bool (*match)(struct file_index_node* node));
+struct file_index_node* file_index_find_ancestor(struct file_index* index, const char* path,
+                                                 size_t path_len, size_t root_len,
+                                                 bool (*match)(struct file_index_node* node));
@@ -1,5 +1,4 @@
 #include <api.h>
-#include <list.h>
 #include <pal_crypto.h>
 #include <pal_debug.h>
 #include <pal_error.h>
@@ -10,6 +9,7 @@
 #include <spinlock.h>
 #include <stdbool.h>
 
+#include "enclave_file_index.h"
 #include "enclave_pages.h"
 
 __sgx_mem_aligned struct pal_enclave_state pal_enclave_state;
@@ -18,7 +18,8 @@ void * enclave_base, * enclave_top;
 
 struct pal_enclave_config pal_enclave_config;
 
-static int register_trusted_file(const char* uri, const char* checksum_str, bool check_duplicates);
+static int register_trusted_file(const char* uri, const char* checksum_str, uint64_t size,
+                                 bool check_duplicates);
 
 bool sgx_is_completely_within_enclave (const void * addr, uint64_t size)
 {
@@ -226,11 +227,20 @@ int init_enclave_key (void)
  * hashes are stored as "stubs" for each file. For a performance reason,
  * each per-chunk hash is a 128-bit AES-CMAC hash value, using a secret
  * key generated at the beginning of the enclave.
+ *
+ * Trusted and allowed files are indexed by their URI (see enclave_file_index.c): a trusted file
+ * must match the opened file exactly, an allowed file may also be a directory containing it. A URI
+ * listed both as trusted and allowed is treated as trusted.
+ *
+ * The size of a trusted file is taken from the manifest ("sgx.trusted_size.xxx", added by the
+ * signer tool) or otherwise queried from the host when the file is opened for the first time, so
+ * that enclave startup does not stat all trusted files.
  */
 
-DEFINE_LIST(trusted_file);
+#define TRUSTED_FILE_SIZE_UNKNOWN ((uint64_t)-1)
+
 struct trusted_file {
-    LIST_TYPE(trusted_file) list;
+    struct file_index_node node;
     int64_t index;
     uint64_t size;
     size_t uri_len;
@@ -239,34 +249,44 @@ struct trusted_file {
     sgx_stub_t * stubs;
 };
 
-DEFINE_LISTP(trusted_file);
-static LISTP_TYPE(trusted_file) trusted_file_list = LISTP_INIT;
+static struct file_index trusted_file_index;
 static spinlock_t trusted_file_lock = INIT_SPINLOCK_UNLOCKED;
 static int trusted_file_indexes = 0;
 static bool allow_file_creation = 0;
 static int file_check_policy = FILE_CHECK_POLICY_STRICT;
 
-/* Assumes `path` is normalized */
-static bool path_is_equal_or_subpath(const struct trusted_file* tf,
-                                     const char* path,
-                                     size_t path_len) {
-    if (tf->uri_len > path_len || memcmp(tf->uri, path, tf->uri_len)) {
-        /* tf->uri is not prefix of `path` */
-        return false;
-    }
-    if (tf->uri_len == path_len) {
-        /* Both are equal */
-        return true;
-    }
-    if (tf->uri[tf->uri_len - 1] == '/' || path[tf->uri_len] == '/') {
-        /* tf->uri is a subpath of `path` */
-        return true;
-    }
-    if (tf->uri_len == URI_PREFIX_FILE_LEN && !memcmp(tf->uri, URI_PREFIX_FILE, URI_PREFIX_FILE_LEN)) {
-        /* Empty path is a prefix of everything */
-        return true;
-    }
-    return false;
+static bool is_trusted_file(struct file_index_node* node) {
+    return container_of(node, struct trusted_file, node)->index;
+}
+
+static bool is_allowed_file(struct file_index_node* node) {
+    return !container_of(node, struct trusted_file, node)->index;
+}
+
+/* Assumes `path` is normalized; must be called with trusted_file_lock held */
+static struct trusted_file* find_trusted_file(const char* path, size_t path_len) {
+    /* trusted files: must be exactly the same URI */
+    struct file_index_node* node = file_index_find(&trusted_file_index, path, path_len,
+                                                   is_trusted_file);
+
+    /* allowed files: must be a subfolder or file */
+    if (!node)
+        node = file_index_find(&trusted_file_index, path, path_len, is_allowed_file);
+    if (!node)
+        node = file_index_find_ancestor(&trusted_file_index, path, path_len, URI_PREFIX_FILE_LEN,
+                                        is_allowed_file);
+
+    return node ? container_of(node, struct trusted_file, node) : NULL;
+}
+
+static int query_file_size(int fd, uint64_t* size) {
+    struct stat stat_buf;
+    int ret = ocall_fstat(fd, &stat_buf);
+    if (IS_ERR(ret))
+        return unix_to_pal_error(ERRNO(ret));
+
+    *size = stat_buf.st_size;
+    return 0;
 }
 
 /*
@@ -287,7 +307,7 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
     *sizeptr = 0;
     *umem = NULL;
 
-    struct trusted_file * tf = NULL, * tmp;
+    struct trusted_file * tf = NULL;
     char uri[URI_MAX];
     char normpath[URI_MAX];
     int ret, fd = file->file.fd;
@@ -303,7 +323,7 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
     /* Allow to create the file when allow_file_creation is turned on;
        The created file is added to allowed_file list for later access */
     if (create && allow_file_creation) {
-       register_trusted_file(uri, NULL, /*check_duplicates=*/true);
+       register_trusted_file(uri, NULL, 0, /*check_duplicates=*/true);
        return 0;
     }
 
@@ -326,23 +346,7 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
     len += URI_PREFIX_FILE_LEN;
 
     spinlock_lock(&trusted_file_lock);
-
-    LISTP_FOR_EACH_ENTRY(tmp, &trusted_file_list, list) {
-        if (tmp->stubs) {
-            /* trusted files: must be exactly the same URI */
-            if (tmp->uri_len == len && !memcmp(tmp->uri, normpath, len + 1)) {
-                tf = tmp;
-                break;
-            }
-        } else {
-            /* allowed files: must be a subfolder or file */
-            if (path_is_equal_or_subpath(tmp, normpath, len)) {
-                tf = tmp;
-                break;
-            }
-        }
-    }
-
+    tf = find_trusted_file(normpath, len);
     spinlock_unlock(&trusted_file_lock);
 
     if (!tf || !tf->index) {
@@ -355,20 +359,34 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
         }
 
         *stubptr = NULL;
-        PAL_STREAM_ATTR attr;
-        ret = _DkStreamAttributesQuery(normpath, &attr);
-        if (!ret)
-            *sizeptr = attr.pending_size;
-        else
-            *sizeptr = 0;
+        uint64_t size = 0;
+        ret = query_file_size(fd, &size);
+        if (ret < 0)
+            return ret;
 
+        *sizeptr = size;
         return 0;
     }
 
     if (tf->index < 0)
         return tf->index;
 
+    spinlock_lock(&trusted_file_lock);
+    uint64_t size = tf->size;
+    spinlock_unlock(&trusted_file_lock);
+
+    if (size == TRUSTED_FILE_SIZE_UNKNOWN) {
+        ret = query_file_size(fd, &size);
+        if (ret < 0)
+            return ret;
+
+        spinlock_lock(&trusted_file_lock);
+        tf->size = size;
+        spinlock_unlock(&trusted_file_lock);
+    }
+
     sgx_stub_t* stubs = NULL;
+    uint8_t* chunk = NULL;
     /* mmap the whole trusted file in untrusted memory for future reads/writes; it is
      * caller's responsibility to unmap those areas after use */
     *sizeptr = tf->size;
@@ -398,6 +416,18 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
         goto failed;
     }
 
+    /*
+     * To prevent TOCTOU attack when generating the file checksum, we need to copy the file
+     * content into the enclave before hashing. The content is copied one file chunk (of
+     * TRUSTED_STUB_SIZE) at a time, and both hashes are computed over the in-enclave copy
+     * while it is still in the cache.
+     */
+    chunk = malloc(TRUSTED_STUB_SIZE);
+    if (!chunk) {
+        ret = -PAL_ERROR_NOMEM;
+        goto failed;
+    }
+
     sgx_stub_t * s = stubs; /* stubs is an array of 128bit values */
     uint64_t offset = 0;
     LIB_SHA256_CONTEXT sha;
@@ -409,48 +439,27 @@ int load_trusted_file (PAL_HANDLE file, sgx_stub_t ** stubptr,
     for (; offset < tf->size ; offset += TRUSTED_STUB_SIZE, s++) {
         /* For each stub, generate a 128bit hash of a file chunk with
          * AES-CMAC, and then update the SHA256 digest. */
-        uint64_t mapping_size = MIN(tf->size - offset, TRUSTED_STUB_SIZE);
-        LIB_AESCMAC_CONTEXT aes_cmac;
-        ret = lib_AESCMACInit(&aes_cmac, (uint8_t*)&enclave_key, sizeof(enclave_key));
-        if (ret < 0)
-            goto failed;
+        uint64_t chunk_size = MIN(tf->size - offset, TRUSTED_STUB_SIZE);
 
-        /*
-         * To prevent TOCTOU attack when generating the file checksum, we
-         * need to copy the file content into the enclave before hashing.
-         * For optimization, we use a relatively small buffer (1024 byte) to
-         * store the data for checksum generation.
-         */
+        /* Any file content needs to be copied into the enclave before
+         * checking and re-hashing */
+        memcpy(chunk, *umem + offset, chunk_size);
 
-#define FILE_CHUNK_SIZE 1024UL
-
-        uint8_t small_chunk[FILE_CHUNK_SIZE]; /* Buffer for hashing */
-        size_t chunk_offset = 0;
-
-        for (; chunk_offset < mapping_size; chunk_offset += FILE_CHUNK_SIZE) {
-            uint64_t chunk_size = MIN(mapping_size - chunk_offset, FILE_CHUNK_SIZE);
-
-            /* Any file content needs to be copied into the enclave before
-             * checking and re-hashing */
-            memcpy(small_chunk, *umem + offset + chunk_offset, chunk_size);
-
-            /* Update the file checksum */
-            ret = lib_SHA256Update(&sha, small_chunk, chunk_size);
-            if (ret < 0)
-                goto failed;
-
-            /* Update the checksum for the file chunk */
-            ret = lib_AESCMACUpdate(&aes_cmac, small_chunk, chunk_size);
-            if (ret < 0)
-                goto failed;
-        }
+        /* Update the file checksum */
+        ret = lib_SHA256Update(&sha, chunk, chunk_size);
+        if (ret < 0)
+            goto failed;
 
         /* Store the checksum for one file chunk for checking */
-        ret = lib_AESCMACFinish(&aes_cmac, (uint8_t *) s, sizeof *s);
+        ret = lib_AESCMAC((uint8_t*)&enclave_key, sizeof(enclave_key), chunk, chunk_size,
+                          (uint8_t*)s, sizeof(*s));
         if (ret < 0)
             goto failed;
     }
 
+    free(chunk);
+    chunk = NULL;
+
     sgx_checksum_t hash;
 
     /* Finalize and checking if the checksum of the whole file matches
@@ -478,6 +487,7 @@ failed:
         assert(*sizeptr > 0);
         ocall_munmap_untrusted(*umem, *sizeptr);
     }
+    free(chunk);
     free(stubs);
 
     spinlock_lock(&trusted_file_lock);
@@ -547,6 +557,7 @@ int copy_and_verify_trusted_file (const char * path, const void * umem,
      * from the beginning of the file. 's' points to the stub that needs to
      * be checked for the current offset. */
     sgx_stub_t * s = stubs + checking / TRUSTED_STUB_SIZE;
+    uint8_t* chunk = NULL; /* scratch buffer for chunks partially overlapping with the region */
     int ret = 0;
 
     for (; checking < umem_end ; checking += TRUSTED_STUB_SIZE, s++) {
@@ -568,48 +579,28 @@ int copy_and_verify_trusted_file (const char * path, const void * umem,
                               (uint8_t*)&hash, sizeof(hash));
         } else {
             /* If the checking chunk only partially overlaps with the region,
-             * read the file content in smaller chunks and only copy the part
-             * needed by the caller. */
-            LIB_AESCMAC_CONTEXT aes_cmac;
-            ret = lib_AESCMACInit(&aes_cmac, (uint8_t*)&enclave_key, sizeof(enclave_key));
-            if (ret < 0)
-                goto failed;
-
-            uint8_t small_chunk[FILE_CHUNK_SIZE]; /* A small buffer */
-            uint64_t chunk_offset = checking;
-
-            for (; chunk_offset < checking_end
-                 ; chunk_offset += FILE_CHUNK_SIZE) {
-                uint64_t chunk_size = MIN(checking_end - chunk_offset,
-                                          FILE_CHUNK_SIZE);
-
-                /* Copy into the small buffer before hashing the content */
-                memcpy(small_chunk, umem + (chunk_offset - umem_start),
-                       chunk_size);
-
-                /* Update the hash for the current chunk */
-                ret = lib_AESCMACUpdate(&aes_cmac, small_chunk, chunk_size);
-                if (ret < 0)
+             * copy the whole chunk into a scratch buffer, check it there and
+             * only copy the part needed by the caller. This happens at most
+             * for the first and the last chunk of the region. */
+            if (!chunk) {
+                chunk = malloc(TRUSTED_STUB_SIZE);
+                if (!chunk)
                     goto failed;
+            }
 
-                /* Determine if the part just copied and checked is needed
-                 * by the caller. If so, copy it into the user buffer. */
-                uint64_t copy_start = chunk_offset;
-                uint64_t copy_end = copy_start + chunk_size;
+            memcpy(chunk, umem + checking - umem_start, checking_size);
 
-                if (copy_start < offset)
-                    copy_start = offset;
-                if (copy_end > offset + size)
-                    copy_end = offset + size;
+            /* Storing the checksum (using AES-CMAC) inside hash. */
+            ret = lib_AESCMAC((uint8_t*)&enclave_key, sizeof(enclave_key), chunk, checking_size,
+                              (uint8_t*)&hash, sizeof(hash));
 
-                if (copy_end > copy_start)
-                    memcpy(buffer + (copy_start - offset),
-                           small_chunk + (copy_start - chunk_offset),
-                           copy_end - copy_start);
-            }
+            /* Determine which part of the chunk is needed by the caller */
+            uint64_t copy_start = MAX(checking, offset);
+            uint64_t copy_end   = MIN(checking_end, offset + size);
 
-            /* Storing the checksum (using AES-CMAC) inside hash. */
-            ret = lib_AESCMACFinish(&aes_cmac, (uint8_t*)&hash, sizeof(hash));
+            if (!ret && copy_end > copy_start)
+                memcpy(buffer + (copy_start - offset), chunk + (copy_start - checking),
+                       copy_end - copy_start);
         }
 
         if (ret < 0)
@@ -628,51 +619,46 @@ int copy_and_verify_trusted_file (const char * path, const void * umem,
             SGX_DBG(DBG_E, "Accesing file:%s is denied. Does not match with MAC"
                     " at chunk starting at %lu-%lu.\n",
                     path, checking, checking_end);
-            return -PAL_ERROR_DENIED;
+            goto failed;
         }
     }
 
+    free(chunk);
     return 0;
 
 failed:
+    free(chunk);
     return -PAL_ERROR_DENIED;
 }
 
-static int register_trusted_file(const char* uri, const char* checksum_str, bool check_duplicates) {
-    struct trusted_file * tf = NULL, * new;
+static int register_trusted_file(const char* uri, const char* checksum_str, uint64_t size,
+                                 bool check_duplicates) {
+    struct trusted_file * new;
     size_t uri_len = strlen(uri);
     int ret;
 
     if (check_duplicates) {
         /* this check is only done during runtime (when creating a new file) and not needed during
-         * initialization (because manifest is assumed to have no duplicates); skipping this check
-         * significantly improves startup time */
+         * initialization (because manifest is assumed to have no duplicates) */
         spinlock_lock(&trusted_file_lock);
-        LISTP_FOR_EACH_ENTRY(tf, &trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&trusted_file_lock);
-                return 0;
-            }
-        }
+        bool found = file_index_find(&trusted_file_index, uri, uri_len, /*match=*/NULL);
         spinlock_unlock(&trusted_file_lock);
+        if (found)
+            return 0;
     }
 
     new = malloc(sizeof(struct trusted_file));
     if (!new)
         return -PAL_ERROR_NOMEM;
 
-    INIT_LIST_HEAD(new, list);
     new->uri_len = uri_len;
     memcpy(new->uri, uri, uri_len + 1);
-    new->size = 0;
+    new->node.uri = new->uri;
+    new->node.uri_len = uri_len;
+    new->size = size;
     new->stubs = NULL;
 
     if (checksum_str) {
-        PAL_STREAM_ATTR attr;
-        ret = _DkStreamAttributesQuery(uri, &attr);
-        if (!ret)
-            new->size = attr.pending_size;
-
         char checksum_text[sizeof(sgx_checksum_t) * 2 + 1] = "\0";
         size_t nbytes = 0;
         for (; nbytes < sizeof(sgx_checksum_t) ; nbytes++) {
@@ -725,19 +711,19 @@ static int register_trusted_file(const char* uri, const char* checksum_str, bool
     if (check_duplicates) {
         /* this check is only done during runtime and not needed during initialization (see above);
          * we check again because same file could have been added by another thread in meantime */
-        LISTP_FOR_EACH_ENTRY(tf, &trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&trusted_file_lock);
-                free(new);
-                return 0;
-            }
+        if (file_index_find(&trusted_file_index, uri, uri_len, /*match=*/NULL)) {
+            spinlock_unlock(&trusted_file_lock);
+            free(new);
+            return 0;
         }
     }
 
-    LISTP_ADD_TAIL(new, &trusted_file_list, list);
+    ret = file_index_add(&trusted_file_index, &new->node);
     spinlock_unlock(&trusted_file_lock);
 
-    return 0;
+    if (ret < 0)
+        free(new);
+    return ret;
 }
 
 static int init_trusted_file (const char * key, const char * uri)
@@ -753,6 +739,20 @@ static int init_trusted_file (const char * key, const char * uri)
     if (ret < 0)
         return 0;
 
+    uint64_t size = TRUSTED_FILE_SIZE_UNKNOWN;
+    char size_str[32];
+    tmp = strcpy_static(cskey, "sgx.trusted_size.", URI_MAX);
+    memcpy(tmp, key, strlen(key) + 1);
+    if (get_config(pal_state.root_config, cskey, size_str, sizeof(size_str)) > 0) {
+        char* end;
+        long val = strtol(size_str, &end, 10);
+        if (val < 0 || *end) {
+            SGX_DBG(DBG_E, "Invalid size of trusted file %s: %s\n", uri, size_str);
+            return -PAL_ERROR_INVAL;
+        }
+        size = val;
+    }
+
     /* Normalize the uri */
     if (!strstartswith_static(uri, URI_PREFIX_FILE)) {
         SGX_DBG(DBG_E, "Invalid URI [%s]: Trusted files must start with 'file:'\n", uri);
@@ -770,7 +770,7 @@ static int init_trusted_file (const char * key, const char * uri)
         return ret;
     }
 
-    return register_trusted_file(normpath, checksum, /*check_duplicates=*/false);
+    return register_trusted_file(normpath, checksum, size, /*check_duplicates=*/false);
 }
 
 int init_trusted_files (void) {
@@ -902,7 +902,7 @@ no_trusted:
             goto out;
         }
 
-        register_trusted_file(norm_path, NULL, /*check_duplicates=*/false);
+        register_trusted_file(norm_path, NULL, 0, /*check_duplicates=*/false);
     }
 
 no_allowed:
@@ -26,9 +26,13 @@
  * size of 8MB. Thus, 512KB limit also works well for the main thread. */
 #define MAX_UNTRUSTED_STACK_BUF (THREAD_STACK_SIZE / 4)
 
-/* global pointer to a single untrusted queue, all accesses must be protected by g_rpc_queue->lock */
+/* global pointer to the untrusted RPC queue; each enclave thread only ever touches its own ring */
 rpc_queue_t* g_rpc_queue;
 
+/* moving average of time to complete each OCALL type via RPC queue, in spin iterations; used to
+ * pick the spin budget before falling back to futex wait */
+static uint64_t g_rpc_avg_spins[OCALL_NR];
+
 static long sgx_exitless_ocall(uint64_t code, void* ms) {
     /* perform OCALL with enclave exit if no RPC queue (i.e., no exitless); no need for atomics
      * because this pointer is set only once at enclave initialization */
@@ -53,18 +57,32 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
      * of the lock */
     spinlock_lock(&req->lock);
 
-    /* enqueue OCALL request into RPC queue; some RPC thread will dequeue it, issue a syscall
-     * and, after syscall is finished, release the request's spinlock */
-    bool enqueued = rpc_enqueue(g_rpc_queue, req);
+    /* enqueue OCALL request into this thread's ring of RPC queue; some RPC thread will dequeue
+     * it, issue a syscall and, after syscall is finished, release the request's spinlock */
+    size_t ring_idx = GET_ENCLAVE_TLS(thread_idx);
+    bool enqueued = rpc_enqueue(g_rpc_queue, ring_idx, req);
     if (!enqueued) {
-        /* no space in queue: all RPC threads are busy with outstanding ocalls; fallback to normal
-         * syscall path with enclave exit */
+        /* no space in ring: RPC threads are lagging behind on our outstanding ocalls; fallback to
+         * normal syscall path with enclave exit */
+        __atomic_add_fetch(&g_rpc_queue->fallbacks.ring_full, 1, __ATOMIC_RELAXED);
+        sgx_reset_ustack(old_ustack);
+        return sgx_ocall(code, ms);
+    }
+
+    if (rpc_queue_all_parked(g_rpc_queue) && rpc_cancel(g_rpc_queue, ring_idx, req)) {
+        /* all RPC threads are parked and nobody will pick up the request; fallback to normal
+         * syscall path with enclave exit, the untrusted runtime wakes up an RPC thread on it */
+        __atomic_add_fetch(&g_rpc_queue->fallbacks.all_parked, 1, __ATOMIC_RELAXED);
         sgx_reset_ustack(old_ustack);
         return sgx_ocall(code, ms);
     }
 
-    /* wait till request processing is finished; try spinlock first */
-    int timedout = spinlock_lock_timeout(&req->lock, RPC_SPINLOCK_TIMEOUT);
+    /* wait till request processing is finished; try spinlock first, for as long as this OCALL
+     * type usually takes */
+    uint64_t spins;
+    bool finished = rpc_spin_wait(req, rpc_spin_budget(&g_rpc_avg_spins[code]), &spins);
+    rpc_spin_update(&g_rpc_avg_spins[code], spins, finished);
+    int timedout = !finished;
 
     /* at this point:
      * - either RPC thread is done with OCALL and released the request's spinlock,
@@ -82,6 +100,8 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
          * moved lock in UNLOCKED state; in this racey case, lock = UNLOCKED = 0 and we do not
          * wait on futex (note that enclave thread grabbed lock but it doesn't matter) */
         if (!spinlock_cmpxchg(&req->lock, &c, SPINLOCK_LOCKED_NO_WAITERS)) {
+            __atomic_add_fetch(&g_rpc_queue->fallbacks.futex_wait, 1, __ATOMIC_RELAXED);
+
             /* allocate futex args on OCALL stack */
             ms_ocall_futex_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
             if (!ms) {
@@ -322,6 +342,14 @@ int ocall_close (int fd)
     int retval = 0;
     ms_ocall_close_t *ms;
 
+    struct ocall_batch* batch = GET_ENCLAVE_TLS(ocall_batch);
+    if (batch && batch->cnt < OCALL_BATCH_MAX) {
+        /* close is deferred till the batch is performed; FD stays valid till then, so it cannot
+         * be reused in between */
+        batch->ops[batch->cnt++] = (ms_ocall_batch_op_t){ .ms_op = OCALL_BATCH_CLOSE, .ms_fd = fd };
+        return 0;
+    }
+
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
@@ -337,6 +365,113 @@ int ocall_close (int fd)
     return retval;
 }
 
+int ocall_batch(struct ocall_batch* batch) {
+    int retval = 0;
+    void* obuf = NULL;
+    bool need_munmap = false;
+    size_t cnt = batch->cnt;
+    size_t buf_size = 0;
+    void* ubufs[OCALL_BATCH_MAX];
+
+    if (!cnt)
+        return 0;
+    if (cnt > OCALL_BATCH_MAX) {
+        retval = -EINVAL;
+        goto out_batch;
+    }
+
+    /* data of reads and of writes from enclave memory go through one untrusted buffer */
+    for (size_t i = 0; i < cnt; i++) {
+        ms_ocall_batch_op_t* op = &batch->ops[i];
+        if (op->ms_op == OCALL_BATCH_PWRITE &&
+                sgx_is_completely_outside_enclave(op->ms_buf, op->ms_count))
+            continue;
+        if (op->ms_op == OCALL_BATCH_PWRITE &&
+                !sgx_is_completely_within_enclave(op->ms_buf, op->ms_count)) {
+            retval = -EPERM;
+            goto out_batch;
+        }
+        if (op->ms_op == OCALL_BATCH_PREAD || op->ms_op == OCALL_BATCH_PWRITE) {
+            if (__builtin_add_overflow(buf_size, op->ms_count, &buf_size)) {
+                retval = -EINVAL;
+                goto out_batch;
+            }
+        }
+    }
+
+    void* old_ustack = sgx_prepare_ustack();
+    char* ubuf = NULL;
+    if (buf_size > MAX_UNTRUSTED_STACK_BUF) {
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(buf_size), &obuf, &need_munmap);
+        if (IS_ERR(retval))
+            goto out;
+        ubuf = obuf;
+    } else if (buf_size) {
+        ubuf = sgx_alloc_on_ustack(buf_size);
+        if (!ubuf) {
+            retval = -EPERM;
+            goto out;
+        }
+    }
+
+    ms_ocall_batch_op_t* uops = sgx_alloc_on_ustack_aligned(sizeof(*uops) * cnt, alignof(*uops));
+    ms_ocall_batch_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!uops || !ms) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    for (size_t i = 0; i < cnt; i++) {
+        ms_ocall_batch_op_t* op = &batch->ops[i];
+        ubufs[i] = NULL;
+        if (op->ms_op == OCALL_BATCH_PWRITE &&
+                sgx_is_completely_outside_enclave(op->ms_buf, op->ms_count)) {
+            ubufs[i] = op->ms_buf;
+        } else if (op->ms_op == OCALL_BATCH_PREAD || op->ms_op == OCALL_BATCH_PWRITE) {
+            ubufs[i] = ubuf;
+            if (op->ms_op == OCALL_BATCH_PWRITE)
+                memcpy(ubuf, op->ms_buf, op->ms_count);
+            ubuf += op->ms_count;
+        }
+        uops[i] = *op;
+        uops[i].ms_buf = ubufs[i];
+        uops[i].ms_result = -ECANCELED;
+    }
+
+    ms->ms_ops = uops;
+    ms->ms_count = cnt;
+
+    retval = sgx_exitless_ocall(OCALL_BATCH, ms);
+    if (IS_ERR(retval))
+        goto out;
+    retval = 0;
+
+    for (size_t i = 0; i < cnt; i++) {
+        ms_ocall_batch_op_t* op = &batch->ops[i];
+        /* read the untrusted result only once, all checks below are done on the copy */
+        long result = uops[i].ms_result;
+        if (result > 0) {
+            if (op->ms_op != OCALL_BATCH_PREAD && op->ms_op != OCALL_BATCH_PWRITE)
+                result = -EPERM;
+            else if ((size_t)result > op->ms_count)
+                result = -EPERM;
+            else if (op->ms_op == OCALL_BATCH_PREAD &&
+                     !sgx_copy_to_enclave(op->ms_buf, op->ms_count, ubufs[i], result))
+                result = -EPERM;
+        }
+        op->ms_result = result;
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    if (obuf)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(buf_size), need_munmap);
+out_batch:
+    /* the batch is consumed even if it was rejected */
+    batch->cnt = 0;
+    return retval;
+}
+
 ssize_t ocall_read(int fd, void* buf, size_t count) {
     ssize_t retval = 0;
     void* obuf = NULL;
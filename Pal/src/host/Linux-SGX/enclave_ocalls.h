@@ -2,6 +2,10 @@
  * This is for enclave to make ocalls to untrusted runtime.
  */
 
+#ifndef ENCLAVE_OCALLS_H
+#define ENCLAVE_OCALLS_H
+
+#include "ocall_types.h"
 #include "pal_linux.h"
 
 #include <asm/stat.h>
@@ -24,6 +28,27 @@ int ocall_open (const char * pathname, int flags, unsigned short mode);
 
 int ocall_close (int fd);
 
+/* Batch of independent syscalls performed with a single OCALL by ocall_batch(). Buffers of reads
+ * point to enclave memory, buffers of writes to enclave or untrusted memory. */
+struct ocall_batch {
+    ms_ocall_batch_op_t ops[OCALL_BATCH_MAX];
+    size_t cnt;
+};
+
+/*!
+ * \brief Perform all syscalls of a batch with a single OCALL.
+ *
+ * Syscalls are performed in order by the untrusted runtime (with one enclave exit, or as one
+ * request to an RPC thread in Exitless mode). While a batch is installed in enclave TLS
+ * (`ocall_batch`), ocall_close() does not close the FD right away but appends the close to it.
+ *
+ * \param[in,out] batch  Batch to perform; on return, `ms_result` of each syscall holds its return
+ *                       value (negative Linux error code on failure) and the batch is emptied.
+ * \return               0 on success, negative Linux error code if the batch could not be
+ *                       submitted at all.
+ */
+int ocall_batch(struct ocall_batch* batch);
+
 ssize_t ocall_read(int fd, void* buf, size_t count);
 
 ssize_t ocall_write(int fd, const void* buf, size_t count);
@@ -113,3 +138,5 @@ int ocall_eventfd (unsigned int initval, int flags);
  */
 int ocall_get_quote(const sgx_spid_t* spid, bool linkable, const sgx_report_t* report,
                     const sgx_quote_nonce_t* nonce, char** quote, size_t* quote_len);
+
+#endif /* ENCLAVE_OCALLS_H */
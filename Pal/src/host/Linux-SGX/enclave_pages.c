@@ -1,6 +1,6 @@
 #include "api.h"
+#include "avl_tree.h"
 #include "enclave_pages.h"
-#include "list.h"
 #include "pal_error.h"
 #include "pal_internal.h"
 #include "pal_linux.h"
@@ -12,52 +12,107 @@ static size_t g_page_size = PRESET_PAGESIZE;
 static void* g_heap_bottom;
 static void* g_heap_top;
 
-/* list of VMAs of used memory areas kept in DESCENDING order */
-/* TODO: rewrite the logic so that this list keeps VMAs in ascending order */
-DEFINE_LIST(heap_vma);
+/* tree of VMAs of used memory areas, ordered by address; VMAs never overlap, so both their bottoms
+ * and tops are sorted */
 struct heap_vma {
-    LIST_TYPE(heap_vma) list;
+    union {
+        struct avl_tree_node node; /* if the VMA is in use */
+        struct heap_vma* next_free; /* if the VMA object is in the free list of the pool */
+    };
     void* bottom;
     void* top;
     bool is_pal_internal;
+    /* augmented data of the subtree rooted at this VMA: lowest bottom, highest top and size of the
+     * largest free area between two VMAs of the subtree; allows to find a free area in O(log n) */
+    void* subtree_bottom;
+    void* subtree_top;
+    size_t subtree_gap;
 };
-DEFINE_LISTP(heap_vma);
 
-static LISTP_TYPE(heap_vma) g_heap_vma_list = LISTP_INIT;
+static bool vma_cmp(struct avl_tree_node* a, struct avl_tree_node* b);
+static void vma_update(struct avl_tree_node* node);
+
+static struct avl_tree g_heap_vma_tree = { .root = NULL, .cmp = vma_cmp, .update = vma_update };
 static PAL_LOCK g_heap_vma_lock = LOCK_INIT;
 
-/* heap_vma objects are taken from pre-allocated pool to avoid recursive mallocs */
+/* heap_vma objects are taken from pre-allocated pool to avoid recursive mallocs; objects that were
+ * never used are taken from the end of the pool, freed objects are kept in a free list */
 #define MAX_HEAP_VMAS 100000
 static struct heap_vma g_heap_vma_pool[MAX_HEAP_VMAS];
+static size_t g_heap_vma_pool_used = 0;
 static size_t g_heap_vma_num = 0;
 static struct heap_vma* g_free_vma = NULL;
 
-/* returns uninitialized heap_vma, the caller is responsible for setting at least bottom/top */
-static struct heap_vma* __alloc_vma(void) {
-    assert(_DkInternalIsLocked(&g_heap_vma_lock));
+static struct heap_vma* node2vma(struct avl_tree_node* node) {
+    return node ? container_of(node, struct heap_vma, node) : NULL;
+}
 
-    if (g_free_vma) {
-        /* simple optimization: if there is a cached free vma object, use it */
-        assert((uintptr_t)g_free_vma >= (uintptr_t)&g_heap_vma_pool[0]);
-        assert((uintptr_t)g_free_vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
+static bool vma_cmp(struct avl_tree_node* a, struct avl_tree_node* b) {
+    return node2vma(a)->bottom <= node2vma(b)->bottom;
+}
 
-        struct heap_vma* ret = g_free_vma;
-        g_free_vma = NULL;
-        g_heap_vma_num++;
-        return ret;
+static void vma_update(struct avl_tree_node* node) {
+    struct heap_vma* vma = node2vma(node);
+    struct heap_vma* left = node2vma(node->left);
+    struct heap_vma* right = node2vma(node->right);
+
+    vma->subtree_bottom = vma->bottom;
+    vma->subtree_top    = vma->top;
+    vma->subtree_gap    = 0;
+    if (left) {
+        vma->subtree_bottom = left->subtree_bottom;
+        vma->subtree_gap    = MAX(left->subtree_gap, (size_t)(vma->bottom - left->subtree_top));
+    }
+    if (right) {
+        vma->subtree_top = right->subtree_top;
+        vma->subtree_gap = MAX(vma->subtree_gap, right->subtree_gap);
+        vma->subtree_gap = MAX(vma->subtree_gap, (size_t)(right->subtree_bottom - vma->top));
     }
+}
 
-    /* FIXME: this loop may become perf bottleneck on large number of vma objects; however,
-     * experiments show that this number typically does not exceed 20 (thanks to VMA merging) */
-    for (size_t i = 0; i < MAX_HEAP_VMAS; i++) {
-        if (!g_heap_vma_pool[i].bottom && !g_heap_vma_pool[i].top) {
-            /* found empty slot in the pool, use it */
-            g_heap_vma_num++;
-            return &g_heap_vma_pool[i];
-        }
+static struct heap_vma* __vma_prev(struct heap_vma* vma) {
+    return node2vma(avl_tree_prev(&vma->node));
+}
+
+static struct heap_vma* __vma_next(struct heap_vma* vma) {
+    return node2vma(avl_tree_next(&vma->node));
+}
+
+static bool vma_bottom_ge(void* addr, struct avl_tree_node* node) {
+    return *(void**)addr <= node2vma(node)->bottom;
+}
+
+static bool vma_top_gt(void* addr, struct avl_tree_node* node) {
+    return *(void**)addr < node2vma(node)->top;
+}
+
+/* returns the lowest VMA with bottom >= `addr` */
+static struct heap_vma* __find_vma_above(void* addr) {
+    return node2vma(avl_tree_lower_bound_fn(&g_heap_vma_tree, &addr, vma_bottom_ge));
+}
+
+/* returns the lowest VMA with top > `addr`, i.e. the first VMA that may overlap with `addr` */
+static struct heap_vma* __find_vma_overlapping(void* addr) {
+    return node2vma(avl_tree_lower_bound_fn(&g_heap_vma_tree, &addr, vma_top_gt));
+}
+
+/* returns uninitialized heap_vma, the caller is responsible for setting at least bottom/top */
+static struct heap_vma* __alloc_vma(void) {
+    assert(_DkInternalIsLocked(&g_heap_vma_lock));
+
+    struct heap_vma* vma = g_free_vma;
+    if (vma) {
+        assert((uintptr_t)vma >= (uintptr_t)&g_heap_vma_pool[0]);
+        assert((uintptr_t)vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
+        g_free_vma = vma->next_free;
+    } else if (g_heap_vma_pool_used < MAX_HEAP_VMAS) {
+        vma = &g_heap_vma_pool[g_heap_vma_pool_used++];
+    } else {
+        return NULL;
     }
 
-    return NULL;
+    g_heap_vma_num++;
+    return vma;
 }
 
 static void __free_vma(struct heap_vma* vma) {
@@ -65,12 +120,51 @@ static void __free_vma(struct heap_vma* vma) {
     assert((uintptr_t)vma >= (uintptr_t)&g_heap_vma_pool[0]);
     assert((uintptr_t)vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
 
-    g_free_vma  = vma;
-    vma->top    = 0;
-    vma->bottom = 0;
+    vma->top       = 0;
+    vma->bottom    = 0;
+    vma->next_free = g_free_vma;
+    g_free_vma     = vma;
     g_heap_vma_num--;
 }
 
+/* returns the highest address at which `size` bytes can be allocated, or NULL if there is no free
+ * area larger than `size` on the heap */
+static void* __find_free_area(size_t size) {
+    assert(_DkInternalIsLocked(&g_heap_vma_lock));
+
+    struct heap_vma* last = node2vma(avl_tree_last(&g_heap_vma_tree));
+    if (!last)
+        return (size_t)(g_heap_top - g_heap_bottom) > size ? g_heap_top - size : NULL;
+
+    if ((size_t)(g_heap_top - last->top) > size)
+        return g_heap_top - size;
+
+    /* descend to the highest free area between two VMAs that is larger than `size` */
+    struct avl_tree_node* node = g_heap_vma_tree.root;
+    while (node && node2vma(node)->subtree_gap > size) {
+        struct heap_vma* vma   = node2vma(node);
+        struct heap_vma* left  = node2vma(node->left);
+        struct heap_vma* right = node2vma(node->right);
+
+        if (right && right->subtree_gap > size) {
+            node = node->right;
+        } else if (right && (size_t)(right->subtree_bottom - vma->top) > size) {
+            return right->subtree_bottom - size;
+        } else if (left && (size_t)(vma->bottom - left->subtree_top) > size) {
+            return vma->bottom - size;
+        } else {
+            node = node->left;
+        }
+    }
+
+    /* corner case: there may be enough space between heap bottom and the lowest-address VMA */
+    struct heap_vma* first = node2vma(avl_tree_first(&g_heap_vma_tree));
+    if ((size_t)(first->bottom - g_heap_bottom) > size)
+        return first->bottom - size;
+
+    return NULL;
+}
+
 int init_enclave_pages(void) {
     int ret;
 
@@ -95,8 +189,7 @@ int init_enclave_pages(void) {
         exec_vma->bottom = SATURATED_P_SUB(pal_sec.exec_addr, MEMORY_GAP, g_heap_bottom);
         exec_vma->top = SATURATED_P_ADD(pal_sec.exec_addr + pal_sec.exec_size, MEMORY_GAP, g_heap_top);
         exec_vma->is_pal_internal = false;
-        INIT_LIST_HEAD(exec_vma, list);
-        LISTP_ADD(exec_vma, &g_heap_vma_list, list);
+        avl_tree_insert(&g_heap_vma_tree, &exec_vma->node);
 
         reserved_size += exec_vma->top - exec_vma->bottom;
     }
@@ -111,8 +204,7 @@ out:
     return ret;
 }
 
-static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal,
-                                    struct heap_vma* vma_above) {
+static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal) {
     assert(_DkInternalIsLocked(&g_heap_vma_lock));
     assert(addr && size);
 
@@ -120,12 +212,13 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
         return NULL;
 
     /* find enclosing VMAs and check that pal-internal VMAs do not overlap with normal VMAs */
+    struct heap_vma* vma_above = __find_vma_above(addr);
     struct heap_vma* vma_below;
     if (vma_above) {
-        vma_below = LISTP_NEXT_ENTRY(vma_above, &g_heap_vma_list, list);
+        vma_below = __vma_prev(vma_above);
     } else {
-        /* no VMA above `addr`; VMA right below `addr` must be the first (highest-address) in list */
-        vma_below = LISTP_FIRST_ENTRY(&g_heap_vma_list, struct heap_vma, list);
+        /* no VMA above `addr`; VMA right below `addr` must be the highest-address one */
+        vma_below = node2vma(avl_tree_last(&g_heap_vma_tree));
     }
 
     /* check whether [addr, addr + size) overlaps with above VMAs of different type */
@@ -137,7 +230,7 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
                     check_vma_above->top, check_vma_above->is_pal_internal);
             return NULL;
         }
-        check_vma_above = LISTP_PREV_ENTRY(check_vma_above, &g_heap_vma_list, list);
+        check_vma_above = __vma_next(check_vma_above);
     }
 
     /* check whether [addr, addr + size) overlaps with below VMAs of different type */
@@ -149,7 +242,7 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
                     check_vma_below->top, check_vma_below->is_pal_internal);
             return NULL;
         }
-        check_vma_below = LISTP_NEXT_ENTRY(check_vma_below, &g_heap_vma_list, list);
+        check_vma_below = __vma_prev(check_vma_below);
     }
 
     /* create VMA with [addr, addr+size); in case of existing overlapping VMAs, the created VMA is
@@ -175,11 +268,11 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
                 vma_above->bottom, vma_above->top);
 
         freed += vma_above->top - vma_above->bottom;
-        struct heap_vma* vma_above_above = LISTP_PREV_ENTRY(vma_above, &g_heap_vma_list, list);
+        struct heap_vma* vma_above_above = __vma_next(vma_above);
 
         vma->bottom = MIN(vma_above->bottom, vma->bottom);
         vma->top    = MAX(vma_above->top, vma->top);
-        LISTP_DEL(vma_above, &g_heap_vma_list, list);
+        avl_tree_delete(&g_heap_vma_tree, &vma_above->node);
 
         __free_vma(vma_above);
         vma_above = vma_above_above;
@@ -192,18 +285,17 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
                 vma_below->bottom, vma_below->top);
 
         freed += vma_below->top - vma_below->bottom;
-        struct heap_vma* vma_below_below = LISTP_NEXT_ENTRY(vma_below, &g_heap_vma_list, list);
+        struct heap_vma* vma_below_below = __vma_prev(vma_below);
 
         vma->bottom = MIN(vma_below->bottom, vma->bottom);
         vma->top    = MAX(vma_below->top, vma->top);
-        LISTP_DEL(vma_below, &g_heap_vma_list, list);
+        avl_tree_delete(&g_heap_vma_tree, &vma_below->node);
 
         __free_vma(vma_below);
         vma_below = vma_below_below;
     }
 
-    INIT_LIST_HEAD(vma, list);
-    LISTP_ADD_AFTER(vma, vma_above, &g_heap_vma_list, list);
+    avl_tree_insert(&g_heap_vma_tree, &vma->node);
     SGX_DBG(DBG_M, "Created vma %p-%p\n", vma->bottom, vma->top);
 
     if (vma->bottom >= vma->top) {
@@ -231,42 +323,21 @@ void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
     SGX_DBG(DBG_M, "Allocating %lu bytes in enclave memory at %p (%s)\n", size, addr,
             is_pal_internal ? "PAL internal" : "normal");
 
-    struct heap_vma* vma_above = NULL;
-    struct heap_vma* vma;
-
     _DkInternalLock(&g_heap_vma_lock);
 
     if (addr) {
-        /* caller specified concrete address; find VMA right-above this address */
+        /* caller specified concrete address */
         if (addr < g_heap_bottom || addr + size > g_heap_top)
             goto out;
-
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-            if (vma->bottom < addr) {
-                /* current VMA is not above `addr`, thus vma_above is VMA right-above `addr` */
-                break;
-            }
-            vma_above = vma;
-        }
-        ret = __create_vma_and_merge(addr, size, is_pal_internal, vma_above);
     } else {
         /* caller did not specify address; find first (highest-address) empty slot that fits */
-        void* vma_above_bottom = g_heap_top;
-
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-            if (vma->top < vma_above_bottom - size) {
-                ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal, vma_above);
-                goto out;
-            }
-            vma_above = vma;
-            vma_above_bottom = vma_above->bottom;
-        }
-
-        /* corner case: there may be enough space between heap bottom and the lowest-address VMA */
-        if (g_heap_bottom < vma_above_bottom - size)
-            ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal, vma_above);
+        addr = __find_free_area(size);
+        if (!addr)
+            goto out;
     }
 
+    ret = __create_vma_and_merge(addr, size, is_pal_internal);
+
 out:
     _DkInternalUnlock(&g_heap_vma_lock);
     return ret;
@@ -289,39 +360,30 @@ int free_enclave_pages(void* addr, size_t size) {
 
     _DkInternalLock(&g_heap_vma_lock);
 
-    /* VMA list contains both normal and pal-internal VMAs; it is impossible to free an area
+    /* VMA tree contains both normal and pal-internal VMAs; it is impossible to free an area
      * that overlaps with VMAs of two types at the same time, so we fail in such cases */
-    bool is_pal_internal_set = false;
-    bool is_pal_internal;
-
-    /* how much memory was actually freed, since [addr, addr + size) can overlap with VMAs */
-    size_t freed = 0;
-
+    struct heap_vma* first = __find_vma_overlapping(addr);
     struct heap_vma* vma;
-    struct heap_vma* p;
-    LISTP_FOR_EACH_ENTRY_SAFE(vma, p, &g_heap_vma_list, list) {
-        if (vma->bottom >= addr + size)
-            continue;
-        if (vma->top <= addr)
-            break;
-
-        /* found VMA overlapping with area to free; check it is either normal or pal-internal */
-        if (!is_pal_internal_set) {
-            is_pal_internal = vma->is_pal_internal;
-            is_pal_internal_set = true;
-        }
-
-        if (is_pal_internal != vma->is_pal_internal) {
+    for (vma = first; vma && vma->bottom < addr + size; vma = __vma_next(vma)) {
+        if (vma->is_pal_internal != first->is_pal_internal) {
             SGX_DBG(DBG_E, "*** Area to free (address %p, size %lu) overlaps with both normal and "
                     "pal-internal VMAs ***\n", addr, size);
             ret = -PAL_ERROR_INVAL;
             goto out;
         }
+    }
+
+    /* how much memory was actually freed, since [addr, addr + size) can overlap with VMAs */
+    size_t freed = 0;
 
+    vma = first;
+    while (vma && vma->bottom < addr + size) {
+        struct heap_vma* next = __vma_next(vma);
         freed += MIN(vma->top, addr + size) - MAX(vma->bottom, addr);
 
-        if (vma->bottom < addr) {
-            /* create VMA [vma->bottom, addr); this may leave VMA [addr + size, vma->top), see below */
+        if (vma->bottom < addr && vma->top > addr + size) {
+            /* area to free is strictly inside the VMA, split off [addr + size, vma->top); this may
+             * only happen for the first VMA, so nothing was modified yet if allocation fails */
             struct heap_vma* new = __alloc_vma();
             if (!new) {
                 SGX_DBG(DBG_E, "*** Cannot create split VMA during freeing of address %p ***\n",
@@ -329,20 +391,29 @@ int free_enclave_pages(void* addr, size_t size) {
                 ret = -PAL_ERROR_NOMEM;
                 goto out;
             }
-            new->top             = addr;
-            new->bottom          = vma->bottom;
+            new->bottom          = addr + size;
+            new->top             = vma->top;
             new->is_pal_internal = vma->is_pal_internal;
-            INIT_LIST_HEAD(new, list);
-            LIST_ADD(new, vma, list);
-        }
-
-        /* compress overlapping VMA to [addr + size, vma->top) */
-        vma->bottom = addr + size;
-        if (vma->top <= addr + size) {
-            /* memory area to free completely covers/extends above the rest of the VMA */
-            LISTP_DEL(vma, &g_heap_vma_list, list);
+            avl_tree_insert(&g_heap_vma_tree, &new->node);
+            vma->top = addr;
+        } else if (vma->bottom < addr) {
+            /* compress overlapping VMA to [vma->bottom, addr) */
+            vma->top = addr;
+        } else if (vma->top > addr + size) {
+            /* compress overlapping VMA to [addr + size, vma->top) */
+            vma->bottom = addr + size;
+        } else {
+            /* memory area to free completely covers the VMA */
+            avl_tree_delete(&g_heap_vma_tree, &vma->node);
             __free_vma(vma);
+            vma = next;
+            continue;
         }
+
+        /* VMA bounds changed, re-insert it to recompute augmented data of the tree */
+        avl_tree_delete(&g_heap_vma_tree, &vma->node);
+        avl_tree_insert(&g_heap_vma_tree, &vma->node);
+        vma = next;
     }
 
     atomic_sub(freed / g_page_size, &g_allocated_pages);
@@ -357,15 +428,12 @@ void* get_enclave_heap_top(void) {
     _DkInternalLock(&g_heap_vma_lock);
 
     void* addr = g_heap_top;
-    struct heap_vma* vma;
-    LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-        if (vma->top < addr) {
-            goto out;
-        }
+    struct heap_vma* vma = node2vma(avl_tree_last(&g_heap_vma_tree));
+    while (vma && vma->top >= addr) {
         addr = vma->bottom;
+        vma = __vma_prev(vma);
     }
 
-out:
     _DkInternalUnlock(&g_heap_vma_lock);
     return addr;
 }
@@ -2,6 +2,9 @@
  * This is for enclave to make ocalls to untrusted runtime.
  */
 
+#ifndef OCALL_TYPES_H
+#define OCALL_TYPES_H
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
@@ -59,6 +62,7 @@ enum {
     OCALL_LOAD_DEBUG,
     OCALL_EVENTFD,
     OCALL_GET_QUOTE,
+    OCALL_BATCH,
     OCALL_NR,
 };
 
@@ -279,4 +283,36 @@ typedef struct {
     size_t            ms_quote_len;
 } ms_ocall_get_quote_t;
 
+/* syscalls that can be performed in a batch via OCALL_BATCH */
+enum {
+    OCALL_BATCH_PREAD = 0,
+    OCALL_BATCH_PWRITE,
+    OCALL_BATCH_FSYNC,
+    OCALL_BATCH_CLOSE,
+};
+
+/* maximum number of syscalls in one OCALL_BATCH */
+#define OCALL_BATCH_MAX  64
+
+/* perform the syscall only if the previous one in the batch completed fully (see
+ * PAL_STREAM_OP_LINK); otherwise, its result is -ECANCELED */
+#define OCALL_BATCH_LINK 0x1
+
+typedef struct {
+    int ms_op;
+    int ms_fd;
+    int ms_flags;
+    void* ms_buf;
+    size_t ms_count;
+    off_t ms_offset;
+    long ms_result;
+} ms_ocall_batch_op_t;
+
+typedef struct {
+    ms_ocall_batch_op_t* ms_ops;
+    size_t ms_count;
+} ms_ocall_batch_t;
+
 #pragma pack(pop)
+
+#endif /* OCALL_TYPES_H */
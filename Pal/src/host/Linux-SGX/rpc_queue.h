@@ -10,24 +10,36 @@
  * threads. If user specifies "0" or omits this directive, then no RPC threads are created and all
  * syscalls perform an enclave exit (as in previous versions of Graphene).
  *
- * All enclave and RPC threads work on a single shared RPC queue (global variable `g_rpc_queue`).
- * To issue a syscall, enclave thread enqueues syscall request in the queue and spins waiting for
- * result. RPC threads spin waiting for syscall requests; when request comes, first lucky RPC
- * thread grabs request, issues syscall to OS, and notifies enclave thread by releasing the request
- * lock. RPC queue is implemented as a FIFO ring buffer with one global lock.
+ * Each enclave thread owns a private ring in the RPC queue (`g_rpc_queue->rings[i]`, where `i` is
+ * the index of the enclave thread's TCS slot). To issue a syscall, enclave thread enqueues syscall
+ * request in its ring and spins waiting for result. RPC threads spin waiting for syscall requests;
+ * when request comes, RPC thread grabs request, issues syscall to OS, and notifies enclave thread
+ * by releasing the request lock. Each ring is a single-producer (its enclave thread),
+ * multi-consumer (RPC threads) FIFO ring buffer without locks: the producer publishes requests by
+ * advancing `rear`, consumers claim requests by compare-and-swap on `front`.
  *
- * The RPC queue with its ring buffer resides in *untrusted memory*. The enclave code accessing the
- * RPC queue must be carefully written to withstand attacks tampering with the queue.
+ * Rings are statically distributed among RPC threads: ring `i` is "home" to RPC thread
+ * `i % rpc_threads_cnt`, so that ocalls of one enclave thread are normally served by the same RPC
+ * thread (and the same CPU core). An RPC thread that finds its home rings empty steals requests
+ * from rings whose home RPC thread is currently busy executing a (possibly blocking) syscall.
  *
- * RPC queue can have up to RPC_QUEUE_SIZE requests simultaneously. All requests are allocated on
+ * Each ring can have up to RPC_RING_SIZE requests simultaneously. All requests are allocated on
  * the untrusted stack of the enclave thread; enclave thread owns its requests and pops them off
  * stack when done with the system call. After enqueuing the request, enclave thread first spins
  * for some time in hope the system call returns immediately (fast path), then sleeps waiting on
- * futex (slow path, useful for blocking syscalls).
+ * futex (slow path, useful for blocking syscalls). The spin budget is adaptive: enclave threads
+ * keep a moving average of how long each OCALL type takes to complete, and OCALL types that
+ * usually block (e.g. poll or accept) spin only briefly before sleeping.
  *
- * NOTE: number of created RPC threads must match max number of simultaneous enclave threads. If
- * there are more RPC threads, CPU time is wasted. If there are less, some enclave threads may
- * starve, especially if there are many blocking syscalls by other enclave threads.
+ * The pool of RPC threads is adaptive too: "sgx.rpc_thread_num" RPC threads are created, but only
+ * "sgx.rpc_thread_num_min" of them (by default all) spin forever. The others park on a futex
+ * after the queue stayed empty for RPC_IDLE_POLLS polls. A parked RPC thread is woken up when an
+ * awake RPC thread sees more pending requests than it can serve, or when an enclave thread
+ * finds no awake RPC thread and falls back to an OCALL with enclave exit.
+ *
+ * NOTE: number of created RPC threads should match max number of simultaneous enclave threads. If
+ * there are more RPC threads, CPU time is wasted. If there are less, several rings share one home
+ * RPC thread and rely on work stealing when that thread is blocked in a syscall.
  *
  * NOTE: The Exitless feature trades slow OCALLs/ECALLs for fast RPC-queue communication at the
  * cost of occupying more CPU cores and burning more CPU cycles. For example, a single-threaded
@@ -35,11 +47,15 @@
  * impact throughput but may improve latency. Only a subset of applications may benefit from
  * Exitless, in particular, single-threaded latency-sensitive apps that cannot be parallelized.
  *
+ * The queue is self-contained (it depends only on spinlock.h) so that it can be stress-tested and
+ * benchmarked on a plain Linux host, see benchmark/rpc_queue_bench.c.
+ *
  * Prototype code was written by Meni Orenbach and adapted to Graphene by Dmitrii Kuvaiskii.
  */
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
+#include <linux/futex.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -53,9 +69,19 @@
  * works well in practice. */
 #define RPC_SPINLOCK_TIMEOUT 1000000
 
-#define RPC_QUEUE_SIZE  1024        /* max # of requests in RPC queue */
+/* Lower bound on the adaptive spin budget; OCALL types that usually block get this budget. */
+#define RPC_SPIN_BUDGET_MIN 1000
+
+/* Number of consecutive empty polls of the queue after which an RPC thread parks (if allowed by
+ * "sgx.rpc_thread_num_min"). With `pause` taking ~100 cycles, this is several milliseconds. */
+#define RPC_IDLE_POLLS 100000
+
+#define RPC_RING_SIZE   16          /* max # of requests in one ring, must be a power of two */
+#define RPC_MAX_RINGS   1024        /* max # of rings (one per enclave thread) */
 #define MAX_RPC_THREADS 256         /* max number of RPC threads */
 
+#define RPC_CACHELINE_SIZE 64
+
 typedef struct {
     spinlock_t lock;  /* can be UNLOCKED / LOCKED_NO_WAITERS / LOCKED_WITH_WAITERS */
     long result;
@@ -63,89 +89,363 @@ typedef struct {
     void* buffer;
 } rpc_request_t;
 
+/* Producer and consumer indexes live on separate cache lines, so that the enclave thread
+ * publishing a request does not bounce the line polled by RPC threads and vice versa. Both
+ * indexes grow monotonically and are never wrapped (2^64 requests will not happen). */
+typedef struct rpc_ring {
+    uint64_t rear __attribute__((aligned(RPC_CACHELINE_SIZE)));   /* written by enclave thread */
+    uint64_t front __attribute__((aligned(RPC_CACHELINE_SIZE)));  /* CASed by RPC threads */
+    rpc_request_t* q[RPC_RING_SIZE] __attribute__((aligned(RPC_CACHELINE_SIZE)));
+} rpc_ring_t;
+
+typedef struct rpc_worker {
+    /* set while the RPC thread executes a syscall or is parked; other RPC threads steal from its
+     * home rings only when one of these flags is set */
+    bool busy __attribute__((aligned(RPC_CACHELINE_SIZE)));
+    bool parked;
+} rpc_worker_t;
+
+/* Exitless OCALLs which fell back to an OCALL with enclave exit. Incremented by enclave threads,
+ * read by the untrusted runtime (see sgx_ocall_stats.c); informative only. */
+typedef struct rpc_fallback_stats {
+    uint64_t ring_full;   /* the ring of the enclave thread was full */
+    uint64_t all_parked;  /* no RPC thread was awake to serve the request */
+    uint64_t futex_wait;  /* the OCALL outlasted the spin budget, the enclave thread slept */
+} rpc_fallback_stats_t;
+
 typedef struct rpc_queue {
-    spinlock_t lock;                  /* global lock for enclave and RPC threads */
-    uint64_t front, rear;             /* indexes into front and rear ends of q */
-    rpc_request_t* q[RPC_QUEUE_SIZE]; /* queue of syscall requests */
-    int rpc_threads[MAX_RPC_THREADS]; /* RPC threads (thread IDs) */
-    size_t rpc_threads_cnt;           /* number of RPC threads */
+    spinlock_t lock;                       /* protects RPC-thread registration, untrusted only */
+    int rpc_threads[MAX_RPC_THREADS];      /* RPC threads (thread IDs) */
+    size_t rpc_threads_cnt;                /* number of RPC threads */
+    size_t rings_cnt;                      /* number of rings in use, set by untrusted runtime */
+    size_t workers_cnt;                    /* max number of RPC threads (sgx.rpc_thread_num) */
+    size_t workers_min;                    /* RPC threads that never park */
+    int awake_cnt __attribute__((aligned(RPC_CACHELINE_SIZE))); /* RPC threads not parked */
+    int doorbell;                          /* futex word on which parked RPC threads sleep */
+    rpc_fallback_stats_t fallbacks __attribute__((aligned(RPC_CACHELINE_SIZE)));
+    rpc_worker_t workers[MAX_RPC_THREADS]; /* per-RPC-thread state */
+    rpc_ring_t rings[RPC_MAX_RINGS];       /* per-enclave-thread rings of syscall requests */
 } rpc_queue_t;
 
+/* OCALL handler invoked by RPC threads, and futex(uaddr, op, val) syscall wrapper */
+typedef long (*rpc_handler_t)(uint64_t ocall_index, void* buffer);
+typedef long (*rpc_futex_t)(int* uaddr, int op, int val);
+
+static_assert((RPC_RING_SIZE & (RPC_RING_SIZE - 1)) == 0, "RPC_RING_SIZE must be a power of two");
+
 extern rpc_queue_t* g_rpc_queue;  /* global RPC queue */
 
-static inline void rpc_queue_init(rpc_queue_t* q) {
+static inline void rpc_queue_init(rpc_queue_t* q, size_t rings_cnt, size_t workers_cnt,
+                                  size_t workers_min) {
     spinlock_init(&q->lock);
-    q->front = 0;
-    q->rear  = 0;
-    for (size_t i = 0; i < RPC_QUEUE_SIZE; i++)
-        q->q[i] = NULL;
+    q->rpc_threads_cnt = 0;
+    q->rings_cnt   = rings_cnt < RPC_MAX_RINGS ? rings_cnt : RPC_MAX_RINGS;
+    q->workers_cnt = workers_cnt < MAX_RPC_THREADS ? workers_cnt : MAX_RPC_THREADS;
+    q->workers_min = workers_min < q->workers_cnt ? workers_min : q->workers_cnt;
+    q->awake_cnt   = (int)q->workers_cnt;
+    q->doorbell    = 0;
+    q->fallbacks.ring_full  = 0;
+    q->fallbacks.all_parked = 0;
+    q->fallbacks.futex_wait = 0;
+    for (size_t i = 0; i < MAX_RPC_THREADS; i++) {
+        q->workers[i].busy   = false;
+        q->workers[i].parked = false;
+    }
+    for (size_t i = 0; i < RPC_MAX_RINGS; i++) {
+        q->rings[i].front = 0;
+        q->rings[i].rear  = 0;
+        for (size_t j = 0; j < RPC_RING_SIZE; j++)
+            q->rings[i].q[j] = NULL;
+    }
 }
 
 /*!
- * \brief Enqueue OCALL request `req` in the shared RPC queue `q`.
+ * \brief Enqueue OCALL request `req` in the ring `ring_idx` of the shared RPC queue `q`.
+ *
+ * Each ring has a single producer -- the enclave thread owning it -- so no locking is needed.
  *
  * This function is called from the enclave code and thus must be written carefully to withstand
  * attacks tampering with untrusted `req` and untrusted `q`. In particular, `req` and `q` must not
  * have arbitrary pointers (or alternatively the code below must sanitize possible pointer values)
- * to prevent arbitrary writes to/reads from the enclave memory. Similarly, `q->q[idx]` code must
- * ensure that `idx` points inside the `q->q` array to prevent buffer overflows.
+ * to prevent arbitrary writes to/reads from the enclave memory. Similarly, `ring->q[idx]` code
+ * must ensure that `idx` points inside the `ring->q` array to prevent buffer overflows; indexes
+ * read from untrusted memory are therefore always taken modulo RPC_RING_SIZE. A tampered `front`
+ * or `rear` can only lead to lost requests, i.e., DoS.
  */
-static inline bool rpc_enqueue(rpc_queue_t* q, rpc_request_t* req) {
-    bool ret = false;
-    spinlock_lock(&q->lock);
+static inline bool rpc_enqueue(rpc_queue_t* q, size_t ring_idx, rpc_request_t* req) {
+    if (ring_idx >= RPC_MAX_RINGS)
+        return false;
 
-    if (q->rear - q->front >= RPC_QUEUE_SIZE) {
-        /* queue is full, cannot enqueue */
-        goto out;
-    }
+    rpc_ring_t* ring = &q->rings[ring_idx];
+    uint64_t rear  = __atomic_load_n(&ring->rear, __ATOMIC_RELAXED);
+    uint64_t front = __atomic_load_n(&ring->front, __ATOMIC_ACQUIRE);
 
-    if (q->q[q->rear % RPC_QUEUE_SIZE]) {
-        /* current slot is occupied, cannot enqueue but the caller can try again */
-        q->rear++;
-        goto out;
+    if (rear - front >= RPC_RING_SIZE) {
+        /* ring is full, cannot enqueue */
+        return false;
     }
 
-    q->q[q->rear % RPC_QUEUE_SIZE] = req;
-    q->rear++;
-    ret = true;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
+    __atomic_store_n(&ring->q[rear % RPC_RING_SIZE], req, __ATOMIC_RELAXED);
+    /* publish the request; pairs with the acquire load of `rear` in rpc_dequeue_ring() */
+    __atomic_store_n(&ring->rear, rear + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*!
+ * \brief Check whether a request just enqueued by an enclave thread may be left unserved.
+ *
+ * Returns true if all RPC threads are parked. The full barrier orders the preceding publication
+ * of the request against the read of `awake_cnt`; together with the barrier in
+ * rpc_worker_park(), either the enclave thread sees a non-zero `awake_cnt` or the parking RPC
+ * thread sees the request. Called from the enclave code; a tampered `awake_cnt` leads only to
+ * an unnecessary enclave exit or to a DoS.
+ */
+static inline bool rpc_queue_all_parked(rpc_queue_t* q) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&q->awake_cnt, __ATOMIC_RELAXED) <= 0;
+}
+
+/*!
+ * \brief Take back request `req` previously enqueued in the ring `ring_idx`.
+ *
+ * Used by an enclave thread when no RPC thread is awake to serve the request. Returns true if the
+ * request was taken back (and thus will not be served by any RPC thread), false if some RPC
+ * thread already dequeued it. Called from the enclave code, see rpc_enqueue() for security notes.
+ */
+static inline bool rpc_cancel(rpc_queue_t* q, size_t ring_idx, rpc_request_t* req) {
+    if (ring_idx >= RPC_MAX_RINGS)
+        return false;
+
+    rpc_ring_t* ring = &q->rings[ring_idx];
+    uint64_t front = __atomic_load_n(&ring->front, __ATOMIC_ACQUIRE);
+    if (front == __atomic_load_n(&ring->rear, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&ring->q[front % RPC_RING_SIZE], __ATOMIC_RELAXED) != req)
+        return false;
+    return __atomic_compare_exchange_n(&ring->front, &front, front + 1, /*weak=*/false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
 }
 
 /*!
- * \brief Dequeue OCALL request `req` from the shared RPC queue `q`.
+ * \brief Spin at most `budget` iterations waiting for RPC thread to finish request `req`.
+ *
+ * Returns true if the request was finished (and its lock was acquired by the caller), false on
+ * timeout. The number of spent iterations is stored in `*spins` in both cases.
+ */
+static inline bool rpc_spin_wait(rpc_request_t* req, uint64_t budget, uint64_t* spins) {
+    uint64_t i = 0;
+    int val;
+    do {
+        while (__atomic_load_n(&req->lock.lock, __ATOMIC_RELAXED) != SPINLOCK_UNLOCKED) {
+            if (i >= budget) {
+                *spins = i;
+                return false;
+            }
+            i++;
+            __asm__ volatile("pause");
+        }
+        val = SPINLOCK_UNLOCKED;
+    } while (!spinlock_cmpxchg(&req->lock, &val, SPINLOCK_LOCKED));
+    *spins = i;
+    return true;
+}
+
+/*!
+ * \brief Spin budget for an OCALL type whose completion time moving average is `*avg_spins`.
+ *
+ * Unknown OCALL types (average is zero) get the full RPC_SPINLOCK_TIMEOUT. OCALL types that
+ * usually time out (i.e., block in the host) get only RPC_SPIN_BUDGET_MIN, so that enclave thread
+ * quickly goes to sleep instead of burning CPU. All other types get a few times their average.
+ */
+static inline uint64_t rpc_spin_budget(const uint64_t* avg_spins) {
+    uint64_t avg = __atomic_load_n(avg_spins, __ATOMIC_RELAXED);
+    if (!avg)
+        return RPC_SPINLOCK_TIMEOUT;
+    if (avg >= RPC_SPINLOCK_TIMEOUT / 2)
+        return RPC_SPIN_BUDGET_MIN;
+    uint64_t budget = avg * 4;
+    if (budget < RPC_SPIN_BUDGET_MIN)
+        return RPC_SPIN_BUDGET_MIN;
+    return budget < RPC_SPINLOCK_TIMEOUT ? budget : RPC_SPINLOCK_TIMEOUT;
+}
+
+/*!
+ * \brief Update completion time moving average `*avg_spins` of an OCALL type.
+ *
+ * A timed-out wait counts as RPC_SPINLOCK_TIMEOUT regardless of the actual budget, so that
+ * blocking OCALL types keep their small budget until they start completing quickly again. Updates
+ * from several threads may race; this only makes the heuristic slightly less precise.
+ */
+static inline void rpc_spin_update(uint64_t* avg_spins, uint64_t spins, bool finished) {
+    int64_t sample = finished ? (int64_t)spins : RPC_SPINLOCK_TIMEOUT;
+    int64_t avg = (int64_t)__atomic_load_n(avg_spins, __ATOMIC_RELAXED);
+    avg = avg ? avg + (sample - avg) / 8 : sample;
+    __atomic_store_n(avg_spins, avg > 0 ? (uint64_t)avg : 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief Dequeue OCALL request from the ring `ring`.
+ *
+ * Several RPC threads may dequeue from the same ring concurrently; the request is claimed by the
+ * thread whose CAS on `front` succeeds. The slot read before the CAS cannot be overwritten by the
+ * producer in between: the producer reuses slot `front % RPC_RING_SIZE` only after observing
+ * `front` moved forward, in which case our CAS fails and we retry.
  *
  * This function is called only from the untrusted code and thus has no security implications.
  */
-static inline rpc_request_t* rpc_dequeue(rpc_queue_t* q) {
-    if (__atomic_load_n(&q->front, __ATOMIC_RELAXED) == __atomic_load_n(&q->rear, __ATOMIC_RELAXED)) {
-        /* quick check that queue is empty; this doesn't acquire a spinlock and thus lowers latency
-         * on rpc_enqueue() performed by enclave threads (they don't have to wait for spinlock
-         * release); note that untrusted RPC threads will simply retry again if this check fails */
-        return NULL;
+static inline rpc_request_t* rpc_dequeue_ring(rpc_ring_t* ring) {
+    uint64_t front = __atomic_load_n(&ring->front, __ATOMIC_ACQUIRE);
+    while (true) {
+        if (front == __atomic_load_n(&ring->rear, __ATOMIC_ACQUIRE)) {
+            /* ring is empty, nothing to dequeue */
+            return NULL;
+        }
+
+        rpc_request_t* req = __atomic_load_n(&ring->q[front % RPC_RING_SIZE], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ring->front, &front, front + 1, /*weak=*/true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return req;
+        /* lost the race to another RPC thread, `front` was reloaded by the failed CAS */
     }
+}
 
-    rpc_request_t* ret = NULL;
-    spinlock_lock(&q->lock);
+/*!
+ * \brief Dequeue OCALL request for the RPC thread `worker_idx` out of `workers_cnt` RPC threads.
+ *
+ * Home rings of this RPC thread (with index `worker_idx` modulo `workers_cnt`) are checked first.
+ * If all of them are empty, the RPC thread tries to steal a request from a ring whose home RPC
+ * thread is busy with another syscall.
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline rpc_request_t* rpc_dequeue(rpc_queue_t* q, size_t worker_idx, size_t workers_cnt) {
+    size_t rings_cnt = __atomic_load_n(&q->rings_cnt, __ATOMIC_RELAXED);
+    rpc_request_t* req;
 
-    if (q->front == q->rear) {
-        /* queue is empty, nothing to dequeue */
-        goto out;
+    for (size_t i = worker_idx; i < rings_cnt; i += workers_cnt) {
+        req = rpc_dequeue_ring(&q->rings[i]);
+        if (req)
+            return req;
     }
 
-    if (!q->q[q->front % RPC_QUEUE_SIZE]) {
-        /* current slot is empty, cannot dequeue but the caller can try next one */
-        q->front++;
-        goto out;
+    for (size_t i = 0; i < rings_cnt; i++) {
+        size_t home = i % workers_cnt;
+        if (home == worker_idx || (!__atomic_load_n(&q->workers[home].busy, __ATOMIC_RELAXED) &&
+                                   !__atomic_load_n(&q->workers[home].parked, __ATOMIC_RELAXED)))
+            continue;
+        req = rpc_dequeue_ring(&q->rings[i]);
+        if (req)
+            return req;
     }
 
-    ret = q->q[q->front % RPC_QUEUE_SIZE];
-    q->q[q->front % RPC_QUEUE_SIZE] = NULL;
-    q->front++;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
+    return NULL;
+}
+
+/*!
+ * \brief Check whether any ring of the RPC queue `q` has pending requests.
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline bool rpc_queue_has_pending(rpc_queue_t* q) {
+    size_t rings_cnt = __atomic_load_n(&q->rings_cnt, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < rings_cnt; i++)
+        if (__atomic_load_n(&q->rings[i].front, __ATOMIC_RELAXED) !=
+                __atomic_load_n(&q->rings[i].rear, __ATOMIC_ACQUIRE))
+            return true;
+    return false;
+}
+
+/*!
+ * \brief Wake up one parked RPC thread, if there is any.
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline void rpc_queue_wake_worker(rpc_queue_t* q, rpc_futex_t futex) {
+    if (__atomic_load_n(&q->awake_cnt, __ATOMIC_RELAXED) >= (int)q->workers_cnt)
+        return;
+    __atomic_add_fetch(&q->doorbell, 1, __ATOMIC_RELEASE);
+    futex(&q->doorbell, FUTEX_WAKE_PRIVATE, 1);
+}
+
+/*!
+ * \brief Park the RPC thread `worker_idx` until woken up by rpc_queue_wake_worker().
+ *
+ * Does nothing if parking would leave less than `workers_min` awake RPC threads, or if some
+ * request arrived in the meantime.
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline void rpc_worker_park(rpc_queue_t* q, size_t worker_idx, rpc_futex_t futex) {
+    rpc_worker_t* worker = &q->workers[worker_idx];
+
+    int awake = __atomic_load_n(&q->awake_cnt, __ATOMIC_RELAXED);
+    do {
+        if (awake <= (int)q->workers_min)
+            return;
+    } while (!__atomic_compare_exchange_n(&q->awake_cnt, &awake, awake - 1, /*weak=*/true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    /* read the doorbell before the last check for requests: a wake-up in between changes the
+     * doorbell and makes futex(wait) return immediately */
+    int doorbell = __atomic_load_n(&q->doorbell, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&worker->parked, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!rpc_queue_has_pending(q))
+        futex(&q->doorbell, FUTEX_WAIT_PRIVATE, doorbell);
+
+    __atomic_store_n(&worker->parked, false, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&q->awake_cnt, 1, __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * \brief Main loop of the RPC thread `worker_idx`: serve requests of the RPC queue `q`.
+ *
+ * Each dequeued request is executed via `handler`, then the awaiting enclave thread is notified
+ * by releasing the request lock (and waking it up via `futex` if it sleeps). After RPC_IDLE_POLLS
+ * empty polls the RPC thread parks; when it sees more pending requests while some RPC threads are
+ * parked, it wakes one of them up. The loop runs until `*stop` becomes true (pass NULL to run
+ * forever).
+ *
+ * This function is called only from the untrusted code and thus has no security implications.
+ */
+static inline void rpc_worker_loop(rpc_queue_t* q, size_t worker_idx, rpc_handler_t handler,
+                                   rpc_futex_t futex, bool* stop) {
+    rpc_worker_t* worker = &q->workers[worker_idx];
+    size_t workers_cnt = q->workers_cnt;
+    uint64_t idle_polls = 0;
+
+    while (!stop || !__atomic_load_n(stop, __ATOMIC_RELAXED)) {
+        rpc_request_t* req = rpc_dequeue(q, worker_idx, workers_cnt);
+        if (!req) {
+            if (++idle_polls >= RPC_IDLE_POLLS) {
+                idle_polls = 0;
+                rpc_worker_park(q, worker_idx, futex);
+            } else {
+                __asm__ volatile("pause");
+            }
+            continue;
+        }
+        idle_polls = 0;
+
+        /* grow the pool of awake RPC threads if the others are not keeping up */
+        if (__atomic_load_n(&q->awake_cnt, __ATOMIC_RELAXED) < (int)workers_cnt &&
+                rpc_queue_has_pending(q))
+            rpc_queue_wake_worker(q, futex);
+
+        /* call actual function and notify awaiting enclave thread when done; while the syscall
+         * is in progress, other RPC threads may steal requests from our home rings */
+        __atomic_store_n(&worker->busy, true, __ATOMIC_RELAXED);
+        req->result = handler(req->ocall_index, req->buffer);
+        __atomic_store_n(&worker->busy, false, __ATOMIC_RELAXED);
+
+        /* this code is based on Mutex 2 from Futexes are Tricky */
+        int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
+        if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
+            /* must unlock and wake waiters */
+            spinlock_unlock(&req->lock);
+            futex(&req->lock.lock, FUTEX_WAKE_PRIVATE, 1);
+        }
+    }
 }
 
 #endif /* QUEUE_H_ */
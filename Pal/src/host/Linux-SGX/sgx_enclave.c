@@ -55,8 +55,10 @@ static long sgx_ocall_exit(void* pms)
     }
 
     /* exit the whole process if exit_group() */
-    if (ms->ms_is_exitgroup)
+    if (ms->ms_is_exitgroup) {
+        sgx_ocall_stats_dump();
         INLINE_SYSCALL(exit_group, 1, (int)ms->ms_exitcode);
+    }
 
     /* otherwise call SGX-related thread reset and exit this thread */
     block_async_signals(true);
@@ -66,6 +68,7 @@ static long sgx_ocall_exit(void* pms)
 
     if (!current_enclave_thread_cnt()) {
         /* no enclave threads left, kill the whole process */
+        sgx_ocall_stats_dump();
         INLINE_SYSCALL(exit_group, 1, (int)ms->ms_exitcode);
     }
 
@@ -650,6 +653,44 @@ static long sgx_ocall_get_quote(void* pms) {
                           &ms->ms_quote, &ms->ms_quote_len);
 }
 
+static long sgx_ocall_batch(void* pms) {
+    ms_ocall_batch_t* ms = (ms_ocall_batch_t*)pms;
+    ODEBUG(OCALL_BATCH, ms);
+
+    for (size_t i = 0; i < ms->ms_count; i++) {
+        ms_ocall_batch_op_t* op = &ms->ms_ops[i];
+
+        if ((op->ms_flags & OCALL_BATCH_LINK) && i) {
+            ms_ocall_batch_op_t* prev = &ms->ms_ops[i - 1];
+            bool rw = prev->ms_op == OCALL_BATCH_PREAD || prev->ms_op == OCALL_BATCH_PWRITE;
+            if (prev->ms_result < 0 || (rw && (size_t)prev->ms_result != prev->ms_count)) {
+                op->ms_result = -ECANCELED;
+                continue;
+            }
+        }
+
+        switch (op->ms_op) {
+            case OCALL_BATCH_PREAD:
+                op->ms_result = INLINE_SYSCALL(pread64, 4, op->ms_fd, op->ms_buf, op->ms_count,
+                                               op->ms_offset);
+                break;
+            case OCALL_BATCH_PWRITE:
+                op->ms_result = INLINE_SYSCALL(pwrite64, 4, op->ms_fd, op->ms_buf, op->ms_count,
+                                               op->ms_offset);
+                break;
+            case OCALL_BATCH_FSYNC:
+                op->ms_result = INLINE_SYSCALL(fsync, 1, op->ms_fd);
+                break;
+            case OCALL_BATCH_CLOSE:
+                op->ms_result = INLINE_SYSCALL(close, 1, op->ms_fd);
+                break;
+            default:
+                op->ms_result = -EINVAL;
+        }
+    }
+    return 0;
+}
+
 sgx_ocall_fn_t ocall_table[OCALL_NR] = {
         [OCALL_EXIT]             = sgx_ocall_exit,
         [OCALL_MMAP_UNTRUSTED]   = sgx_ocall_mmap_untrusted,
@@ -689,14 +730,45 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
         [OCALL_LOAD_DEBUG]       = sgx_ocall_load_debug,
         [OCALL_EVENTFD]          = sgx_ocall_eventfd,
         [OCALL_GET_QUOTE]        = sgx_ocall_get_quote,
+        [OCALL_BATCH]            = sgx_ocall_batch,
     };
 
 #define EDEBUG(code, ms) do {} while (0)
 
 rpc_queue_t* g_rpc_queue = NULL; /* pointer to untrusted queue */
 
+static long rpc_futex(int* uaddr, int op, int val) {
+    return INLINE_SYSCALL(futex, 6, uaddr, op, val, NULL, NULL, 0);
+}
+
+static long handle_ocall(uint64_t code, void* ms, bool exitless) {
+    if (!g_ocall_stats_enabled)
+        return ocall_table[code](ms);
+
+    /* counted before the call, which may never return (e.g. OCALL_EXIT) */
+    sgx_ocall_stats_begin(code, exitless);
+    uint64_t start = ocall_stats_tsc();
+    long ret = ocall_table[code](ms);
+    sgx_ocall_stats_end(code, ocall_stats_tsc() - start);
+    return ret;
+}
+
+static long rpc_handle_ocall(uint64_t ocall_index, void* buffer) {
+    return handle_ocall(ocall_index, buffer, /*exitless=*/true);
+}
+
+/* Called from sgx_entry.S on every OCALL with enclave exit. */
+long sgx_ocall_dispatch(uint64_t code, void* ms) {
+    /* enclave threads exit when no RPC thread is awake (and on blocking waits); make sure that
+     * some RPC thread is awake for their subsequent exitless OCALLs */
+    if (g_rpc_queue)
+        rpc_queue_wake_worker(g_rpc_queue, rpc_futex);
+
+    return handle_ocall(code, ms, /*exitless=*/false);
+}
+
 static int rpc_thread_loop(void* arg) {
-    __UNUSED(arg);
+    size_t worker_idx = (size_t)arg;
     long mytid = INLINE_SYSCALL(gettid, 0);
 
     /* block all signals except SIGUSR2 for RPC thread */
@@ -710,28 +782,7 @@ static int rpc_thread_loop(void* arg) {
     g_rpc_queue->rpc_threads_cnt++;
     spinlock_unlock(&g_rpc_queue->lock);
 
-    while (1) {
-        rpc_request_t* req = rpc_dequeue(g_rpc_queue);
-        if (!req) {
-            __asm__ volatile("pause");
-            continue;
-        }
-
-        /* call actual function and notify awaiting enclave thread when done */
-        sgx_ocall_fn_t f = ocall_table[req->ocall_index];
-        req->result = f(req->buffer);
-
-        /* this code is based on Mutex 2 from Futexes are Tricky */
-        int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
-        if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
-            /* must unlock and wake waiters */
-            spinlock_unlock(&req->lock);
-            int ret = INLINE_SYSCALL(futex, 6, &req->lock.lock, FUTEX_WAKE_PRIVATE,
-                                     1, NULL, NULL, 0);
-            if (ret == -1)
-                SGX_DBG(DBG_E, "RPC thread failed to wake up enclave thread\n");
-        }
-    }
+    rpc_worker_loop(g_rpc_queue, worker_idx, rpc_handle_ocall, rpc_futex, /*stop=*/NULL);
 
     /* NOTREACHED */
     return 0;
@@ -745,8 +796,9 @@ static int start_rpc(size_t num_of_threads) {
     if (IS_ERR_P(g_rpc_queue))
         return -ENOMEM;
 
-    /* initialize g_rpc_queue just for sanity, it will be overwritten by in-enclave code */
-    rpc_queue_init(g_rpc_queue);
+    /* initialize g_rpc_queue with one ring per enclave thread (TCS slot) */
+    rpc_queue_init(g_rpc_queue, pal_enclave.thread_num, num_of_threads,
+                   pal_enclave.rpc_thread_num_min);
 
     for (size_t i = 0; i < num_of_threads; i++) {
         void* stack = (void*)INLINE_SYSCALL(mmap, 6, NULL, RPC_STACK_SIZE,
@@ -762,7 +814,7 @@ static int start_rpc(size_t num_of_threads) {
         int ret = clone(rpc_thread_loop, child_stack_top,
                         CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
                         CLONE_THREAD | CLONE_SIGHAND | CLONE_PTRACE | CLONE_PARENT_SETTID,
-                        NULL, &dummy_parent_tid_field, NULL);
+                        (void*)i, &dummy_parent_tid_field, NULL);
 
         if (IS_ERR(ret)) {
             INLINE_SYSCALL(munmap, 2, stack, RPC_STACK_SIZE);
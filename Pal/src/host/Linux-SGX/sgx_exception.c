@@ -265,6 +265,17 @@ int sgx_signal_setup (void)
     if (block_signals(true, sig, 1) < 0)
         goto err;
 
+    /* SIGUSR1 prints the OCALL statistics, if enabled (otherwise it kills the process); the
+     * parent process may have left it blocked */
+    if (g_ocall_stats_enabled) {
+        if ((ret = sgx_ocall_stats_start_thread()) < 0)
+            goto err;
+    } else {
+        sig[0] = SIGUSR1;
+        if ((ret = block_signals(false, sig, 1)) < 0)
+            goto err;
+    }
+
     return 0;
 err:
     return ret;
@@ -68,6 +68,7 @@ extern struct pal_enclave {
     unsigned long size;
     unsigned long thread_num;
     unsigned long rpc_thread_num;
+    unsigned long rpc_thread_num_min;
     unsigned long ssaframesize;
 
     /* files */
@@ -149,6 +150,21 @@ uint64_t sgx_edbgrd (void * addr);
 void sgx_edbgwr (void * addr, uint64_t data);
 
 int sgx_init_child_process (struct pal_sec * pal_sec);
+
+/* OCALL statistics, see sgx_ocall_stats.c */
+extern bool g_ocall_stats_enabled;
+
+static inline uint64_t ocall_stats_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void sgx_ocall_stats_init(void);
+void sgx_ocall_stats_begin(uint64_t code, bool exitless);
+void sgx_ocall_stats_end(uint64_t code, uint64_t cycles);
+void sgx_ocall_stats_dump(void);
+int sgx_ocall_stats_start_thread(void);
 int sgx_signal_setup (void);
 int block_signals (bool block, const int * sigs, int nsig);
 int block_async_signals (bool block);
@@ -308,8 +308,8 @@ int initialize_enclave (struct pal_enclave * enclave)
             goto out;
         }
 
-        if (enclave->rpc_thread_num && enclave->thread_num > RPC_QUEUE_SIZE) {
-            SGX_DBG(DBG_E, "Too many threads for exitless feature (more than capacity of RPC queue)\n");
+        if (enclave->rpc_thread_num && enclave->thread_num > RPC_MAX_RINGS) {
+            SGX_DBG(DBG_E, "Too many threads for exitless feature (more than RPC queue rings)\n");
             ret = -EINVAL;
             goto out;
         }
@@ -317,6 +317,22 @@ int initialize_enclave (struct pal_enclave * enclave)
         enclave->rpc_thread_num = 0;  /* by default, do not use exitless feature */
     }
 
+    /* RPC threads above this number park when idle; by default all RPC threads stay awake */
+    enclave->rpc_thread_num_min = enclave->rpc_thread_num;
+    if (get_config(enclave->config, "sgx.rpc_thread_num_min", cfgbuf, sizeof(cfgbuf)) > 0) {
+        enclave->rpc_thread_num_min = parse_int(cfgbuf);
+
+        if (enclave->rpc_thread_num_min > enclave->rpc_thread_num) {
+            SGX_DBG(DBG_E, "sgx.rpc_thread_num_min cannot exceed sgx.rpc_thread_num\n");
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    if (get_config(enclave->config, "sgx.ocall_stats", cfgbuf, sizeof(cfgbuf)) > 0 &&
+            cfgbuf[0] == '1')
+        sgx_ocall_stats_init();
+
     if (get_config(enclave->config, "sgx.static_address", cfgbuf, sizeof(cfgbuf)) > 0 && cfgbuf[0] == '1') {
         enclave->baseaddr = ALIGN_DOWN_POW2(heap_min, enclave->size);
     } else {
@@ -551,6 +567,7 @@ int initialize_enclave (struct pal_enclave * enclave)
                     gs->exec_size = exec_area->size;
                 }
                 gs->thread = NULL;
+                gs->thread_idx = t;
             }
         } else if (!strcmp_static(areas[i].desc, "tcs")) {
             data = (void *) INLINE_SYSCALL(mmap, 6, NULL, areas[i].size,
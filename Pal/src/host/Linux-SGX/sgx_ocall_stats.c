@@ -0,0 +1,223 @@
+/* Copyright (C) 2020 Intel Corporation
+   This file is part of Graphene Library OS.
+
+   Graphene Library OS is free software: you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   Graphene Library OS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/*
+ * sgx_ocall_stats.c
+ *
+ * OCALL statistics of the untrusted runtime ("sgx.ocall_stats = 1" in the manifest): for each
+ * OCALL code, the number of OCALLs performed with an enclave exit and through the RPC queue
+ * (exitless), and the time spent executing them in the untrusted runtime, with a histogram. The
+ * counters of exitless OCALLs that fell back to an enclave exit are kept by the enclave in the RPC
+ * queue (see rpc_fallback_stats_t in rpc_queue.h). The statistics are printed on SIGUSR1 and when
+ * the process exits. SIGUSR1 is blocked in all threads and waited for by a dedicated thread, so
+ * that it never interrupts host syscalls of enclave and RPC threads with EINTR.
+ *
+ * Times are measured in TSC ticks; the cumulative times are converted to microseconds when
+ * printed, with the TSC frequency measured since the statistics were enabled.
+ */
+
+#include <asm/errno.h>
+#include <asm/mman.h>
+#include <linux/signal.h>
+#include <linux/time.h>
+#include <sigset.h>
+
+#include "ocall_types.h"
+#include "rpc_queue.h"
+#include "sgx_internal.h"
+
+/* OCALLs by time: < 2^OCALL_STATS_HIST_MIN ticks, then twice as long for each bucket */
+#define OCALL_STATS_HIST_MIN  10
+#define OCALL_STATS_HIST_SIZE 20
+
+struct ocall_stat {
+    uint64_t exits;
+    uint64_t exitless;
+    uint64_t cycles;
+    uint64_t hist[OCALL_STATS_HIST_SIZE];
+};
+
+bool g_ocall_stats_enabled;
+
+static struct ocall_stat g_ocall_stats[OCALL_NR];
+static uint64_t g_start_tsc;
+static uint64_t g_start_ns;
+
+static const char* const g_ocall_names[OCALL_NR] = {
+    [OCALL_EXIT]             = "exit",
+    [OCALL_MMAP_UNTRUSTED]   = "mmap_untrusted",
+    [OCALL_MUNMAP_UNTRUSTED] = "munmap_untrusted",
+    [OCALL_CPUID]            = "cpuid",
+    [OCALL_OPEN]             = "open",
+    [OCALL_CLOSE]            = "close",
+    [OCALL_READ]             = "read",
+    [OCALL_WRITE]            = "write",
+    [OCALL_PREAD]            = "pread",
+    [OCALL_PWRITE]           = "pwrite",
+    [OCALL_FSTAT]            = "fstat",
+    [OCALL_FIONREAD]         = "fionread",
+    [OCALL_FSETNONBLOCK]     = "fsetnonblock",
+    [OCALL_FCHMOD]           = "fchmod",
+    [OCALL_FSYNC]            = "fsync",
+    [OCALL_FTRUNCATE]        = "ftruncate",
+    [OCALL_MKDIR]            = "mkdir",
+    [OCALL_GETDENTS]         = "getdents",
+    [OCALL_RESUME_THREAD]    = "resume_thread",
+    [OCALL_CLONE_THREAD]     = "clone_thread",
+    [OCALL_CREATE_PROCESS]   = "create_process",
+    [OCALL_FUTEX]            = "futex",
+    [OCALL_SOCKETPAIR]       = "socketpair",
+    [OCALL_LISTEN]           = "listen",
+    [OCALL_ACCEPT]           = "accept",
+    [OCALL_CONNECT]          = "connect",
+    [OCALL_RECV]             = "recv",
+    [OCALL_SEND]             = "send",
+    [OCALL_SETSOCKOPT]       = "setsockopt",
+    [OCALL_SHUTDOWN]         = "shutdown",
+    [OCALL_GETTIME]          = "gettime",
+    [OCALL_SLEEP]            = "sleep",
+    [OCALL_POLL]             = "poll",
+    [OCALL_RENAME]           = "rename",
+    [OCALL_DELETE]           = "delete",
+    [OCALL_LOAD_DEBUG]       = "load_debug",
+    [OCALL_EVENTFD]          = "eventfd",
+    [OCALL_GET_QUOTE]        = "get_quote",
+    [OCALL_BATCH]            = "batch",
+};
+
+static uint64_t get_ns(void) {
+    struct timespec ts;
+    INLINE_SYSCALL(clock_gettime, 2, CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void sgx_ocall_stats_init(void) {
+    g_start_tsc = ocall_stats_tsc();
+    g_start_ns  = get_ns();
+    g_ocall_stats_enabled = true;
+}
+
+void sgx_ocall_stats_begin(uint64_t code, bool exitless) {
+    struct ocall_stat* stat = &g_ocall_stats[code];
+    __atomic_add_fetch(exitless ? &stat->exitless : &stat->exits, 1, __ATOMIC_RELAXED);
+}
+
+void sgx_ocall_stats_end(uint64_t code, uint64_t cycles) {
+    struct ocall_stat* stat = &g_ocall_stats[code];
+    int bucket = 0;
+    if (cycles >> OCALL_STATS_HIST_MIN)
+        bucket = 64 - __builtin_clzl(cycles >> OCALL_STATS_HIST_MIN);
+    if (bucket >= OCALL_STATS_HIST_SIZE)
+        bucket = OCALL_STATS_HIST_SIZE - 1;
+
+    __atomic_add_fetch(&stat->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stat->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/* Prints the statistics to stderr, one line per write; async-signal-safe. */
+void sgx_ocall_stats_dump(void) {
+    char line[1024];
+    int len;
+
+    if (!g_ocall_stats_enabled)
+        return;
+
+    uint64_t elapsed_ns  = get_ns() - g_start_ns;
+    uint64_t elapsed_tsc = ocall_stats_tsc() - g_start_tsc;
+    uint64_t mhz = elapsed_ns >= 1000 ? elapsed_tsc / (elapsed_ns / 1000) : 0;
+
+    pal_printf("OCALL statistics of process %d (TSC at %lu MHz):\n",
+               (int)INLINE_SYSCALL(getpid, 0), mhz);
+
+    len = snprintf(line, sizeof(line), "ocall exits exitless host_us hist(<%lu",
+                   1UL << OCALL_STATS_HIST_MIN);
+    for (int j = 1; j < OCALL_STATS_HIST_SIZE - 1; j++)
+        len += snprintf(line + len, sizeof(line) - len, " <%lu",
+                        1UL << (OCALL_STATS_HIST_MIN + j));
+    pal_printf("%s >=%lu ticks)\n", line,
+               1UL << (OCALL_STATS_HIST_MIN + OCALL_STATS_HIST_SIZE - 2));
+
+    for (int i = 0; i < OCALL_NR; i++) {
+        const struct ocall_stat* stat = &g_ocall_stats[i];
+        uint64_t exits    = __atomic_load_n(&stat->exits, __ATOMIC_RELAXED);
+        uint64_t exitless = __atomic_load_n(&stat->exitless, __ATOMIC_RELAXED);
+        if (!exits && !exitless)
+            continue;
+
+        uint64_t cycles = __atomic_load_n(&stat->cycles, __ATOMIC_RELAXED);
+        len = snprintf(line, sizeof(line), "%s %lu %lu %lu", g_ocall_names[i] ? : "?", exits,
+                       exitless, mhz ? cycles / mhz : 0);
+        for (int j = 0; j < OCALL_STATS_HIST_SIZE; j++)
+            len += snprintf(line + len, sizeof(line) - len, " %lu",
+                            __atomic_load_n(&stat->hist[j], __ATOMIC_RELAXED));
+        pal_printf("%s\n", line);
+    }
+
+    if (g_rpc_queue) {
+        rpc_fallback_stats_t* fallbacks = &g_rpc_queue->fallbacks;
+        pal_printf("exitless fallbacks: ring full %lu, no RPC thread awake %lu, "
+                   "spin timeout (futex wait) %lu\n",
+                   __atomic_load_n(&fallbacks->ring_full, __ATOMIC_RELAXED),
+                   __atomic_load_n(&fallbacks->all_parked, __ATOMIC_RELAXED),
+                   __atomic_load_n(&fallbacks->futex_wait, __ATOMIC_RELAXED));
+    }
+}
+
+static int ocall_stats_thread(void* arg) {
+    __UNUSED(arg);
+
+    /* all signals stay blocked in this thread, SIGUSR1 is only waited for */
+    __sigset_t mask;
+    __sigfillset(&mask);
+    INLINE_SYSCALL(rt_sigprocmask, 4, SIG_SETMASK, &mask, NULL, sizeof(mask));
+
+    __sigemptyset(&mask);
+    __sigaddset(&mask, SIGUSR1);
+    while (true) {
+        int sig = INLINE_SYSCALL(rt_sigtimedwait, 4, &mask, NULL, NULL, sizeof(mask));
+        if (sig == SIGUSR1)
+            sgx_ocall_stats_dump();
+    }
+
+    /* NOTREACHED */
+    return 0;
+}
+
+/* Must be called before any other thread is created: they inherit the blocked SIGUSR1. */
+int sgx_ocall_stats_start_thread(void) {
+    int sig = SIGUSR1;
+    int ret = block_signals(true, &sig, 1);
+    if (ret < 0)
+        return ret;
+
+    void* stack = (void*)INLINE_SYSCALL(mmap, 6, NULL, ALT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (IS_ERR_P(stack))
+        return -ENOMEM;
+
+    void* child_stack_top = ALIGN_DOWN_PTR(stack + ALT_STACK_SIZE, 16);
+
+    int dummy_parent_tid_field = 0;
+    ret = clone(ocall_stats_thread, child_stack_top,
+                CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM | CLONE_THREAD | CLONE_SIGHAND |
+                CLONE_PTRACE | CLONE_PARENT_SETTID,
+                NULL, &dummy_parent_tid_field, NULL);
+    if (IS_ERR(ret)) {
+        INLINE_SYSCALL(munmap, 2, stack, ALT_STACK_SIZE);
+        return -ENOMEM;
+    }
+    return 0;
+}
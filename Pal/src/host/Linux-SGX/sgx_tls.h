@@ -45,6 +45,8 @@ struct enclave_tls {
     uint64_t exec_size;
     int*     clear_child_tid;
     struct untrusted_area untrusted_area_cache;
+    uint64_t thread_idx; /* index of this thread's TCS slot, stable across thread re-creation */
+    struct ocall_batch* ocall_batch; /* if set, ocall_close() is deferred into this batch */
 };
 
 #ifndef DEBUG
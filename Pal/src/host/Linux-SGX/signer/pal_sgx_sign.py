@@ -850,9 +850,10 @@ def main_sign(args):
     # Get trusted checksums and measurements
     print("Trusted files:")
     for key, val in get_trusted_files(manifest, args).items():
-        (uri, _, checksum) = val
+        (uri, target, checksum) = val
         print("    %s %s" % (checksum, uri))
         manifest['sgx.trusted_checksum.' + key] = checksum
+        manifest['sgx.trusted_size.' + key] = str(os.path.getsize(target))
 
     print("Trusted children:")
     for key, val in get_trusted_children(manifest).items():
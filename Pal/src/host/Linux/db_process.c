@@ -35,12 +35,16 @@
 #include "pal_linux_defs.h"
 #include "pal_rtld.h"
 #include "pal_security.h"
+#include "spinlock.h"
 
 typedef __kernel_pid_t pid_t;
 #include <asm/errno.h>
 #include <asm/fcntl.h>
 #include <asm/poll.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
 #include <linux/sched.h>
+#include <linux/signal.h>
 #include <linux/time.h>
 #include <linux/types.h>
 #include <sys/socket.h>
@@ -70,6 +74,7 @@ static inline int create_process_handle(PAL_HANDLE* parent, PAL_HANDLE* child) {
     phdl->process.stream      = fds[0];
     phdl->process.pid         = linux_state.pid;
     phdl->process.nonblocking = PAL_FALSE;
+    phdl->process.shm         = PAL_IDX_POISON; /* set up by the child */
 
     chdl = malloc(HANDLE_SIZE(process));
     if (!chdl) {
@@ -83,6 +88,10 @@ static inline int create_process_handle(PAL_HANDLE* parent, PAL_HANDLE* child) {
     chdl->process.pid         = 0; /* unknown yet */
     chdl->process.nonblocking = PAL_FALSE;
 
+    /* shared memory for passing the checkpoint to the child; optional, older hosts lack memfd */
+    ret = INLINE_SYSCALL(memfd_create, 2, "graphene-checkpoint", MFD_CLOEXEC);
+    chdl->process.shm = IS_ERR(ret) ? PAL_IDX_POISON : (PAL_IDX)ret;
+
     *parent = phdl;
     *child  = chdl;
     ret = 0;
@@ -100,6 +109,7 @@ out:
 
 struct proc_param {
     PAL_HANDLE parent;
+    PAL_HANDLE child;
     PAL_HANDLE exec;
     PAL_HANDLE manifest;
     const char** argv;
@@ -110,6 +120,7 @@ struct proc_args {
     struct pal_sec  pal_sec;
 
     unsigned long   memory_quota;
+    PAL_BOL         shm;
 
     unsigned int    parent_data_size;
     unsigned int    exec_data_size;
@@ -139,6 +150,12 @@ child_process (struct proc_param * proc_param)
     if (IS_ERR(ret))
         goto failed;
 
+    if (proc_param->child->process.shm != PAL_IDX_POISON) {
+        ret = INLINE_SYSCALL(dup2, 2, proc_param->child->process.shm, PROC_SHM_FD);
+        if (IS_ERR(ret))
+            goto failed;
+    }
+
     if (proc_param->parent)
         handle_set_cloexec(proc_param->parent,   false);
     if (proc_param->exec)
@@ -154,40 +171,45 @@ failed:
     return -PAL_ERROR_DENIED;
 }
 
-int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
+static int open_executable (PAL_HANDLE * exec_handle, const char * uri)
 {
-
     PAL_HANDLE exec = NULL;
-    PAL_HANDLE parent_handle = NULL, child_handle = NULL;
     int ret;
 
-    /* step 1: open uri and check whether it is an executable */
+    if ((ret = _DkStreamOpen(&exec, uri, PAL_ACCESS_RDONLY, 0, 0, 0)) < 0)
+        return ret;
 
-    if (uri) {
-        if ((ret = _DkStreamOpen(&exec, uri, PAL_ACCESS_RDONLY, 0, 0, 0)) < 0)
-            return ret;
+    if (check_elf_object(exec) < 0) {
+        _DkObjectClose(exec);
+        return -PAL_ERROR_INVAL;
+    }
 
-        if (check_elf_object(exec) < 0) {
-            ret = -PAL_ERROR_INVAL;
-            goto out;
-        }
+    /* If this process creation is for fork emulation,
+     * map address of executable is already determined.
+     * tell its address to forked process.
+     */
+    size_t len;
+    const char * file_uri = URI_PREFIX_FILE;
+    if (exec_map && exec_map->l_name &&
+        (len = strlen(uri)) >= URI_PREFIX_FILE_LEN && !memcmp(uri, file_uri, URI_PREFIX_FILE_LEN) &&
+        /* skip "file:"*/
+        strlen(exec_map->l_name) == len - URI_PREFIX_FILE_LEN &&
+        /* + 1 for lasting * NUL */
+        !memcmp(exec_map->l_name, uri + URI_PREFIX_FILE_LEN, len - URI_PREFIX_FILE_LEN + 1))
+        exec->file.map_start = (PAL_PTR)exec_map->l_map_start;
+
+    *exec_handle = exec;
+    return 0;
+}
 
-        /* If this process creation is for fork emulation,
-         * map address of executable is already determined.
-         * tell its address to forked process.
-         */
-        size_t len;
-        const char * file_uri = URI_PREFIX_FILE;
-        if (exec_map && exec_map->l_name &&
-            (len = strlen(uri)) >= URI_PREFIX_FILE_LEN && !memcmp(uri, file_uri, URI_PREFIX_FILE_LEN) &&
-            /* skip "file:"*/
-            strlen(exec_map->l_name) == len - URI_PREFIX_FILE_LEN &&
-            /* + 1 for lasting * NUL */
-            !memcmp(exec_map->l_name, uri + URI_PREFIX_FILE_LEN, len - URI_PREFIX_FILE_LEN + 1))
-            exec->file.map_start = (PAL_PTR)exec_map->l_map_start;
-    }
+/* Starts the PAL loader in a new process and sends it the parameters. The caller blocks async
+ * signals (see _DkProcessCreate()). */
+static int spawn_process (PAL_HANDLE * handle, PAL_HANDLE exec, const char ** args)
+{
+    PAL_HANDLE parent_handle = NULL, child_handle = NULL;
+    int ret;
 
-    /* step 2: create parant and child process handle */
+    /* step 1: create parant and child process handle */
 
     struct proc_param param;
     ret = create_process_handle(&parent_handle, &child_handle);
@@ -195,10 +217,11 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
         goto out;
 
     param.parent = parent_handle;
+    param.child = child_handle;
     param.exec = exec;
     param.manifest = pal_state.manifest_handle;
 
-    /* step 3: compose process parameter */
+    /* step 2: compose process parameter */
 
     size_t parent_datasz = 0, exec_datasz = 0, manifest_datasz = 0;
     void * parent_data = NULL;
@@ -237,6 +260,7 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
     proc_args->pal_sec._dl_debug_state = NULL;
     proc_args->pal_sec._r_debug = NULL;
     proc_args->memory_quota = linux_state.memory_quota;
+    proc_args->shm = child_handle->process.shm != PAL_IDX_POISON;
 
     void * data = (void *) (proc_args + 1);
 
@@ -260,7 +284,7 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
         proc_args->manifest_data_size = 0;
     }
 
-    /* step 4: create a child thread which will execve in the future */
+    /* step 3: create a child thread which will execve in the future */
 
     /* the first argument must be the PAL */
     int argc = 0;
@@ -272,13 +296,6 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
         memcpy(&param.argv[1], args, sizeof(const char *) * argc);
     param.argv[argc + 1] = NULL;
 
-    /* Child's signal handler may mess with parent's memory during vfork(),
-     * so block signals
-     */
-    ret = block_async_signals(true);
-    if (ret < 0)
-        goto out;
-
     ret = child_process(&param);
     if (IS_ERR(ret)) {
         ret = -PAL_ERROR_DENIED;
@@ -288,11 +305,6 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
     proc_args->pal_sec.process_id = ret;
     child_handle->process.pid = ret;
 
-    /* children unblock async signals by signal_setup() */
-    ret = block_async_signals(false);
-    if (ret < 0)
-        goto out;
-
     /* step 4: send parameters over the process handle */
 
     ret = INLINE_SYSCALL(write, 3,
@@ -310,8 +322,6 @@ int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
 out:
     if (parent_handle)
         _DkObjectClose(parent_handle);
-    if (exec)
-        _DkObjectClose(exec);
     if (ret < 0) {
         if (child_handle)
             _DkObjectClose(child_handle);
@@ -319,6 +329,201 @@ out:
     return ret;
 }
 
+/*
+ * Pool of pre-started processes for fork emulation (`loader.fork_pool_size` in the manifest).
+ *
+ * A new process spends most of its startup in the PAL loader and the LibOS initialization (parsing
+ * the manifest, loading and relocating the LibOS), before it reads the checkpoint from the parent.
+ * None of this depends on the state of the parent at the time of fork: for fork, a process is
+ * created with the executable of the parent and without arguments, and everything else it gets
+ * (process stream, executable and manifest handles) can be prepared in advance. So after the first
+ * fork, a helper thread keeps `loader.fork_pool_size` processes started this way, which initialize
+ * and then wait for the checkpoint; a later fork of the same executable takes one of them and only
+ * sends the checkpoint. The helper thread refills the pool in the background.
+ *
+ * The helper thread runs with async signals blocked, so that they are delivered to the threads of
+ * the application. Processes left in the pool are killed when this process exits.
+ */
+#define FORK_POOL_MAX_SIZE 16
+
+static spinlock_t g_fork_pool_lock = INIT_SPINLOCK_UNLOCKED;
+static PAL_HANDLE g_fork_pool[FORK_POOL_MAX_SIZE];
+static int g_fork_pool_count;
+static int g_fork_pool_size = -1;           /* -1 until the manifest was read */
+static char * g_fork_pool_uri;              /* executable the pooled processes run */
+static PAL_HANDLE g_fork_pool_exec;
+static PAL_HANDLE g_fork_pool_thread;
+static int g_fork_pool_seq;                 /* futex; changes when a process is taken */
+
+static int fork_pool_refill (void * arg)
+{
+    __UNUSED(arg);
+
+    while (true) {
+        int seq = __atomic_load_n(&g_fork_pool_seq, __ATOMIC_ACQUIRE);
+
+        spinlock_lock(&g_fork_pool_lock);
+        bool full = g_fork_pool_count >= g_fork_pool_size;
+        spinlock_unlock(&g_fork_pool_lock);
+
+        if (full) {
+            INLINE_SYSCALL(futex, 6, &g_fork_pool_seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+            continue;
+        }
+
+        PAL_HANDLE child = NULL;
+        int ret = spawn_process(&child, g_fork_pool_exec, NULL);
+        if (ret < 0) {
+            printf("Cannot pre-start a process for fork (%s), the pool is disabled\n",
+                   pal_strerror(ret));
+            spinlock_lock(&g_fork_pool_lock);
+            g_fork_pool_size = 0;
+            spinlock_unlock(&g_fork_pool_lock);
+            return ret;
+        }
+
+        spinlock_lock(&g_fork_pool_lock);
+        bool exiting = !g_fork_pool_size;
+        if (!exiting)
+            g_fork_pool[g_fork_pool_count++] = child;
+        spinlock_unlock(&g_fork_pool_lock);
+
+        if (exiting) {
+            /* fork_pool_kill() ran meanwhile */
+            INLINE_SYSCALL(kill, 2, child->process.pid, SIGKILL);
+            INLINE_SYSCALL(wait4, 4, child->process.pid, NULL, 0, NULL);
+            _DkObjectClose(child);
+            return 0;
+        }
+    }
+}
+
+/* Starts filling the pool after the first fork of `uri`. */
+static void fork_pool_start (const char * uri)
+{
+    spinlock_lock(&g_fork_pool_lock);
+    if (g_fork_pool_size < 0) {
+        char cfgbuf[CONFIG_MAX];
+        ssize_t len = get_config(pal_state.root_config, "loader.fork_pool_size", cfgbuf,
+                                 sizeof(cfgbuf));
+        g_fork_pool_size = len > 0 ? MIN(atoi(cfgbuf), FORK_POOL_MAX_SIZE) : 0;
+    }
+    bool start = g_fork_pool_size > 0 && !g_fork_pool_uri;
+    if (start) {
+        size_t len = strlen(uri) + 1;
+        g_fork_pool_uri = malloc(len);
+        if (g_fork_pool_uri)
+            memcpy(g_fork_pool_uri, uri, len);
+        else
+            start = false;
+    }
+    spinlock_unlock(&g_fork_pool_lock);
+
+    if (!start)
+        return;
+
+    /* the helper thread keeps its own handle of the executable */
+    int ret = open_executable(&g_fork_pool_exec, uri);
+    if (ret < 0)
+        goto err;
+
+    /* the new thread inherits the signal mask */
+    ret = block_async_signals(true);
+    if (ret < 0)
+        goto err;
+    ret = _DkThreadCreate(&g_fork_pool_thread, fork_pool_refill, NULL);
+    block_async_signals(false);
+    if (ret < 0)
+        goto err;
+    return;
+
+err:
+    printf("Cannot start the pool of processes for fork (%s)\n", pal_strerror(ret));
+    spinlock_lock(&g_fork_pool_lock);
+    g_fork_pool_size = 0;
+    spinlock_unlock(&g_fork_pool_lock);
+}
+
+/* Takes a pre-started process for a fork of `uri`, if there is one. */
+static bool fork_pool_take (PAL_HANDLE * handle, const char * uri)
+{
+    while (true) {
+        PAL_HANDLE child = NULL;
+
+        spinlock_lock(&g_fork_pool_lock);
+        if (g_fork_pool_count > 0 && !strcmp(uri, g_fork_pool_uri))
+            child = g_fork_pool[--g_fork_pool_count];
+        spinlock_unlock(&g_fork_pool_lock);
+
+        if (!child)
+            return false;
+
+        __atomic_add_fetch(&g_fork_pool_seq, 1, __ATOMIC_RELEASE);
+        INLINE_SYSCALL(futex, 6, &g_fork_pool_seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+
+        /* the process may have died meanwhile (its end of the stream is closed then) */
+        struct pollfd pfd = {.fd = child->process.stream, .events = POLLIN, .revents = 0};
+        struct timespec tp = {0, 0};
+        int ret = INLINE_SYSCALL(ppoll, 5, &pfd, 1, &tp, NULL, 0);
+        if (!IS_ERR(ret) && !(ret == 1 && (pfd.revents & (POLLERR | POLLHUP)))) {
+            *handle = child;
+            return true;
+        }
+        _DkObjectClose(child);
+    }
+}
+
+/* Kills the processes left in the pool (on exit). */
+static void fork_pool_kill (void)
+{
+    spinlock_lock(&g_fork_pool_lock);
+    g_fork_pool_size = 0;
+    for (int i = 0; i < g_fork_pool_count; i++) {
+        int pid = g_fork_pool[i]->process.pid;
+        INLINE_SYSCALL(kill, 2, pid, SIGKILL);
+        INLINE_SYSCALL(wait4, 4, pid, NULL, 0, NULL);
+    }
+    g_fork_pool_count = 0;
+    spinlock_unlock(&g_fork_pool_lock);
+}
+
+int _DkProcessCreate (PAL_HANDLE * handle, const char * uri, const char ** args)
+{
+    /* forks of the same executable are created without arguments */
+    if (!args && uri && fork_pool_take(handle, uri))
+        return 0;
+
+    PAL_HANDLE exec = NULL;
+    int ret;
+
+    /* open uri and check whether it is an executable */
+    if (uri && (ret = open_executable(&exec, uri)) < 0)
+        return ret;
+
+    /* Child's signal handler may mess with parent's memory during vfork(),
+     * so block signals
+     */
+    ret = block_async_signals(true);
+    if (ret < 0)
+        goto out;
+
+    ret = spawn_process(handle, exec, args);
+
+    /* children unblock async signals by signal_setup() */
+    int unblock_ret = block_async_signals(false);
+    if (!ret && unblock_ret < 0) {
+        _DkObjectClose(*handle);
+        ret = unblock_ret;
+    }
+
+    if (!ret && !args && uri)
+        fork_pool_start(uri);
+out:
+    if (exec)
+        _DkObjectClose(exec);
+    return ret;
+}
+
 void init_child_process (PAL_HANDLE * parent_handle,
                          PAL_HANDLE * exec_handle,
                          PAL_HANDLE * manifest_handle)
@@ -370,6 +575,9 @@ void init_child_process (PAL_HANDLE * parent_handle,
     data += proc_args->parent_data_size;
     *parent_handle = parent;
 
+    if (proc_args->shm)
+        parent->process.shm = PROC_SHM_FD;
+
     /* occupy PROC_INIT_FD so no one will use it */
     INLINE_SYSCALL(dup2, 2, 0, PROC_INIT_FD);
 
@@ -407,6 +615,8 @@ no_data:
 
 noreturn void _DkProcessExit (int exitcode)
 {
+    fork_pool_kill();
+
     if (exitcode == PAL_WAIT_FOR_CHILDREN_EXIT) {
         /* this is a "temporary" process exiting after execve'ing a child process: it must still
          * be around until the child finally exits (because its parent in turn may wait on it) */
@@ -482,6 +692,52 @@ static int proc_close (PAL_HANDLE handle)
         handle->process.stream = PAL_IDX_POISON;
     }
 
+    if (handle->process.shm != PAL_IDX_POISON) {
+        INLINE_SYSCALL(close, 1, handle->process.shm);
+        handle->process.shm = PAL_IDX_POISON;
+    }
+
+    return 0;
+}
+
+/*
+ * Process streams can carry a memory object shared between the parent and the child (a memfd
+ * created by _DkProcessCreate), so that large data (the checkpoint on fork) is passed by mapping
+ * it instead of copying it through the stream. The sender sets its length and maps it shared and
+ * writable, the receiver maps it (typically copy-on-write). Both sides can map it several times
+ * (e.g. for passing memory of the parent on demand); the memory is freed when both sides closed
+ * the process stream and unmapped it.
+ */
+static int64_t proc_setlength (PAL_HANDLE handle, uint64_t length)
+{
+    if (handle->process.shm == PAL_IDX_POISON)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int ret = INLINE_SYSCALL(ftruncate, 2, handle->process.shm, length);
+    if (IS_ERR(ret))
+        return unix_to_pal_error(ERRNO(ret));
+
+    return (int64_t) length;
+}
+
+static int proc_map (PAL_HANDLE handle, void ** addr, int prot,
+                     uint64_t offset, uint64_t size)
+{
+    if (handle->process.shm == PAL_IDX_POISON)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    void * mem = *addr;
+    int flags = MAP_FILE|HOST_FLAGS(0, prot)|(mem ? MAP_FIXED : 0);
+    /* the receiver uses the data right away; shared mappings may be large and only sparsely
+     * filled by the sender, so they are not populated */
+    if (prot & PAL_PROT_WRITECOPY)
+        flags |= MAP_POPULATE;
+    mem = (void *) ARCH_MMAP(mem, size, HOST_PROT(prot), flags, handle->process.shm, offset);
+
+    if (IS_ERR_P(mem))
+        return -PAL_ERROR_DENIED;
+
+    *addr = mem;
     return 0;
 }
 
@@ -562,6 +818,8 @@ struct handle_ops proc_ops = {
         .write          = &proc_write,
         .close          = &proc_close,
         .delete         = &proc_delete,
+        .map            = &proc_map,
+        .setlength      = &proc_setlength,
         .attrquerybyhdl = &proc_attrquerybyhdl,
         .attrsetbyhdl   = &proc_attrsetbyhdl,
     };
@@ -212,6 +212,9 @@ int handle_deserialize(PAL_HANDLE* handle, const void* data, int size) {
             break;
         }
         case pal_type_process:
+            /* the shared memory descriptor is not transferred with the handle */
+            hdl->process.shm = PAL_IDX_POISON;
+            break;
         case pal_type_eventfd:
             break;
         default:
@@ -382,3 +385,16 @@ int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     *cargo = handle;
     return 0;
 }
+
+/* _DkStreamsSubmit for internal use. On Linux, every operation is a plain syscall anyway, so they
+   are simply executed one by one. */
+int _DkStreamsSubmit(PAL_STREAM_OP* ops, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if ((ops[i].flags & PAL_STREAM_OP_LINK) && i && !_DkStreamOpCompleted(&ops[i - 1])) {
+            _DkStreamOpSetResult(&ops[i], -PAL_ERROR_TRYAGAIN);
+            continue;
+        }
+        _DkStreamOpSetResult(&ops[i], _DkStreamOpExecute(&ops[i]));
+    }
+    return 0;
+}
@@ -141,6 +141,8 @@ typedef struct pal_handle
             PAL_IDX stream;
             PAL_IDX pid;
             PAL_BOL nonblocking;
+            /* memfd shared with the other process (for checkpoints), mapped at most once */
+            PAL_IDX shm;
         } process;
 
         struct {
@@ -168,9 +170,10 @@ typedef struct pal_handle
 
 extern void __check_pending_event (void);
 
-#define LEAVE_PAL_CALL() do { __check_pending_event(); } while (0)
+#define LEAVE_PAL_CALL() \
+    do { pal_call_timing_leave(); __check_pending_event(); } while (0)
 
 #define LEAVE_PAL_CALL_RETURN(retval) \
-    do { __check_pending_event(); return (retval); } while (0)
+    do { pal_call_timing_leave(); __check_pending_event(); return (retval); } while (0)
 
 #endif /* PAL_HOST_H */
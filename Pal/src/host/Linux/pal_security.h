@@ -68,6 +68,7 @@ extern struct pal_sec {
 } pal_sec;
 
 #define PROC_INIT_FD 255
+#define PROC_SHM_FD  254
 
 #define RANDGEN_DEVICE "/dev/urandom"
 
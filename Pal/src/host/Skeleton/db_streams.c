@@ -49,3 +49,8 @@ int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
 int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
+
+/* _DkStreamsSubmit for internal use. Perform a vector of stream operations. */
+int _DkStreamsSubmit(PAL_STREAM_OP* ops, size_t count) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
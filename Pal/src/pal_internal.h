@@ -142,16 +142,36 @@ static inline int handle_size (PAL_HANDLE handle)
     return sizeof(*handle);
 }
 
+static inline uint64_t pal_call_tsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* See pal_call_timing in PAL_TCB. */
+static inline void pal_call_timing_enter(void) {
+    PAL_TCB* tcb = pal_get_tcb();
+    if (tcb->pal_call_timing)
+        tcb->pal_call_start = pal_call_tsc();
+}
+
+static inline void pal_call_timing_leave(void) {
+    PAL_TCB* tcb = pal_get_tcb();
+    if (tcb->pal_call_timing)
+        tcb->pal_call_cycles += pal_call_tsc() - tcb->pal_call_start;
+}
+
 #ifndef ENTER_PAL_CALL
-# define ENTER_PAL_CALL(name)
+# define ENTER_PAL_CALL(name)   pal_call_timing_enter()
 #endif
 
 #ifndef LEAVE_PAL_CALL
-# define LEAVE_PAL_CALL()
+# define LEAVE_PAL_CALL()       pal_call_timing_leave()
 #endif
 
 #ifndef LEAVE_PAL_CALL_RETURN
-# define LEAVE_PAL_CALL_RETURN(retval)     do { return (retval); } while (0)
+# define LEAVE_PAL_CALL_RETURN(retval) \
+    do { pal_call_timing_leave(); return (retval); } while (0)
 #endif
 
 /* failure notify. The rountine is called whenever a PAL call return
@@ -240,6 +260,10 @@ int _DkStreamMap (PAL_HANDLE handle, void ** addr, int prot, uint64_t offset,
 int _DkStreamUnmap (void * addr, uint64_t size);
 int64_t _DkStreamSetLength (PAL_HANDLE handle, uint64_t length);
 int _DkStreamFlush (PAL_HANDLE handle);
+int _DkStreamsSubmit(PAL_STREAM_OP* ops, size_t count);
+int64_t _DkStreamOpExecute(PAL_STREAM_OP* op);
+void _DkStreamOpSetResult(PAL_STREAM_OP* op, int64_t ret);
+bool _DkStreamOpCompleted(const PAL_STREAM_OP* op);
 int _DkStreamGetName (PAL_HANDLE handle, char * buf, int size);
 const char * _DkStreamRealpath (PAL_HANDLE hdl);
 int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo);